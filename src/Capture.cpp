@@ -0,0 +1,340 @@
+//-----------------------------------------------------------------------------
+//		         Name: Capture.cpp
+//		  Description: Records the calls Kodi makes into the visualisation
+//					   to a binary file and reads them back, so a session
+//					   can be replayed exactly
+//-----------------------------------------------------------------------------
+
+#include "Capture.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char CAPTURE_MAGIC[4] = { 'F', 'N', 'T', 'C' };
+
+//-----------------------------------------------------------------------------
+// Name: CCaptureWriter()
+// Desc:
+//-----------------------------------------------------------------------------
+CCaptureWriter::CCaptureWriter()
+{
+  m_pFile           = NULL;
+  m_pRecord         = NULL;
+  m_nRecordCapacity = 0;
+
+  pthread_mutex_init( &m_mutex, NULL );
+}
+
+CCaptureWriter::~CCaptureWriter()
+{
+  Close();
+  free( m_pRecord );
+
+  pthread_mutex_destroy( &m_mutex );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Open()
+// Desc: Starts a new capture, replacing szFile
+//-----------------------------------------------------------------------------
+bool CCaptureWriter::Open( const char *szFile )
+{
+  Close();
+
+  FILE *pFile = fopen( szFile, "wb" );
+  if( pFile == NULL )
+    return false;
+
+  // Keep the audio thread off the disk most of the time
+  setvbuf( pFile, NULL, _IOFBF, 1 << 20 );
+
+  fwrite( CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC), 1, pFile );
+  fwrite( &CAPTURE_VERSION, sizeof(CAPTURE_VERSION), 1, pFile );
+
+  pthread_mutex_lock( &m_mutex );
+  m_pFile = pFile;
+  pthread_mutex_unlock( &m_mutex );
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Close()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::Close( void )
+{
+  pthread_mutex_lock( &m_mutex );
+  if( m_pFile != NULL )
+    fclose( m_pFile );
+  m_pFile = NULL;
+  pthread_mutex_unlock( &m_mutex );
+}
+
+//-----------------------------------------------------------------------------
+// Name: IsOpen()
+// Desc:
+//-----------------------------------------------------------------------------
+bool CCaptureWriter::IsOpen( void )
+{
+  pthread_mutex_lock( &m_mutex );
+  bool bOpen = m_pFile != NULL;
+  pthread_mutex_unlock( &m_mutex );
+  return bOpen;
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteRecord()
+// Desc: Copies the type and the parts into m_pRecord and writes it with a
+//       single fwrite(), so records from different threads never interleave.
+//       Does nothing once the file is closed.
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteRecord( int nType, const void *const *ppParts, const size_t *pSizes, int nParts )
+{
+  size_t size = 1;
+  for( int i = 0; i < nParts; i++ )
+    size += pSizes[i];
+
+  pthread_mutex_lock( &m_mutex );
+
+  if( m_pFile == NULL )
+  {
+    pthread_mutex_unlock( &m_mutex );
+    return;
+  }
+
+  if( size > m_nRecordCapacity )
+  {
+    unsigned char *pRecord = (unsigned char*)realloc( m_pRecord, size );
+    if( pRecord == NULL )
+    {
+      pthread_mutex_unlock( &m_mutex );
+      return;
+    }
+    m_pRecord         = pRecord;
+    m_nRecordCapacity = size;
+  }
+
+  unsigned char *pDest = m_pRecord;
+  *pDest++ = (unsigned char)nType;
+  for( int i = 0; i < nParts; i++ )
+  {
+    if( pSizes[i] > 0 )
+      memcpy( pDest, ppParts[i], pSizes[i] );
+    pDest += pSizes[i];
+  }
+  fwrite( m_pRecord, size, 1, m_pFile );
+
+  pthread_mutex_unlock( &m_mutex );
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteSeed()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteSeed( uint64_t seed )
+{
+  const void *ppParts[] = { &seed };
+  const size_t pSizes[] = { sizeof(seed) };
+  WriteRecord( CAPTURE_SEED, ppParts, pSizes, 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteSetting()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteSetting( const char *szName, int iValue )
+{
+  size_t length = strlen( szName );
+  if( length > 255 )
+    length = 255;
+
+  int32_t value = iValue;
+  uint8_t nameLength = (uint8_t)length;
+  const void *ppParts[] = { &nameLength, szName, &value };
+  const size_t pSizes[] = { sizeof(nameLength), length, sizeof(value) };
+  WriteRecord( CAPTURE_SETTING, ppParts, pSizes, 3 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteStart()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteStart( int iChannels, int iSamplesPerSec, int iBitsPerSample,
+                                 const char *szSongName, double fClock )
+{
+  int32_t format[3] = { iChannels, iSamplesPerSec, iBitsPerSample };
+  size_t length = szSongName != NULL ? strlen( szSongName ) : 0;
+  if( length > 255 )
+    length = 255;
+  uint16_t nameLength = (uint16_t)length;
+
+  const void *ppParts[] = { format, &fClock, &nameLength, szSongName };
+  const size_t pSizes[] = { sizeof(format), sizeof(fClock), sizeof(nameLength), length };
+  WriteRecord( CAPTURE_START, ppParts, pSizes, 4 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteAudioData()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteAudioData( const float *pAudioData, int iAudioDataLength,
+                                     const float *pFreqData, int iFreqDataLength )
+{
+  int32_t lengths[2] = { pAudioData != NULL && iAudioDataLength > 0 ? iAudioDataLength : 0,
+                         pFreqData != NULL && iFreqDataLength > 0 ? iFreqDataLength : 0 };
+
+  const void *ppParts[] = { lengths, pAudioData, pFreqData };
+  const size_t pSizes[] = { sizeof(lengths), lengths[0] * sizeof(float), lengths[1] * sizeof(float) };
+  WriteRecord( CAPTURE_AUDIO, ppParts, pSizes, 3 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: WriteRender()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureWriter::WriteRender( double fClock )
+{
+  const void *ppParts[] = { &fClock };
+  const size_t pSizes[] = { sizeof(fClock) };
+  WriteRecord( CAPTURE_RENDER, ppParts, pSizes, 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: CCaptureReader()
+// Desc:
+//-----------------------------------------------------------------------------
+CCaptureReader::CCaptureReader()
+{
+  m_pFile          = NULL;
+  m_pAudioData     = NULL;
+  m_iAudioCapacity = 0;
+  m_pFreqData      = NULL;
+  m_iFreqCapacity  = 0;
+}
+
+CCaptureReader::~CCaptureReader()
+{
+  Close();
+  free( m_pAudioData );
+  free( m_pFreqData );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Open()
+// Desc: Fails on files that aren't captures of this version
+//-----------------------------------------------------------------------------
+bool CCaptureReader::Open( const char *szFile )
+{
+  Close();
+
+  m_pFile = fopen( szFile, "rb" );
+  if( m_pFile == NULL )
+    return false;
+
+  char magic[4];
+  uint32_t version = 0;
+  if( !Read( magic, sizeof(magic) ) || memcmp( magic, CAPTURE_MAGIC, sizeof(magic) ) != 0 ||
+      !Read( &version, sizeof(version) ) || version != CAPTURE_VERSION )
+  {
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Close()
+// Desc:
+//-----------------------------------------------------------------------------
+void CCaptureReader::Close( void )
+{
+  if( m_pFile != NULL )
+    fclose( m_pFile );
+  m_pFile = NULL;
+}
+
+bool CCaptureReader::Read( void *pDest, size_t size )
+{
+  return size == 0 || fread( pDest, size, 1, m_pFile ) == 1;
+}
+
+float *CCaptureReader::Reserve( float **ppBuffer, int *pCapacity, int iLength )
+{
+  if( iLength > *pCapacity )
+  {
+    float *pBuffer = (float*)realloc( *ppBuffer, iLength * sizeof(float) );
+    if( pBuffer == NULL )
+      return NULL;
+    *ppBuffer  = pBuffer;
+    *pCapacity = iLength;
+  }
+  return *ppBuffer;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Next()
+// Desc:
+//-----------------------------------------------------------------------------
+bool CCaptureReader::Next( CaptureRecord *pRecord )
+{
+  if( m_pFile == NULL )
+    return false;
+
+  int nType = fgetc( m_pFile );
+  if( nType == EOF )
+    return false;
+
+  pRecord->m_nType = nType;
+
+  switch( nType )
+  {
+    case CAPTURE_SEED:
+      return Read( &pRecord->m_seed, sizeof(pRecord->m_seed) );
+
+    case CAPTURE_SETTING:
+    {
+      int length = fgetc( m_pFile );
+      int32_t value;
+      if( length == EOF || !Read( pRecord->m_szName, length ) || !Read( &value, sizeof(value) ) )
+        return false;
+      pRecord->m_szName[length] = '\0';
+      pRecord->m_iValue = value;
+      return true;
+    }
+
+    case CAPTURE_START:
+    {
+      int32_t format[3];
+      uint16_t nameLength;
+      if( !Read( format, sizeof(format) ) || !Read( &pRecord->m_fClock, sizeof(pRecord->m_fClock) ) ||
+          !Read( &nameLength, sizeof(nameLength) ) || nameLength > 255 ||
+          !Read( pRecord->m_szName, nameLength ) )
+        return false;
+      pRecord->m_szName[nameLength] = '\0';
+      pRecord->m_iChannels      = format[0];
+      pRecord->m_iSamplesPerSec = format[1];
+      pRecord->m_iBitsPerSample = format[2];
+      return true;
+    }
+
+    case CAPTURE_AUDIO:
+    {
+      int32_t lengths[2];
+      if( !Read( lengths, sizeof(lengths) ) || lengths[0] < 0 || lengths[1] < 0 )
+        return false;
+      pRecord->m_iAudioDataLength = lengths[0];
+      pRecord->m_iFreqDataLength  = lengths[1];
+      pRecord->m_pAudioData = Reserve( &m_pAudioData, &m_iAudioCapacity, lengths[0] );
+      pRecord->m_pFreqData  = Reserve( &m_pFreqData, &m_iFreqCapacity, lengths[1] );
+      return (lengths[0] == 0 || pRecord->m_pAudioData != NULL) &&
+             (lengths[1] == 0 || pRecord->m_pFreqData != NULL) &&
+             Read( pRecord->m_pAudioData, lengths[0] * sizeof(float) ) &&
+             Read( pRecord->m_pFreqData, lengths[1] * sizeof(float) );
+    }
+
+    case CAPTURE_RENDER:
+      return Read( &pRecord->m_fClock, sizeof(pRecord->m_fClock) );
+  }
+
+  return false;
+}
@@ -0,0 +1,122 @@
+//-----------------------------------------------------------------------------
+//		         Name: Capture.h
+//		  Description: Records the calls Kodi makes into the visualisation
+//					   to a binary file and reads them back, so a session
+//					   can be replayed exactly
+//-----------------------------------------------------------------------------
+
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// File layout, host byte order:
+//
+//   char[4]   "FNTC"
+//   uint32    CAPTURE_VERSION
+//   records   uint8 type followed by its payload:
+//
+//   CAPTURE_SEED     uint64 seed
+//   CAPTURE_SETTING  uint8 name length, name, int32 value
+//   CAPTURE_START    int32 channels, samples per sec, bits per sample,
+//                    float64 clock, uint16 name length, name
+//   CAPTURE_AUDIO    int32 audio length, int32 freq length,
+//                    float32 audio[], float32 freq[]
+//   CAPTURE_RENDER   float64 clock
+//
+// Clock values are what CTimer read at that point, so a replay can hand
+// them back through CTimer::SetVirtualTime().
+//-----------------------------------------------------------------------------
+const uint32_t CAPTURE_VERSION = 1;
+
+const int CAPTURE_SEED    = 1;
+const int CAPTURE_SETTING = 2;
+const int CAPTURE_START   = 3;
+const int CAPTURE_AUDIO   = 4;
+const int CAPTURE_RENDER  = 5;
+
+class CCaptureWriter
+{
+
+public:
+
+    CCaptureWriter(void);
+   ~CCaptureWriter(void);
+
+    bool Open( const char *szFile );
+    void Close( void );
+    bool IsOpen( void );
+
+    void WriteSeed( uint64_t seed );
+    void WriteSetting( const char *szName, int iValue );
+    void WriteStart( int iChannels, int iSamplesPerSec, int iBitsPerSample,
+                     const char *szSongName, double fClock );
+    void WriteAudioData( const float *pAudioData, int iAudioDataLength,
+                         const float *pFreqData, int iFreqDataLength );
+    void WriteRender( double fClock );
+
+private:
+
+    // Writes the record of nType made up of the nParts buffers in one go
+    void WriteRecord( int nType, const void *const *ppParts, const size_t *pSizes, int nParts );
+
+    // AudioData() and Render() may write from different threads, and
+    // ADDON_Stop() may close the file under them, so the file and the
+    // record buffer are only touched with m_mutex held. Every record is put
+    // together in m_pRecord and written with a single fwrite().
+    pthread_mutex_t m_mutex;
+    FILE          *m_pFile;
+    unsigned char *m_pRecord;
+    size_t         m_nRecordCapacity;
+};
+
+//-----------------------------------------------------------------------------
+// One record as read back. The buffers belong to the reader and are only
+// valid until the next call to Next().
+//-----------------------------------------------------------------------------
+struct CaptureRecord
+{
+    int      m_nType;
+    uint64_t m_seed;
+    char     m_szName[256];     // Setting or song name
+    int      m_iValue;
+    int      m_iChannels;
+    int      m_iSamplesPerSec;
+    int      m_iBitsPerSample;
+    double   m_fClock;
+    float   *m_pAudioData;
+    int      m_iAudioDataLength;
+    float   *m_pFreqData;
+    int      m_iFreqDataLength;
+};
+
+class CCaptureReader
+{
+
+public:
+
+    CCaptureReader(void);
+   ~CCaptureReader(void);
+
+    bool Open( const char *szFile );
+    void Close( void );
+
+    // Returns false at the end of the file or on a damaged record
+    bool Next( CaptureRecord *pRecord );
+
+private:
+
+    bool Read( void *pDest, size_t size );
+    float *Reserve( float **ppBuffer, int *pCapacity, int iLength );
+
+    FILE  *m_pFile;
+    float *m_pAudioData;
+    int    m_iAudioCapacity;
+    float *m_pFreqData;
+    int    m_iFreqCapacity;
+};
+
+#endif /* CAPTURE_H_INCLUDED */
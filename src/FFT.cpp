@@ -0,0 +1,253 @@
+//-----------------------------------------------------------------------------
+//		         Name: FFT.cpp
+//		  Description: Power spectrum of the PCM samples Kodi hands
+//					   AudioData(), for when we don't use Kodi's own
+//-----------------------------------------------------------------------------
+
+#include "FFT.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Amplitude 1.0 is full scale, 96 dB is the top of the level range
+static const double FULL_SCALE = 65536.0;
+
+//-----------------------------------------------------------------------------
+// Name: CRealFFT()
+// Desc:
+//-----------------------------------------------------------------------------
+CRealFFT::CRealFFT()
+{
+  m_nSize  = 0;
+  m_fScale = 0.0f;
+
+  memset( m_pRe, 0, sizeof(m_pRe) );
+  memset( m_pIm, 0, sizeof(m_pIm) );
+
+  SetSize( FFT_MIN_SIZE );
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetSize()
+// Desc:
+//-----------------------------------------------------------------------------
+bool CRealFFT::SetSize( int nSize )
+{
+  if( nSize < FFT_MIN_SIZE || nSize > FFT_MAX_SIZE || (nSize & (nSize - 1)) != 0 )
+    return false;
+  if( nSize == m_nSize )
+    return true;
+
+  m_nSize = nSize;
+
+  int nHalf = nSize / 2;
+  int nBits = 0;
+  while( (1 << nBits) < nHalf )
+    nBits++;
+
+  // Periodic Hann window; it sums to nSize / 2, so a sine of amplitude a
+  // peaks at |X| = a * nSize / 4
+  for( int n = 0; n < nSize; n++ )
+    m_pWindow[n] = (float)(0.5 - 0.5 * cos( 2.0 * M_PI * n / nSize ));
+
+  double fAmplitude = 4.0 / nSize * FULL_SCALE;
+  m_fScale = (float)(fAmplitude * fAmplitude / 4.0);    // PowerSpectrum() works on 2X
+
+  for( int n = 0; n < nHalf; n++ )
+  {
+    int r = 0;
+    for( int b = 0; b < nBits; b++ )
+      r |= ((n >> b) & 1) << (nBits - 1 - b);
+    m_pBitRev[n] = r;
+  }
+
+  for( int h = 4; h < nHalf; h <<= 1 )
+  {
+    for( int j = 0; j < h; j++ )
+    {
+      m_pTwiddleRe[h - 4 + j] = (float)cos( M_PI * j / h );
+      m_pTwiddleIm[h - 4 + j] = (float)-sin( M_PI * j / h );
+    }
+  }
+
+  for( int k = 0; k < nHalf; k++ )
+  {
+    m_pSplitRe[k] = (float)cos( 2.0 * M_PI * k / nSize );
+    m_pSplitIm[k] = (float)-sin( 2.0 * M_PI * k / nSize );
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Transform()
+// Desc: In place FFT of the bit reversed m_pRe/m_pIm. The first two
+//       radix-2 passes are done together as one radix-4 pass, every pass
+//       after that has at least four butterflies in a row with the same
+//       spacing.
+//-----------------------------------------------------------------------------
+void CRealFFT::Transform( void )
+{
+  int nHalf = m_nSize / 2;
+  float *pRe = m_pRe;
+  float *pIm = m_pIm;
+
+  for( int b = 0; b < nHalf; b += 4 )
+  {
+    float t0r = pRe[b]     + pRe[b + 1], t0i = pIm[b]     + pIm[b + 1];
+    float t1r = pRe[b]     - pRe[b + 1], t1i = pIm[b]     - pIm[b + 1];
+    float t2r = pRe[b + 2] + pRe[b + 3], t2i = pIm[b + 2] + pIm[b + 3];
+    float t3r = pRe[b + 2] - pRe[b + 3], t3i = pIm[b + 2] - pIm[b + 3];
+
+    // t3 turned by -i
+    pRe[b]     = t0r + t2r;  pIm[b]     = t0i + t2i;
+    pRe[b + 1] = t1r + t3i;  pIm[b + 1] = t1i - t3r;
+    pRe[b + 2] = t0r - t2r;  pIm[b + 2] = t0i - t2i;
+    pRe[b + 3] = t1r - t3i;  pIm[b + 3] = t1i + t3r;
+  }
+
+  for( int h = 4; h < nHalf; h <<= 1 )
+  {
+    const float *pWRe = m_pTwiddleRe + h - 4;
+    const float *pWIm = m_pTwiddleIm + h - 4;
+
+    for( int b = 0; b < nHalf; b += 2 * h )
+    {
+      float *pARe = pRe + b,     *pAIm = pIm + b;
+      float *pCRe = pRe + b + h, *pCIm = pIm + b + h;
+
+#if defined(__SSE2__)
+      for( int j = 0; j < h; j += 4 )
+      {
+        __m128 wr = _mm_loadu_ps( pWRe + j );
+        __m128 wi = _mm_loadu_ps( pWIm + j );
+        __m128 cr = _mm_load_ps( pCRe + j );
+        __m128 ci = _mm_load_ps( pCIm + j );
+        __m128 tr = _mm_sub_ps( _mm_mul_ps( cr, wr ), _mm_mul_ps( ci, wi ) );
+        __m128 ti = _mm_add_ps( _mm_mul_ps( cr, wi ), _mm_mul_ps( ci, wr ) );
+        __m128 ar = _mm_load_ps( pARe + j );
+        __m128 ai = _mm_load_ps( pAIm + j );
+        _mm_store_ps( pARe + j, _mm_add_ps( ar, tr ) );
+        _mm_store_ps( pAIm + j, _mm_add_ps( ai, ti ) );
+        _mm_store_ps( pCRe + j, _mm_sub_ps( ar, tr ) );
+        _mm_store_ps( pCIm + j, _mm_sub_ps( ai, ti ) );
+      }
+#else
+      for( int j = 0; j < h; j++ )
+      {
+        float tr = pCRe[j] * pWRe[j] - pCIm[j] * pWIm[j];
+        float ti = pCRe[j] * pWIm[j] + pCIm[j] * pWRe[j];
+        float ar = pARe[j], ai = pAIm[j];
+        pARe[j] = ar + tr;  pAIm[j] = ai + ti;
+        pCRe[j] = ar - tr;  pCIm[j] = ai - ti;
+      }
+#endif
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// PowerSpectrum
+//
+// The even samples go in as the real and the odd ones as the imaginary part
+// of a complex FFT Z of half the size. With Zm = Z[(size/2 - k) mod size/2]
+// and W = e^(-2 i pi k / size), the real spectrum is
+//
+//   2X[k] = (Z[k] + conj(Zm)) - i W (Z[k] - conj(Zm))
+//
+// Both paths do the same float operations in the same order.
+//-----------------------------------------------------------------------------
+static inline float splitPower( float zr, float zi, float mr, float mi, float c, float s )
+{
+  float er = zr + mr, ei = zi - mi;
+  float dr = zr - mr, di = zi + mi;
+  float xr = er + c * di + s * dr;
+  float xi = ei - c * dr + s * di;
+  return xr * xr + xi * xi;
+}
+
+void CRealFFT::PowerSpectrum( const float *pSamples, float *pPower )
+{
+  int nHalf = m_nSize / 2;
+
+  for( int n = 0; n < nHalf; n++ )
+  {
+    int r = m_pBitRev[n];
+    m_pRe[r] = pSamples[2 * n]     * m_pWindow[2 * n];
+    m_pIm[r] = pSamples[2 * n + 1] * m_pWindow[2 * n + 1];
+  }
+
+  Transform();
+
+  pPower[0] = splitPower( m_pRe[0], m_pIm[0], m_pRe[0], m_pIm[0], m_pSplitRe[0], m_pSplitIm[0] ) * m_fScale;
+
+  int k = 1;
+#if defined(__SSE2__)
+  const __m128 vScale = _mm_set1_ps( m_fScale );
+
+  // Z[k..k+3] against Z[nHalf-k-3..nHalf-k], reversed
+  for( ; k + 4 <= nHalf; k += 4 )
+  {
+    __m128 zr = _mm_loadu_ps( m_pRe + k );
+    __m128 zi = _mm_loadu_ps( m_pIm + k );
+    __m128 mr = _mm_shuffle_ps( _mm_loadu_ps( m_pRe + nHalf - k - 3 ), _mm_loadu_ps( m_pRe + nHalf - k - 3 ), _MM_SHUFFLE( 0, 1, 2, 3 ) );
+    __m128 mi = _mm_shuffle_ps( _mm_loadu_ps( m_pIm + nHalf - k - 3 ), _mm_loadu_ps( m_pIm + nHalf - k - 3 ), _MM_SHUFFLE( 0, 1, 2, 3 ) );
+    __m128 c  = _mm_loadu_ps( m_pSplitRe + k );
+    __m128 s  = _mm_loadu_ps( m_pSplitIm + k );
+
+    __m128 er = _mm_add_ps( zr, mr ), ei = _mm_sub_ps( zi, mi );
+    __m128 dr = _mm_sub_ps( zr, mr ), di = _mm_add_ps( zi, mi );
+    __m128 xr = _mm_add_ps( _mm_add_ps( er, _mm_mul_ps( c, di ) ), _mm_mul_ps( s, dr ) );
+    __m128 xi = _mm_add_ps( _mm_sub_ps( ei, _mm_mul_ps( c, dr ) ), _mm_mul_ps( s, di ) );
+    __m128 p  = _mm_add_ps( _mm_mul_ps( xr, xr ), _mm_mul_ps( xi, xi ) );
+    _mm_storeu_ps( pPower + k, _mm_mul_ps( p, vScale ) );
+  }
+#endif
+
+  for( ; k < nHalf; k++ )
+    pPower[k] = splitPower( m_pRe[k], m_pIm[k], m_pRe[nHalf - k], m_pIm[nHalf - k],
+                            m_pSplitRe[k], m_pSplitIm[k] ) * m_fScale;
+}
+
+//-----------------------------------------------------------------------------
+// Name: CSampleHistory()
+// Desc:
+//-----------------------------------------------------------------------------
+CSampleHistory::CSampleHistory()
+{
+  Clear();
+}
+
+void CSampleHistory::Clear( void )
+{
+  memset( m_pSamples, 0, sizeof(m_pSamples) );
+  m_nPos = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Add()
+// Desc:
+//-----------------------------------------------------------------------------
+void CSampleHistory::Add( const float *pData, int iLength, int iChannels )
+{
+  if( pData == NULL || iChannels < 1 )
+    return;
+
+  float fMix = 1.0f / iChannels;
+
+  for( int i = 0; i + iChannels <= iLength; i += iChannels )
+  {
+    float fSample = pData[i];
+    for( int c = 1; c < iChannels; c++ )
+      fSample += pData[i + c];
+    fSample *= fMix;
+
+    m_pSamples[m_nPos] = fSample;
+    m_pSamples[m_nPos + FFT_MAX_SIZE] = fSample;
+    if( ++m_nPos == FFT_MAX_SIZE )
+      m_nPos = 0;
+  }
+}
@@ -0,0 +1,86 @@
+//-----------------------------------------------------------------------------
+//		         Name: FFT.h
+//		  Description: Power spectrum of the PCM samples Kodi hands
+//					   AudioData(), for when we don't use Kodi's own
+//-----------------------------------------------------------------------------
+
+#ifndef FFT_H_INCLUDED
+#define FFT_H_INCLUDED
+
+#define FFT_MIN_SIZE 512
+#define FFT_MAX_SIZE 8192
+
+//-----------------------------------------------------------------------------
+// Name: CRealFFT
+// Desc: Real FFT of a power of two samples, done as a complex FFT of half
+//       the size: a radix-4 first pass, then radix-2 passes four butterflies
+//       at a time with SSE2. All tables are sized for FFT_MAX_SIZE, so
+//       nothing is allocated, and are rebuilt only when the size changes.
+//-----------------------------------------------------------------------------
+class CRealFFT
+{
+
+public:
+
+    CRealFFT(void);
+
+    // nSize a power of two in [FFT_MIN_SIZE, FFT_MAX_SIZE]
+    bool SetSize( int nSize );
+    int GetSize( void ) { return m_nSize; }
+
+    // Hann windowed power of pSamples[0, size) in size / 2 bins of
+    // sample rate / size Hz, from 0 Hz up; the layout CSpectrumBands takes.
+    // A full scale sine reads about 96 dB.
+    void PowerSpectrum( const float *pSamples, float *pPower );
+
+private:
+
+    void Transform( void );
+
+    int   m_nSize;
+    float m_fScale;                            // Power of a bin per |X|^2
+
+    float m_pWindow[FFT_MAX_SIZE];
+    int   m_pBitRev[FFT_MAX_SIZE / 2];         // Where each complex input goes
+
+    // e^(-i pi j / h) for j < h of the pass with butterflies h apart,
+    // starting at h - 4
+    float m_pTwiddleRe[FFT_MAX_SIZE / 2];
+    float m_pTwiddleIm[FFT_MAX_SIZE / 2];
+
+    // e^(-2 i pi k / size), untangling the real spectrum from the complex one
+    float m_pSplitRe[FFT_MAX_SIZE / 2];
+    float m_pSplitIm[FFT_MAX_SIZE / 2];
+
+    float m_pRe[FFT_MAX_SIZE / 2] __attribute__((aligned(16)));
+    float m_pIm[FFT_MAX_SIZE / 2] __attribute__((aligned(16)));
+};
+
+//-----------------------------------------------------------------------------
+// Name: CSampleHistory
+// Desc: The last FFT_MAX_SIZE samples, mixed down to mono. Every sample is
+//       kept twice, FFT_MAX_SIZE apart, so the latest ones are always
+//       contiguous.
+//-----------------------------------------------------------------------------
+class CSampleHistory
+{
+
+public:
+
+    CSampleHistory(void);
+
+    void Clear( void );
+
+    // iLength interleaved samples of iChannels channels
+    void Add( const float *pData, int iLength, int iChannels );
+
+    // The latest nSamples, oldest first; nSamples <= FFT_MAX_SIZE
+    const float *GetLatest( int nSamples ) { return m_pSamples + m_nPos + FFT_MAX_SIZE - nSamples; }
+
+private:
+
+    float m_pSamples[2 * FFT_MAX_SIZE];
+    int   m_nPos;                              // Where the next one goes
+};
+
+#endif /* FFT_H_INCLUDED */
@@ -14,9 +14,18 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include "timer.h"
+#include "Capture.h"
+#include "FFT.h"
+#include "Onset.h"
+#include "Profiler.h"
+#include "Spectrum.h"
+#include "TripleBuffer.h"
+#include <stdlib.h>
 
 #define	FREQ_DATA_SIZE 1024			// size of frequency data wanted
-#define MAX_BARS 720				// number of bars in the Spectrum
+#define FFT_DEFAULT_SIZE 1024		// our FFT's size when Kodi sends no frequency data
+#define MAX_BARS SPECTRUM_MAX_BARS	// number of bars in the Spectrum
+#define FREQ_LEVELS_SIZE (2*MAX_BARS)	// bars are at the even entries of m_pFreq, the min level at the odd
 #define MIN_PEAK_DECAY_SPEED 0		// decay speed in dB/frame
 #define MAX_PEAK_DECAY_SPEED 4
 #define MIN_RISE_SPEED 0.01f		// fraction of actual rise to allow
@@ -32,13 +41,20 @@
 #define TEXTURE_WIDTH 1
 #define MAX_CHANNELS 2
 #define MAX_SETTINGS 64
+#define MAX_FRAME_TIME 0.1f			// longest step a slow frame may take, in seconds
+#define MAX_EMITTERS PARTICLE_MAX_EMITTERS
+#define PARTICLES_PER_EMITTER 1000	// particle budget, shared by all emitters
+#define EMITTER_RING_RADIUS 6.0f		// emitters past the first stand on a ring this wide around the axis
 
 static CParticleSystem m_ParticleSystem;
+static CRandom m_presetRandom;		// Start()'s pick of the next setting
+static CRandom m_audioRandom;		// AudioData()'s draws
 
-static HsvColor m_clrColor;
-static int m_iHDir = 1;
-static int m_iSDir = 1;
-static int m_iVDir = 1;
+// Each emitter's color drifts on its own, in AudioData()
+static HsvColor m_clrColor[MAX_EMITTERS];
+static int m_iHDir[MAX_EMITTERS];
+static int m_iSDir[MAX_EMITTERS];
+static int m_iVDir[MAX_EMITTERS];
 
 static float m_fElapsedTime;
 static int m_dwCurTime;
@@ -46,18 +62,58 @@ static int m_dwLastTime;
 
 static float m_fUpdateSpeed			= 1000.0f;
 static float m_fRotation			= 0.0f;
+static float m_fRotationSpeed		= 0.0f;	// Render()'s copy of the setting's
 
 static ParticleSystemSettings m_pssSettings[MAX_SETTINGS];
 static int m_iCurrSetting = 0;
 static int m_iNumSettings = 2;
 static bool m_bCycleSettings = true;
 
-static int		m_iSampleRate;
-
-static float	m_pFreq[FREQ_DATA_SIZE];
-static float	m_pFreqPrev[FREQ_DATA_SIZE];				
-
-static int		m_iBars		= 12;
+static int		m_iThreads	= 1;		// cores the particle update is spread over
+static int		m_iEmitters	= 1;		// fountains the setting asks for
+static int		m_iRenderMode = RM_BILLBOARDS;
+static int		m_iSeed		= 0;		// 0 seeds from the clock
+static float	m_fSimRate	= 0.0f;		// Simulation steps per second, 0 steps once per frame
+static bool		m_bAnalytic	= false;	// Particle positions from their age instead of integrated
+
+static char		m_szAddonPath[1024] = ".";
+static CCaptureWriter m_capture;		// Open while FOUNTAIN_CAPTURE names a file
+static uint64_t	m_nLastProfileDump = 0;	// ProfilerNow() of the last log dump
+
+static float	m_pFreq[FREQ_LEVELS_SIZE];
+static float	m_pFreqPrev[FREQ_LEVELS_SIZE];				
+static CSpectrumBands m_spectrum;		// Bins of every bar
+static float	m_pBars[MAX_BARS];		// Unsmoothed levels of the bars
+static CSpectrumEnvelope m_envelope;	// Smooths them into m_pFreq
+
+static float	m_fRiseSpeed		= MAX_RISE_SPEED;
+static float	m_fFallSpeed		= MAX_FALL_SPEED;
+static float	m_fPeakDecaySpeed	= 1.0f;
+static float	m_fPeakHoldTime		= 0.25f;	// seconds
+
+static int		m_iFFTSize	= 0;		// 0 takes Kodi's frequency data
+static CSampleHistory m_history;		// Mono PCM our FFT runs over
+static CRealFFT	m_fft;
+static float	m_pFFTPower[FFT_MAX_SIZE / 2];	// Its output
+
+static COnsetDetector m_onset;			// Beats in the bars
+static float	m_fBeatKick = 0.0f;		// 1 on a beat, fading away after
+static int		m_nBursts	= 0;		// AudioFrame::m_nBursts of the current Start()
+static int		m_nBurstsApplied = 0;	// Render()'s count of them
+static float	m_fRotationSign = 1.0f;	// Beats and loud bars reverse the preset's rotation
+
+// AudioData() may run on another thread than Render(). It only touches the
+// particle system through the frames it publishes here, which Render()
+// applies before updating. Frames of an earlier Start() are dropped.
+static CTripleBuffer<AudioFrame> m_audioFrames;
+static int		m_iGeneration = 0;		// Bumped by every Start()
+
+// Nor does it share Start()'s state; it gets its own copy through here
+static CTripleBuffer<StartState> m_startStates;
+static StartState m_startState;			// Start()'s, only ever published from its thread
+static StartState m_audioState;			// AudioData()'s copy of the latest one
+
+static int		m_iBars		= 12;		// "bars" setting, published by the next Start() or Render()
 static bool		m_bLogScale = false;
 static float	m_fMinFreq	= 200;
 static float	m_fMaxFreq	= MAX_FREQUENCY;
@@ -70,13 +126,143 @@ CTimer gTimer;
 void SetDefaults();
 void SetDefaults(ParticleSystemSettings* settings);
 void SetDefaults(EffectSettings* settings);
-void ShiftColor(ParticleSystemSettings* settings);
+HsvColor ShiftColor(ParticleSystemSettings* settings, int iEmitter, int iBarOffset);
 void CreateArrays();
 
-CVector Shift(EffectSettings* settings);
+CVector Shift(EffectSettings* settings, int iBarOffset);
 
 inline int RandPosNeg() {
-	return (float)rand() > RAND_MAX/2.0f ? 1 : -1;
+	return m_audioRandom.NextSign(1.0f) > 0.0f ? 1 : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Seeds the add-on's and the particle system's generators. A given seed
+// reproduces a run, whichever threads Kodi calls us on.
+//-----------------------------------------------------------------------------
+void SeedFountain(uint64_t seed)
+{
+  m_presetRandom.Seed(seed);
+  m_ParticleSystem.SetRandomSeed(seed + 1);
+  m_audioRandom.Seed(seed + 2);
+  m_capture.WriteSeed(seed);
+}
+
+// 0 picks a different seed every time
+void SeedRandom(int iSeed)
+{
+  SeedFountain(iSeed != 0 ? (uint64_t)iSeed : (uint64_t)time(NULL));
+}
+
+//-----------------------------------------------------------------------------
+// Hands the envelope the speed settings, kept to the ranges that look sane
+//-----------------------------------------------------------------------------
+static void SetEnvelopeSpeeds()
+{
+  m_envelope.SetSpeeds(std::max((float)MIN_RISE_SPEED, std::min((float)MAX_RISE_SPEED, m_fRiseSpeed)),
+                       std::max((float)MIN_FALL_SPEED, std::min((float)MAX_FALL_SPEED, m_fFallSpeed)),
+                       std::max((float)MIN_PEAK_DECAY_SPEED, std::min((float)MAX_PEAK_DECAY_SPEED, m_fPeakDecaySpeed)),
+                       m_fPeakHoldTime);
+}
+
+//-----------------------------------------------------------------------------
+// Index into m_pFreq iBarOffset bars on, wrapping around the spectrum
+//-----------------------------------------------------------------------------
+static int OffsetLevel(int iIndex, int iBarOffset)
+{
+  if (iBarOffset == 0)
+    return iIndex;
+  return (iIndex + 2 * iBarOffset) % (2 * m_audioState.m_iBars);
+}
+
+//-----------------------------------------------------------------------------
+// Hands AudioData() a copy of m_startState
+//-----------------------------------------------------------------------------
+static void PublishStartState()
+{
+  *m_startStates.GetWriteBuffer() = m_startState;
+  m_startStates.Publish();
+}
+
+//-----------------------------------------------------------------------------
+// Starts AudioData()'s own state over for a new Start()
+//-----------------------------------------------------------------------------
+static void ResetAudioState(const StartState &state)
+{
+  m_history.Clear();
+  m_envelope.Reset();
+  m_onset.Reset();
+  m_fBeatKick = 0.0f;
+  m_nBursts = 0;
+  m_fRotationSign = 1.0f;
+
+  //set (or reset) our previous frequency data array
+  for (int i=0; i<FREQ_LEVELS_SIZE; i++)
+  {
+    m_pFreqPrev[i] = 0.0f;
+  }
+
+  for (int i=0; i<state.m_nEmitters; i++)
+  {
+    m_clrColor[i] = state.m_pColors[i];
+    m_iHDir[i] = 1;
+    m_iSDir[i] = 1;
+    m_iVDir[i] = 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Turns emitter iEmitter's vectors about the axis of rotation to its place
+// on the ring of nEmitters, so every fountain is the preset's own fountain
+// seen from another side
+//-----------------------------------------------------------------------------
+static void PlaceEmitter(int iEmitter, int nEmitters, CVector *pGravity, CVector *pWind, CVector *pVelocity, CVector *pPosition)
+{
+  if (nEmitters < 2)
+    return;
+
+  float fAngle = 2.0f * (float)M_PI * iEmitter / nEmitters;
+  float c = cosf(fAngle), s = sinf(fAngle);
+  CVector *pVectors[4] = { pGravity, pWind, pVelocity, pPosition };
+  for (int i=0; i<4; i++)
+  {
+    CVector v = *pVectors[i];
+    pVectors[i]->x = v.x * c - v.y * s;
+    pVectors[i]->y = v.x * s + v.y * c;
+  }
+
+  pPosition->x += EMITTER_RING_RADIUS * c;
+  pPosition->y += EMITTER_RING_RADIUS * s;
+}
+
+//-----------------------------------------------------------------------------
+// Everything ADDON_Create does once the add-on is registered; also the
+// entry point of tools that run the visualisation outside Kodi
+//-----------------------------------------------------------------------------
+void CreateFountain(const char *szAddonPath)
+{
+  strncpy(m_szAddonPath, szAddonPath, sizeof(m_szAddonPath) - 1);
+  m_szAddonPath[sizeof(m_szAddonPath) - 1] = '\0';
+
+  m_iCurrSetting = -1;
+  m_startState.m_iGeneration = m_iGeneration;
+  m_startState.m_iSetting = 0;
+  m_startState.m_iSampleRate = 0;
+  m_startState.m_iChannels = 2;
+  m_startState.m_nEmitters = 1;
+  m_startState.m_iBars = m_iBars;
+  m_startState.m_pColors[0] = HsvColor( 360.0f, 1.0f, .06f );
+  m_audioState.m_iGeneration = m_iGeneration - 1;	// AudioData() starts from m_startState
+  PublishStartState();
+  m_ParticleSystem.ctor();
+  SeedRandom(m_iSeed);
+  SetDefaults();
+  m_ParticleSystem.Init();
+  m_ParticleSystem.SetThreadCount(m_iThreads);
+  m_ParticleSystem.SetRenderMode(m_iRenderMode);
+  m_ParticleSystem.SetFixedStep(m_fSimRate > 0.0f ? 1.0f / m_fSimRate : 0.0f);
+  m_ParticleSystem.SetAnalytic(m_bAnalytic);
+  SetEnvelopeSpeeds();
+  gTimer.SetMaxDeltaTime(MAX_FRAME_TIME);
 }
 
 ADDON_STATUS ADDON_Create(void* hdl, void* props)
@@ -93,26 +279,23 @@ ADDON_STATUS ADDON_Create(void* hdl, void* props)
     return ADDON_STATUS_PERMANENT_FAILURE;
   }
 
-  m_clrColor = HsvColor( 360.0f, 1.0f, .06f );
-  m_iCurrSetting = -1;
-  srand(time(NULL));
+  // Record the session for fountain_replay when asked to
+  const char *szCapture = getenv("FOUNTAIN_CAPTURE");
+  if (szCapture != NULL && *szCapture != '\0' && !m_capture.Open(szCapture))
+    XBMC->Log(ADDON::LOG_ERROR, "Fountain: can't write capture %s", szCapture);
 
-  m_ParticleSystem.ctor();
-  SetDefaults();
-  m_ParticleSystem.Init();
+  char szAddonPath[1024];
+  XBMC->GetSetting("__addonpath__", szAddonPath);
+  CreateFountain(szAddonPath);
 
   return ADDON_STATUS_OK;
 }
 
 extern "C" void Start(int iChannels, int iSamplesPerSec, int iBitsPerSample, const char* szSongName)
 {
-  m_iSampleRate = iSamplesPerSec;
-
-  //set (or reset) our previous frequency data array
-  for (int i=0; i<FREQ_DATA_SIZE; i++)
-  {
-    m_pFreqPrev[i] = 0.0f;
-  }
+  m_startState.m_iSampleRate = iSamplesPerSec;
+  m_startState.m_iChannels = iChannels;
+  m_startState.m_iBars = __atomic_load_n(&m_iBars, __ATOMIC_RELAXED);
 
   if (m_bCycleSettings || m_iNumSettings < 3)
     m_iCurrSetting++;
@@ -121,103 +304,176 @@ extern "C" void Start(int iChannels, int iSamplesPerSec, int iBitsPerSample, con
     int iNextSetting = m_iCurrSetting;
     //TODO: try and fix this to be more random
     while (iNextSetting == m_iCurrSetting)
-      iNextSetting = ((float)rand () / RAND_MAX) * m_iNumSettings;
+      iNextSetting = m_presetRandom.NextFloat() * m_iNumSettings;
     m_iCurrSetting = iNextSetting;
   }
   if (m_iCurrSetting >= m_iNumSettings || m_iCurrSetting < 0)
     m_iCurrSetting = 0;
 
-  m_clrColor = m_pssSettings[m_iCurrSetting].m_hsvColor;
-  m_iHDir = 1;
-  m_iSDir = 1;
-  m_iVDir = 1;
+  // Every emitter starts off a different hue of the preset's range
+  ParticleSystemSettings *pSettings = &m_pssSettings[m_iCurrSetting];
+  float fHueRange = pSettings->m_csHue.max - pSettings->m_csHue.min;
+  int nEmitters = m_iEmitters;
+  m_startState.m_iSetting = m_iCurrSetting;
+  m_startState.m_nEmitters = nEmitters;
+  for (int i=0; i<nEmitters; i++)
+  {
+    HsvColor *pColor = &m_startState.m_pColors[i];
+    *pColor = pSettings->m_hsvColor;
+    if (i > 0 && fHueRange > 0.0f)
+      pColor->h = pSettings->m_csHue.min + fmodf(pColor->h - pSettings->m_csHue.min + i * fHueRange / nEmitters, fHueRange);
+  }
   InitParticleSystem(m_pssSettings[m_iCurrSetting]);
+  m_fRotationSpeed = m_pssSettings[m_iCurrSetting].m_fRotationSpeed;
+  m_nBurstsApplied = 0;
+  m_startState.m_iGeneration = __atomic_add_fetch(&m_iGeneration, 1, __ATOMIC_RELEASE);
+  PublishStartState();
   gTimer.Init();
+
+  m_capture.WriteStart(iChannels, iSamplesPerSec, iBitsPerSample, szSongName, gTimer.GetTime());
 }
 
 extern "C" void AudioData(const float* pAudioData, int iAudioDataLength, float *pFreqData, int iFreqDataLength)
 {
-  ParticleSystemSettings *currSettings = &m_pssSettings[m_iCurrSetting];
-
-  if (iFreqDataLength>FREQ_DATA_SIZE)
-    iFreqDataLength = FREQ_DATA_SIZE;
-
-  // Group data into frequency bins by averaging (Ignore the constant term)
-  int jmin=2;
-  int jmax;
-  // FIXME:  Roll conditionals out of loop
-  for (int i=0, iBin=0; i < m_iBars; i++, iBin+=2)
-  {
-    m_pFreq[iBin]=0.000001f;	// almost zero to avoid taking log of zero later
-    if (m_bLogScale)
-      jmax = (int) (m_fMinFreq*pow(m_fMaxFreq/m_fMinFreq,(float)i/m_iBars)/m_iSampleRate*iFreqDataLength + 0.5f);
-    else
-      jmax = (int) ((m_fMinFreq + (m_fMaxFreq-m_fMinFreq)*i/m_iBars)/m_iSampleRate*iFreqDataLength + 0.5f);
-    // Round up to nearest multiple of 2 and check that jmin is not jmax
-    jmax<<=1;
-    if (jmax > iFreqDataLength) jmax = iFreqDataLength;
-    if (jmax==jmin) jmin-=2;
-    for (int j=jmin; j<jmax; j+=2)
-    {
-      m_pFreq[iBin]+=pFreqData[j]+pFreqData[j+1];
-    }
-    m_pFreq[iBin] /=(jmax-jmin);
-    jmin = jmax;
+  PROFILE_SCOPE(PROFILE_AUDIODATA);
+
+  // Pick up what the latest Start() and settings left, starting over when
+  // it's a new Start()
+  if (m_startStates.Update())
+  {
+    const StartState *pState = m_startStates.GetReadBuffer();
+    if (pState->m_iGeneration != m_audioState.m_iGeneration)
+      ResetAudioState(*pState);
+    m_audioState = *pState;
   }
 
+  const int iBars = m_audioState.m_iBars;
+  const int iChannels = m_audioState.m_iChannels;
+  const int iSampleRate = m_audioState.m_iSampleRate;
+  ParticleSystemSettings *currSettings = &m_pssSettings[m_audioState.m_iSetting];
+  AudioFrame *pFrame = m_audioFrames.GetWriteBuffer();
+
+  pFrame->m_iGeneration = m_audioState.m_iGeneration;
+
+  bool bBeat = false;
+
+  m_capture.WriteAudioData(pAudioData, iAudioDataLength, pFreqData, iFreqDataLength);
 
-  // Transform data to dB scale, 0 (Quietest possible) to 96 (Loudest)
-  int i;
-  for (i=0; i < (m_iBars*2); i++)
   {
-    m_pFreq[i] = 10*log10(m_pFreq[i]);
-    if (m_pFreq[i] > MAX_LEVEL)
-      m_pFreq[i] = MAX_LEVEL;
-    if (m_pFreq[i] < MIN_LEVEL)
-      m_pFreq[i] = MIN_LEVEL;
+    PROFILE_SCOPE(PROFILE_SPECTRUM);
+
+    // Kept up to date either way, so switching to our FFT has a full window
+    m_history.Add(pAudioData, iAudioDataLength, iChannels);
+
+    // Our own FFT over the latest samples, when asked for or when Kodi sent
+    // no frequency data (it only does when GetInfo() wanted it)
+    int iFFTSize = m_iFFTSize;
+    if (iFFTSize == 0 && (pFreqData == NULL || iFreqDataLength <= 0))
+      iFFTSize = FFT_DEFAULT_SIZE;
+
+    if (iFFTSize != 0)
+    {
+      m_fft.SetSize(iFFTSize);
+      m_fft.PowerSpectrum(m_history.GetLatest(iFFTSize), m_pFFTPower);
+      pFreqData = m_pFFTPower;
+      iFreqDataLength = iFFTSize / 2;
+    }
+    else if (iFreqDataLength>FREQ_DATA_SIZE)
+      iFreqDataLength = FREQ_DATA_SIZE;
+
+    // Group data into frequency bins by averaging and transform them to dB
+    // scale, 0 (Quietest possible) to 96 (Loudest), truncated to the users
+    // range. The bins of each bar are only worked out again when the layout
+    // or the data format changes.
+    m_spectrum.Configure(iBars, m_bLogScale, m_fMinFreq, m_fMaxFreq, iSampleRate, iFreqDataLength);
+    float fMinLevel = std::max((float)MIN_LEVEL, m_fMinLevel);
+    m_spectrum.Analyze(pFreqData, m_pBars, fMinLevel, std::min((float)MAX_LEVEL, m_fMaxLevel));
+
+    // Smoothing and onsets go by the audio rather than the clock
+    float fAudioTime = iSampleRate > 0 && iChannels > 0 ? (float)(iAudioDataLength / iChannels) / iSampleRate : 0.0f;
+
+    // The effects read the bars smoothed; onsets need them as they are
+    m_envelope.Process(m_pBars, iBars, fAudioTime, fMinLevel, m_pFreq);
+    bBeat = m_onset.Process(m_pBars, iBars, fAudioTime);
+
+    // The kick fades over a quarter beat, or 1/8 s before there's a tempo
+    float fPeriod = m_onset.GetBeatPeriod();
+    m_fBeatKick = bBeat ? 1.0f : m_fBeatKick * expf(-fAudioTime / (fPeriod > 0.0f ? 0.25f * fPeriod : 0.125f));
   }
 
-  // truncate data to the users range
-  if (m_pFreq[i] > m_fMaxLevel)
-    m_pFreq[i] = m_fMaxLevel;
-  if (m_pFreq[i] < m_fMinLevel)
-    m_pFreq[i] = m_fMinLevel;
+  if (currSettings->m_bBeatRotation)
+  {
+    if (bBeat)
+      m_fRotationSign*=-1;
+  }
+  else
+  {
+    //if we exceed the rotation sensitivity threshold, reverse our rotation
+    int rotationBar = std::min(iBars, currSettings->m_iRotationBar);
+    if (abs(m_pFreq[rotationBar] - m_pFreqPrev[rotationBar]) > MAX_LEVEL * currSettings->m_fRotationSensitivity)
+      m_fRotationSign*=-1;
+  }
+  pFrame->m_fRotationSpeed = currSettings->m_fRotationSpeed * m_fRotationSign;
 
-  //if we exceed the rotation sensitivity threshold, reverse our rotation
-  int rotationBar = std::min(m_iBars, currSettings->m_iRotationBar);
-  if (abs(m_pFreq[rotationBar] - m_pFreqPrev[rotationBar]) > MAX_LEVEL * currSettings->m_fRotationSensitivity)
-    currSettings->m_fRotationSpeed*=-1;
+  // Every emitter follows its own part of the spectrum; the first one
+  // follows the bars the settings give
+  int nEmitters = m_audioState.m_nEmitters;
+  pFrame->m_nEmitters = nEmitters;
 
-  ShiftColor(currSettings);
+  {
+    PROFILE_SCOPE(PROFILE_SHIFTCOLOR);
+    for (int i=0; i<nEmitters; i++)
+      pFrame->m_pEmitters[i].m_hsvColor = ShiftColor(currSettings, i, i * iBars / nEmitters);
+  }
 
   //adjust num to release
-  if (currSettings->m_fNumToReleaseMod != 0.0f)
+  for (int i=0; i<nEmitters; i++)
   {
-    int numToReleaseBar = std::min(m_iBars, 10);
-    float level = (m_pFreq[numToReleaseBar]/(float)MAX_LEVEL);
-    int numToRelease = level * currSettings->m_dwNumToRelease;
-    int mod = numToRelease * currSettings->m_fNumToReleaseMod;
-    numToRelease+=mod;
-    m_ParticleSystem.SetNumToRelease(numToRelease);
+    EmitterFrame *pEmitter = &pFrame->m_pEmitters[i];
+    pEmitter->m_bNumToRelease = currSettings->m_fNumToReleaseMod != 0.0f;
+    if (pEmitter->m_bNumToRelease)
+    {
+      int numToReleaseBar = OffsetLevel(std::min(iBars, 10), i * iBars / nEmitters);
+      float level = (m_pFreq[numToReleaseBar]/(float)MAX_LEVEL);
+      int numToRelease = level * currSettings->m_dwNumToRelease;
+      int mod = numToRelease * currSettings->m_fNumToReleaseMod;
+      numToRelease+=mod;
+      pEmitter->m_dwNumToRelease = numToRelease;
+    }
   }
 
-  //adjust gravity
-  CVector vGravity = Shift(&currSettings->m_esGravity);
-  m_ParticleSystem.SetGravity(vGravity);
+  //burst on beats; Render() releases whatever it hasn't yet
+  if (bBeat)
+    m_nBursts += currSettings->m_dwBeatRelease;
+  pFrame->m_nBursts = m_nBursts;
 
-  //adjust wind
-  CVector vWind = Shift(&currSettings->m_esWind);
-  m_ParticleSystem.SetWind(vWind);
+  {
+    PROFILE_SCOPE(PROFILE_SHIFT);
+
+    for (int i=0; i<nEmitters; i++)
+    {
+      EmitterFrame *pEmitter = &pFrame->m_pEmitters[i];
+      int iBarOffset = i * iBars / nEmitters;
+
+      //adjust gravity
+      pEmitter->m_vGravity = Shift(&currSettings->m_esGravity, iBarOffset);
+
+      //adjust wind
+      pEmitter->m_vWind = Shift(&currSettings->m_esWind, iBarOffset);
+
+      //adjust velocity
+      pEmitter->m_vVelocity = Shift(&currSettings->m_esVelocity, iBarOffset) * (1.0f + currSettings->m_fBeatKick * m_fBeatKick);
 
-  //adjust velocity
-  CVector vVelocity = Shift(&currSettings->m_esVelocity);
-  m_ParticleSystem.SetVelocity(vVelocity);
+      //adjust position
+      pEmitter->m_vPosition = Shift(&currSettings->m_esPosition, iBarOffset);
 
-  //adjust position
-  CVector vPosition = Shift(&currSettings->m_esPosition);
-  m_ParticleSystem.SetPosition(vPosition);
+      PlaceEmitter(i, nEmitters, &pEmitter->m_vGravity, &pEmitter->m_vWind, &pEmitter->m_vVelocity, &pEmitter->m_vPosition);
+    }
+  }
+
+  m_audioFrames.Publish();
 
-  memcpy(m_pFreqPrev, m_pFreq, FREQ_DATA_SIZE);
+  memcpy(m_pFreqPrev, m_pFreq, sizeof(m_pFreq));
 }
 
 //-- GetInfo ------------------------------------------------------------------
@@ -225,19 +481,89 @@ extern "C" void AudioData(const float* pAudioData, int iAudioDataLength, float *
 //-----------------------------------------------------------------------------
 extern "C" void GetInfo(VIS_INFO* pInfo)
 {
-  pInfo->bWantsFreq = true;
+  // Kodi's FFT is only needed when we aren't doing our own. Whichever
+  // runs, the frequency data is a window of samples behind.
+  pInfo->bWantsFreq = m_iFFTSize == 0;
   pInfo->iSyncDelay = 15;
 }
 
 #include <iostream>
 
+//-----------------------------------------------------------------------------
+// Hands the latest AudioData() results to the particle system, if there are
+// new ones from since the last Start()
+//-----------------------------------------------------------------------------
+static void ApplyAudioFrame()
+{
+  if (!m_audioFrames.Update())
+    return;
+
+  const AudioFrame *pFrame = m_audioFrames.GetReadBuffer();
+  if (pFrame->m_iGeneration != __atomic_load_n(&m_iGeneration, __ATOMIC_ACQUIRE))
+    return;
+
+  int nEmitters = std::min(pFrame->m_nEmitters, m_ParticleSystem.GetEmitterCount());
+  for (int i=0; i<nEmitters; i++)
+  {
+    const EmitterFrame *pEmitter = &pFrame->m_pEmitters[i];
+    m_ParticleSystem.SelectEmitter(i);
+    if (pEmitter->m_bNumToRelease)
+      m_ParticleSystem.SetNumToRelease(pEmitter->m_dwNumToRelease);
+    m_ParticleSystem.SetColor(pEmitter->m_hsvColor);
+    m_ParticleSystem.SetGravity(pEmitter->m_vGravity);
+    m_ParticleSystem.SetWind(pEmitter->m_vWind);
+    m_ParticleSystem.SetVelocity(pEmitter->m_vVelocity);
+    m_ParticleSystem.SetPosition(pEmitter->m_vPosition);
+
+    // Frames may have been skipped, the count covers their bursts too
+    m_ParticleSystem.Burst(pFrame->m_nBursts - m_nBurstsApplied);
+  }
+  m_ParticleSystem.SelectEmitter(0);
+  m_fRotationSpeed = pFrame->m_fRotationSpeed;
+
+  m_nBurstsApplied = pFrame->m_nBursts;
+}
+
+static void LogProfileLine(const char *szLine, void *)
+{
+  XBMC->Log(ADDON::LOG_NOTICE, "Fountain: %s", szLine);
+}
+
 extern "C" void Render()
 {
+  // Dump and restart the histograms every PROFILE_DUMP_INTERVAL while
+  // profiling, outside of the frame being timed. Without Kodi's log
+  // (fountain_replay) whoever enabled the profiler reads them instead.
+  if (XBMC && ProfilerEnabled())
+  {
+    uint64_t nNow = ProfilerNow();
+    if (nNow - m_nLastProfileDump >= (uint64_t)(PROFILE_DUMP_INTERVAL * 1e9))
+    {
+      if (m_nLastProfileDump != 0)
+        DumpProfile(LogProfileLine, NULL);
+      ResetProfile();
+      m_nLastProfileDump = nNow;
+    }
+  }
+
+  PROFILE_SCOPE(PROFILE_FRAME);
+
+  // A new bar count takes effect mid-song. The settings may change on
+  // another thread, so only this one hands AudioData() a new StartState.
+  int iBars = __atomic_load_n(&m_iBars, __ATOMIC_RELAXED);
+  if (iBars != m_startState.m_iBars)
+  {
+    m_startState.m_iBars = iBars;
+    PublishStartState();
+  }
+
+  ApplyAudioFrame();
+
   //
   // Set up our view
   SetupCamera();
   SetupPerspective();
-  SetupRotation(0.0f, 0.0f, m_fRotation+=m_pssSettings[m_iCurrSetting].m_fRotationSpeed);
+  SetupRotation(0.0f, 0.0f, m_fRotation+=m_fRotationSpeed);
   glClearColor(0.0, 0.0, 0.0, 1.0);
   glDisable(GL_DEPTH_TEST);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -249,6 +575,7 @@ extern "C" void Render()
   //
 
   gTimer.Update();
+  m_capture.WriteRender(gTimer.GetTime());
   m_fElapsedTime = gTimer.GetDeltaTime();
   m_ParticleSystem.Update( m_fElapsedTime );
 
@@ -283,14 +610,19 @@ extern "C" void Render()
 
 void CreateArrays()
 {
-  memset(m_pFreq, 0, 1024*sizeof(float));
+  memset(m_pFreq, 0, sizeof(m_pFreq));
 }
 
 void SetDefaults()
 {
-  m_ParticleSystem.SetMaxParticles(1000);
+  m_ParticleSystem.SetMaxParticles(PARTICLES_PER_EMITTER);
   SetDefaults(&m_pssSettings[0]);
   SetDefaults(&m_pssSettings[1]);
+
+  // The second one moves with the beat instead of every frame
+  m_pssSettings[1].m_dwBeatRelease	= 60;
+  m_pssSettings[1].m_fBeatKick		= 0.5f;
+  m_pssSettings[1].m_bBeatRotation	= true;
 }
 
 void SetDefaults(ParticleSystemSettings* settings)
@@ -322,6 +654,9 @@ void SetDefaults(ParticleSystemSettings* settings)
   settings->m_csHue.modifier	= 360.0f;
   settings->m_csHue.variation	= 45.0f;
   settings->m_csHue.bar		= 1;
+  settings->m_csHue.freqLow	= 0.0f;
+  settings->m_csHue.freqHigh	= 0.0f;
+  settings->m_csHue.peak		= false;
 
   settings->m_csSaturation.min		= 1.0f;
   settings->m_csSaturation.min		= 1.0f;
@@ -329,6 +664,9 @@ void SetDefaults(ParticleSystemSettings* settings)
   settings->m_csSaturation.modifier	= 0.0f;
   settings->m_csSaturation.variation	= 0.0f;
   settings->m_csSaturation.bar		= 1;
+  settings->m_csSaturation.freqLow	= 0.0f;
+  settings->m_csSaturation.freqHigh	= 0.0f;
+  settings->m_csSaturation.peak		= false;
 
   settings->m_csValue.min			= 0.2f;
   settings->m_csValue.min			= 0.6f;
@@ -336,15 +674,24 @@ void SetDefaults(ParticleSystemSettings* settings)
   settings->m_csValue.modifier	= 0.3f;
   settings->m_csValue.variation	= 0.3f;
   settings->m_csValue.bar			= 1;
+  settings->m_csValue.freqLow		= 0.0f;
+  settings->m_csValue.freqHigh	= 0.0f;
+  settings->m_csValue.peak			= false;
 
   settings->m_fRotationSpeed			= 0.01f;
   settings->m_fRotationSensitivity	= 0.15;
   settings->m_iRotationBar			= 0;
+
+  settings->m_dwBeatRelease			= 0;
+  settings->m_fBeatKick				= 0.0f;
+  settings->m_bBeatRotation			= false;
 }
 
 void SetDefaults(EffectSettings* settings)
 {
   settings->bars             = CVector( 1, 1, 1 );
+  settings->freqLow          = CVector( 0, 0, 0 );
+  settings->freqHigh         = CVector( 0, 0, 0 );
   settings->bInvert          = false;
   settings->modifier         = 0.0f;
   settings->mode             = MODE_BOTH;
@@ -376,63 +723,93 @@ void SetupRotation(float x, float y, float z)
   glRotatef(z/M_PI*180, 0.0, 0.0, 1.0);
 }
 
-void ShiftColor(ParticleSystemSettings* settings)
+//-----------------------------------------------------------------------------
+// Level this and last AudioData() of an effect's bar (1 based) iBarOffset
+// bars on, or of its frequency range when it has one. Ranges cost no more
+// than bars, they come out of the spectrum's running sums.
+//-----------------------------------------------------------------------------
+void GetEffectLevel(int iBar, int iBarOffset, float fLowFreq, float fHighFreq, float *pLevel, float *pPrev)
+{
+  if (fHighFreq > fLowFreq)
+  {
+    *pLevel = m_spectrum.GetLevel(fLowFreq, fHighFreq);
+    *pPrev = m_spectrum.GetPrevLevel(fLowFreq, fHighFreq);
+    return;
+  }
+
+  int iBin = OffsetLevel(std::max(0, std::min(m_audioState.m_iBars, iBar) - 1) * 2, iBarOffset);
+  *pLevel = m_pFreq[iBin];
+  *pPrev = m_pFreqPrev[iBin];
+}
+
+float GetColorLevel(ColorSetting* setting, int iBarOffset)
+{
+  if (setting->freqHigh > setting->freqLow)
+    return m_spectrum.GetLevel(setting->freqLow, setting->freqHigh);
+  if (setting->peak)
+    return m_envelope.GetPeak(OffsetLevel(setting->bar, iBarOffset) / 2);
+  return m_pFreq[OffsetLevel(setting->bar, iBarOffset)];
+}
+
+HsvColor ShiftColor(ParticleSystemSettings* settings, int iEmitter, int iBarOffset)
 {
-  float hadjust	= m_pssSettings[m_iCurrSetting].m_csHue.shiftRate;
-  float hmin		= m_pssSettings[m_iCurrSetting].m_csHue.min;
-  float hmax		= m_pssSettings[m_iCurrSetting].m_csHue.max;
+  HsvColor *pColor = &m_clrColor[iEmitter];
 
-  float sadjust	= m_pssSettings[m_iCurrSetting].m_csSaturation.shiftRate;
-  float smin		= m_pssSettings[m_iCurrSetting].m_csSaturation.min;
-  float smax		= m_pssSettings[m_iCurrSetting].m_csSaturation.max;
+  float hadjust	= settings->m_csHue.shiftRate;
+  float hmin		= settings->m_csHue.min;
+  float hmax		= settings->m_csHue.max;
 
-  float vadjust	= m_pssSettings[m_iCurrSetting].m_csValue.shiftRate;
-  float vmin		= m_pssSettings[m_iCurrSetting].m_csValue.min;
-  float vmax		= m_pssSettings[m_iCurrSetting].m_csValue.max;
+  float sadjust	= settings->m_csSaturation.shiftRate;
+  float smin		= settings->m_csSaturation.min;
+  float smax		= settings->m_csSaturation.max;
 
-  m_clrColor.h += hadjust * m_iHDir;
-  if ( m_clrColor.h >= hmax  || m_clrColor.h <= hmin )
+  float vadjust	= settings->m_csValue.shiftRate;
+  float vmin		= settings->m_csValue.min;
+  float vmax		= settings->m_csValue.max;
+
+  pColor->h += hadjust * m_iHDir[iEmitter];
+  if ( pColor->h >= hmax  || pColor->h <= hmin )
   {
-    m_clrColor.h -= hadjust * m_iHDir;
-    m_iHDir *= -1;
+    pColor->h -= hadjust * m_iHDir[iEmitter];
+    m_iHDir[iEmitter] *= -1;
   }
 
-  m_clrColor.h = std::min(m_clrColor.h, hmax);
-  m_clrColor.h = std::max(m_clrColor.h, hmin);
+  pColor->h = std::min(pColor->h, hmax);
+  pColor->h = std::max(pColor->h, hmin);
 
-  m_clrColor.s += sadjust * m_iSDir;
-  if ( m_clrColor.s >= smax  || m_clrColor.s <= smin )
+  pColor->s += sadjust * m_iSDir[iEmitter];
+  if ( pColor->s >= smax  || pColor->s <= smin )
   {
-    m_clrColor.s -= sadjust * m_iSDir;
-    m_iSDir *= -1;
+    pColor->s -= sadjust * m_iSDir[iEmitter];
+    m_iSDir[iEmitter] *= -1;
   }
 
-  m_clrColor.s = std::min(m_clrColor.s, smax);
-  m_clrColor.s = std::max(m_clrColor.s, smin);
+  pColor->s = std::min(pColor->s, smax);
+  pColor->s = std::max(pColor->s, smin);
 
-  m_clrColor.v += vadjust * m_iVDir;
-  if ( m_clrColor.v >= vmax  || m_clrColor.v <= vmin )
+  pColor->v += vadjust * m_iVDir[iEmitter];
+  if ( pColor->v >= vmax  || pColor->v <= vmin )
   {
-    m_clrColor.v -= vadjust * m_iVDir;
-    m_iVDir *= -1;
+    pColor->v -= vadjust * m_iVDir[iEmitter];
+    m_iVDir[iEmitter] *= -1;
   }
 
-  m_clrColor.v = std::min(m_clrColor.v, vmax);
-  m_clrColor.v = std::max(m_clrColor.v, vmin);
+  pColor->v = std::min(pColor->v, vmax);
+  pColor->v = std::max(pColor->v, vmin);
 
-  float audioh = (m_pFreq[settings->m_csHue.bar] / MAX_LEVEL)			* settings->m_csHue.modifier;
-  float audios = (m_pFreq[settings->m_csSaturation.bar] / MAX_LEVEL)	* settings->m_csSaturation.modifier;
-  float audiov = (m_pFreq[settings->m_csValue.bar] / MAX_LEVEL)		* settings->m_csValue.modifier;
+  float audioh = (GetColorLevel(&settings->m_csHue, iBarOffset) / MAX_LEVEL)			* settings->m_csHue.modifier;
+  float audios = (GetColorLevel(&settings->m_csSaturation, iBarOffset) / MAX_LEVEL)	* settings->m_csSaturation.modifier;
+  float audiov = (GetColorLevel(&settings->m_csValue, iBarOffset) / MAX_LEVEL)		* settings->m_csValue.modifier;
 
-  float h = m_clrColor.h + audioh;
+  float h = pColor->h + audioh;
   while(h > 360)
     h -= 360;
 
-  float s = m_clrColor.s + audios;
+  float s = pColor->s + audios;
   while(s > 1)
     s -= 1;
 
-  float v = m_clrColor.v + audiov;
+  float v = pColor->v + audiov;
   while(v > 1)
     v -= 1;
 
@@ -445,79 +822,87 @@ void ShiftColor(ParticleSystemSettings* settings)
   v = std::min(v, vmax);
   v = std::max(v, vmin);
 
-  m_ParticleSystem.SetColor( HsvColor(h, s, v) );
+  return HsvColor(h, s, v);
 }
 
 void InitParticleSystem(ParticleSystemSettings settings)
 {
 	//m_chTexFile		= settings.m_chTexFile;
-  m_ParticleSystem.SetNumToRelease	( settings.m_dwNumToRelease );
-  m_ParticleSystem.SetReleaseInterval	( settings.m_fReleaseInterval );
-  m_ParticleSystem.SetLifeCycle		( settings.m_fLifeCycle );
-  m_ParticleSystem.SetSize			( settings.m_fSize );
-  m_ParticleSystem.SetColor			( settings.m_hsvColor );
-  m_ParticleSystem.SetPosition		( settings.m_esPosition.vector );
-  m_ParticleSystem.SetVelocity		( settings.m_esVelocity.vector );
-  m_ParticleSystem.SetGravity			( settings.m_esGravity.vector );
-  m_ParticleSystem.SetWind			( settings.m_esWind.vector );
-  m_ParticleSystem.SetAirResistence	( settings.m_bAirResistence );
-  m_ParticleSystem.SetVelocityVar		( settings.m_fVelocityVar );
-
-  m_ParticleSystem.SetMaxH			( settings.m_csHue.max );
-  m_ParticleSystem.SetMinH			( settings.m_csHue.min );
-  m_ParticleSystem.SetHVar			( settings.m_csHue.variation );
-
-  m_ParticleSystem.SetMaxS			( settings.m_csSaturation.max );
-  m_ParticleSystem.SetMinS			( settings.m_csSaturation.min );
-  m_ParticleSystem.SetSVar			( settings.m_csSaturation.variation );
-
-  m_ParticleSystem.SetMaxV			( settings.m_csValue.max );
-  m_ParticleSystem.SetMinV			( settings.m_csValue.min );
-  m_ParticleSystem.SetVVar			( settings.m_csValue.variation );
-
-  char tmp[1024];
-  XBMC->GetSetting("__addonpath__", tmp);
-  strcat(tmp, "/resources/particle.bmp");
+  // All emitters share the particle budget and the texture
+  int nEmitters = m_startState.m_nEmitters;
+  m_ParticleSystem.SetMaxParticles(PARTICLES_PER_EMITTER * nEmitters);
+  m_ParticleSystem.SetEmitterCount(nEmitters);
+
+  for (int i=0; i<nEmitters; i++)
+  {
+    CVector vGravity = settings.m_esGravity.vector;
+    CVector vWind = settings.m_esWind.vector;
+    CVector vVelocity = settings.m_esVelocity.vector;
+    CVector vPosition = settings.m_esPosition.vector;
+    PlaceEmitter(i, nEmitters, &vGravity, &vWind, &vVelocity, &vPosition);
+
+    m_ParticleSystem.SelectEmitter		( i );
+    m_ParticleSystem.SetNumToRelease	( settings.m_dwNumToRelease );
+    m_ParticleSystem.SetReleaseInterval	( settings.m_fReleaseInterval );
+    m_ParticleSystem.SetLifeCycle		( settings.m_fLifeCycle );
+    m_ParticleSystem.SetSize			( settings.m_fSize );
+    m_ParticleSystem.SetColor			( m_startState.m_pColors[i] );
+    m_ParticleSystem.SetPosition		( vPosition );
+    m_ParticleSystem.SetVelocity		( vVelocity );
+    m_ParticleSystem.SetGravity			( vGravity );
+    m_ParticleSystem.SetWind			( vWind );
+    m_ParticleSystem.SetAirResistence	( settings.m_bAirResistence );
+    m_ParticleSystem.SetVelocityVar		( settings.m_fVelocityVar );
+
+    m_ParticleSystem.SetMaxH			( settings.m_csHue.max );
+    m_ParticleSystem.SetMinH			( settings.m_csHue.min );
+    m_ParticleSystem.SetHVar			( settings.m_csHue.variation );
+
+    m_ParticleSystem.SetMaxS			( settings.m_csSaturation.max );
+    m_ParticleSystem.SetMinS			( settings.m_csSaturation.min );
+    m_ParticleSystem.SetSVar			( settings.m_csSaturation.variation );
+
+    m_ParticleSystem.SetMaxV			( settings.m_csValue.max );
+    m_ParticleSystem.SetMinV			( settings.m_csValue.min );
+    m_ParticleSystem.SetVVar			( settings.m_csValue.variation );
+  }
+  m_ParticleSystem.SelectEmitter(0);
+
+  char tmp[sizeof(m_szAddonPath) + 32];
+  snprintf(tmp, sizeof(tmp), "%s/resources/particle.bmp", m_szAddonPath);
   m_ParticleSystem.SetTexture(tmp);
 }
 
-CVector Shift(EffectSettings* settings)
+CVector Shift(EffectSettings* settings, int iBarOffset)
 {
-  int xBand = std::min(m_iBars, (int)settings->bars.x);
-  int yBand = std::min(m_iBars, (int)settings->bars.y);
-  int zBand = std::min(m_iBars, (int)settings->bars.z);
-
-  xBand-=1;
-  xBand*=2;
-
-  yBand-=1;
-  yBand*=2;
-
-  zBand-=1;
-  zBand*=2;
-
   if (settings->modifier == 0.0f)
     return settings->vector;
 
+  float xLevel, yLevel, zLevel;
+  float xPrev, yPrev, zPrev;
+  GetEffectLevel((int)settings->bars.x, iBarOffset, settings->freqLow.x, settings->freqHigh.x, &xLevel, &xPrev);
+  GetEffectLevel((int)settings->bars.y, iBarOffset, settings->freqLow.y, settings->freqHigh.y, &yLevel, &yPrev);
+  GetEffectLevel((int)settings->bars.z, iBarOffset, settings->freqLow.z, settings->freqHigh.z, &zLevel, &zPrev);
+
   float x, y, z;
 
   if (settings->mode == MODE_DIFFERENCE)
   {
-    x = abs((m_pFreq[xBand] - m_pFreqPrev[xBand])/MAX_LEVEL);
-    y = abs((m_pFreq[yBand] - m_pFreqPrev[yBand])/MAX_LEVEL);
-    z = abs((m_pFreq[zBand] - m_pFreqPrev[zBand])/MAX_LEVEL);
+    x = abs((xLevel - xPrev)/MAX_LEVEL);
+    y = abs((yLevel - yPrev)/MAX_LEVEL);
+    z = abs((zLevel - zPrev)/MAX_LEVEL);
   }
   else if (settings->mode == MODE_LEVEL)
   {
-    x = m_pFreq[xBand]/MAX_LEVEL;
-    y = m_pFreq[yBand]/MAX_LEVEL;
-    z = m_pFreq[zBand]/MAX_LEVEL;
+    x = xLevel/MAX_LEVEL;
+    y = yLevel/MAX_LEVEL;
+    z = zLevel/MAX_LEVEL;
   }
   else
   {
-    x = std::max(1.f, (m_pFreq[xBand] + abs(m_pFreq[xBand] - m_pFreqPrev[xBand]))/MAX_LEVEL);
-    y = std::max(1.f, (m_pFreq[yBand] + abs(m_pFreq[yBand] - m_pFreqPrev[yBand]))/MAX_LEVEL);
-    z = std::max(1.f, (m_pFreq[zBand] + abs(m_pFreq[zBand] - m_pFreqPrev[zBand]))/MAX_LEVEL);
+    x = std::max(1.f, (xLevel + abs(xLevel - xPrev))/MAX_LEVEL);
+    y = std::max(1.f, (yLevel + abs(yLevel - yPrev))/MAX_LEVEL);
+    z = std::max(1.f, (zLevel + abs(zLevel - zPrev))/MAX_LEVEL);
   }
 
   if (settings->bInvert)
@@ -527,9 +912,9 @@ CVector Shift(EffectSettings* settings)
     z = 1 - z;
   }
 
-  x = getRandomMinMax(-x, x);
-  y = getRandomMinMax(-y, y);
-  z = getRandomMinMax(-z, z);
+  x = m_audioRandom.NextFloat(-x, x);
+  y = m_audioRandom.NextFloat(-y, y);
+  z = m_audioRandom.NextFloat(-z, z);
 
   if (settings->modificationMode == MODIFICATION_MODE_LINEAR)
   {
@@ -545,9 +930,9 @@ CVector Shift(EffectSettings* settings)
     y = (powf((y + 1) * settings->vector.y, mod));
     z = (powf((z + 1) * settings->vector.z, mod));
 
-    x = randomizeSign(x);
-    y = randomizeSign(y);
-    z = randomizeSign(z);
+    x = m_audioRandom.NextSign(x);
+    y = m_audioRandom.NextSign(y);
+    z = m_audioRandom.NextSign(z);
   }
 
   x += settings->vector.x;
@@ -605,6 +990,7 @@ extern "C" bool IsLocked()
 extern "C" void ADDON_Stop()
 {
   m_ParticleSystem.dtor();
+  m_capture.Close();
 }
 
 //-- Destroy ------------------------------------------------------------------
@@ -621,7 +1007,7 @@ extern "C" void ADDON_Destroy()
 //-----------------------------------------------------------------------------
 extern "C" bool ADDON_HasSettings()
 {
-  return false;
+  return true;
 }
 
 //-- GetStatus ---------------------------------------------------------------
@@ -657,6 +1043,148 @@ extern "C" void ADDON_FreeSettings()
 //-----------------------------------------------------------------------------
 extern "C" ADDON_STATUS ADDON_SetSetting(const char *strSetting, const void* value)
 {
+  if (!strSetting || !value)
+    return ADDON_STATUS_UNKNOWN;
+
+  // The seed that actually gets used is captured by SeedFountain(), and
+  // profiling doesn't change what gets drawn
+  if (strcmp(strSetting, "logscale") == 0)
+    m_capture.WriteSetting(strSetting, *(const bool*)value ? 1 : 0);
+  else if (strcmp(strSetting, "seed") != 0 && strcmp(strSetting, "profile") != 0)
+    m_capture.WriteSetting(strSetting, *(const int*)value);
+
+  if (strcmp(strSetting, "threads") == 0)
+  {
+    static const int threadCounts[] = { 1, 2, 3, 4, 6, 8 };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(threadCounts)/sizeof(threadCounts[0])))
+      index = 0;
+    m_iThreads = threadCounts[index];
+    m_ParticleSystem.SetThreadCount(m_iThreads);
+  }
+  else if (strcmp(strSetting, "emitters") == 0)
+  {
+    // Takes effect with the next Start()
+    static const int emitterCounts[] = { 1, 2, 4, 8, 16, MAX_EMITTERS };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(emitterCounts)/sizeof(emitterCounts[0])))
+      index = 0;
+    m_iEmitters = emitterCounts[index];
+  }
+  else if (strcmp(strSetting, "seed") == 0)
+  {
+    m_iSeed = *(const int*)value;
+    SeedRandom(m_iSeed);
+  }
+  else if (strcmp(strSetting, "rendermode") == 0)
+  {
+    static const int renderModes[] = { RM_BILLBOARDS, RM_POINTSPRITES, RM_INSTANCED };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(renderModes)/sizeof(renderModes[0])))
+      index = 0;
+    m_iRenderMode = renderModes[index];
+    m_ParticleSystem.SetRenderMode(m_iRenderMode);
+  }
+  else if (strcmp(strSetting, "smoothing") == 0)
+  {
+    // Average weighs in a fifth of each new frame, median looks at five
+    static const int filters[] = { TF_NONE, TF_AVERAGE, TF_MEDIAN };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(filters)/sizeof(filters[0])))
+      index = 0;
+    gTimer.SetFilter(filters[index], 0.2f, 5);
+  }
+  else if (strcmp(strSetting, "simrate") == 0)
+  {
+    // Fixed simulation rates, 0 steps once per displayed frame
+    static const float simRates[] = { 0.0f, 30.0f, 60.0f, 120.0f };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(simRates)/sizeof(simRates[0])))
+      index = 0;
+    m_fSimRate = simRates[index];
+    m_ParticleSystem.SetFixedStep(m_fSimRate > 0.0f ? 1.0f / m_fSimRate : 0.0f);
+  }
+  else if (strcmp(strSetting, "motion") == 0)
+  {
+    m_bAnalytic = *(const int*)value == 1;
+    m_ParticleSystem.SetAnalytic(m_bAnalytic);
+  }
+  else if (strcmp(strSetting, "colors") == 0)
+  {
+    // Converted, or looked up in a hue x saturation x value table. The
+    // coarse one (276 KB) is off by up to 17 of 255 levels, the fine one
+    // (2.2 MB) by up to 8; fountain_bench --colortable measures others.
+    static const int colorTables[][3] = { { 0, 0, 0 }, { 90, 16, 16 }, { 180, 32, 32 } };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(colorTables)/sizeof(colorTables[0])))
+      index = 0;
+    m_ParticleSystem.SetColorTable(colorTables[index][0], colorTables[index][1], colorTables[index][2]);
+  }
+  else if (strcmp(strSetting, "bars") == 0)
+  {
+    static const int barCounts[] = { 12, 24, 48, 96, 180, 360, MAX_BARS };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(barCounts)/sizeof(barCounts[0])))
+      index = 0;
+    __atomic_store_n(&m_iBars, barCounts[index], __ATOMIC_RELAXED);
+  }
+  else if (strcmp(strSetting, "logscale") == 0)
+    m_bLogScale = *(const bool*)value;
+  else if (strcmp(strSetting, "attack") == 0)
+  {
+    // Part of a rise the bars follow per frame
+    static const float riseSpeeds[] = { MAX_RISE_SPEED, 0.5f, 0.2f, 0.05f };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(riseSpeeds)/sizeof(riseSpeeds[0])))
+      index = 0;
+    m_fRiseSpeed = riseSpeeds[index];
+    SetEnvelopeSpeeds();
+  }
+  else if (strcmp(strSetting, "release") == 0)
+  {
+    // Part of a fall the bars follow per frame
+    static const float fallSpeeds[] = { MAX_FALL_SPEED, 0.3f, 0.1f, 0.03f };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(fallSpeeds)/sizeof(fallSpeeds[0])))
+      index = 0;
+    m_fFallSpeed = fallSpeeds[index];
+    SetEnvelopeSpeeds();
+  }
+  else if (strcmp(strSetting, "peakhold") == 0)
+  {
+    static const float holdTimes[] = { 0.0f, 0.25f, 0.5f, 1.0f };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(holdTimes)/sizeof(holdTimes[0])))
+      index = 1;
+    m_fPeakHoldTime = holdTimes[index];
+    SetEnvelopeSpeeds();
+  }
+  else if (strcmp(strSetting, "peakdecay") == 0)
+  {
+    // dB per frame
+    static const float decaySpeeds[] = { 0.5f, 1.0f, 2.0f, MAX_PEAK_DECAY_SPEED };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(decaySpeeds)/sizeof(decaySpeeds[0])))
+      index = 1;
+    m_fPeakDecaySpeed = decaySpeeds[index];
+    SetEnvelopeSpeeds();
+  }
+  else if (strcmp(strSetting, "fft") == 0)
+  {
+    // Kodi's frequency data, or our FFT of the PCM data at one of these sizes
+    static const int fftSizes[] = { 0, 512, 1024, 2048, 4096, 8192 };
+    int index = *(const int*)value;
+    if (index < 0 || index >= (int)(sizeof(fftSizes)/sizeof(fftSizes[0])))
+      index = 0;
+    m_iFFTSize = fftSizes[index];
+  }
+  else if (strcmp(strSetting, "profile") == 0)
+  {
+    // Timings go to the log every PROFILE_DUMP_INTERVAL seconds
+    EnableProfiler(*(const bool*)value);
+    m_nLastProfileDump = 0;
+  }
+
   return ADDON_STATUS_OK;
 }
 
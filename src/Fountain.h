@@ -28,6 +28,8 @@ struct EffectSettings
 {
   CVector vector;
   CVector bars;
+  CVector freqLow;     // Frequency range in Hz driving each axis instead
+  CVector freqHigh;    // of its bar, where freqHigh > freqLow
   float modifier;
   MODIFICATION_MODE modificationMode;
   MODE mode;
@@ -42,6 +44,9 @@ struct ColorSetting
   float modifier;
   float variation;
   int bar;
+  float freqLow;       // Frequency range in Hz used instead of the bar,
+  float freqHigh;      // where freqHigh > freqLow
+  bool peak;           // Follows the held peak of the bar rather than its level
 };
 
 struct ParticleSystemSettings
@@ -71,8 +76,50 @@ struct ParticleSystemSettings
   float		m_fNumToReleaseMod;
   MODE		m_mMode;
   bool		m_bInvert;
+
+  // Beats the onset detector finds
+  int			m_dwBeatRelease;		// Particles burst out on every beat
+  float		m_fBeatKick;			// Velocity boost on a beat, fading over a quarter beat
+  bool		m_bBeatRotation;		// Beats reverse the rotation, not m_fRotationSensitivity
+};
+
+// What one AudioData() works out for an emitter
+struct EmitterFrame
+{
+  bool        m_bNumToRelease;     // m_dwNumToRelease is only set with a mod
+  int         m_dwNumToRelease;
+  HsvColor    m_hsvColor;
+  CVector     m_vGravity;
+  CVector     m_vWind;
+  CVector     m_vVelocity;
+  CVector     m_vPosition;
+};
+
+// What one AudioData() works out for the particle system, handed to Render()
+struct AudioFrame
+{
+  int         m_iGeneration;       // Start() it belongs to
+  int         m_nEmitters;
+  EmitterFrame m_pEmitters[PARTICLE_MAX_EMITTERS];
+  float       m_fRotationSpeed;
+  int         m_nBursts;           // Particles each emitter burst out since Start()
+};
+
+// What AudioData() goes by of a Start(), handed over from the thread that
+// called it. Render() hands over a new copy when a setting changes it mid-song.
+struct StartState
+{
+  int         m_iGeneration;       // Start() it belongs to
+  int         m_iSetting;          // Preset
+  int         m_iSampleRate;
+  int         m_iChannels;
+  int         m_nEmitters;
+  int         m_iBars;
+  HsvColor    m_pColors[PARTICLE_MAX_EMITTERS];  // Where each emitter's color starts drifting
 };
 
+void CreateFountain(const char *szAddonPath);
+void SeedFountain(uint64_t seed);
 void InitParticleSystem(ParticleSystemSettings settings);
 void InitParticles();
 void SetupCamera();
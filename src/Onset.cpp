@@ -0,0 +1,151 @@
+//-----------------------------------------------------------------------------
+//		         Name: Onset.cpp
+//		  Description: Finds beats in the spectrum bars as they come in
+//					   and estimates the tempo from them
+//-----------------------------------------------------------------------------
+
+#include "Onset.h"
+#include <math.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+// Name: COnsetDetector()
+// Desc:
+//-----------------------------------------------------------------------------
+COnsetDetector::COnsetDetector()
+{
+  m_fSensitivity = 1.5f;
+  Reset();
+}
+
+//-----------------------------------------------------------------------------
+// Name: Reset()
+// Desc: Forgets the flux statistics, the onsets and the tempo
+//-----------------------------------------------------------------------------
+void COnsetDetector::Reset( void )
+{
+  m_iPrevBars  = 0;
+  m_fFlux      = 0.0f;
+  m_fMean      = 0.0f;
+  m_fDeviation = 0.0f;
+  m_bAbove     = false;
+  m_fTime      = 0.0;
+  m_nOnsets    = 0;
+  m_fTempo     = 0.0f;
+
+  memset( m_pOnsets, 0, sizeof(m_pOnsets) );
+  memset( m_pTempo, 0, sizeof(m_pTempo) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Process()
+// Desc:
+//-----------------------------------------------------------------------------
+bool COnsetDetector::Process( const float *pLevels, int iBars, float fDeltaTime )
+{
+  if( pLevels == NULL || iBars <= 0 )
+    return false;
+  if( iBars > SPECTRUM_MAX_BARS )
+    iBars = SPECTRUM_MAX_BARS;
+
+  m_fTime += fDeltaTime;
+
+  // Nothing to compare with after the bars changed
+  if( iBars != m_iPrevBars )
+  {
+    for( int i = 0; i < iBars; i++ )
+      m_pPrev[i] = pLevels[i];
+    m_iPrevBars = iBars;
+    return false;
+  }
+
+  // Only rises count, a note dying away is no onset
+  float fSum = 0.0f;
+  for( int i = 0; i < iBars; i++ )
+  {
+    float fRise = pLevels[i] - m_pPrev[i];
+    if( fRise > 0.0f )
+      fSum += fRise;
+    m_pPrev[i] = pLevels[i];
+  }
+  m_fFlux = fSum / iBars;
+
+  // Against the threshold of the flux before this call
+  bool bOnset = false;
+  bool bAbove = m_fFlux > GetThreshold();
+  if( bAbove && !m_bAbove )
+  {
+    double fLast = m_nOnsets > 0 ? m_pOnsets[(m_nOnsets - 1) % ONSET_HISTORY] : 0.0;
+    if( m_nOnsets == 0 || m_fTime - fLast >= ONSET_MIN_INTERVAL )
+    {
+      AddOnset();
+      bOnset = true;
+    }
+  }
+  m_bAbove = bAbove;
+
+  float fAlpha = 1.0f - expf( -fDeltaTime / ONSET_TIME_CONSTANT );
+  m_fMean      += fAlpha * (m_fFlux - m_fMean);
+  m_fDeviation += fAlpha * (fabsf( m_fFlux - m_fMean ) - m_fDeviation);
+
+  return bOnset;
+}
+
+//-----------------------------------------------------------------------------
+// Name: AddOnset()
+// Desc: Votes for the tempi the intervals to the last few onsets give,
+//       nearer onsets weighing more, and takes the best one
+//-----------------------------------------------------------------------------
+void COnsetDetector::AddOnset( void )
+{
+  for( int b = 0; b < ONSET_TEMPO_BINS; b++ )
+    m_pTempo[b] *= ONSET_TEMPO_DECAY;
+
+  int nBack = m_nOnsets < ONSET_HISTORY ? m_nOnsets : ONSET_HISTORY;
+  for( int k = 1; k <= nBack; k++ )
+  {
+    double fInterval = m_fTime - m_pOnsets[(m_nOnsets - k) % ONSET_HISTORY];
+    if( fInterval <= 0.0 )
+      continue;
+
+    // k onsets back is most likely k beats back
+    double fBPM = 60.0 * k / fInterval;
+    while( fBPM < ONSET_MIN_TEMPO )
+      fBPM *= 2.0;
+    while( fBPM > ONSET_MAX_TEMPO )
+      fBPM *= 0.5;
+
+    int b = (int)(fBPM - ONSET_MIN_TEMPO + 0.5);
+    float fWeight = 1.0f / k;
+    m_pTempo[b] += fWeight;
+    if( b > 0 )
+      m_pTempo[b - 1] += 0.5f * fWeight;
+    if( b + 1 < ONSET_TEMPO_BINS )
+      m_pTempo[b + 1] += 0.5f * fWeight;
+  }
+
+  m_pOnsets[m_nOnsets % ONSET_HISTORY] = m_fTime;
+  m_nOnsets++;
+
+  if( m_nOnsets < 4 )
+    return;
+
+  int nBest = 0;
+  for( int b = 1; b < ONSET_TEMPO_BINS; b++ )
+  {
+    if( m_pTempo[b] > m_pTempo[nBest] )
+      nBest = b;
+  }
+
+  // Between the bins, through a parabola over the peak and its neighbours
+  float fOffset = 0.0f;
+  if( nBest > 0 && nBest + 1 < ONSET_TEMPO_BINS )
+  {
+    float l = m_pTempo[nBest - 1], c = m_pTempo[nBest], r = m_pTempo[nBest + 1];
+    float fDenominator = l - 2.0f * c + r;
+    if( fDenominator < 0.0f )
+      fOffset = 0.5f * (l - r) / fDenominator;
+  }
+
+  m_fTempo = ONSET_MIN_TEMPO + nBest + fOffset;
+}
@@ -0,0 +1,77 @@
+//-----------------------------------------------------------------------------
+//		         Name: Onset.h
+//		  Description: Finds beats in the spectrum bars as they come in
+//					   and estimates the tempo from them
+//-----------------------------------------------------------------------------
+
+#ifndef ONSET_H_INCLUDED
+#define ONSET_H_INCLUDED
+
+#include "Spectrum.h"
+
+const float ONSET_MIN_INTERVAL  = 0.1f;    // Seconds, onsets closer than this are one
+const float ONSET_TIME_CONSTANT = 1.0f;    // Seconds the threshold follows the flux over
+const float ONSET_FLOOR         = 0.1f;    // dB per bar, less flux is never an onset
+
+const int   ONSET_HISTORY       = 8;       // Onsets the tempo looks back over
+const int   ONSET_MIN_TEMPO     = 60;      // BPM range the tempo is folded into
+const int   ONSET_MAX_TEMPO     = 200;
+const int   ONSET_TEMPO_BINS    = ONSET_MAX_TEMPO - ONSET_MIN_TEMPO + 1;
+const float ONSET_TEMPO_DECAY   = 0.9f;    // Weight the histogram keeps per onset
+
+//-----------------------------------------------------------------------------
+// Name: COnsetDetector
+// Desc: Spectral flux, the average rise in dB over the bars, against a
+//       threshold that follows its running mean and mean deviation; an onset
+//       is the flux crossing it. The intervals to the last few onsets, folded
+//       into ONSET_MIN_TEMPO..ONSET_MAX_TEMPO, go into a slowly forgetting
+//       histogram whose peak is the tempo. A call costs a pass over the bars, an onset a pass
+//       over the histogram.
+//-----------------------------------------------------------------------------
+class COnsetDetector
+{
+
+public:
+
+    COnsetDetector(void);
+
+    void Reset( void );
+
+    // Threshold in mean deviations above the mean flux
+    void SetSensitivity( float fSensitivity ) { m_fSensitivity = fSensitivity; }
+
+    // Takes the levels in dB of iBars bars, as CSpectrumBands::Analyze()
+    // leaves them, fDeltaTime seconds of audio after the last call. True
+    // when they start an onset.
+    bool Process( const float *pLevels, int iBars, float fDeltaTime );
+
+    float GetFlux( void ) { return m_fFlux; }
+    float GetThreshold( void ) { return m_fMean + m_fSensitivity * m_fDeviation + ONSET_FLOOR; }
+
+    // BPM, 0 until there have been a few onsets
+    float GetTempo( void ) { return m_fTempo; }
+    float GetBeatPeriod( void ) { return m_fTempo > 0.0f ? 60.0f / m_fTempo : 0.0f; }
+
+private:
+
+    void AddOnset( void );
+
+    float  m_fSensitivity;
+
+    float  m_pPrev[SPECTRUM_MAX_BARS];       // Levels of the last call
+    int    m_iPrevBars;                      // 0 before the first call
+
+    float  m_fFlux;
+    float  m_fMean;                          // Exponential averages of the flux...
+    float  m_fDeviation;                     // ...and of its distance to the mean
+    bool   m_bAbove;                         // Flux over the threshold last call
+
+    double m_fTime;                          // Seconds of audio seen
+    double m_pOnsets[ONSET_HISTORY];         // Ring of the latest onset times
+    int    m_nOnsets;                        // Onsets seen
+
+    float  m_pTempo[ONSET_TEMPO_BINS];       // Weight of each BPM
+    float  m_fTempo;
+};
+
+#endif /* ONSET_H_INCLUDED */
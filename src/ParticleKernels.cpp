@@ -0,0 +1,1662 @@
+//-----------------------------------------------------------------------------
+//		         Name: ParticleKernels.cpp
+//		  Description: Vectorized inner loops working on the structure-of-
+//					   arrays particle store of CParticleSystem
+//-----------------------------------------------------------------------------
+
+#include "ParticleKernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAS_AVX2_KERNELS
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: integrateScalar()
+// Desc: Reference implementation, also used for the loop tails. Without
+//       bDrag the air resistence term is left out, which is what it adds
+//       up to when no particle has any.
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+static void integrateScalar( const ParticleStreams &s, int i, int dwEnd,
+                             float fCurrentTime, float dt )
+{
+  for( ; i < dwEnd; ++i )
+  {
+    const ParticleParams &p = s.m_pParamTable[s.m_pParam[i]];
+
+    s.m_pExpired[i] = (fCurrentTime - s.m_pInitTime[i]) >= p.m_fLifeCycle;
+
+    float vx = s.m_pVelX[i] + p.m_fGravX * dt;
+    float vy = s.m_pVelY[i] + p.m_fGravY * dt;
+    float vz = s.m_pVelZ[i] + p.m_fGravZ * dt;
+
+    if( bDrag )
+    {
+      float dtDrag = dt * p.m_fDrag;
+      vx += (p.m_fWindX - vx) * dtDrag;
+      vy += (p.m_fWindY - vy) * dtDrag;
+      vz += (p.m_fWindZ - vz) * dtDrag;
+    }
+
+    s.m_pPrevX[i] = s.m_pPosX[i];
+    s.m_pPrevY[i] = s.m_pPosY[i];
+    s.m_pPrevZ[i] = s.m_pPosZ[i];
+    s.m_pPosX[i] += vx * dt;
+    s.m_pPosY[i] += vy * dt;
+    s.m_pPosZ[i] += vz * dt;
+
+    s.m_pVelX[i] = vx;
+    s.m_pVelY[i] = vy;
+    s.m_pVelZ[i] = vz;
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: gatherParams()
+// Desc: Transposes the ParticleParams of particles i..i+3 into one vector
+//       per field: gravity, wind and then drag, life cycle and 1 / drag
+//-----------------------------------------------------------------------------
+struct ParamVectors
+{
+  __m128 gx, gy, gz;
+  __m128 wx, wy, wz;
+  __m128 drag, life, invDrag;
+};
+
+static inline void gatherParams( const unsigned short *pParam, const ParticleParams *pTable,
+                                 int i, ParamVectors *pOut )
+{
+  const float *p0 = &pTable[pParam[i    ]].m_fGravX;
+  const float *p1 = &pTable[pParam[i + 1]].m_fGravX;
+  const float *p2 = &pTable[pParam[i + 2]].m_fGravX;
+  const float *p3 = &pTable[pParam[i + 3]].m_fGravX;
+
+  __m128 r0 = _mm_load_ps( p0 );
+  __m128 r1 = _mm_load_ps( p1 );
+  __m128 r2 = _mm_load_ps( p2 );
+  __m128 r3 = _mm_load_ps( p3 );
+  _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+  pOut->gx = r0; pOut->gy = r1; pOut->gz = r2;
+
+  r0 = _mm_load_ps( p0 + 4 );
+  r1 = _mm_load_ps( p1 + 4 );
+  r2 = _mm_load_ps( p2 + 4 );
+  r3 = _mm_load_ps( p3 + 4 );
+  _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+  pOut->wx = r0; pOut->wy = r1; pOut->wz = r2;
+
+  r0 = _mm_load_ps( p0 + 8 );
+  r1 = _mm_load_ps( p1 + 8 );
+  r2 = _mm_load_ps( p2 + 8 );
+  r3 = _mm_load_ps( p3 + 8 );
+  _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+  pOut->drag = r0; pOut->life = r1; pOut->invDrag = r3;
+}
+
+//-----------------------------------------------------------------------------
+// Name: integrateSSE2()
+// Desc: Four particles per iteration
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+static int integrateSSE2( const ParticleStreams &s, int i, int dwEnd,
+                          float fCurrentTime, float dt )
+{
+  const __m128 vDt   = _mm_set1_ps( dt );
+  const __m128 vTime = _mm_set1_ps( fCurrentTime );
+
+  for( ; i + 4 <= dwEnd; i += 4 )
+  {
+    ParamVectors p;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &p );
+
+    __m128 age  = _mm_sub_ps( vTime, _mm_loadu_ps( s.m_pInitTime + i ) );
+    int    mask = _mm_movemask_ps( _mm_cmpge_ps( age, p.life ) );
+    s.m_pExpired[i    ] = (mask     ) & 1;
+    s.m_pExpired[i + 1] = (mask >> 1) & 1;
+    s.m_pExpired[i + 2] = (mask >> 2) & 1;
+    s.m_pExpired[i + 3] = (mask >> 3) & 1;
+
+    __m128 vx = _mm_add_ps( _mm_loadu_ps( s.m_pVelX + i ), _mm_mul_ps( p.gx, vDt ) );
+    __m128 vy = _mm_add_ps( _mm_loadu_ps( s.m_pVelY + i ), _mm_mul_ps( p.gy, vDt ) );
+    __m128 vz = _mm_add_ps( _mm_loadu_ps( s.m_pVelZ + i ), _mm_mul_ps( p.gz, vDt ) );
+
+    if( bDrag )
+    {
+      __m128 dtDrag = _mm_mul_ps( vDt, p.drag );
+      vx = _mm_add_ps( vx, _mm_mul_ps( _mm_sub_ps( p.wx, vx ), dtDrag ) );
+      vy = _mm_add_ps( vy, _mm_mul_ps( _mm_sub_ps( p.wy, vy ), dtDrag ) );
+      vz = _mm_add_ps( vz, _mm_mul_ps( _mm_sub_ps( p.wz, vz ), dtDrag ) );
+    }
+
+    __m128 px = _mm_loadu_ps( s.m_pPosX + i );
+    __m128 py = _mm_loadu_ps( s.m_pPosY + i );
+    __m128 pz = _mm_loadu_ps( s.m_pPosZ + i );
+    _mm_storeu_ps( s.m_pPrevX + i, px );
+    _mm_storeu_ps( s.m_pPrevY + i, py );
+    _mm_storeu_ps( s.m_pPrevZ + i, pz );
+    _mm_storeu_ps( s.m_pPosX + i, _mm_add_ps( px, _mm_mul_ps( vx, vDt ) ) );
+    _mm_storeu_ps( s.m_pPosY + i, _mm_add_ps( py, _mm_mul_ps( vy, vDt ) ) );
+    _mm_storeu_ps( s.m_pPosZ + i, _mm_add_ps( pz, _mm_mul_ps( vz, vDt ) ) );
+
+    _mm_storeu_ps( s.m_pVelX + i, vx );
+    _mm_storeu_ps( s.m_pVelY + i, vy );
+    _mm_storeu_ps( s.m_pVelZ + i, vz );
+  }
+
+  return i;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: integrateAVX2()
+// Desc: Eight particles per iteration. Compiled for AVX2 regardless of the
+//       global compiler flags and only called when the CPU supports it.
+//       No FMA on purpose, so that results match the other paths bit for bit.
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+__attribute__((target("avx2")))
+static int integrateAVX2( const ParticleStreams &s, int i, int dwEnd,
+                          float fCurrentTime, float dt )
+{
+  const __m256 vDt   = _mm256_set1_ps( dt );
+  const __m256 vTime = _mm256_set1_ps( fCurrentTime );
+
+  for( ; i + 8 <= dwEnd; i += 8 )
+  {
+    ParamVectors lo, hi;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &lo );
+    gatherParams( s.m_pParam, s.m_pParamTable, i + 4, &hi );
+
+#define PARAMS256( field ) _mm256_insertf128_ps( _mm256_castps128_ps256( lo.field ), hi.field, 1 )
+
+    __m256 age  = _mm256_sub_ps( vTime, _mm256_loadu_ps( s.m_pInitTime + i ) );
+    int    mask = _mm256_movemask_ps( _mm256_cmp_ps( age, PARAMS256( life ), _CMP_GE_OQ ) );
+    for( int n = 0; n < 8; ++n )
+      s.m_pExpired[i + n] = (mask >> n) & 1;
+
+    __m256 vx = _mm256_add_ps( _mm256_loadu_ps( s.m_pVelX + i ), _mm256_mul_ps( PARAMS256( gx ), vDt ) );
+    __m256 vy = _mm256_add_ps( _mm256_loadu_ps( s.m_pVelY + i ), _mm256_mul_ps( PARAMS256( gy ), vDt ) );
+    __m256 vz = _mm256_add_ps( _mm256_loadu_ps( s.m_pVelZ + i ), _mm256_mul_ps( PARAMS256( gz ), vDt ) );
+
+    if( bDrag )
+    {
+      __m256 dtDrag = _mm256_mul_ps( vDt, PARAMS256( drag ) );
+      vx = _mm256_add_ps( vx, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wx ), vx ), dtDrag ) );
+      vy = _mm256_add_ps( vy, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wy ), vy ), dtDrag ) );
+      vz = _mm256_add_ps( vz, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wz ), vz ), dtDrag ) );
+    }
+
+#undef PARAMS256
+
+    __m256 px = _mm256_loadu_ps( s.m_pPosX + i );
+    __m256 py = _mm256_loadu_ps( s.m_pPosY + i );
+    __m256 pz = _mm256_loadu_ps( s.m_pPosZ + i );
+    _mm256_storeu_ps( s.m_pPrevX + i, px );
+    _mm256_storeu_ps( s.m_pPrevY + i, py );
+    _mm256_storeu_ps( s.m_pPrevZ + i, pz );
+    _mm256_storeu_ps( s.m_pPosX + i, _mm256_add_ps( px, _mm256_mul_ps( vx, vDt ) ) );
+    _mm256_storeu_ps( s.m_pPosY + i, _mm256_add_ps( py, _mm256_mul_ps( vy, vDt ) ) );
+    _mm256_storeu_ps( s.m_pPosZ + i, _mm256_add_ps( pz, _mm256_mul_ps( vz, vDt ) ) );
+
+    _mm256_storeu_ps( s.m_pVelX + i, vx );
+    _mm256_storeu_ps( s.m_pVelY + i, vy );
+    _mm256_storeu_ps( s.m_pVelZ + i, vz );
+  }
+
+  return i;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: integrateCompactScalar()
+// Desc: Reference implementation of the compact store, also used for the
+//       loop tails
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+static void integrateCompactScalar( const CompactParticleStreams &s, int i, int dwEnd,
+                                    unsigned short nTick, float dt )
+{
+  const float fTickTime = 1.0f / COMPACT_TICKS_PER_SECOND;
+
+  for( ; i < dwEnd; ++i )
+  {
+    const ParticleParams &p = s.m_pParamTable[s.m_pParam[i]];
+
+    unsigned short nAge = (unsigned short)(nTick - s.m_pBirthTick[i]);
+    bool bExpired = (float)nAge * fTickTime >= p.m_fLifeCycle;
+
+    float vx = s.m_pVelX[i] * s.m_fFromFixed + p.m_fGravX * dt;
+    float vy = s.m_pVelY[i] * s.m_fFromFixed + p.m_fGravY * dt;
+    float vz = s.m_pVelZ[i] * s.m_fFromFixed + p.m_fGravZ * dt;
+
+    if( bDrag )
+    {
+      float dtDrag = dt * p.m_fDrag;
+      vx += (p.m_fWindX - vx) * dtDrag;
+      vy += (p.m_fWindY - vy) * dtDrag;
+      vz += (p.m_fWindZ - vz) * dtDrag;
+    }
+
+    s.m_pPrevX[i] = s.m_pPosX[i];
+    s.m_pPrevY[i] = s.m_pPosY[i];
+    s.m_pPrevZ[i] = s.m_pPosZ[i];
+    float px = s.m_pPosX[i] * s.m_fFromFixed + vx * dt;
+    float py = s.m_pPosY[i] * s.m_fFromFixed + vy * dt;
+    float pz = s.m_pPosZ[i] * s.m_fFromFixed + vz * dt;
+    s.m_pPosX[i] = ToFixed( px, s.m_fToFixed );
+    s.m_pPosY[i] = ToFixed( py, s.m_fToFixed );
+    s.m_pPosZ[i] = ToFixed( pz, s.m_fToFixed );
+
+    // Particles that left the extent would stick to its edge
+    s.m_pExpired[i] = bExpired || !InFixedRange( px, s.m_fToFixed ) ||
+                      !InFixedRange( py, s.m_fToFixed ) || !InFixedRange( pz, s.m_fToFixed );
+
+    s.m_pVelX[i] = ToFixed( vx, s.m_fToFixed );
+    s.m_pVelY[i] = ToFixed( vy, s.m_fToFixed );
+    s.m_pVelZ[i] = ToFixed( vz, s.m_fToFixed );
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: loadFixed(), storeFixed()
+// Desc: Four 16 bit fixed point values to and from floats, rounding and
+//       clamping like ToFixed()
+//-----------------------------------------------------------------------------
+static inline __m128 loadFixed( const short *p, __m128 vFromFixed )
+{
+  __m128i q = _mm_loadl_epi64( (const __m128i*)p );
+  q = _mm_srai_epi32( _mm_unpacklo_epi16( q, q ), 16 );
+  return _mm_mul_ps( _mm_cvtepi32_ps( q ), vFromFixed );
+}
+
+static inline void storeFixed( short *p, __m128 f, __m128 vToFixed )
+{
+  f = _mm_mul_ps( f, vToFixed );
+  f = _mm_min_ps( _mm_max_ps( f, _mm_set1_ps( -32767.0f ) ), _mm_set1_ps( 32767.0f ) );
+  __m128i q = _mm_cvtps_epi32( f );
+  _mm_storel_epi64( (__m128i*)p, _mm_packs_epi32( q, q ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: inFixedRange()
+// Desc: All ones in the lanes storeFixed() doesn't clamp, like InFixedRange()
+//-----------------------------------------------------------------------------
+static inline __m128 inFixedRange( __m128 f, __m128 vToFixed )
+{
+  f = _mm_mul_ps( f, vToFixed );
+  return _mm_and_ps( _mm_cmpge_ps( f, _mm_set1_ps( -32767.0f ) ), _mm_cmple_ps( f, _mm_set1_ps( 32767.0f ) ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: integrateCompactSSE2()
+// Desc: Four particles per iteration
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+static int integrateCompactSSE2( const CompactParticleStreams &s, int i, int dwEnd,
+                                 unsigned short nTick, float dt )
+{
+  const __m128  vDt       = _mm_set1_ps( dt );
+  const __m128  vTickTime = _mm_set1_ps( 1.0f / COMPACT_TICKS_PER_SECOND );
+  const __m128i vTick     = _mm_set1_epi16( (short)nTick );
+  const __m128  vToFixed  = _mm_set1_ps( s.m_fToFixed );
+  const __m128  vFromFixed = _mm_set1_ps( s.m_fFromFixed );
+
+  for( ; i + 4 <= dwEnd; i += 4 )
+  {
+    ParamVectors p;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &p );
+
+    // Ages wrap like the ticks, then widen without sign
+    __m128i nAge = _mm_sub_epi16( vTick, _mm_loadl_epi64( (const __m128i*)(s.m_pBirthTick + i) ) );
+    __m128  age  = _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( nAge, _mm_setzero_si128() ) ), vTickTime );
+    __m128  expired = _mm_cmpge_ps( age, p.life );
+
+    __m128 vx = _mm_add_ps( loadFixed( s.m_pVelX + i, vFromFixed ), _mm_mul_ps( p.gx, vDt ) );
+    __m128 vy = _mm_add_ps( loadFixed( s.m_pVelY + i, vFromFixed ), _mm_mul_ps( p.gy, vDt ) );
+    __m128 vz = _mm_add_ps( loadFixed( s.m_pVelZ + i, vFromFixed ), _mm_mul_ps( p.gz, vDt ) );
+
+    if( bDrag )
+    {
+      __m128 dtDrag = _mm_mul_ps( vDt, p.drag );
+      vx = _mm_add_ps( vx, _mm_mul_ps( _mm_sub_ps( p.wx, vx ), dtDrag ) );
+      vy = _mm_add_ps( vy, _mm_mul_ps( _mm_sub_ps( p.wy, vy ), dtDrag ) );
+      vz = _mm_add_ps( vz, _mm_mul_ps( _mm_sub_ps( p.wz, vz ), dtDrag ) );
+    }
+
+    __m128 px = loadFixed( s.m_pPosX + i, vFromFixed );
+    __m128 py = loadFixed( s.m_pPosY + i, vFromFixed );
+    __m128 pz = loadFixed( s.m_pPosZ + i, vFromFixed );
+
+    _mm_storel_epi64( (__m128i*)(s.m_pPrevX + i), _mm_loadl_epi64( (const __m128i*)(s.m_pPosX + i) ) );
+    _mm_storel_epi64( (__m128i*)(s.m_pPrevY + i), _mm_loadl_epi64( (const __m128i*)(s.m_pPosY + i) ) );
+    _mm_storel_epi64( (__m128i*)(s.m_pPrevZ + i), _mm_loadl_epi64( (const __m128i*)(s.m_pPosZ + i) ) );
+
+    px = _mm_add_ps( px, _mm_mul_ps( vx, vDt ) );
+    py = _mm_add_ps( py, _mm_mul_ps( vy, vDt ) );
+    pz = _mm_add_ps( pz, _mm_mul_ps( vz, vDt ) );
+    storeFixed( s.m_pPosX + i, px, vToFixed );
+    storeFixed( s.m_pPosY + i, py, vToFixed );
+    storeFixed( s.m_pPosZ + i, pz, vToFixed );
+
+    // Particles that left the extent would stick to its edge
+    __m128 inside = _mm_and_ps( _mm_and_ps( inFixedRange( px, vToFixed ), inFixedRange( py, vToFixed ) ),
+                                inFixedRange( pz, vToFixed ) );
+    int    mask   = _mm_movemask_ps( _mm_or_ps( expired, _mm_andnot_ps( inside, _mm_castsi128_ps( _mm_set1_epi32( -1 ) ) ) ) );
+    s.m_pExpired[i    ] = (mask     ) & 1;
+    s.m_pExpired[i + 1] = (mask >> 1) & 1;
+    s.m_pExpired[i + 2] = (mask >> 2) & 1;
+    s.m_pExpired[i + 3] = (mask >> 3) & 1;
+
+    storeFixed( s.m_pVelX + i, vx, vToFixed );
+    storeFixed( s.m_pVelY + i, vy, vToFixed );
+    storeFixed( s.m_pVelZ + i, vz, vToFixed );
+  }
+
+  return i;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: loadFixedAVX2(), storeFixedAVX2(), inFixedRangeAVX2()
+// Desc: Eight 16 bit fixed point values to and from floats, and which of
+//       them storeFixedAVX2() doesn't clamp
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline __m256 loadFixedAVX2( const short *p, __m256 vFromFixed )
+{
+  __m256i q = _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i*)p ) );
+  return _mm256_mul_ps( _mm256_cvtepi32_ps( q ), vFromFixed );
+}
+
+__attribute__((target("avx2")))
+static inline void storeFixedAVX2( short *p, __m256 f, __m256 vToFixed )
+{
+  f = _mm256_mul_ps( f, vToFixed );
+  f = _mm256_min_ps( _mm256_max_ps( f, _mm256_set1_ps( -32767.0f ) ), _mm256_set1_ps( 32767.0f ) );
+  __m256i q = _mm256_cvtps_epi32( f );
+  _mm_storeu_si128( (__m128i*)p, _mm_packs_epi32( _mm256_castsi256_si128( q ),
+                                                  _mm256_extracti128_si256( q, 1 ) ) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256 inFixedRangeAVX2( __m256 f, __m256 vToFixed )
+{
+  f = _mm256_mul_ps( f, vToFixed );
+  return _mm256_and_ps( _mm256_cmp_ps( f, _mm256_set1_ps( -32767.0f ), _CMP_GE_OQ ),
+                        _mm256_cmp_ps( f, _mm256_set1_ps( 32767.0f ), _CMP_LE_OQ ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: integrateCompactAVX2()
+// Desc: Eight particles per iteration
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+__attribute__((target("avx2")))
+static int integrateCompactAVX2( const CompactParticleStreams &s, int i, int dwEnd,
+                                 unsigned short nTick, float dt )
+{
+  const __m256  vDt        = _mm256_set1_ps( dt );
+  const __m256  vTickTime  = _mm256_set1_ps( 1.0f / COMPACT_TICKS_PER_SECOND );
+  const __m128i vTick      = _mm_set1_epi16( (short)nTick );
+  const __m256  vToFixed   = _mm256_set1_ps( s.m_fToFixed );
+  const __m256  vFromFixed = _mm256_set1_ps( s.m_fFromFixed );
+
+  for( ; i + 8 <= dwEnd; i += 8 )
+  {
+    ParamVectors lo, hi;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &lo );
+    gatherParams( s.m_pParam, s.m_pParamTable, i + 4, &hi );
+
+#define PARAMS256( field ) _mm256_insertf128_ps( _mm256_castps128_ps256( lo.field ), hi.field, 1 )
+
+    __m128i nAge = _mm_sub_epi16( vTick, _mm_loadu_si128( (const __m128i*)(s.m_pBirthTick + i) ) );
+    __m256  age  = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( nAge ) ), vTickTime );
+    __m256  expired = _mm256_cmp_ps( age, PARAMS256( life ), _CMP_GE_OQ );
+
+    __m256 vx = _mm256_add_ps( loadFixedAVX2( s.m_pVelX + i, vFromFixed ), _mm256_mul_ps( PARAMS256( gx ), vDt ) );
+    __m256 vy = _mm256_add_ps( loadFixedAVX2( s.m_pVelY + i, vFromFixed ), _mm256_mul_ps( PARAMS256( gy ), vDt ) );
+    __m256 vz = _mm256_add_ps( loadFixedAVX2( s.m_pVelZ + i, vFromFixed ), _mm256_mul_ps( PARAMS256( gz ), vDt ) );
+
+    if( bDrag )
+    {
+      __m256 dtDrag = _mm256_mul_ps( vDt, PARAMS256( drag ) );
+      vx = _mm256_add_ps( vx, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wx ), vx ), dtDrag ) );
+      vy = _mm256_add_ps( vy, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wy ), vy ), dtDrag ) );
+      vz = _mm256_add_ps( vz, _mm256_mul_ps( _mm256_sub_ps( PARAMS256( wz ), vz ), dtDrag ) );
+    }
+
+#undef PARAMS256
+
+    __m256 px = loadFixedAVX2( s.m_pPosX + i, vFromFixed );
+    __m256 py = loadFixedAVX2( s.m_pPosY + i, vFromFixed );
+    __m256 pz = loadFixedAVX2( s.m_pPosZ + i, vFromFixed );
+
+    _mm_storeu_si128( (__m128i*)(s.m_pPrevX + i), _mm_loadu_si128( (const __m128i*)(s.m_pPosX + i) ) );
+    _mm_storeu_si128( (__m128i*)(s.m_pPrevY + i), _mm_loadu_si128( (const __m128i*)(s.m_pPosY + i) ) );
+    _mm_storeu_si128( (__m128i*)(s.m_pPrevZ + i), _mm_loadu_si128( (const __m128i*)(s.m_pPosZ + i) ) );
+
+    px = _mm256_add_ps( px, _mm256_mul_ps( vx, vDt ) );
+    py = _mm256_add_ps( py, _mm256_mul_ps( vy, vDt ) );
+    pz = _mm256_add_ps( pz, _mm256_mul_ps( vz, vDt ) );
+    storeFixedAVX2( s.m_pPosX + i, px, vToFixed );
+    storeFixedAVX2( s.m_pPosY + i, py, vToFixed );
+    storeFixedAVX2( s.m_pPosZ + i, pz, vToFixed );
+
+    __m256 inside = _mm256_and_ps( _mm256_and_ps( inFixedRangeAVX2( px, vToFixed ), inFixedRangeAVX2( py, vToFixed ) ),
+                                   inFixedRangeAVX2( pz, vToFixed ) );
+    int    mask   = _mm256_movemask_ps( _mm256_or_ps( expired, _mm256_andnot_ps( inside, _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) ) ) ) );
+    for( int n = 0; n < 8; ++n )
+      s.m_pExpired[i + n] = (mask >> n) & 1;
+
+    storeFixedAVX2( s.m_pVelX + i, vx, vToFixed );
+    storeFixedAVX2( s.m_pVelY + i, vy, vToFixed );
+    storeFixedAVX2( s.m_pVelZ + i, vz, vToFixed );
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: expireScalar()
+// Desc: Reference implementation, also used for the loop tails
+//-----------------------------------------------------------------------------
+static void expireScalar( const ParticleStreams &s, int i, int dwEnd, float fCurrentTime )
+{
+  for( ; i < dwEnd; ++i )
+    s.m_pExpired[i] = (fCurrentTime - s.m_pInitTime[i]) >= s.m_pParamTable[s.m_pParam[i]].m_fLifeCycle;
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: expireSSE2()
+// Desc: Four particles per iteration
+//-----------------------------------------------------------------------------
+static int expireSSE2( const ParticleStreams &s, int i, int dwEnd, float fCurrentTime )
+{
+  const __m128 vTime = _mm_set1_ps( fCurrentTime );
+
+  for( ; i + 4 <= dwEnd; i += 4 )
+  {
+    __m128 life = _mm_setr_ps( s.m_pParamTable[s.m_pParam[i    ]].m_fLifeCycle,
+                               s.m_pParamTable[s.m_pParam[i + 1]].m_fLifeCycle,
+                               s.m_pParamTable[s.m_pParam[i + 2]].m_fLifeCycle,
+                               s.m_pParamTable[s.m_pParam[i + 3]].m_fLifeCycle );
+    __m128 age  = _mm_sub_ps( vTime, _mm_loadu_ps( s.m_pInitTime + i ) );
+    int    mask = _mm_movemask_ps( _mm_cmpge_ps( age, life ) );
+    s.m_pExpired[i    ] = (mask     ) & 1;
+    s.m_pExpired[i + 1] = (mask >> 1) & 1;
+    s.m_pExpired[i + 2] = (mask >> 2) & 1;
+    s.m_pExpired[i + 3] = (mask >> 3) & 1;
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// exp(-x) for x >= 0 as 2^n * 2^f, with n the nearest integer to -x / ln 2 and
+// 2^f, |f| <= 1/2, from its Taylor series. Good to a few ulp and, unlike
+// expf(), the same in every path below. The polynomial is split in pairs
+// of terms rather than nested, for a shorter chain of dependent operations:
+//
+//   2^f = (1 + c1 f) + (c2 + c3 f) f^2 + ((c4 + c5 f) + c6 f^2) f^4
+//-----------------------------------------------------------------------------
+static const float EXP_LOG2E = 1.44269504f;
+static const float EXP_MIN   = -126.0f;      // Smallest normal power of two
+static const float EXP_C1    = 0.693147181f; // ln2^n / n!
+static const float EXP_C2    = 0.240226507f;
+static const float EXP_C3    = 0.0555041087f;
+static const float EXP_C4    = 0.00961812911f;
+static const float EXP_C5    = 0.00133335581f;
+static const float EXP_C6    = 0.000154035304f;
+
+//-----------------------------------------------------------------------------
+// Name: expNegScalar()
+// Desc: exp(-x) for x >= 0
+//-----------------------------------------------------------------------------
+static inline float expNegScalar( float x )
+{
+  float t = x * -EXP_LOG2E;
+  t = t > EXP_MIN ? t : EXP_MIN;
+#if defined(__SSE2__)
+  int n = _mm_cvtss_si32( _mm_set_ss( t ) );
+#else
+  int n = (int)__builtin_lrintf( t );
+#endif
+  float f   = t - (float)n;
+  float ff  = f * f;
+  float ff2 = ff * ff;
+
+  float p = ((1.0f + EXP_C1 * f) + (EXP_C2 + EXP_C3 * f) * ff) +
+            ((EXP_C4 + EXP_C5 * f) + EXP_C6 * ff) * ff2;
+
+  union { int i; float f; } scale;
+  scale.i = (n + 127) << 23;
+  return p * scale.f;
+}
+
+//-----------------------------------------------------------------------------
+// Name: evaluateScalar()
+// Desc: Reference implementation, also used for the loop tails
+//-----------------------------------------------------------------------------
+static void evaluateScalar( const ParticleStreams &s, int i, int dwEnd, float fTime,
+                            float *pX, float *pY, float *pZ )
+{
+  for( ; i < dwEnd; ++i )
+  {
+    const ParticleParams &p = s.m_pParamTable[s.m_pParam[i]];
+
+    float age = fTime - s.m_pInitTime[i];
+    age = age > 0.0f ? age : 0.0f;
+
+    float e, f1, f2;
+    AnalyticFactors( p, age, &e, &f1, &f2 );
+
+    pX[i] = (s.m_pPosX[i] + s.m_pVelX[i] * f1) + (p.m_fGravX + p.m_fDrag * p.m_fWindX) * f2;
+    pY[i] = (s.m_pPosY[i] + s.m_pVelY[i] * f1) + (p.m_fGravY + p.m_fDrag * p.m_fWindY) * f2;
+    pZ[i] = (s.m_pPosZ[i] + s.m_pVelZ[i] * f1) + (p.m_fGravZ + p.m_fDrag * p.m_fWindZ) * f2;
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: factorsSSE2()
+// Desc: f1 and f2 of AnalyticFactors() for four particles
+//-----------------------------------------------------------------------------
+static inline void factorsSSE2( __m128 k, __m128 invK, __m128 a, __m128 *pF1, __m128 *pF2 )
+{
+  const __m128 vOne = _mm_set1_ps( 1.0f );
+
+  __m128  t = _mm_max_ps( _mm_mul_ps( _mm_mul_ps( k, a ), _mm_set1_ps( -EXP_LOG2E ) ), _mm_set1_ps( EXP_MIN ) );
+  __m128i n = _mm_cvtps_epi32( t );
+  __m128  f = _mm_sub_ps( t, _mm_cvtepi32_ps( n ) );
+  __m128  ff  = _mm_mul_ps( f, f );
+  __m128  ff2 = _mm_mul_ps( ff, ff );
+
+  __m128 p01 = _mm_add_ps( vOne, _mm_mul_ps( _mm_set1_ps( EXP_C1 ), f ) );
+  __m128 p23 = _mm_add_ps( _mm_set1_ps( EXP_C2 ), _mm_mul_ps( _mm_set1_ps( EXP_C3 ), f ) );
+  __m128 p45 = _mm_add_ps( _mm_set1_ps( EXP_C4 ), _mm_mul_ps( _mm_set1_ps( EXP_C5 ), f ) );
+  __m128 p   = _mm_add_ps( _mm_add_ps( p01, _mm_mul_ps( p23, ff ) ),
+                           _mm_mul_ps( _mm_add_ps( p45, _mm_mul_ps( _mm_set1_ps( EXP_C6 ), ff ) ), ff2 ) );
+  __m128 e = _mm_mul_ps( p, _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( n, _mm_set1_epi32( 127 ) ), 23 ) ) );
+
+  __m128 drag = _mm_cmpgt_ps( k, _mm_setzero_ps() );
+  __m128 f1   = _mm_mul_ps( _mm_sub_ps( vOne, e ), invK );
+  __m128 f2   = _mm_mul_ps( _mm_sub_ps( a, f1 ), invK );
+  __m128 g2   = _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 0.5f ), a ), a );
+  *pF1 = _mm_or_ps( _mm_and_ps( drag, f1 ), _mm_andnot_ps( drag, a ) );
+  *pF2 = _mm_or_ps( _mm_and_ps( drag, f2 ), _mm_andnot_ps( drag, g2 ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: evaluateSSE2()
+// Desc: Four particles per iteration
+//-----------------------------------------------------------------------------
+static int evaluateSSE2( const ParticleStreams &s, int i, int dwEnd, float fTime,
+                         float *pX, float *pY, float *pZ )
+{
+  const __m128 vTime = _mm_set1_ps( fTime );
+
+  for( ; i + 4 <= dwEnd; i += 4 )
+  {
+    ParamVectors p;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &p );
+
+    __m128 age = _mm_max_ps( _mm_sub_ps( vTime, _mm_loadu_ps( s.m_pInitTime + i ) ), _mm_setzero_ps() );
+    __m128 f1, f2;
+    factorsSSE2( p.drag, p.invDrag, age, &f1, &f2 );
+
+    __m128 ax = _mm_add_ps( p.gx, _mm_mul_ps( p.drag, p.wx ) );
+    __m128 ay = _mm_add_ps( p.gy, _mm_mul_ps( p.drag, p.wy ) );
+    __m128 az = _mm_add_ps( p.gz, _mm_mul_ps( p.drag, p.wz ) );
+
+    _mm_storeu_ps( pX + i, _mm_add_ps( _mm_add_ps( _mm_loadu_ps( s.m_pPosX + i ),
+                                                   _mm_mul_ps( _mm_loadu_ps( s.m_pVelX + i ), f1 ) ),
+                                       _mm_mul_ps( ax, f2 ) ) );
+    _mm_storeu_ps( pY + i, _mm_add_ps( _mm_add_ps( _mm_loadu_ps( s.m_pPosY + i ),
+                                                   _mm_mul_ps( _mm_loadu_ps( s.m_pVelY + i ), f1 ) ),
+                                       _mm_mul_ps( ay, f2 ) ) );
+    _mm_storeu_ps( pZ + i, _mm_add_ps( _mm_add_ps( _mm_loadu_ps( s.m_pPosZ + i ),
+                                                   _mm_mul_ps( _mm_loadu_ps( s.m_pVelZ + i ), f1 ) ),
+                                       _mm_mul_ps( az, f2 ) ) );
+  }
+
+  return i;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: factorsAVX2()
+// Desc: f1 and f2 of AnalyticFactors() for eight particles
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline void factorsAVX2( __m256 k, __m256 invK, __m256 a, __m256 *pF1, __m256 *pF2 )
+{
+  const __m256 vOne = _mm256_set1_ps( 1.0f );
+
+  __m256  t = _mm256_max_ps( _mm256_mul_ps( _mm256_mul_ps( k, a ), _mm256_set1_ps( -EXP_LOG2E ) ),
+                             _mm256_set1_ps( EXP_MIN ) );
+  __m256i n = _mm256_cvtps_epi32( t );
+  __m256  f = _mm256_sub_ps( t, _mm256_cvtepi32_ps( n ) );
+  __m256  ff  = _mm256_mul_ps( f, f );
+  __m256  ff2 = _mm256_mul_ps( ff, ff );
+
+  __m256 p01 = _mm256_add_ps( vOne, _mm256_mul_ps( _mm256_set1_ps( EXP_C1 ), f ) );
+  __m256 p23 = _mm256_add_ps( _mm256_set1_ps( EXP_C2 ), _mm256_mul_ps( _mm256_set1_ps( EXP_C3 ), f ) );
+  __m256 p45 = _mm256_add_ps( _mm256_set1_ps( EXP_C4 ), _mm256_mul_ps( _mm256_set1_ps( EXP_C5 ), f ) );
+  __m256 p   = _mm256_add_ps( _mm256_add_ps( p01, _mm256_mul_ps( p23, ff ) ),
+                              _mm256_mul_ps( _mm256_add_ps( p45, _mm256_mul_ps( _mm256_set1_ps( EXP_C6 ), ff ) ), ff2 ) );
+  __m256 e = _mm256_mul_ps( p, _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_add_epi32( n, _mm256_set1_epi32( 127 ) ), 23 ) ) );
+
+  __m256 drag = _mm256_cmp_ps( k, _mm256_setzero_ps(), _CMP_GT_OQ );
+  __m256 f1   = _mm256_mul_ps( _mm256_sub_ps( vOne, e ), invK );
+  __m256 f2   = _mm256_mul_ps( _mm256_sub_ps( a, f1 ), invK );
+  __m256 g2   = _mm256_mul_ps( _mm256_mul_ps( _mm256_set1_ps( 0.5f ), a ), a );
+  *pF1 = _mm256_blendv_ps( a, f1, drag );
+  *pF2 = _mm256_blendv_ps( g2, f2, drag );
+}
+
+//-----------------------------------------------------------------------------
+// Name: evaluateAVX2()
+// Desc: Eight particles per iteration
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static int evaluateAVX2( const ParticleStreams &s, int i, int dwEnd, float fTime,
+                         float *pX, float *pY, float *pZ )
+{
+  const __m256 vTime = _mm256_set1_ps( fTime );
+
+  for( ; i + 8 <= dwEnd; i += 8 )
+  {
+    ParamVectors lo, hi;
+    gatherParams( s.m_pParam, s.m_pParamTable, i, &lo );
+    gatherParams( s.m_pParam, s.m_pParamTable, i + 4, &hi );
+
+#define PARAMS256( field ) _mm256_insertf128_ps( _mm256_castps128_ps256( lo.field ), hi.field, 1 )
+
+    __m256 drag = PARAMS256( drag );
+    __m256 age  = _mm256_max_ps( _mm256_sub_ps( vTime, _mm256_loadu_ps( s.m_pInitTime + i ) ), _mm256_setzero_ps() );
+    __m256 f1, f2;
+    factorsAVX2( drag, PARAMS256( invDrag ), age, &f1, &f2 );
+
+    __m256 ax = _mm256_add_ps( PARAMS256( gx ), _mm256_mul_ps( drag, PARAMS256( wx ) ) );
+    __m256 ay = _mm256_add_ps( PARAMS256( gy ), _mm256_mul_ps( drag, PARAMS256( wy ) ) );
+    __m256 az = _mm256_add_ps( PARAMS256( gz ), _mm256_mul_ps( drag, PARAMS256( wz ) ) );
+
+#undef PARAMS256
+
+    _mm256_storeu_ps( pX + i, _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( s.m_pPosX + i ),
+                                                            _mm256_mul_ps( _mm256_loadu_ps( s.m_pVelX + i ), f1 ) ),
+                                             _mm256_mul_ps( ax, f2 ) ) );
+    _mm256_storeu_ps( pY + i, _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( s.m_pPosY + i ),
+                                                            _mm256_mul_ps( _mm256_loadu_ps( s.m_pVelY + i ), f1 ) ),
+                                             _mm256_mul_ps( ay, f2 ) ) );
+    _mm256_storeu_ps( pZ + i, _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( s.m_pPosZ + i ),
+                                                            _mm256_mul_ps( _mm256_loadu_ps( s.m_pVelZ + i ), f1 ) ),
+                                             _mm256_mul_ps( az, f2 ) ) );
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: fromFixed(), toFixed()
+// Desc: Scale of the fixed point a store keeps, which the float store
+//       doesn't need
+//-----------------------------------------------------------------------------
+static inline float fromFixed( const ParticleStreams & ) { return 1.0f; }
+static inline float fromFixed( const CompactParticleStreams &s ) { return s.m_fFromFixed; }
+static inline float toFixed( const ParticleStreams & ) { return 1.0f; }
+static inline float toFixed( const CompactParticleStreams &s ) { return s.m_fToFixed; }
+
+//-----------------------------------------------------------------------------
+// Name: loadScalar(), storeScalar()
+// Desc: One attribute of a particle of either store as a float, and back
+//-----------------------------------------------------------------------------
+static inline float loadScalar( const float *p, float ) { return *p; }
+static inline float loadScalar( const short *p, float fFromFixed ) { return *p * fFromFixed; }
+static inline void storeScalar( float *p, float f, float ) { *p = f; }
+static inline void storeScalar( short *p, float f, float fToFixed ) { *p = ToFixed( f, fToFixed ); }
+
+//-----------------------------------------------------------------------------
+// Name: recycleParticle()
+// Desc: Ages particle i by its life cycle, so it expires with the next step
+//-----------------------------------------------------------------------------
+static inline void recycleParticle( const ParticleStreams &s, int i, unsigned short )
+{
+  s.m_pInitTime[i] -= s.m_pParamTable[s.m_pParam[i]].m_fLifeCycle;
+}
+
+static inline void recycleParticle( const CompactParticleStreams &s, int i, unsigned short nTick )
+{
+  float fLifeCycle = s.m_pParamTable[s.m_pParam[i]].m_fLifeCycle;
+  s.m_pBirthTick[i] = (unsigned short)(nTick - (unsigned short)(fLifeCycle * COMPACT_TICKS_PER_SECOND + 1.0f));
+}
+
+//-----------------------------------------------------------------------------
+// Name: collideScalar()
+// Desc: Reference implementation, also used for the loop tails
+//-----------------------------------------------------------------------------
+template <int nResult, class Streams>
+static void collideScalar( const Streams &s, int i, int dwEnd,
+                           const CollisionPlanes &planes, unsigned short nTick )
+{
+  const float fFromFixed = fromFixed( s );
+  const float fToFixed   = toFixed( s );
+
+  for( ; i < dwEnd; ++i )
+  {
+    if( s.m_pExpired[i] )
+      continue;
+
+    float px = loadScalar( s.m_pPosX + i, fFromFixed );
+    float py = loadScalar( s.m_pPosY + i, fFromFixed );
+    float pz = loadScalar( s.m_pPosZ + i, fFromFixed );
+    float vx = 0.0f, vy = 0.0f, vz = 0.0f;
+    float ox = 0.0f, oy = 0.0f, oz = 0.0f;
+    bool bMoved = false;
+
+    for( int n = planes.m_nPlanes - 1; n >= 0; --n )
+    {
+      float d = (planes.m_pPointX[n] - px) * planes.m_pNormalX[n] +
+                (planes.m_pPointY[n] - py) * planes.m_pNormalY[n] +
+                (planes.m_pPointZ[n] - pz) * planes.m_pNormalZ[n];
+      if( !(d > 0.001f) )
+        continue;
+
+      int nPlaneResult = nResult == CR_MIXED ? planes.m_pCollisionResult[n] : nResult;
+      if( nPlaneResult == CR_RECYCLE )
+      {
+        recycleParticle( s, i, nTick );
+        continue;
+      }
+      if( nPlaneResult != CR_BOUNCE && nPlaneResult != CR_STICK )
+        continue;
+
+      if( !bMoved )
+      {
+        vx = loadScalar( s.m_pVelX + i, fFromFixed );
+        vy = loadScalar( s.m_pVelY + i, fFromFixed );
+        vz = loadScalar( s.m_pVelZ + i, fFromFixed );
+        ox = loadScalar( s.m_pPrevX + i, fFromFixed );
+        oy = loadScalar( s.m_pPrevY + i, fFromFixed );
+        oz = loadScalar( s.m_pPrevZ + i, fFromFixed );
+        bMoved = true;
+      }
+
+      px = ox;
+      py = oy;
+      pz = oz;
+
+      if( nPlaneResult == CR_BOUNCE )
+      {
+        float nx = planes.m_pNormalX[n], ny = planes.m_pNormalY[n], nz = planes.m_pNormalZ[n];
+        float kr = planes.m_pBounceFactor[n];
+        float dot = nx * vx + ny * vy + nz * vz;
+        float vnx = dot * nx, vny = dot * ny, vnz = dot * nz;
+        vx = (vx - vnx) - kr * vnx;
+        vy = (vy - vny) - kr * vny;
+        vz = (vz - vnz) - kr * vnz;
+      }
+      else
+      {
+        vx = vy = vz = 0.0f;
+      }
+    }
+
+    if( bMoved )
+    {
+      storeScalar( s.m_pPosX + i, px, fToFixed );
+      storeScalar( s.m_pPosY + i, py, fToFixed );
+      storeScalar( s.m_pPosZ + i, pz, fToFixed );
+      storeScalar( s.m_pVelX + i, vx, fToFixed );
+      storeScalar( s.m_pVelY + i, vy, fToFixed );
+      storeScalar( s.m_pVelZ + i, vz, fToFixed );
+    }
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: loadSSE2(), storeSSE2()
+// Desc: Four particles' worth of one attribute of either store
+//-----------------------------------------------------------------------------
+static inline __m128 loadSSE2( const float *p, __m128 ) { return _mm_loadu_ps( p ); }
+static inline __m128 loadSSE2( const short *p, __m128 vFromFixed ) { return loadFixed( p, vFromFixed ); }
+static inline void storeSSE2( float *p, __m128 f, __m128 ) { _mm_storeu_ps( p, f ); }
+static inline void storeSSE2( short *p, __m128 f, __m128 vToFixed ) { storeFixed( p, f, vToFixed ); }
+
+static inline __m128 selectSSE2( __m128 mask, __m128 a, __m128 b )
+{
+  return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: liveSSE2()
+// Desc: All ones in the lanes of the particles that haven't expired
+//-----------------------------------------------------------------------------
+static inline __m128 liveSSE2( const unsigned char *pExpired )
+{
+  int nExpired;
+  memcpy( &nExpired, pExpired, sizeof(nExpired) );
+
+  const __m128i zero = _mm_setzero_si128();
+  __m128i e = _mm_unpacklo_epi8( _mm_cvtsi32_si128( nExpired ), zero );
+  e = _mm_unpacklo_epi16( e, zero );
+  return _mm_castsi128_ps( _mm_cmpeq_epi32( e, zero ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: loadPlaneSSE2()
+// Desc: Plane n of planes in every lane
+//-----------------------------------------------------------------------------
+struct PlaneVectors
+{
+  __m128 nx, ny, nz;
+  __m128 px, py, pz;
+  __m128 kr;
+};
+
+static inline void loadPlaneSSE2( const CollisionPlanes &planes, int n, PlaneVectors *pOut )
+{
+  pOut->nx = _mm_set1_ps( planes.m_pNormalX[n] );
+  pOut->ny = _mm_set1_ps( planes.m_pNormalY[n] );
+  pOut->nz = _mm_set1_ps( planes.m_pNormalZ[n] );
+  pOut->px = _mm_set1_ps( planes.m_pPointX[n] );
+  pOut->py = _mm_set1_ps( planes.m_pPointY[n] );
+  pOut->pz = _mm_set1_ps( planes.m_pPointZ[n] );
+  pOut->kr = _mm_set1_ps( planes.m_pBounceFactor[n] );
+}
+
+//-----------------------------------------------------------------------------
+// Name: collideSSE2()
+// Desc: Four particles per iteration, against one plane at a time. Only
+//       batches that hit a plane load their velocities and store anything.
+//-----------------------------------------------------------------------------
+template <bool bSinglePlane, int nResult, class Streams>
+static int collideSSE2( const Streams &s, int i, int dwEnd,
+                        const CollisionPlanes &planes, unsigned short nTick )
+{
+  const __m128 vFromFixed = _mm_set1_ps( fromFixed( s ) );
+  const __m128 vToFixed   = _mm_set1_ps( toFixed( s ) );
+  const __m128 vEpsilon   = _mm_set1_ps( 0.001f );
+
+  PlaneVectors single;
+  if( bSinglePlane )
+    loadPlaneSSE2( planes, 0, &single );
+
+  for( ; i + 4 <= dwEnd; i += 4 )
+  {
+    __m128 live = liveSSE2( s.m_pExpired + i );
+    if( _mm_movemask_ps( live ) == 0 )
+      continue;
+
+    __m128 px = loadSSE2( s.m_pPosX + i, vFromFixed );
+    __m128 py = loadSSE2( s.m_pPosY + i, vFromFixed );
+    __m128 pz = loadSSE2( s.m_pPosZ + i, vFromFixed );
+    __m128 vx = _mm_setzero_ps(), vy = _mm_setzero_ps(), vz = _mm_setzero_ps();
+    __m128 ox = _mm_setzero_ps(), oy = _mm_setzero_ps(), oz = _mm_setzero_ps();
+    bool bMoved = false;
+
+    for( int n = bSinglePlane ? 0 : planes.m_nPlanes - 1; n >= 0; --n )
+    {
+      PlaneVectors plane;
+      if( bSinglePlane )
+        plane = single;
+      else
+        loadPlaneSSE2( planes, n, &plane );
+
+      __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_sub_ps( plane.px, px ), plane.nx ),
+                                         _mm_mul_ps( _mm_sub_ps( plane.py, py ), plane.ny ) ),
+                             _mm_mul_ps( _mm_sub_ps( plane.pz, pz ), plane.nz ) );
+      __m128 hit  = _mm_and_ps( _mm_cmpgt_ps( d, vEpsilon ), live );
+      int    mask = _mm_movemask_ps( hit );
+      if( mask == 0 )
+        continue;
+
+      int nPlaneResult = nResult == CR_MIXED ? planes.m_pCollisionResult[n] : nResult;
+      if( nPlaneResult == CR_RECYCLE )
+      {
+        for( int k = 0; k < 4; ++k )
+        {
+          if( mask & (1 << k) )
+            recycleParticle( s, i + k, nTick );
+        }
+        continue;
+      }
+      if( nPlaneResult != CR_BOUNCE && nPlaneResult != CR_STICK )
+        continue;
+
+      if( !bMoved )
+      {
+        vx = loadSSE2( s.m_pVelX + i, vFromFixed );
+        vy = loadSSE2( s.m_pVelY + i, vFromFixed );
+        vz = loadSSE2( s.m_pVelZ + i, vFromFixed );
+        ox = loadSSE2( s.m_pPrevX + i, vFromFixed );
+        oy = loadSSE2( s.m_pPrevY + i, vFromFixed );
+        oz = loadSSE2( s.m_pPrevZ + i, vFromFixed );
+        bMoved = true;
+      }
+
+      px = selectSSE2( hit, ox, px );
+      py = selectSSE2( hit, oy, py );
+      pz = selectSSE2( hit, oz, pz );
+
+      if( nPlaneResult == CR_BOUNCE )
+      {
+        __m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( plane.nx, vx ), _mm_mul_ps( plane.ny, vy ) ),
+                                 _mm_mul_ps( plane.nz, vz ) );
+        __m128 vnx = _mm_mul_ps( dot, plane.nx );
+        __m128 vny = _mm_mul_ps( dot, plane.ny );
+        __m128 vnz = _mm_mul_ps( dot, plane.nz );
+        vx = selectSSE2( hit, _mm_sub_ps( _mm_sub_ps( vx, vnx ), _mm_mul_ps( plane.kr, vnx ) ), vx );
+        vy = selectSSE2( hit, _mm_sub_ps( _mm_sub_ps( vy, vny ), _mm_mul_ps( plane.kr, vny ) ), vy );
+        vz = selectSSE2( hit, _mm_sub_ps( _mm_sub_ps( vz, vnz ), _mm_mul_ps( plane.kr, vnz ) ), vz );
+      }
+      else
+      {
+        vx = _mm_andnot_ps( hit, vx );
+        vy = _mm_andnot_ps( hit, vy );
+        vz = _mm_andnot_ps( hit, vz );
+      }
+    }
+
+    // Lanes that didn't move store what they loaded, which the fixed point
+    // of the compact store converts back to the same steps
+    if( bMoved )
+    {
+      storeSSE2( s.m_pPosX + i, px, vToFixed );
+      storeSSE2( s.m_pPosY + i, py, vToFixed );
+      storeSSE2( s.m_pPosZ + i, pz, vToFixed );
+      storeSSE2( s.m_pVelX + i, vx, vToFixed );
+      storeSSE2( s.m_pVelY + i, vy, vToFixed );
+      storeSSE2( s.m_pVelZ + i, vz, vToFixed );
+    }
+  }
+
+  return i;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: loadAVX2(), storeAVX2()
+// Desc: Eight particles' worth of one attribute of either store
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline __m256 loadAVX2( const float *p, __m256 ) { return _mm256_loadu_ps( p ); }
+__attribute__((target("avx2")))
+static inline __m256 loadAVX2( const short *p, __m256 vFromFixed ) { return loadFixedAVX2( p, vFromFixed ); }
+__attribute__((target("avx2")))
+static inline void storeAVX2( float *p, __m256 f, __m256 ) { _mm256_storeu_ps( p, f ); }
+__attribute__((target("avx2")))
+static inline void storeAVX2( short *p, __m256 f, __m256 vToFixed ) { storeFixedAVX2( p, f, vToFixed ); }
+
+//-----------------------------------------------------------------------------
+// Name: liveAVX2()
+// Desc: All ones in the lanes of the particles that haven't expired
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline __m256 liveAVX2( const unsigned char *pExpired )
+{
+  __m256i e = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)pExpired ) );
+  return _mm256_castsi256_ps( _mm256_cmpeq_epi32( e, _mm256_setzero_si256() ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: collideAVX2()
+// Desc: Eight particles per iteration
+//-----------------------------------------------------------------------------
+struct PlaneVectors256
+{
+  __m256 nx, ny, nz;
+  __m256 px, py, pz;
+  __m256 kr;
+};
+
+__attribute__((target("avx2")))
+static inline void loadPlaneAVX2( const CollisionPlanes &planes, int n, PlaneVectors256 *pOut )
+{
+  pOut->nx = _mm256_set1_ps( planes.m_pNormalX[n] );
+  pOut->ny = _mm256_set1_ps( planes.m_pNormalY[n] );
+  pOut->nz = _mm256_set1_ps( planes.m_pNormalZ[n] );
+  pOut->px = _mm256_set1_ps( planes.m_pPointX[n] );
+  pOut->py = _mm256_set1_ps( planes.m_pPointY[n] );
+  pOut->pz = _mm256_set1_ps( planes.m_pPointZ[n] );
+  pOut->kr = _mm256_set1_ps( planes.m_pBounceFactor[n] );
+}
+
+template <bool bSinglePlane, int nResult, class Streams>
+__attribute__((target("avx2")))
+static int collideAVX2( const Streams &s, int i, int dwEnd,
+                        const CollisionPlanes &planes, unsigned short nTick )
+{
+  const __m256 vFromFixed = _mm256_set1_ps( fromFixed( s ) );
+  const __m256 vToFixed   = _mm256_set1_ps( toFixed( s ) );
+  const __m256 vEpsilon   = _mm256_set1_ps( 0.001f );
+
+  PlaneVectors256 single;
+  if( bSinglePlane )
+    loadPlaneAVX2( planes, 0, &single );
+
+  for( ; i + 8 <= dwEnd; i += 8 )
+  {
+    __m256 live = liveAVX2( s.m_pExpired + i );
+    if( _mm256_movemask_ps( live ) == 0 )
+      continue;
+
+    __m256 px = loadAVX2( s.m_pPosX + i, vFromFixed );
+    __m256 py = loadAVX2( s.m_pPosY + i, vFromFixed );
+    __m256 pz = loadAVX2( s.m_pPosZ + i, vFromFixed );
+    __m256 vx = _mm256_setzero_ps(), vy = _mm256_setzero_ps(), vz = _mm256_setzero_ps();
+    __m256 ox = _mm256_setzero_ps(), oy = _mm256_setzero_ps(), oz = _mm256_setzero_ps();
+    bool bMoved = false;
+
+    for( int n = bSinglePlane ? 0 : planes.m_nPlanes - 1; n >= 0; --n )
+    {
+      PlaneVectors256 plane;
+      if( bSinglePlane )
+        plane = single;
+      else
+        loadPlaneAVX2( planes, n, &plane );
+
+      __m256 d = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_sub_ps( plane.px, px ), plane.nx ),
+                                               _mm256_mul_ps( _mm256_sub_ps( plane.py, py ), plane.ny ) ),
+                                _mm256_mul_ps( _mm256_sub_ps( plane.pz, pz ), plane.nz ) );
+      __m256 hit  = _mm256_and_ps( _mm256_cmp_ps( d, vEpsilon, _CMP_GT_OQ ), live );
+      int    mask = _mm256_movemask_ps( hit );
+      if( mask == 0 )
+        continue;
+
+      int nPlaneResult = nResult == CR_MIXED ? planes.m_pCollisionResult[n] : nResult;
+      if( nPlaneResult == CR_RECYCLE )
+      {
+        for( int k = 0; k < 8; ++k )
+        {
+          if( mask & (1 << k) )
+            recycleParticle( s, i + k, nTick );
+        }
+        continue;
+      }
+      if( nPlaneResult != CR_BOUNCE && nPlaneResult != CR_STICK )
+        continue;
+
+      if( !bMoved )
+      {
+        vx = loadAVX2( s.m_pVelX + i, vFromFixed );
+        vy = loadAVX2( s.m_pVelY + i, vFromFixed );
+        vz = loadAVX2( s.m_pVelZ + i, vFromFixed );
+        ox = loadAVX2( s.m_pPrevX + i, vFromFixed );
+        oy = loadAVX2( s.m_pPrevY + i, vFromFixed );
+        oz = loadAVX2( s.m_pPrevZ + i, vFromFixed );
+        bMoved = true;
+      }
+
+      px = _mm256_blendv_ps( px, ox, hit );
+      py = _mm256_blendv_ps( py, oy, hit );
+      pz = _mm256_blendv_ps( pz, oz, hit );
+
+      if( nPlaneResult == CR_BOUNCE )
+      {
+        __m256 dot = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( plane.nx, vx ), _mm256_mul_ps( plane.ny, vy ) ),
+                                    _mm256_mul_ps( plane.nz, vz ) );
+        __m256 vnx = _mm256_mul_ps( dot, plane.nx );
+        __m256 vny = _mm256_mul_ps( dot, plane.ny );
+        __m256 vnz = _mm256_mul_ps( dot, plane.nz );
+        vx = _mm256_blendv_ps( vx, _mm256_sub_ps( _mm256_sub_ps( vx, vnx ), _mm256_mul_ps( plane.kr, vnx ) ), hit );
+        vy = _mm256_blendv_ps( vy, _mm256_sub_ps( _mm256_sub_ps( vy, vny ), _mm256_mul_ps( plane.kr, vny ) ), hit );
+        vz = _mm256_blendv_ps( vz, _mm256_sub_ps( _mm256_sub_ps( vz, vnz ), _mm256_mul_ps( plane.kr, vnz ) ), hit );
+      }
+      else
+      {
+        vx = _mm256_andnot_ps( hit, vx );
+        vy = _mm256_andnot_ps( hit, vy );
+        vz = _mm256_andnot_ps( hit, vz );
+      }
+    }
+
+    if( bMoved )
+    {
+      storeAVX2( s.m_pPosX + i, px, vToFixed );
+      storeAVX2( s.m_pPosY + i, py, vToFixed );
+      storeAVX2( s.m_pPosZ + i, pz, vToFixed );
+      storeAVX2( s.m_pVelX + i, vx, vToFixed );
+      storeAVX2( s.m_pVelY + i, vy, vToFixed );
+      storeAVX2( s.m_pVelZ + i, vz, vToFixed );
+    }
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: CpuHasAVX2()
+// Desc:
+//-----------------------------------------------------------------------------
+bool CpuHasAVX2( void )
+{
+#if defined(HAS_AVX2_KERNELS)
+  static int hasAVX2 = -1;
+  if( hasAVX2 < 0 )
+  {
+    __builtin_cpu_init();
+    hasAVX2 = __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+  }
+  return hasAVX2 == 1;
+#else
+  return false;
+#endif
+}
+
+static int m_nKernelPath = KERNEL_PATH_AVX2;     // SetKernelPath()'s cap
+
+//-----------------------------------------------------------------------------
+// Name: useAVX2(), useSSE2()
+// Desc: Whether the kernels run their AVX2 or SSE2 loops before the scalar
+//       tail
+//-----------------------------------------------------------------------------
+static inline bool useAVX2( void )
+{
+  return m_nKernelPath >= KERNEL_PATH_AVX2 && CpuHasAVX2();
+}
+
+static inline bool useSSE2( void )
+{
+  return m_nKernelPath >= KERNEL_PATH_SSE2;
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetKernelPath(), GetKernelPath()
+// Desc:
+//-----------------------------------------------------------------------------
+void SetKernelPath( int nPath )
+{
+  m_nKernelPath = nPath < KERNEL_PATH_SCALAR ? KERNEL_PATH_SCALAR :
+                  nPath > KERNEL_PATH_AVX2 ? KERNEL_PATH_AVX2 : nPath;
+}
+
+int GetKernelPath( void )
+{
+  int nPath = KERNEL_PATH_SCALAR;
+#if defined(__SSE2__)
+  nPath = KERNEL_PATH_SSE2;
+#endif
+  if( CpuHasAVX2() )
+    nPath = KERNEL_PATH_AVX2;
+  return nPath < m_nKernelPath ? nPath : m_nKernelPath;
+}
+
+//-----------------------------------------------------------------------------
+// Name: integrate(), integrateCompact()
+// Desc: The vector loops the CPU has, then the scalar tail
+//-----------------------------------------------------------------------------
+template <bool bDrag>
+static void integrate( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                       float fCurrentTime, float fElapsedTime )
+{
+  int i = dwBegin;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( useAVX2() )
+    i = integrateAVX2<bDrag>( streams, i, dwEnd, fCurrentTime, fElapsedTime );
+#endif
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = integrateSSE2<bDrag>( streams, i, dwEnd, fCurrentTime, fElapsedTime );
+#endif
+
+  integrateScalar<bDrag>( streams, i, dwEnd, fCurrentTime, fElapsedTime );
+}
+
+template <bool bDrag>
+static void integrateCompact( const CompactParticleStreams &streams, int dwBegin, int dwEnd,
+                              unsigned short nCurrentTick, float fElapsedTime )
+{
+  int i = dwBegin;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( useAVX2() )
+    i = integrateCompactAVX2<bDrag>( streams, i, dwEnd, nCurrentTick, fElapsedTime );
+#endif
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = integrateCompactSSE2<bDrag>( streams, i, dwEnd, nCurrentTick, fElapsedTime );
+#endif
+
+  integrateCompactScalar<bDrag>( streams, i, dwEnd, nCurrentTick, fElapsedTime );
+}
+
+//-----------------------------------------------------------------------------
+// Name: collide(), collideAny()
+// Desc: The vector loops the CPU has, then the scalar tail, compiled for
+//       a single plane or several and for the result all planes share.
+//       collideAny() picks the one for planes.
+//-----------------------------------------------------------------------------
+template <bool bSinglePlane, int nResult, class Streams>
+static void collide( const Streams &streams, int dwBegin, int dwEnd,
+                     const CollisionPlanes &planes, unsigned short nTick )
+{
+  int i = dwBegin;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( useAVX2() )
+    i = collideAVX2<bSinglePlane, nResult>( streams, i, dwEnd, planes, nTick );
+#endif
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = collideSSE2<bSinglePlane, nResult>( streams, i, dwEnd, planes, nTick );
+#endif
+
+  collideScalar<nResult>( streams, i, dwEnd, planes, nTick );
+}
+
+template <class Streams>
+static void collideAny( const Streams &streams, int dwBegin, int dwEnd,
+                        const CollisionPlanes &planes, unsigned short nTick )
+{
+  typedef void (*Kernel)( const Streams &, int, int, const CollisionPlanes &, unsigned short );
+  static const Kernel kernels[2][CR_MIXED + 1] =
+  {
+    { collide<false, CR_BOUNCE, Streams>, collide<false, CR_STICK, Streams>,
+      collide<false, CR_RECYCLE, Streams>, collide<false, CR_MIXED, Streams> },
+    { collide<true, CR_BOUNCE, Streams>, collide<true, CR_STICK, Streams>,
+      collide<true, CR_RECYCLE, Streams>, collide<true, CR_MIXED, Streams> },
+  };
+
+  if( planes.m_nPlanes <= 0 )
+    return;
+
+  int nResult = planes.m_nResult >= 0 && planes.m_nResult <= CR_MIXED ? planes.m_nResult : CR_MIXED;
+  kernels[planes.m_nPlanes == 1][nResult]( streams, dwBegin, dwEnd, planes, nTick );
+}
+
+//-----------------------------------------------------------------------------
+// Name: IntegrateParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void IntegrateParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                         float fCurrentTime, float fElapsedTime, bool bDrag )
+{
+  if( bDrag )
+    integrate<true>( streams, dwBegin, dwEnd, fCurrentTime, fElapsedTime );
+  else
+    integrate<false>( streams, dwBegin, dwEnd, fCurrentTime, fElapsedTime );
+}
+
+//-----------------------------------------------------------------------------
+// Name: IntegrateCompactParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void IntegrateCompactParticles( const CompactParticleStreams &streams, int dwBegin, int dwEnd,
+                                unsigned short nCurrentTick, float fElapsedTime, bool bDrag )
+{
+  if( bDrag )
+    integrateCompact<true>( streams, dwBegin, dwEnd, nCurrentTick, fElapsedTime );
+  else
+    integrateCompact<false>( streams, dwBegin, dwEnd, nCurrentTick, fElapsedTime );
+}
+
+//-----------------------------------------------------------------------------
+// Name: CollideParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void CollideParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                       const CollisionPlanes &planes )
+{
+  collideAny( streams, dwBegin, dwEnd, planes, 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Name: CollideCompactParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void CollideCompactParticles( const CompactParticleStreams &streams, int dwBegin, int dwEnd,
+                              const CollisionPlanes &planes, unsigned short nCurrentTick )
+{
+  collideAny( streams, dwBegin, dwEnd, planes, nCurrentTick );
+}
+
+//-----------------------------------------------------------------------------
+// Name: AnalyticFactors()
+// Desc:
+//-----------------------------------------------------------------------------
+void AnalyticFactors( const ParticleParams &p, float fAge, float *pDecay, float *pF1, float *pF2 )
+{
+  float e = expNegScalar( p.m_fDrag * fAge );
+  *pDecay = e;
+  if( p.m_fDrag > 0.0f )
+  {
+    *pF1 = (1.0f - e) * p.m_fInvDrag;
+    *pF2 = (fAge - *pF1) * p.m_fInvDrag;
+  }
+  else
+  {
+    *pF1 = fAge;
+    *pF2 = 0.5f * fAge * fAge;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: ExpireParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void ExpireParticles( const ParticleStreams &streams, int dwBegin, int dwEnd, float fCurrentTime )
+{
+  int i = dwBegin;
+
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = expireSSE2( streams, i, dwEnd, fCurrentTime );
+#endif
+
+  expireScalar( streams, i, dwEnd, fCurrentTime );
+}
+
+//-----------------------------------------------------------------------------
+// Name: EvaluateParticles()
+// Desc:
+//-----------------------------------------------------------------------------
+void EvaluateParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                        float fTime, float *pX, float *pY, float *pZ )
+{
+  int i = dwBegin;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( useAVX2() )
+    i = evaluateAVX2( streams, i, dwEnd, fTime, pX, pY, pZ );
+#endif
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = evaluateSSE2( streams, i, dwEnd, fTime, pX, pY, pZ );
+#endif
+
+  evaluateScalar( streams, i, dwEnd, fTime, pX, pY, pZ );
+}
+
+//-----------------------------------------------------------------------------
+// Name: hsvToRGBScalar()
+// Desc: Reference implementation, also used for the loop tails. Picks the
+//       channels by hue sextant k like convertHSV2RGB():
+//
+//         k   0  1  2  3  4  5
+//         r   v  q  p  p  t  v
+//         g   t  v  v  q  p  p
+//         b   p  p  t  v  v  q
+//-----------------------------------------------------------------------------
+static void hsvToRGBScalar( const float *pH, const float *pS, const float *pV,
+                            float *pR, float *pG, float *pB, int i, int dwCount )
+{
+  for( ; i < dwCount; ++i )
+  {
+    float h = pH[i], s = pS[i], v = pV[i];
+
+    if( h == 360.0f )
+      h = 0.0f;
+    h = h / 60.0f;
+    int   k = (int)h;
+    float f = h - (float)k;
+    float p = v * (1.0f - s);
+    float q = v * (1.0f - (s * f));
+    float t = v * (1.0f - (s * (1.0f - f)));
+
+    pR[i] = k == 1 ? q : (k == 2 || k == 3) ? p : k == 4 ? t : v;
+    pG[i] = k == 0 ? t : (k == 1 || k == 2) ? v : k == 3 ? q : p;
+    pB[i] = k == 2 ? t : (k == 3 || k == 4) ? v : k == 5 ? q : p;
+  }
+}
+
+#if defined(__SSE2__)
+static inline __m128 select4( __m128 mask, __m128 a, __m128 b )
+{
+  return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: hsvToRGBSSE2()
+// Desc: Four colors per iteration
+//-----------------------------------------------------------------------------
+static int hsvToRGBSSE2( const float *pH, const float *pS, const float *pV,
+                         float *pR, float *pG, float *pB, int i, int dwCount )
+{
+  const __m128 one = _mm_set1_ps( 1.0f );
+
+  for( ; i + 4 <= dwCount; i += 4 )
+  {
+    __m128 h = _mm_loadu_ps( pH + i );
+    __m128 s = _mm_loadu_ps( pS + i );
+    __m128 v = _mm_loadu_ps( pV + i );
+
+    h = _mm_andnot_ps( _mm_cmpeq_ps( h, _mm_set1_ps( 360.0f ) ), h );
+    h = _mm_div_ps( h, _mm_set1_ps( 60.0f ) );
+    __m128i k = _mm_cvttps_epi32( h );
+    __m128  f = _mm_sub_ps( h, _mm_cvtepi32_ps( k ) );
+    __m128  p = _mm_mul_ps( v, _mm_sub_ps( one, s ) );
+    __m128  q = _mm_mul_ps( v, _mm_sub_ps( one, _mm_mul_ps( s, f ) ) );
+    __m128  t = _mm_mul_ps( v, _mm_sub_ps( one, _mm_mul_ps( s, _mm_sub_ps( one, f ) ) ) );
+
+    __m128 k0 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 0 ) ) );
+    __m128 k1 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 1 ) ) );
+    __m128 k2 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 2 ) ) );
+    __m128 k3 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 3 ) ) );
+    __m128 k4 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 4 ) ) );
+    __m128 k5 = _mm_castsi128_ps( _mm_cmpeq_epi32( k, _mm_set1_epi32( 5 ) ) );
+
+    __m128 r = select4( k1, q, select4( _mm_or_ps( k2, k3 ), p, select4( k4, t, v ) ) );
+    __m128 g = select4( k0, t, select4( _mm_or_ps( k1, k2 ), v, select4( k3, q, p ) ) );
+    __m128 b = select4( k2, t, select4( _mm_or_ps( k3, k4 ), v, select4( k5, q, p ) ) );
+
+    _mm_storeu_ps( pR + i, r );
+    _mm_storeu_ps( pG + i, g );
+    _mm_storeu_ps( pB + i, b );
+  }
+
+  return i;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: hsvToRGBAVX2()
+// Desc: Eight colors per iteration
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static int hsvToRGBAVX2( const float *pH, const float *pS, const float *pV,
+                         float *pR, float *pG, float *pB, int i, int dwCount )
+{
+  const __m256 one = _mm256_set1_ps( 1.0f );
+
+  for( ; i + 8 <= dwCount; i += 8 )
+  {
+    __m256 h = _mm256_loadu_ps( pH + i );
+    __m256 s = _mm256_loadu_ps( pS + i );
+    __m256 v = _mm256_loadu_ps( pV + i );
+
+    h = _mm256_andnot_ps( _mm256_cmp_ps( h, _mm256_set1_ps( 360.0f ), _CMP_EQ_OQ ), h );
+    h = _mm256_div_ps( h, _mm256_set1_ps( 60.0f ) );
+    __m256i k = _mm256_cvttps_epi32( h );
+    __m256  f = _mm256_sub_ps( h, _mm256_cvtepi32_ps( k ) );
+    __m256  p = _mm256_mul_ps( v, _mm256_sub_ps( one, s ) );
+    __m256  q = _mm256_mul_ps( v, _mm256_sub_ps( one, _mm256_mul_ps( s, f ) ) );
+    __m256  t = _mm256_mul_ps( v, _mm256_sub_ps( one, _mm256_mul_ps( s, _mm256_sub_ps( one, f ) ) ) );
+
+    __m256 k0 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 0 ) ) );
+    __m256 k1 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 1 ) ) );
+    __m256 k2 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 2 ) ) );
+    __m256 k3 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 3 ) ) );
+    __m256 k4 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 4 ) ) );
+    __m256 k5 = _mm256_castsi256_ps( _mm256_cmpeq_epi32( k, _mm256_set1_epi32( 5 ) ) );
+
+    __m256 r = _mm256_blendv_ps( _mm256_blendv_ps( _mm256_blendv_ps( v, t, k4 ), p, _mm256_or_ps( k2, k3 ) ), q, k1 );
+    __m256 g = _mm256_blendv_ps( _mm256_blendv_ps( _mm256_blendv_ps( p, q, k3 ), v, _mm256_or_ps( k1, k2 ) ), t, k0 );
+    __m256 b = _mm256_blendv_ps( _mm256_blendv_ps( _mm256_blendv_ps( p, q, k5 ), v, _mm256_or_ps( k3, k4 ) ), t, k2 );
+
+    _mm256_storeu_ps( pR + i, r );
+    _mm256_storeu_ps( pG + i, g );
+    _mm256_storeu_ps( pB + i, b );
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: ConvertHSVToRGB()
+// Desc:
+//-----------------------------------------------------------------------------
+void ConvertHSVToRGB( const float *pH, const float *pS, const float *pV,
+                      float *pR, float *pG, float *pB, int dwCount )
+{
+  int i = 0;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( useAVX2() )
+    i = hsvToRGBAVX2( pH, pS, pV, pR, pG, pB, i, dwCount );
+#endif
+#if defined(__SSE2__)
+  if( useSSE2() )
+    i = hsvToRGBSSE2( pH, pS, pV, pR, pG, pB, i, dwCount );
+#endif
+
+  hsvToRGBScalar( pH, pS, pV, pR, pG, pB, i, dwCount );
+}
+
+//-----------------------------------------------------------------------------
+// Name: PackColors()
+// Desc: Rounds each component to the nearest of 256 levels
+//-----------------------------------------------------------------------------
+static inline unsigned int packComponent( float f )
+{
+  f = f < 0.0f ? 0.0f : f > 1.0f ? 1.0f : f;
+  return (unsigned int)(f * 255.0f + 0.5f);
+}
+
+void PackColors( const float *pR, const float *pG, const float *pB,
+                 unsigned int *pColor, int dwCount )
+{
+  for( int i = 0; i < dwCount; ++i )
+    pColor[i] = packComponent( pR[i] ) | (packComponent( pG[i] ) << 8) |
+                (packComponent( pB[i] ) << 16) | 0xff000000u;
+}
+
+//-----------------------------------------------------------------------------
+// Name: CColorTable()
+// Desc:
+//-----------------------------------------------------------------------------
+CColorTable::CColorTable()
+{
+  m_pTable = NULL;
+  m_nHue   = 0;
+  m_nSat   = 0;
+  m_nVal   = 0;
+}
+
+CColorTable::~CColorTable()
+{
+  Free();
+}
+
+//-----------------------------------------------------------------------------
+// Name: Build()
+// Desc: Hue is sampled around the circle, saturation and value from 0 to 1
+//       inclusive
+//-----------------------------------------------------------------------------
+bool CColorTable::Build( int nHue, int nSat, int nVal )
+{
+  Free();
+
+  if( nHue < 1 || nSat < 2 || nVal < 2 )
+    return nHue == 0 || nSat == 0 || nVal == 0;
+
+  int dwCount = nHue * nSat * nVal;
+  float *pHSV = (float*)malloc( dwCount * 3 * sizeof(float) );
+  m_pTable = (float*)malloc( dwCount * 3 * sizeof(float) );
+  if( pHSV == NULL || m_pTable == NULL )
+  {
+    free( pHSV );
+    Free();
+    return false;
+  }
+
+  float *pH = pHSV, *pS = pHSV + dwCount, *pV = pHSV + 2 * dwCount;
+  for( int h = 0, n = 0; h < nHue; ++h )
+    for( int s = 0; s < nSat; ++s )
+      for( int v = 0; v < nVal; ++v, ++n )
+      {
+        pH[n] = 360.0f * h / nHue;
+        pS[n] = (float)s / (nSat - 1);
+        pV[n] = (float)v / (nVal - 1);
+      }
+
+  // Convert planar, then interleave so a lookup touches one cache line
+  ConvertHSVToRGB( pH, pS, pV, pH, pS, pV, dwCount );
+  for( int n = 0; n < dwCount; ++n )
+  {
+    m_pTable[n * 3    ] = pH[n];
+    m_pTable[n * 3 + 1] = pS[n];
+    m_pTable[n * 3 + 2] = pV[n];
+  }
+  free( pHSV );
+
+  m_nHue = nHue;
+  m_nSat = nSat;
+  m_nVal = nVal;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Free()
+// Desc:
+//-----------------------------------------------------------------------------
+void CColorTable::Free( void )
+{
+  free( m_pTable );
+  m_pTable = NULL;
+  m_nHue = m_nSat = m_nVal = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Lookup()
+// Desc:
+//-----------------------------------------------------------------------------
+void CColorTable::Lookup( const float *pH, const float *pS, const float *pV,
+                          float *pR, float *pG, float *pB, int dwCount )
+{
+  if( m_pTable == NULL )
+  {
+    ConvertHSVToRGB( pH, pS, pV, pR, pG, pB, dwCount );
+    return;
+  }
+
+  const float fHueScale = m_nHue / 360.0f;
+
+  for( int i = 0; i < dwCount; ++i )
+  {
+    int h = (int)(pH[i] * fHueScale + 0.5f) % m_nHue;
+    int s = (int)(pS[i] * (m_nSat - 1) + 0.5f);
+    int v = (int)(pV[i] * (m_nVal - 1) + 0.5f);
+    if( h < 0 ) h += m_nHue;
+    s = s < 0 ? 0 : s >= m_nSat ? m_nSat - 1 : s;
+    v = v < 0 ? 0 : v >= m_nVal ? m_nVal - 1 : v;
+
+    const float *pRGB = m_pTable + ((h * m_nSat + s) * m_nVal + v) * 3;
+    pR[i] = pRGB[0];
+    pG[i] = pRGB[1];
+    pB[i] = pRGB[2];
+  }
+}
@@ -0,0 +1,301 @@
+//-----------------------------------------------------------------------------
+//		         Name: ParticleKernels.h
+//		  Description: Vectorized inner loops working on the structure-of-
+//					   arrays particle store of CParticleSystem
+//-----------------------------------------------------------------------------
+
+#ifndef PARTICLEKERNELS_H_INCLUDED
+#define PARTICLEKERNELS_H_INCLUDED
+
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Resolution of the 16 bit birth times of the compact store. Ages wrap
+// after 65536 ticks, so compact particles live for less than a minute.
+const int   COMPACT_TICKS_PER_SECOND = 1024;
+const float COMPACT_MAX_AGE          = 63.0f;
+
+// Collision Results
+const int CR_BOUNCE  = 0;
+const int CR_STICK   = 1;
+const int CR_RECYCLE = 2;
+const int CR_MIXED   = 3;  // Not a plane's: planes with different results
+
+// Most collision planes one system can have
+const int COLLISION_MAX_PLANES = 64;
+
+//-----------------------------------------------------------------------------
+// What every particle released under the same emitter settings has in
+// common, kept once in a table the particles index. Each group of four
+// floats loads as one vector.
+//-----------------------------------------------------------------------------
+struct ParticleParams
+{
+    float       m_fGravX;       // Constant acceleration
+    float       m_fGravY;
+    float       m_fGravZ;
+    float       m_fPad0;
+    float       m_fWindX;       // Velocity the air drags the particle towards
+    float       m_fWindY;
+    float       m_fWindZ;
+    float       m_fPad1;
+    float       m_fDrag;        // 1.0f with air resistence, 0.0f without
+    float       m_fLifeCycle;
+    float       m_fSize;        // Half the edge length of the particle's quad
+    float       m_fInvDrag;     // 1 / m_fDrag, 0.0f without air resistence
+} __attribute__((aligned(16)));
+
+//-----------------------------------------------------------------------------
+// Pointers to the particle arrays a kernel reads and writes. All arrays are
+// indexed by particle; the kernels only touch the range they are given.
+//-----------------------------------------------------------------------------
+struct ParticleStreams
+{
+    float       *m_pPosX;       // Current position, updated in place
+    float       *m_pPosY;
+    float       *m_pPosZ;
+    float       *m_pPrevX;      // Receives the position before the step
+    float       *m_pPrevY;
+    float       *m_pPrevZ;
+    float       *m_pVelX;       // Current velocity, updated in place
+    float       *m_pVelY;
+    float       *m_pVelZ;
+    float       *m_pInitTime;   // Only moved back by planes that recycle
+    const unsigned short *m_pParam;          // Each particle's entry of...
+    const ParticleParams *m_pParamTable;     // ...this table
+    unsigned char *m_pExpired;  // Receives 1 for particles whose time is up
+};
+
+//-----------------------------------------------------------------------------
+// The same for the compact store: positions and velocities are signed 16
+// bit fixed point, m_fToFixed steps per unit, and birth times are ticks
+// of 1 / COMPACT_TICKS_PER_SECOND seconds that wrap around.
+//-----------------------------------------------------------------------------
+struct CompactParticleStreams
+{
+    short       *m_pPosX;
+    short       *m_pPosY;
+    short       *m_pPosZ;
+    short       *m_pPrevX;
+    short       *m_pPrevY;
+    short       *m_pPrevZ;
+    short       *m_pVelX;
+    short       *m_pVelY;
+    short       *m_pVelZ;
+    unsigned short *m_pBirthTick;
+    const unsigned short *m_pParam;
+    const ParticleParams *m_pParamTable;
+    unsigned char *m_pExpired;
+    float        m_fToFixed;
+    float        m_fFromFixed;  // 1 / m_fToFixed
+};
+
+//-----------------------------------------------------------------------------
+// The collision planes of a system, one array per attribute so the kernels
+// can test a batch of particles against each plane in turn. Particles meet
+// them from the last one to the first.
+//-----------------------------------------------------------------------------
+struct CollisionPlanes
+{
+    int         m_nPlanes;
+    int         m_nResult;               // What all of them do, CR_MIXED if they differ
+    float       m_pNormalX[COLLISION_MAX_PLANES];  // The plane's normal
+    float       m_pNormalY[COLLISION_MAX_PLANES];
+    float       m_pNormalZ[COLLISION_MAX_PLANES];
+    float       m_pPointX[COLLISION_MAX_PLANES];   // A coplanar point within the plane
+    float       m_pPointY[COLLISION_MAX_PLANES];
+    float       m_pPointZ[COLLISION_MAX_PLANES];
+    float       m_pBounceFactor[COLLISION_MAX_PLANES];   // Coefficient of restitution (or how bouncy the plane is)
+    int         m_pCollisionResult[COLLISION_MAX_PLANES]; // What will particles do when they strike the plane
+};
+
+//-----------------------------------------------------------------------------
+// Name: ToFixed()
+// Desc: Rounds f * fToFixed to the nearest step, clamped to the 16 bit
+//       range, as the compact kernels store it
+//-----------------------------------------------------------------------------
+inline short ToFixed( float f, float fToFixed )
+{
+  f *= fToFixed;
+  f = f < -32767.0f ? -32767.0f : f > 32767.0f ? 32767.0f : f;
+#if defined(__SSE2__)
+  return (short)_mm_cvtss_si32( _mm_set_ss( f ) );
+#else
+  return (short)__builtin_lrintf( f );
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Name: InFixedRange()
+// Desc: Whether ToFixed() stores f as it is rather than clamped to the edge
+//       of the range
+//-----------------------------------------------------------------------------
+inline bool InFixedRange( float f, float fToFixed )
+{
+  f *= fToFixed;
+  return f >= -32767.0f && f <= 32767.0f;
+}
+
+//-----------------------------------------------------------------------------
+// Name: CpuHasAVX2()
+// Desc: Whether the AVX2 versions of the kernels can run on this CPU
+//-----------------------------------------------------------------------------
+bool CpuHasAVX2( void );
+
+// Instruction sets the kernels can run on, each one including the ones before
+const int KERNEL_PATH_SCALAR = 0;
+const int KERNEL_PATH_SSE2   = 1;
+const int KERNEL_PATH_AVX2   = 2;
+
+//-----------------------------------------------------------------------------
+// Name: SetKernelPath(), GetKernelPath()
+// Desc: Caps the instruction set the kernels use at nPath, so the paths can
+//       be compared; KERNEL_PATH_AVX2, the default, leaves them whatever the
+//       CPU has. Only call it while no kernel runs. GetKernelPath() is the
+//       path they take, which is lower than the cap when the CPU or the
+//       compiler has less.
+//-----------------------------------------------------------------------------
+void SetKernelPath( int nPath );
+int GetKernelPath( void );
+
+//-----------------------------------------------------------------------------
+// Name: IntegrateParticles()
+// Desc: Advances particles [dwBegin, dwEnd) by one explicit Euler step:
+//
+//         v += g * dt
+//         v += (w - v) * dt       (only with air resistence)
+//         p += v * dt
+//
+//       with g, w and the air resistence of the particle's ParticleParams,
+//       and flags every particle that had already outlived its life cycle
+//       at fCurrentTime. Uses AVX2 or SSE2 when the CPU has them; results
+//       are identical to the scalar path. bDrag false skips the air
+//       resistence term, which only gives the same results if none of the
+//       particles has any.
+//-----------------------------------------------------------------------------
+void IntegrateParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                         float fCurrentTime, float fElapsedTime, bool bDrag = true );
+
+//-----------------------------------------------------------------------------
+// Name: IntegrateCompactParticles()
+// Desc: IntegrateParticles() on the compact store, with the time as a tick
+//       count. Every step rounds position and velocity back to fixed point.
+//       Particles that move out of the range of the fixed point are flagged
+//       as expired; velocities beyond it are clamped.
+//       Uses AVX2 or SSE2 when the CPU has them; results are identical to
+//       the scalar path.
+//-----------------------------------------------------------------------------
+void IntegrateCompactParticles( const CompactParticleStreams &streams, int dwBegin, int dwEnd,
+                                unsigned short nCurrentTick, float fElapsedTime, bool bDrag = true );
+
+//-----------------------------------------------------------------------------
+// Name: CollideParticles()
+// Desc: Checks the live particles of [dwBegin, dwEnd) against planes. A
+//       particle behind a plane (further than 0.001 along its normal from
+//       it) is handled as the plane's result says:
+//
+//         CR_BOUNCE   back to its previous position, v = Vt - Kr * Vn
+//         CR_STICK    back to its previous position, v = 0
+//         CR_RECYCLE  aged by its life cycle, so it expires next step
+//
+//       where Vn = (N.v) N and Vt = v - Vn. The planes that come after see
+//       the particle as the ones before left it. Uses AVX2 or SSE2 when
+//       the CPU has them; results are identical to the scalar path.
+//-----------------------------------------------------------------------------
+void CollideParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                       const CollisionPlanes &planes );
+
+//-----------------------------------------------------------------------------
+// Name: CollideCompactParticles()
+// Desc: CollideParticles() on the compact store. Recycled particles are
+//       given a birth tick one life cycle before nCurrentTick.
+//-----------------------------------------------------------------------------
+void CollideCompactParticles( const CompactParticleStreams &streams, int dwBegin, int dwEnd,
+                              const CollisionPlanes &planes, unsigned short nCurrentTick );
+
+//-----------------------------------------------------------------------------
+// Name: AnalyticFactors()
+// Desc: How birth velocity and acceleration enter the motion of a particle
+//       fAge seconds old under the drag k of p, the closed form of what the
+//       integrator approximates:
+//
+//         e  = exp(-k a)
+//         f1 = (1 - e) / k        (a with k = 0)
+//         f2 = (a - f1) / k       (a^2 / 2 with k = 0)
+//
+//         p  = p0 + v0 * f1 + (g + k w) * f2
+//         v  = v0 * e + (g + k w) * f1
+//-----------------------------------------------------------------------------
+void AnalyticFactors( const ParticleParams &p, float fAge, float *pDecay, float *pF1, float *pF2 );
+
+//-----------------------------------------------------------------------------
+// Name: ExpireParticles()
+// Desc: Only the expiry test of IntegrateParticles(), for particles that
+//       aren't integrated
+//-----------------------------------------------------------------------------
+void ExpireParticles( const ParticleStreams &streams, int dwBegin, int dwEnd, float fCurrentTime );
+
+//-----------------------------------------------------------------------------
+// Name: EvaluateParticles()
+// Desc: Positions of particles [dwBegin, dwEnd) at fTime from the state
+//       they were emitted with, using AnalyticFactors(). The streams'
+//       positions and velocities are those at birth and are only read;
+//       the results go to pX, pY and pZ. Particles not born yet at fTime
+//       stay where they were emitted. Uses AVX2 or SSE2 when the CPU has
+//       them; results are identical to the scalar path.
+//-----------------------------------------------------------------------------
+void EvaluateParticles( const ParticleStreams &streams, int dwBegin, int dwEnd,
+                        float fTime, float *pX, float *pY, float *pZ );
+
+//-----------------------------------------------------------------------------
+// Name: ConvertHSVToRGB()
+// Desc: Converts dwCount colors from hue (degrees, 0 - 360), saturation and
+//       value (0 - 1) to red, green and blue. Same results as the scalar
+//       convertHSV2RGB(), without branches and several colors at a time.
+//       The output arrays may be the input arrays.
+//-----------------------------------------------------------------------------
+void ConvertHSVToRGB( const float *pH, const float *pS, const float *pV,
+                      float *pR, float *pG, float *pB, int dwCount );
+
+//-----------------------------------------------------------------------------
+// Name: PackColors()
+// Desc: Packs dwCount colors with components in 0 - 1 into RGBA8, red in
+//       the lowest byte and an opaque alpha, as GL_UNSIGNED_BYTE vertex
+//       colors read them
+//-----------------------------------------------------------------------------
+void PackColors( const float *pR, const float *pG, const float *pB,
+                 unsigned int *pColor, int dwCount );
+
+//-----------------------------------------------------------------------------
+// Precomputed HSV to RGB table. Colors are looked up at the nearest of
+// nHue x nSat x nVal samples instead of being converted.
+//-----------------------------------------------------------------------------
+class CColorTable
+{
+
+public:
+
+    CColorTable(void);
+   ~CColorTable(void);
+
+    // Samples the color space; 0 for any of the resolutions frees the table
+    bool Build( int nHue, int nSat, int nVal );
+    void Free( void );
+    bool IsBuilt( void ) { return m_pTable != NULL; }
+
+    // Same contract as ConvertHSVToRGB()
+    void Lookup( const float *pH, const float *pS, const float *pV,
+                 float *pR, float *pG, float *pB, int dwCount );
+
+private:
+
+    float *m_pTable;    // RGB triples, hue major, value minor
+    int    m_nHue;
+    int    m_nSat;
+    int    m_nVal;
+};
+
+#endif /* PARTICLEKERNELS_H_INCLUDED */
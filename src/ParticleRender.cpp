@@ -0,0 +1,609 @@
+//-----------------------------------------------------------------------------
+//		         Name: ParticleRender.cpp
+//		  Description: OpenGL side of the CParticleSystem Class: texture,
+//					   vertex buffers and the render modes. Kept apart
+//					   from the simulation so that it can be built and
+//					   benchmarked without a GL context.
+//-----------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include <stdio.h>
+#include <string.h>
+#include <SOIL/SOIL.h>
+#include <algorithm>
+#include <stddef.h>
+
+//-----------------------------------------------------------------------------
+// Name : hasGLVersion()
+// Desc : Checks whether the current context is at least OpenGL major.minor
+//-----------------------------------------------------------------------------
+static bool hasGLVersion( int major, int minor )
+{
+  const char *szVersion = (const char*)glGetString( GL_VERSION );
+  int ctxMajor = 0, ctxMinor = 0;
+
+  if( szVersion == NULL || sscanf( szVersion, "%d.%d", &ctxMajor, &ctxMinor ) != 2 )
+    return false;
+
+  return ctxMajor > major || (ctxMajor == major && ctxMinor >= minor);
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetTexture()
+// Desc: 
+//-----------------------------------------------------------------------------
+bool CParticleSystem::SetTexture( char *chTexFile)
+{
+    // Deallocate the memory that was previously reserved for this string.
+  if( m_chTexFile != NULL )
+  {
+    free(m_chTexFile);
+    m_chTexFile = NULL;
+  }
+    
+  // Dynamically allocate the correct amount of memory.
+  m_chTexFile = (char*)malloc( strlen( chTexFile ) + 1);
+
+  // If the allocation succeeds, copy the initialization string.
+  if( m_chTexFile != NULL )
+    strcpy( m_chTexFile, chTexFile );
+
+  if( m_texture != 0)
+    glDeleteTextures(1, &m_texture);
+
+  m_texture = SOIL_load_OGL_texture(m_chTexFile, SOIL_LOAD_RGBA, 0, 0);
+
+  return m_texture != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Init()
+// Desc: 
+//-----------------------------------------------------------------------------
+bool CParticleSystem::Init()
+{
+    // Point sprites with distance attenuation need OpenGL 2.0. The largest
+    // size they can be drawn at is whatever the driver reports for
+    // (non antialiased) points.
+    m_bDeviceSupportsPSIZE = hasGLVersion( 2, 0 );
+
+    GLfloat pointSizeRange[2] = { 1.0f, 1.0f };
+    if( m_bDeviceSupportsPSIZE )
+      glGetFloatv( GL_ALIASED_POINT_SIZE_RANGE, pointSizeRange );
+    m_fMaxPointSize = pointSizeRange[1];
+
+    // Stream the billboards through a buffer object where the driver has
+    // them (OpenGL 1.5), plain client side vertex arrays otherwise
+    if( m_vertexBuffer == 0 && hasGLVersion( 1, 5 ) )
+    {
+      glGenBuffers(1, &m_vertexBuffer);
+      glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+      glBufferData(GL_ARRAY_BUFFER, m_dwDiscard * 6 * sizeof(BillboardVertex), NULL, GL_STREAM_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    m_dwVBOffset = 0;
+
+    if( m_instanceProgram == 0 && m_vertexBuffer != 0 && hasGLVersion( 3, 3 ) )
+      InitInstancing();
+
+    if( m_pVertexData == NULL )
+      m_pVertexData = (unsigned char*)malloc( m_dwDiscard * 6 * sizeof(BillboardVertex) );
+
+    return m_pVertexData != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Name: ReleaseRenderer()
+// Desc: Frees the texture, the buffers and the shader
+//-----------------------------------------------------------------------------
+void CParticleSystem::ReleaseRenderer()
+{
+    if( m_texture != 0)
+      glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+
+    if( m_vertexBuffer != 0 )
+      glDeleteBuffers(1, &m_vertexBuffer);
+    m_vertexBuffer = 0;
+
+    if( m_quadBuffer != 0 )
+      glDeleteBuffers(1, &m_quadBuffer);
+    m_quadBuffer = 0;
+
+    if( m_instanceProgram != 0 )
+      glDeleteProgram(m_instanceProgram);
+    m_instanceProgram = 0;
+
+    free(m_pVertexData);
+    m_pVertexData = NULL;
+}
+
+struct CUSTOMVERTEX
+{
+  float x, y, z; // The transformed position for the vertex.
+  float tu, tv;  // The vertex texture coordinates
+};
+
+//Store each point of the triangle together with it's colour
+static const CUSTOMVERTEX cvVertices[] =
+{
+  { -1.0f, -1.0f, 0.0f    ,0.0f, 1.0f }, // x, y, z, textures (tu, tv) 
+  { -1.0f,  1.0f, 0.0f    ,0.0f, 0.0f }, 
+  {  1.0f,  1.0f, 0.0f    ,1.0f, 0.0f },
+
+  { -1.0f, -1.0f, 0.0f    ,0.0f, 1.0f },
+  {  1.0f,  1.0f, 0.0f    ,1.0f, 0.0f },
+  {  1.0f, -1.0f, 0.0f    ,1.0f, 1.0f }
+
+};
+
+//-----------------------------------------------------------------------------
+// Name: BuildBillboards()
+// Desc: Writes the two textured triangles of particles
+//       [dwFirst, dwFirst + dwCount) to pVertices, already scaled and moved
+//       to the particle's position
+//-----------------------------------------------------------------------------
+void CParticleSystem::BuildBillboards( int dwFirst, int dwCount, BillboardVertex *pVertices )
+{
+    for (int n=dwFirst;n<dwFirst+dwCount;++n)
+    {
+      CVector vPos = GetRenderPosition(n);
+      float fSize = m_pParamTable[m_pParam[n]].m_fSize;
+      for (size_t i=0;i<6;++i)
+      {
+        pVertices->tu = cvVertices[i].tu;
+        pVertices->tv = cvVertices[i].tv;
+        pVertices->color = m_pColor[n];
+        pVertices->x  = vPos.x + cvVertices[i].x * fSize;
+        pVertices->y  = vPos.y + cvVertices[i].y * fSize;
+        pVertices->z  = vPos.z + cvVertices[i].z * fSize;
+        ++pVertices;
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Name: BuildPointSprites()
+// Desc: Writes one point vertex per particle [dwFirst, dwFirst + dwCount)
+//-----------------------------------------------------------------------------
+void CParticleSystem::BuildPointSprites( int dwFirst, int dwCount, PointVertex *pVertices )
+{
+    for (int n=dwFirst;n<dwFirst+dwCount;++n)
+    {
+      pVertices->posit = GetRenderPosition(n);
+      pVertices->color = m_pColor[n];
+      ++pVertices;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Name: BuildInstances()
+// Desc: Writes the instance data of particles [dwFirst, dwFirst + dwCount)
+//-----------------------------------------------------------------------------
+void CParticleSystem::BuildInstances( int dwFirst, int dwCount, InstanceVertex *pVertices )
+{
+    for (int n=dwFirst;n<dwFirst+dwCount;++n)
+    {
+      CVector vPos = GetRenderPosition(n);
+      pVertices->x    = vPos.x;
+      pVertices->y    = vPos.y;
+      pVertices->z    = vPos.z;
+      pVertices->size = m_pParamTable[m_pParam[n]].m_fSize;
+      pVertices->color = m_pColor[n];
+      ++pVertices;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Name: BuildCompactInstances()
+// Desc: The same in the compact store's fixed point, for half the upload
+//-----------------------------------------------------------------------------
+void CParticleSystem::BuildCompactInstances( int dwFirst, int dwCount, CompactInstanceVertex *pVertices )
+{
+    for (int n=dwFirst;n<dwFirst+dwCount;++n)
+    {
+      if (m_fInterpolation >= 1.0f)
+      {
+        pVertices->x = m_pFixedPosX[n];
+        pVertices->y = m_pFixedPosY[n];
+        pVertices->z = m_pFixedPosZ[n];
+      }
+      else
+      {
+        CVector vPos = GetRenderPosition(n);
+        pVertices->x = ToFixed(vPos.x, m_fToFixed);
+        pVertices->y = ToFixed(vPos.y, m_fToFixed);
+        pVertices->z = ToFixed(vPos.z, m_fToFixed);
+      }
+      pVertices->size  = ToFixed(m_pParamTable[m_pParam[n]].m_fSize, m_fToFixed);
+      pVertices->color = m_pColor[n];
+      ++pVertices;
+    }
+}
+
+// Generic attributes of the instanced renderer
+static const GLuint IA_CORNER   = 0;  // Quad corner (x, y) and texture coordinates
+static const GLuint IA_POSITION = 1;  // Particle position and size
+static const GLuint IA_COLOR    = 2;  // Particle color
+
+// The quad is expanded around the particle in world space, like
+// BuildBillboards() does. The fixed function pipeline the other modes go
+// through adds the ambient term on top of the emission and takes alpha
+// from the diffuse material, so does this. Positions from the compact
+// store come in fixed point and are scaled back here.
+static const char *szInstanceVS =
+  "#version 120\n"
+  "attribute vec4 corner;\n"
+  "attribute vec4 position;\n"
+  "attribute vec4 color;\n"
+  "uniform float scale;\n"
+  "varying vec4 vColor;\n"
+  "varying vec2 vTexCoord;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 q = position * scale;\n"
+  "  vec3 p = q.xyz + vec3(corner.xy * q.w, 0.0);\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 1.0);\n"
+  "  vColor = vec4(clamp(color.rgb + gl_FrontMaterial.ambient.rgb * gl_LightModel.ambient.rgb, 0.0, 1.0),\n"
+  "                gl_FrontMaterial.diffuse.a);\n"
+  "  vTexCoord = corner.zw;\n"
+  "}\n";
+
+static const char *szInstanceFS =
+  "#version 120\n"
+  "uniform sampler2D tex;\n"
+  "varying vec4 vColor;\n"
+  "varying vec2 vTexCoord;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = vColor * texture2D(tex, vTexCoord);\n"
+  "}\n";
+
+//-----------------------------------------------------------------------------
+// Name: compileShader()
+// Desc: Returns 0 if the shader doesn't compile
+//-----------------------------------------------------------------------------
+static GLuint compileShader( GLenum type, const char *szSource )
+{
+  GLuint shader = glCreateShader( type );
+  GLint status = GL_FALSE;
+
+  glShaderSource( shader, 1, &szSource, NULL );
+  glCompileShader( shader );
+  glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
+  if( status != GL_TRUE )
+  {
+    glDeleteShader( shader );
+    return 0;
+  }
+
+  return shader;
+}
+
+//-----------------------------------------------------------------------------
+// Name: InitInstancing()
+// Desc: Uploads the unit quad and builds the shader of the instanced
+//       renderer. Leaves m_instanceProgram at 0 if any of it fails.
+//-----------------------------------------------------------------------------
+bool CParticleSystem::InitInstancing()
+{
+    GLuint vs = compileShader(GL_VERTEX_SHADER, szInstanceVS);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, szInstanceFS);
+    GLint status = GL_FALSE;
+
+    if (vs != 0 && fs != 0)
+    {
+      m_instanceProgram = glCreateProgram();
+      glAttachShader(m_instanceProgram, vs);
+      glAttachShader(m_instanceProgram, fs);
+      glBindAttribLocation(m_instanceProgram, IA_CORNER, "corner");
+      glBindAttribLocation(m_instanceProgram, IA_POSITION, "position");
+      glBindAttribLocation(m_instanceProgram, IA_COLOR, "color");
+      glLinkProgram(m_instanceProgram);
+      glGetProgramiv(m_instanceProgram, GL_LINK_STATUS, &status);
+    }
+
+    if (vs != 0)
+      glDeleteShader(vs);
+    if (fs != 0)
+      glDeleteShader(fs);
+
+    if (status != GL_TRUE)
+    {
+      if (m_instanceProgram != 0)
+        glDeleteProgram(m_instanceProgram);
+      m_instanceProgram = 0;
+      return false;
+    }
+
+    m_instanceScale = glGetUniformLocation(m_instanceProgram, "scale");
+
+    float quad[6][4];
+    for (int i=0;i<6;++i)
+    {
+      quad[i][0] = cvVertices[i].x;
+      quad[i][1] = cvVertices[i].y;
+      quad[i][2] = cvVertices[i].tu;
+      quad[i][3] = cvVertices[i].tv;
+    }
+
+    glGenBuffers(1, &m_quadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: BeginChunk()
+// Desc: Returns the staging memory for the next dwCount particles of
+//       particleBytes each. Starts over at the beginning of the buffer once
+//       it is full; the driver gets a fresh buffer then, so it doesn't have
+//       to wait for the draws still reading the old one.
+//-----------------------------------------------------------------------------
+unsigned char *CParticleSystem::BeginChunk( int dwCount, size_t particleBytes )
+{
+    if (m_dwVBOffset + dwCount > m_dwDiscard)
+    {
+      m_dwVBOffset = 0;
+      if (m_vertexBuffer != 0)
+        glBufferData(GL_ARRAY_BUFFER, m_dwDiscard * 6 * sizeof(BillboardVertex), NULL, GL_STREAM_DRAW);
+    }
+
+    return m_pVertexData + m_dwVBOffset * particleBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Name: EndChunk()
+// Desc: Hands the chunk filled after BeginChunk() to the driver
+//-----------------------------------------------------------------------------
+void CParticleSystem::EndChunk( int dwCount, size_t particleBytes )
+{
+    if (m_vertexBuffer != 0)
+      glBufferSubData(GL_ARRAY_BUFFER, m_dwVBOffset * particleBytes, dwCount * particleBytes,
+                      m_pVertexData + m_dwVBOffset * particleBytes);
+}
+
+//-----------------------------------------------------------------------------
+// Name: RenderBillboards()
+// Desc: Draws every particle as two textured triangles
+//-----------------------------------------------------------------------------
+void CParticleSystem::RenderBillboards()
+{
+    const size_t particleBytes = 6 * sizeof(BillboardVertex);
+    const char *pBase = m_vertexBuffer != 0 ? NULL : (const char*)m_pVertexData;
+
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(BillboardVertex), pBase + offsetof(BillboardVertex, tu));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BillboardVertex), pBase + offsetof(BillboardVertex, color));
+    glVertexPointer(3, GL_FLOAT, sizeof(BillboardVertex), pBase + offsetof(BillboardVertex, x));
+
+    for (int dwFirst=0;dwFirst<m_dwActiveCount;dwFirst+=m_dwFlush)
+    {
+      int dwCount = std::min(m_dwFlush, m_dwActiveCount - dwFirst);
+
+      BuildBillboards(dwFirst, dwCount, (BillboardVertex*)BeginChunk(dwCount, particleBytes));
+      EndChunk(dwCount, particleBytes);
+
+      glDrawArrays(GL_TRIANGLES, m_dwVBOffset * 6, dwCount * 6);
+      m_dwVBOffset += dwCount;
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+//-----------------------------------------------------------------------------
+// Name: GetUniformSize()
+// Desc: The size all emitters draw their particles at, false if they differ
+//-----------------------------------------------------------------------------
+bool CParticleSystem::GetUniformSize( float *pSize )
+{
+    for (int n=1;n<m_nEmitters;++n)
+    {
+      if (m_pEmitters[n].m_fSize != m_pEmitters[0].m_fSize)
+        return false;
+    }
+
+    *pSize = m_pEmitters[0].m_fSize;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: RenderPointSprites()
+// Desc: Draws every particle as a single point sprite. The sprites are
+//       scaled with the distance to the eye so they cover what the
+//       billboards would. Returns false without drawing anything if the
+//       nearest particle would need a bigger sprite than the device can do.
+//-----------------------------------------------------------------------------
+bool CParticleSystem::RenderPointSprites()
+{
+    GLfloat modelView[16], projection[16];
+    GLint viewport[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // One point size goes for every sprite, so emitters of different sizes
+    // need the billboards
+    float fSize;
+    if (!GetUniformSize(&fSize))
+      return false;
+
+    // A billboard 2 * fSize high at eye distance d covers fPointSize / d
+    // pixels
+    float fPointSize = fSize * projection[5] * viewport[3];
+
+    // Find the nearest particle in front of the eye, where it is drawn
+    float fMinDistance = 0.0f;
+    for (int n=0;n<m_dwActiveCount;++n)
+    {
+      CVector vPos = GetRenderPosition(n);
+      float d = -(modelView[2] * vPos.x + modelView[6] * vPos.y +
+                  modelView[10] * vPos.z + modelView[14]);
+      if (d > 0.0f && (fMinDistance == 0.0f || d < fMinDistance))
+        fMinDistance = d;
+    }
+
+    if (fMinDistance > 0.0f && fPointSize / fMinDistance > m_fMaxPointSize)
+      return false;
+
+    const GLfloat attenuation[] = { 0.0f, 0.0f, 1.0f };
+    glPointSize(fPointSize);
+    glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, attenuation);
+    glPointParameterf(GL_POINT_SIZE_MIN, 0.0f);
+    glPointParameterf(GL_POINT_SIZE_MAX, m_fMaxPointSize);
+    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+    glEnable(GL_POINT_SPRITE);
+
+    const size_t particleBytes = sizeof(PointVertex);
+    const char *pBase = m_vertexBuffer != 0 ? NULL : (const char*)m_pVertexData;
+
+    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(PointVertex), pBase + offsetof(PointVertex, color));
+    glVertexPointer(3, GL_FLOAT, sizeof(PointVertex), pBase + offsetof(PointVertex, posit));
+
+    for (int dwFirst=0;dwFirst<m_dwActiveCount;dwFirst+=m_dwFlush)
+    {
+      int dwCount = std::min(m_dwFlush, m_dwActiveCount - dwFirst);
+
+      BuildPointSprites(dwFirst, dwCount, (PointVertex*)BeginChunk(dwCount, particleBytes));
+      EndChunk(dwCount, particleBytes);
+
+      glDrawArrays(GL_POINTS, m_dwVBOffset, dwCount);
+      m_dwVBOffset += dwCount;
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    glDisable(GL_POINT_SPRITE);
+    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_FALSE);
+    glPointSize(1.0f);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: RenderInstanced()
+// Desc: Draws every particle as an instance of the unit quad. Only the
+//       position, size and color of each particle go to the driver, and
+//       up to m_dwDiscard of them are drawn with a single call.
+//-----------------------------------------------------------------------------
+bool CParticleSystem::RenderInstanced()
+{
+    if (m_instanceProgram == 0)
+      return false;
+
+    const size_t particleBytes = m_bCompact ? sizeof(CompactInstanceVertex) : sizeof(InstanceVertex);
+
+    glUseProgram(m_instanceProgram);
+    glUniform1f(m_instanceScale, m_bCompact ? m_fFromFixed : 1.0f);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+    glEnableVertexAttribArray(IA_CORNER);
+    glVertexAttribPointer(IA_CORNER, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(IA_POSITION);
+    glEnableVertexAttribArray(IA_COLOR);
+    glVertexAttribDivisor(IA_POSITION, 1);
+    glVertexAttribDivisor(IA_COLOR, 1);
+
+    for (int dwFirst=0;dwFirst<m_dwActiveCount;dwFirst+=m_dwDiscard)
+    {
+      int dwCount = std::min(m_dwDiscard, m_dwActiveCount - dwFirst);
+
+      if (m_bCompact)
+        BuildCompactInstances(dwFirst, dwCount, (CompactInstanceVertex*)BeginChunk(dwCount, particleBytes));
+      else
+        BuildInstances(dwFirst, dwCount, (InstanceVertex*)BeginChunk(dwCount, particleBytes));
+      EndChunk(dwCount, particleBytes);
+
+      const char *pBase = (const char*)NULL + m_dwVBOffset * particleBytes;
+      if (m_bCompact)
+      {
+        glVertexAttribPointer(IA_POSITION, 4, GL_SHORT, GL_FALSE, particleBytes, pBase + offsetof(CompactInstanceVertex, x));
+        glVertexAttribPointer(IA_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, particleBytes, pBase + offsetof(CompactInstanceVertex, color));
+      }
+      else
+      {
+        glVertexAttribPointer(IA_POSITION, 4, GL_FLOAT, GL_FALSE, particleBytes, pBase + offsetof(InstanceVertex, x));
+        glVertexAttribPointer(IA_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, particleBytes, pBase + offsetof(InstanceVertex, color));
+      }
+      glDrawArraysInstanced(GL_TRIANGLES, 0, 6, dwCount);
+      m_dwVBOffset += dwCount;
+    }
+
+    glVertexAttribDivisor(IA_COLOR, 0);
+    glVertexAttribDivisor(IA_POSITION, 0);
+    glDisableVertexAttribArray(IA_COLOR);
+    glDisableVertexAttribArray(IA_POSITION);
+    glDisableVertexAttribArray(IA_CORNER);
+
+    glUseProgram(0);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Render()
+// Desc: Renders the particle system
+// Note: I couldn't get textures to display on the point sprites used by
+//		 the original Render method, so I have heavily rewritten it to not
+//		 user point sprites.
+//		 All particles go out as one vertex stream, m_dwFlush particles at
+//		 a time, with the particle color as per vertex emission instead of
+//		 a material change and a matrix push per particle. Point sprites
+//		 are back as RM_POINTSPRITES, which sends one vertex per particle
+//		 instead of six, and RM_INSTANCED, which sends only the particle
+//		 data and lets the driver expand a static quad.
+//-----------------------------------------------------------------------------
+bool CParticleSystem::Render()
+{
+    PROFILE_SCOPE(PROFILE_RENDER);
+
+    if (m_pVertexData == NULL)
+      return false;
+
+    EvaluatePositions();
+
+    const GLfloat dif[] = {1.0, 1.0, 1.0, 1.0};
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, dif);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, dif);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, dif);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, dif);
+
+    // The vertex color replaces the per particle glMaterial(GL_EMISSION)
+    glColorMaterial(GL_FRONT_AND_BACK, GL_EMISSION);
+    glEnable(GL_COLOR_MATERIAL);
+
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+
+    glMatrixMode(GL_MODELVIEW);
+
+    if (m_vertexBuffer != 0)
+      glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+
+    bool bRendered = false;
+    if (m_nRenderMode == RM_POINTSPRITES && m_bDeviceSupportsPSIZE)
+      bRendered = RenderPointSprites();
+    else if (m_nRenderMode == RM_INSTANCED)
+      bRendered = RenderInstanced();
+    if (!bRendered)
+      RenderBillboards();
+
+    if (m_vertexBuffer != 0)
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glDisable(GL_COLOR_MATERIAL);
+    glDisable(GL_TEXTURE_2D);
+
+    return true;
+}
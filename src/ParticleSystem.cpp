@@ -8,9 +8,10 @@
 
 #include "ParticleSystem.h"
 #include "Util.h"
+#include <stdio.h>
 #include <string.h>
-#include <SOIL/SOIL.h>
 #include <algorithm>
+#include <stddef.h>
 
 const int HBAND = 128;
 const int SBAND = 256;
@@ -25,48 +26,6 @@ HsvColor::HsvColor( float hin, float sin, float vin )
 	v = vin;
 }
 
-//-----------------------------------------------------------------------------
-// Name: getRandomVector()
-// Desc: Generates a random vector where X,Y, and Z components are between
-//       -1.0 and 1.0
-//-----------------------------------------------------------------------------
-CVector getRandomVector()
-{
-  CVector vVector;
-    // Pick a random Z between -1.0f and 1.0f.
-    vVector.z = getRandomMinMax( -1.0f, 1.0f);
-    
-    // Get radius of this circle
-    float radius = (float)sqrt(1 - vVector.z * vVector.z);
-    
-    // Pick a random point on a circle.
-    float t = getRandomMinMax( -M_PI, M_PI);
-
-    // Compute matching X and Y for our Z.
-    vVector.x = (float)cosf(t) * radius;
-    vVector.y = (float)sinf(t) * radius;
-
-    return vVector;
-}
-
-//-----------------------------------------------------------------------------
-// Name : classifyPoint()
-// Desc : Classifies a point against the plane passed
-//-----------------------------------------------------------------------------
-int classifyPoint( CVector *vPoint, Plane *pPlane )
-{
-	CVector vDirection = pPlane->m_vPoint - *vPoint;
-	float fResult = DotProduct(vDirection, pPlane->m_vNormal );
-
-	if( fResult < -0.001f )
-        return CP_FRONT;
-
-	if( fResult >  0.001f )
-        return CP_BACK;
-
-	return CP_ONPLANE;
-}
-
 //-----------------------------------------------------------------------------
 // Name: CParticleSystem()
 // Desc:
@@ -76,41 +35,84 @@ CParticleSystem::CParticleSystem()
 }
 void CParticleSystem::ctor()
 {
-    m_dwVBOffset       = 0;    // Gives the offset of the vertex buffer chunk that's currently being filled
-    m_dwFlush          = 512;  // Number of point sprites to load before sending them to hardware(512 = 2048 divided into 4 chunks)
-    m_dwDiscard        = 2048; // Max number of point sprites the vertex buffer can load until we are forced to discard and start over
-    m_pActiveList      = NULL; // Head node of point sprites that are active
-    m_pFreeList        = NULL; // Head node of point sprites that are inactive and waiting to be recycled.
-    m_pPlanes          = NULL;
+    m_dwVBOffset       = 0;     // Gives the offset of the vertex buffer chunk that's currently being filled
+    m_dwFlush          = 8192;  // Number of particles to load before sending them to hardware(8192 = 32768 divided into 4 chunks)
+    m_dwDiscard        = 32768; // Max number of particles the vertex buffer can load until we are forced to discard and start over
+    m_vertexBuffer     = 0;
+    m_pVertexData      = NULL;
+    m_quadBuffer       = 0;
+    m_instanceProgram  = 0;
+    m_instanceScale    = -1;
+    m_nRenderMode      = RM_BILLBOARDS;
+    m_planes.m_nPlanes = 0;
+    m_planes.m_nResult = CR_BOUNCE;
+    for( int n = 0; n < COLLISION_MAX_PLANES; ++n )
+        m_pPlaneIndex[n] = -1;
+    m_pParticleData    = NULL; // Backing store for the particle arrays, see ReserveParticles()
+    m_dwCapacity       = 0;
+    m_bCompact         = false;
+    m_fCompactExtent   = PARTICLE_COMPACT_EXTENT;
+    m_fToFixed         = 32767.0f / PARTICLE_COMPACT_EXTENT;
+    m_fFromFixed       = PARTICLE_COMPACT_EXTENT / 32767.0f;
+    m_bAnalytic        = false;
+    m_bBirthState      = false;
+    m_fEvaluateTime    = 0.0f;
+    m_pParamTable      = NULL;
+    m_pParamRefs       = NULL;
+    m_pFreeParams      = NULL;
+    m_nFreeParams      = 0;
+    m_nParamCapacity   = 0;
+    m_nDragParams      = 0;
+    m_bDrag            = true;
+    m_pWorkerPool      = NULL;
+    m_nThreads         = 1;
+    m_fStepTime        = 0.0f;
+    m_fFixedStep       = 0.0f;
+    m_nMaxSubsteps     = PARTICLE_MAX_SUBSTEPS;
+    m_fAccumulator     = 0.0;
+    m_fInterpolation   = 1.0f;
+    m_bProfiling       = false;
+    m_nIntegrateTime   = 0;
+    m_nCollideTime     = 0;
 	m_dwActiveCount    = 0;
 	m_fCurrentTime     = 0.0f;
-	m_fLastUpdate      = 0.0f;
     m_chTexFile        = NULL;
     m_texture     = 0;
     m_dwMaxParticles   = 1;
-    m_dwNumToRelease   = 1;
-    m_fReleaseInterval = 1.0f;
-    m_fLifeCycle       = 1.0f;
-    m_fSize            = 1.0f;
-    m_clrColor         = HsvColor(0.0f,1.0f,0.6f);
-    m_vPosition        = CVector(0.0f,0.0f,0.0f);
-    m_vVelocity        = CVector(0.0f,0.0f,0.0f);
-    m_vGravity         = CVector(0.0f,0.0f,0.0f);
-    m_vWind            = CVector(0.0f,0.0f,0.0f);
-    m_bAirResistence   = true;
-    m_fVelocityVar     = 1.0f;
-
-	m_fMaxH				= 360.0f;
-	m_fMinH				= 0.0f;
-	m_fHVar				= 45.0f;
-
-	m_fMaxS				= 1.0f;
-	m_fMinS				= 1.0f;
-	m_fSVar				= 0.0f;
+    m_random.Seed( 0 );
+
+    ParticleEmitter *pEmitter = &m_pEmitters[0];
+    pEmitter->m_dwNumToRelease   = 1;
+    pEmitter->m_dwBurst          = 0;
+    pEmitter->m_fReleaseInterval = 1.0f;
+    pEmitter->m_fLastUpdate      = 0.0f;
+    pEmitter->m_fLifeCycle       = 1.0f;
+    pEmitter->m_fSize            = 1.0f;
+    pEmitter->m_clrColor         = HsvColor(0.0f,1.0f,0.6f);
+    pEmitter->m_vPosition        = CVector(0.0f,0.0f,0.0f);
+    pEmitter->m_vVelocity        = CVector(0.0f,0.0f,0.0f);
+    pEmitter->m_vGravity         = CVector(0.0f,0.0f,0.0f);
+    pEmitter->m_vWind            = CVector(0.0f,0.0f,0.0f);
+    pEmitter->m_bAirResistence   = true;
+    pEmitter->m_fVelocityVar     = 1.0f;
+
+	pEmitter->m_fMaxH			= 360.0f;
+	pEmitter->m_fMinH			= 0.0f;
+	pEmitter->m_fHVar			= 45.0f;
+
+	pEmitter->m_fMaxS			= 1.0f;
+	pEmitter->m_fMinS			= 1.0f;
+	pEmitter->m_fSVar			= 0.0f;
 	
-	m_fMaxV				= 0.6f;
-	m_fMinV				= 0.2f;
-	m_fVVar				= 0.3f;
+	pEmitter->m_fMaxV			= 0.6f;
+	pEmitter->m_fMinV			= 0.2f;
+	pEmitter->m_fVVar			= 0.3f;
+
+    pEmitter->m_nParam           = -1;
+
+    m_pEmitter         = pEmitter;
+    m_nEmitters        = 1;
+    m_nFirstEmitter    = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -123,28 +125,20 @@ CParticleSystem::~CParticleSystem()
 
 void CParticleSystem::dtor()
 {
-    while( m_pPlanes ) // Repeat till null...
-    {
-        Plane *pPlane = m_pPlanes;   // Hold onto the first one
-        m_pPlanes = pPlane->m_pNext; // Move down to the next one
-        free(pPlane);               // Delete the one we're holding
-    }
+    m_planes.m_nPlanes = 0;
+    for( int n = 0; n < COLLISION_MAX_PLANES; ++n )
+        m_pPlaneIndex[n] = -1;
 
-    while( m_pActiveList )
-    {
-        Particle* pParticle = m_pActiveList;
-        m_pActiveList = pParticle->m_pNext;
-        free(pParticle);
-    }
-    m_pActiveList = NULL;
+    FreeParticles();
+    FreeParams();
+    m_colorTable.Free();
 
-    while( m_pFreeList )
+    if( m_pWorkerPool != NULL )
     {
-        Particle *pParticle = m_pFreeList;
-        m_pFreeList = pParticle->m_pNext;
-        free(pParticle);
+        delete m_pWorkerPool;
+        m_pWorkerPool = NULL;
     }
-    m_pFreeList = NULL;
+    m_nThreads = 1;
 
 	if( m_chTexFile != NULL )
 	{
@@ -152,69 +146,540 @@ void CParticleSystem::dtor()
 		m_chTexFile = NULL;
 	}
 
-    if( m_texture != 0)
-      glDeleteTextures(1, &m_texture);
+    ReleaseRenderer();
 }
 
 //-----------------------------------------------------------------------------
-// Name: SetTexture()
-// Desc: 
+// Name: carveArray()
+// Desc: Hands out the next 32 byte aligned slice of a particle data block
+//-----------------------------------------------------------------------------
+static void *carveArray( char **ppBlock, int dwCount, size_t elementSize )
+{
+  void *pArray = *ppBlock;
+  *ppBlock += (dwCount * elementSize + 31) & ~(size_t)31;
+  return pArray;
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetMaxParticles()
+// Desc: Sets the particle budget and preallocates storage for all of it,
+//       so that Update() never has to allocate.
 //-----------------------------------------------------------------------------
-bool CParticleSystem::SetTexture( char *chTexFile)
+void CParticleSystem::SetMaxParticles( int dwMaxParticles )
 {
-    // Deallocate the memory that was previously reserved for this string.
-  if( m_chTexFile != NULL )
+  if( ReserveParticles( dwMaxParticles ) )
+    m_dwMaxParticles = dwMaxParticles;
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetCompactStorage()
+// Desc: Switches stores. The live particles are dropped rather than
+//       converted; the next Update() allocates the new store.
+//-----------------------------------------------------------------------------
+void CParticleSystem::SetCompactStorage( bool bCompact, float fExtent )
+{
+  if( fExtent <= 0.0f )
+    fExtent = PARTICLE_COMPACT_EXTENT;
+
+  if( bCompact == m_bCompact && fExtent == m_fCompactExtent )
+    return;
+
+  RestartParticleSystem();
+  FreeParticles();
+
+  m_bCompact       = bCompact;
+  m_fCompactExtent = fExtent;
+  m_fToFixed       = 32767.0f / fExtent;
+  m_fFromFixed     = fExtent / 32767.0f;
+
+  UpdateMotionMode();
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetAnalytic()
+// Desc:
+//-----------------------------------------------------------------------------
+void CParticleSystem::SetAnalytic( bool bAnalytic )
+{
+  m_bAnalytic = bAnalytic;
+  UpdateMotionMode();
+}
+
+//-----------------------------------------------------------------------------
+// Name: UpdateMotionMode()
+// Desc: Goes analytic or back to integrating when what it depends on
+//       changed, converting the live particles
+//-----------------------------------------------------------------------------
+void CParticleSystem::UpdateMotionMode( void )
+{
+  bool bBirthState = m_bAnalytic && !m_bCompact && m_planes.m_nPlanes == 0;
+  if( bBirthState == m_bBirthState )
+    return;
+
+  RebaseParticles( bBirthState );
+  m_bBirthState = bBirthState;
+}
+
+//-----------------------------------------------------------------------------
+// Name: RebaseParticles()
+// Desc: Turns the current positions and velocities of the float store into
+//       the birth state that leads to them at m_fCurrentTime, or the other
+//       way round. Birth times stay, so particles expire as before.
+//-----------------------------------------------------------------------------
+void CParticleSystem::RebaseParticles( bool bToBirthState )
+{
+  for( int i = 0; i < m_dwActiveCount; ++i )
   {
-    free(m_chTexFile);
-    m_chTexFile = NULL;
+    const ParticleParams &p = m_pParamTable[m_pParam[i]];
+    float fAge = std::max( 0.0f, m_fCurrentTime - m_pInitTime[i] );
+
+    float e, f1, f2;
+    AnalyticFactors( p, fAge, &e, &f1, &f2 );
+
+    float ax = p.m_fGravX + p.m_fDrag * p.m_fWindX;
+    float ay = p.m_fGravY + p.m_fDrag * p.m_fWindY;
+    float az = p.m_fGravZ + p.m_fDrag * p.m_fWindZ;
+
+    if( bToBirthState )
+    {
+      m_pVelX[i] = (m_pVelX[i] - ax * f1) / e;
+      m_pVelY[i] = (m_pVelY[i] - ay * f1) / e;
+      m_pVelZ[i] = (m_pVelZ[i] - az * f1) / e;
+      m_pPosX[i] -= m_pVelX[i] * f1 + ax * f2;
+      m_pPosY[i] -= m_pVelY[i] * f1 + ay * f2;
+      m_pPosZ[i] -= m_pVelZ[i] * f1 + az * f2;
+    }
+    else
+    {
+      // Where it was a step ago, for the interpolation
+      float ep, f1p, f2p;
+      AnalyticFactors( p, std::max( 0.0f, fAge - m_fStepTime ), &ep, &f1p, &f2p );
+      m_pPrevX[i] = m_pPosX[i] + m_pVelX[i] * f1p + ax * f2p;
+      m_pPrevY[i] = m_pPosY[i] + m_pVelY[i] * f1p + ay * f2p;
+      m_pPrevZ[i] = m_pPosZ[i] + m_pVelZ[i] * f1p + az * f2p;
+
+      m_pPosX[i] += m_pVelX[i] * f1 + ax * f2;
+      m_pPosY[i] += m_pVelY[i] * f1 + ay * f2;
+      m_pPosZ[i] += m_pVelZ[i] * f1 + az * f2;
+      m_pVelX[i]  = m_pVelX[i] * e + ax * f1;
+      m_pVelY[i]  = m_pVelY[i] * e + ay * f1;
+      m_pVelZ[i]  = m_pVelZ[i] * e + az * f1;
+    }
   }
-    
-  // Dynamically allocate the correct amount of memory.
-  m_chTexFile = (char*)malloc( strlen( chTexFile ) + 1);
+}
 
-  // If the allocation succeeds, copy the initialization string.
-  if( m_chTexFile != NULL )
-    strcpy( m_chTexFile, chTexFile );
+//-----------------------------------------------------------------------------
+// Name: GetParticleArrays()
+// Desc: Lists the arrays of the current store and the size of their
+//       elements, returns how many there are
+//-----------------------------------------------------------------------------
+static const int MAX_PARTICLE_ARRAYS = 16;
 
-  if( m_texture != 0)
-    glDeleteTextures(1, &m_texture);
+int CParticleSystem::GetParticleArrays( void ***pppArrays, size_t *pElementSizes )
+{
+  int nArrays = 0;
 
-  m_texture = SOIL_load_OGL_texture(m_chTexFile, SOIL_LOAD_RGBA, 0, 0);
+#define PARTICLE_ARRAY( member ) \
+  pElementSizes[nArrays] = sizeof(*member); pppArrays[nArrays++] = (void**)&member;
 
-  return m_texture != 0;
+  if( m_bCompact )
+  {
+    PARTICLE_ARRAY( m_pFixedPosX ) PARTICLE_ARRAY( m_pFixedPosY ) PARTICLE_ARRAY( m_pFixedPosZ )
+    PARTICLE_ARRAY( m_pFixedPrevX ) PARTICLE_ARRAY( m_pFixedPrevY ) PARTICLE_ARRAY( m_pFixedPrevZ )
+    PARTICLE_ARRAY( m_pFixedVelX ) PARTICLE_ARRAY( m_pFixedVelY ) PARTICLE_ARRAY( m_pFixedVelZ )
+    PARTICLE_ARRAY( m_pBirthTick )
+  }
+  else
+  {
+    PARTICLE_ARRAY( m_pPosX ) PARTICLE_ARRAY( m_pPosY ) PARTICLE_ARRAY( m_pPosZ )
+    PARTICLE_ARRAY( m_pPrevX ) PARTICLE_ARRAY( m_pPrevY ) PARTICLE_ARRAY( m_pPrevZ )
+    PARTICLE_ARRAY( m_pVelX ) PARTICLE_ARRAY( m_pVelY ) PARTICLE_ARRAY( m_pVelZ )
+    PARTICLE_ARRAY( m_pInitTime )
+  }
+  PARTICLE_ARRAY( m_pColor )
+  PARTICLE_ARRAY( m_pParam )
+  PARTICLE_ARRAY( m_pExpired )
+
+#undef PARTICLE_ARRAY
+
+  return nArrays;
+}
+
+//-----------------------------------------------------------------------------
+// Name: ReserveParticles()
+// Desc: (Re)allocates the particle arrays to hold dwCapacity particles. Live
+//       particles are carried over, up to the new capacity.
+//-----------------------------------------------------------------------------
+bool CParticleSystem::ReserveParticles( int dwCapacity )
+{
+  if( dwCapacity < 1 )
+    return false;
+
+  if( dwCapacity == m_dwCapacity )
+    return true;
+
+  void **ppMembers[MAX_PARTICLE_ARRAYS];
+  size_t elementSizes[MAX_PARTICLE_ARRAYS];
+  int nArrays = GetParticleArrays( ppMembers, elementSizes );
+
+  size_t blockSize = 0;
+  for( int n = 0; n < nArrays; ++n )
+    blockSize += (dwCapacity * elementSizes[n] + 31) & ~(size_t)31;
+
+  void *pData = NULL;
+  if( posix_memalign( &pData, 32, blockSize ) != 0 )
+    return false;
+
+  // Carve the block into arrays in the order they are listed
+  char *pBlock = (char*)pData;
+  void *pArrays[MAX_PARTICLE_ARRAYS];
+  for( int n = 0; n < nArrays; ++n )
+    pArrays[n] = carveArray( &pBlock, dwCapacity, elementSizes[n] );
+
+  int dwKeep = std::min( m_dwActiveCount, dwCapacity );
+  if( m_pParticleData && dwKeep > 0 )
+  {
+    for( int n = 0; n < nArrays; ++n )
+      memcpy( pArrays[n], *ppMembers[n], dwKeep * elementSizes[n] );
+  }
+
+  // The particles that don't fit any more let go of their blocks
+  for( int i = dwKeep; i < m_dwActiveCount; ++i )
+    ReleaseParams( m_pParam[i] );
+
+  FreeParticles();
+
+  m_pParticleData   = pData;
+  m_dwCapacity      = dwCapacity;
+  m_dwActiveCount   = dwKeep;
+  for( int n = 0; n < nArrays; ++n )
+    *ppMembers[n] = pArrays[n];
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: FreeParticles()
+// Desc: Releases the particle arrays
+//-----------------------------------------------------------------------------
+void CParticleSystem::FreeParticles( void )
+{
+  void **ppMembers[MAX_PARTICLE_ARRAYS];
+  size_t elementSizes[MAX_PARTICLE_ARRAYS];
+  int nArrays = GetParticleArrays( ppMembers, elementSizes );
+  for( int n = 0; n < nArrays; ++n )
+    *ppMembers[n] = NULL;
+
+  free( m_pParticleData );
+  m_pParticleData = NULL;
+  m_dwCapacity    = 0;
+  m_dwActiveCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Name: MoveParticle()
+// Desc: Copies every attribute of particle dwSrc over particle dwDst
+//-----------------------------------------------------------------------------
+void CParticleSystem::MoveParticle( int dwDst, int dwSrc )
+{
+  if( m_bCompact )
+  {
+    m_pFixedPosX[dwDst]   = m_pFixedPosX[dwSrc];
+    m_pFixedPosY[dwDst]   = m_pFixedPosY[dwSrc];
+    m_pFixedPosZ[dwDst]   = m_pFixedPosZ[dwSrc];
+    m_pFixedPrevX[dwDst]  = m_pFixedPrevX[dwSrc];
+    m_pFixedPrevY[dwDst]  = m_pFixedPrevY[dwSrc];
+    m_pFixedPrevZ[dwDst]  = m_pFixedPrevZ[dwSrc];
+    m_pFixedVelX[dwDst]   = m_pFixedVelX[dwSrc];
+    m_pFixedVelY[dwDst]   = m_pFixedVelY[dwSrc];
+    m_pFixedVelZ[dwDst]   = m_pFixedVelZ[dwSrc];
+    m_pBirthTick[dwDst]   = m_pBirthTick[dwSrc];
+  }
+  else
+  {
+    m_pPosX[dwDst]        = m_pPosX[dwSrc];
+    m_pPosY[dwDst]        = m_pPosY[dwSrc];
+    m_pPosZ[dwDst]        = m_pPosZ[dwSrc];
+    m_pPrevX[dwDst]       = m_pPrevX[dwSrc];
+    m_pPrevY[dwDst]       = m_pPrevY[dwSrc];
+    m_pPrevZ[dwDst]       = m_pPrevZ[dwSrc];
+    m_pVelX[dwDst]        = m_pVelX[dwSrc];
+    m_pVelY[dwDst]        = m_pVelY[dwSrc];
+    m_pVelZ[dwDst]        = m_pVelZ[dwSrc];
+    m_pInitTime[dwDst]    = m_pInitTime[dwSrc];
+  }
+  m_pColor[dwDst]         = m_pColor[dwSrc];
+  m_pParam[dwDst]         = m_pParam[dwSrc];
+  m_pExpired[dwDst]       = m_pExpired[dwSrc];
+}
+
+//-----------------------------------------------------------------------------
+// Name: AcquireParams()
+// Desc: Copies params into a free block, growing the table if there is
+//       none, and hands out its index with one reference. -1 when the table
+//       can't grow any further.
+//-----------------------------------------------------------------------------
+int CParticleSystem::AcquireParams( const ParticleParams &params )
+{
+  if( m_nFreeParams == 0 )
+  {
+    if( m_nParamCapacity >= PARTICLE_MAX_PARAMS )
+      return -1;
+
+    int nCapacity = m_nParamCapacity > 0 ? std::min( m_nParamCapacity * 2, PARTICLE_MAX_PARAMS )
+                                         : 4 * PARTICLE_MAX_EMITTERS;
+
+    void *pTable = NULL;
+    if( posix_memalign( &pTable, 16, nCapacity * sizeof(ParticleParams) ) != 0 )
+      return -1;
+    unsigned int *pRefs = (unsigned int*)realloc( m_pParamRefs, nCapacity * sizeof(unsigned int) );
+    if( pRefs == NULL )
+    {
+      free( pTable );
+      return -1;
+    }
+    m_pParamRefs = pRefs;
+    unsigned short *pFree = (unsigned short*)realloc( m_pFreeParams, nCapacity * sizeof(unsigned short) );
+    if( pFree == NULL )
+    {
+      free( pTable );
+      return -1;
+    }
+    m_pFreeParams = pFree;
+
+    if( m_pParamTable )
+      memcpy( pTable, m_pParamTable, m_nParamCapacity * sizeof(ParticleParams) );
+    free( m_pParamTable );
+    m_pParamTable = (ParticleParams*)pTable;
+
+    // The lowest new index comes off the stack first
+    for( int n = nCapacity - 1; n >= m_nParamCapacity; --n )
+    {
+      m_pParamRefs[n] = 0;
+      m_pFreeParams[m_nFreeParams++] = (unsigned short)n;
+    }
+    m_nParamCapacity = nCapacity;
+  }
+
+  int nParam = m_pFreeParams[--m_nFreeParams];
+  m_pParamTable[nParam] = params;
+  m_pParamRefs[nParam]  = 1;
+  if( params.m_fDrag != 0.0f )
+    ++m_nDragParams;
+  return nParam;
+}
+
+//-----------------------------------------------------------------------------
+// Name: ReleaseParams()
+// Desc: Drops one reference to block nParam, freeing it with the last
+//-----------------------------------------------------------------------------
+void CParticleSystem::ReleaseParams( int nParam )
+{
+  if( --m_pParamRefs[nParam] == 0 )
+  {
+    m_pFreeParams[m_nFreeParams++] = (unsigned short)nParam;
+    if( m_pParamTable[nParam].m_fDrag != 0.0f )
+      --m_nDragParams;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: FreeParams()
+// Desc: Releases the parameter table; no particle may reference it any more
+//-----------------------------------------------------------------------------
+void CParticleSystem::FreeParams( void )
+{
+  free( m_pParamTable );
+  free( m_pParamRefs );
+  free( m_pFreeParams );
+  m_pParamTable    = NULL;
+  m_pParamRefs     = NULL;
+  m_pFreeParams    = NULL;
+  m_nFreeParams    = 0;
+  m_nParamCapacity = 0;
+  m_nDragParams    = 0;
+
+  for( int n = 0; n < PARTICLE_MAX_EMITTERS; ++n )
+    m_pEmitters[n].m_nParam = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Name: GetParticleStreams()
+// Desc: Bundles the particle arrays for the kernels in ParticleKernels.cpp
+//-----------------------------------------------------------------------------
+ParticleStreams CParticleSystem::GetParticleStreams( void )
+{
+  ParticleStreams streams;
+  streams.m_pPosX      = m_pPosX;
+  streams.m_pPosY      = m_pPosY;
+  streams.m_pPosZ      = m_pPosZ;
+  streams.m_pPrevX     = m_pPrevX;
+  streams.m_pPrevY     = m_pPrevY;
+  streams.m_pPrevZ     = m_pPrevZ;
+  streams.m_pVelX      = m_pVelX;
+  streams.m_pVelY      = m_pVelY;
+  streams.m_pVelZ      = m_pVelZ;
+  streams.m_pInitTime  = m_pInitTime;
+  streams.m_pParam     = m_pParam;
+  streams.m_pParamTable = m_pParamTable;
+  streams.m_pExpired   = m_pExpired;
+  return streams;
+}
+
+//-----------------------------------------------------------------------------
+// Name: GetCompactStreams()
+// Desc: The same for the compact store
+//-----------------------------------------------------------------------------
+CompactParticleStreams CParticleSystem::GetCompactStreams( void )
+{
+  CompactParticleStreams streams;
+  streams.m_pPosX       = m_pFixedPosX;
+  streams.m_pPosY       = m_pFixedPosY;
+  streams.m_pPosZ       = m_pFixedPosZ;
+  streams.m_pPrevX      = m_pFixedPrevX;
+  streams.m_pPrevY      = m_pFixedPrevY;
+  streams.m_pPrevZ      = m_pFixedPrevZ;
+  streams.m_pVelX       = m_pFixedVelX;
+  streams.m_pVelY       = m_pFixedVelY;
+  streams.m_pVelZ       = m_pFixedVelZ;
+  streams.m_pBirthTick  = m_pBirthTick;
+  streams.m_pParam      = m_pParam;
+  streams.m_pParamTable = m_pParamTable;
+  streams.m_pExpired    = m_pExpired;
+  streams.m_fToFixed    = m_fToFixed;
+  streams.m_fFromFixed  = m_fFromFixed;
+  return streams;
 }
 
 //-----------------------------------------------------------------------------
 // Name: SetCollisionPlane()
 // Desc: 
 //-----------------------------------------------------------------------------
-void CParticleSystem::SetCollisionPlane( const CVector& vPlaneNormal, const CVector& vPoint, 
-                                         float fBounceFactor, int nCollisionResult )
+int CParticleSystem::SetCollisionPlane( const CVector& vPlaneNormal, const CVector& vPoint, 
+                                        float fBounceFactor, int nCollisionResult )
 {
-    Plane *pPlane = (Plane*)malloc(sizeof (Plane));
-    memset(pPlane,0,sizeof(Plane));
+    if( m_planes.m_nPlanes >= COLLISION_MAX_PLANES )
+        return -1;
+
+    int nHandle = 0;                 // There is a free one with a free plane
+    while( m_pPlaneIndex[nHandle] >= 0 )
+        ++nHandle;
+
+    int n = m_planes.m_nPlanes++;
+    m_pPlaneIndex[nHandle] = n;
+    m_pPlaneHandle[n]      = nHandle;
+    m_planes.m_pNormalX[n]         = vPlaneNormal.x;
+    m_planes.m_pNormalY[n]         = vPlaneNormal.y;
+    m_planes.m_pNormalZ[n]         = vPlaneNormal.z;
+    m_planes.m_pPointX[n]          = vPoint.x;
+    m_planes.m_pPointY[n]          = vPoint.y;
+    m_planes.m_pPointZ[n]          = vPoint.z;
+    m_planes.m_pBounceFactor[n]    = fBounceFactor;
+    m_planes.m_pCollisionResult[n] = nCollisionResult;
+
+    UpdateCollisionPlanes();
+    return nHandle;
+}
 
-    pPlane->m_vNormal          = vPlaneNormal;
-    pPlane->m_vPoint           = vPoint;
-    pPlane->m_fBounceFactor    = fBounceFactor;
-    pPlane->m_nCollisionResult = nCollisionResult;
+//-----------------------------------------------------------------------------
+// Name: RemoveCollisionPlane()
+// Desc: Drops the plane of handle nHandle. The ones after it move down in
+//       the table, so their handles are pointed at where they end up.
+//-----------------------------------------------------------------------------
+void CParticleSystem::RemoveCollisionPlane( int nHandle )
+{
+  if( nHandle < 0 || nHandle >= COLLISION_MAX_PLANES || m_pPlaneIndex[nHandle] < 0 )
+    return;
 
-    pPlane->m_pNext = m_pPlanes; // Attach the curent list to it...
-    m_pPlanes = pPlane;          // ... and make it the new head.
+  int nPlane = m_pPlaneIndex[nHandle];
+  m_pPlaneIndex[nHandle] = -1;
+
+  int nMove = m_planes.m_nPlanes - nPlane - 1;
+  memmove( m_planes.m_pNormalX + nPlane, m_planes.m_pNormalX + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pNormalY + nPlane, m_planes.m_pNormalY + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pNormalZ + nPlane, m_planes.m_pNormalZ + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pPointX + nPlane, m_planes.m_pPointX + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pPointY + nPlane, m_planes.m_pPointY + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pPointZ + nPlane, m_planes.m_pPointZ + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pBounceFactor + nPlane, m_planes.m_pBounceFactor + nPlane + 1, nMove * sizeof(float) );
+  memmove( m_planes.m_pCollisionResult + nPlane, m_planes.m_pCollisionResult + nPlane + 1, nMove * sizeof(int) );
+  memmove( m_pPlaneHandle + nPlane, m_pPlaneHandle + nPlane + 1, nMove * sizeof(int) );
+  --m_planes.m_nPlanes;
+
+  for( int n = nPlane; n < m_planes.m_nPlanes; ++n )
+    m_pPlaneIndex[m_pPlaneHandle[n]] = n;
+
+  UpdateCollisionPlanes();
 }
 
 //-----------------------------------------------------------------------------
-// Name: Init()
-// Desc: 
+// Name: ClearCollisionPlanes()
+// Desc:
 //-----------------------------------------------------------------------------
-bool CParticleSystem::Init()
+void CParticleSystem::ClearCollisionPlanes( void )
 {
-    // Get max point size
-    m_fMaxPointSize = 63; // TODO?
+  m_planes.m_nPlanes = 0;
+  for( int n = 0; n < COLLISION_MAX_PLANES; ++n )
+    m_pPlaneIndex[n] = -1;
+  UpdateCollisionPlanes();
+}
 
-    m_bDeviceSupportsPSIZE = false;
+//-----------------------------------------------------------------------------
+// Name: UpdateCollisionPlanes()
+// Desc: Works out the result the planes share, which picks the collision
+//       kernel, after they changed
+//-----------------------------------------------------------------------------
+void CParticleSystem::UpdateCollisionPlanes( void )
+{
+  int nResult = m_planes.m_nPlanes > 0 ? m_planes.m_pCollisionResult[0] : CR_BOUNCE;
+  for( int n = 1; n < m_planes.m_nPlanes; ++n )
+  {
+    if( m_planes.m_pCollisionResult[n] != nResult )
+      nResult = CR_MIXED;
+  }
+  if( nResult < 0 || nResult > CR_MIXED )
+    nResult = CR_MIXED;
+  m_planes.m_nResult = nResult;
 
-    return true;
+  UpdateMotionMode();          // Analytic particles can't collide
+}
+
+//-----------------------------------------------------------------------------
+// Name: SetEmitterCount()
+// Desc: Adds or drops emitters at the end. Particles already released stay
+//       where they are, whichever emitter they came from.
+//-----------------------------------------------------------------------------
+void CParticleSystem::SetEmitterCount( int nEmitters )
+{
+  nEmitters = std::max( 1, std::min( PARTICLE_MAX_EMITTERS, nEmitters ) );
+
+  for( int n = nEmitters; n < m_nEmitters; ++n )
+  {
+    if( m_pEmitters[n].m_nParam >= 0 )
+      ReleaseParams( m_pEmitters[n].m_nParam );
+    m_pEmitters[n].m_nParam = -1;
+  }
+
+  for( int n = m_nEmitters; n < nEmitters; ++n )
+  {
+    m_pEmitters[n] = m_pEmitters[0];
+    m_pEmitters[n].m_dwBurst     = 0;
+    m_pEmitters[n].m_fLastUpdate = m_fCurrentTime;
+    m_pEmitters[n].m_nParam      = -1;
+  }
+
+  m_nEmitters = nEmitters;
+  m_nFirstEmitter %= m_nEmitters;
+  SelectEmitter( m_pEmitter - m_pEmitters );
+}
+
+//-----------------------------------------------------------------------------
+// Name: SelectEmitter()
+// Desc: Picks the emitter the attribute functions work on
+//-----------------------------------------------------------------------------
+void CParticleSystem::SelectEmitter( int nEmitter )
+{
+  m_pEmitter = &m_pEmitters[std::max( 0, std::min( m_nEmitters - 1, nEmitter ) )];
 }
 
 #include <iostream>
@@ -225,316 +690,472 @@ bool CParticleSystem::Init()
 //-----------------------------------------------------------------------------
 bool CParticleSystem::Update( float fElpasedTime )
 {
-  Particle  *pParticle;
-  Particle **ppParticle;
-  Plane     *pPlane;
-  Plane    **ppPlane;
-  CVector vOldPosition;
+  PROFILE_SCOPE( PROFILE_UPDATE );
+
+  // Make sure the whole particle budget is preallocated
+  if( m_dwCapacity < m_dwMaxParticles && !ReserveParticles( m_dwMaxParticles ) )
+    return false;
 
-  m_fCurrentTime += fElpasedTime;     // Update our particle system timer...
+  if( m_fFixedStep <= 0.0f )
+    return Step( fElpasedTime );
 
-  ppParticle = &m_pActiveList; // Start at the head of the active list
+  // Run as many fixed steps as the frame time covers. Each step sees the
+  // same time and emits the same way at any frame rate.
+  m_fAccumulator += fElpasedTime;
 
-  while( *ppParticle )
+  for( int n = 0; n < m_nMaxSubsteps && m_fAccumulator >= m_fFixedStep; ++n )
   {
-    pParticle = *ppParticle; // Set a pointer to the head
+    if( !Step( m_fFixedStep ) )
+      return false;
+    m_fAccumulator -= m_fFixedStep;
+  }
 
-    // Calculate new position
-    float fTimePassed  = m_fCurrentTime - pParticle->m_fInitTime;
+  // Too far behind to catch up, let the time go
+  if( m_fAccumulator >= m_fFixedStep )
+    m_fAccumulator = fmod( m_fAccumulator, (double)m_fFixedStep );
 
-    if( fTimePassed >= pParticle->m_fLifeCycle )
-    {
-      // Time is up, put the particle back on the free list...
-      *ppParticle = pParticle->m_pNext;
-      pParticle->m_pNext = m_pFreeList;
-      m_pFreeList = pParticle;
+  m_fInterpolation = (float)(m_fAccumulator / m_fFixedStep);
+  return true;
+}
 
-      --m_dwActiveCount;
-    }
-    else
-    {
-      // Update particle position and velocity
+//-----------------------------------------------------------------------------
+// Name: SetFixedStep()
+// Desc:
+//-----------------------------------------------------------------------------
+void CParticleSystem::SetFixedStep( float fStep )
+{
+  m_fFixedStep     = fStep > 0.0f ? fStep : 0.0f;
+  m_fAccumulator   = 0.0;
+  m_fInterpolation = 1.0f;
+}
 
-      // Update velocity with respect to Gravity (Constant Accelaration)
-      pParticle->m_vCurVel += pParticle->m_vGravity * fElpasedTime;
+//-----------------------------------------------------------------------------
+// Name: Step()
+// Desc: Advances the particle system by fStepTime: moves and collides the
+//       live particles, removes the dead and emits new ones
+//-----------------------------------------------------------------------------
+bool CParticleSystem::Step( float fStepTime )
+{
+  m_fCurrentTime += fStepTime;     // Update our particle system timer...
+  m_fStepTime     = fStepTime;
 
-      // Update velocity with respect to Wind (Accelaration based on 
-      // difference of vectors)
-      if( pParticle->m_bAirResistence == true )
-        pParticle->m_vCurVel += (pParticle->m_vWind - pParticle->m_vCurVel) * fElpasedTime;
+  m_bProfiling     = ProfilerEnabled();
+  m_nIntegrateTime = 0;
+  m_nCollideTime   = 0;
 
-      // Finally, update position with respect to velocity
-      vOldPosition = pParticle->m_vCurPos;
-      pParticle->m_vCurPos += pParticle->m_vCurVel * fElpasedTime;
+  // Integrate and collide all live particles, on the worker threads when
+  // there is enough work to go around...
+  int nChunks = (m_dwActiveCount + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
 
-      //-----------------------------------------------------------------
-      // BEGIN Checking the particle against each plane that was set up
+  // Air resistence is left out while no particle has any
+  m_bDrag = m_nDragParams > 0;
 
-      ppPlane = &m_pPlanes; // Set a pointer to the head
+  if( m_pWorkerPool != NULL && nChunks > 1 )
+    m_pWorkerPool->Run( SimulateChunk, this, nChunks );
+  else
+    SimulateParticles( 0, m_dwActiveCount );
 
-      while( *ppPlane )
-      {
-        pPlane = *ppPlane;
-        int result = classifyPoint( &pParticle->m_vCurPos, pPlane );
-
-        if( result == CP_BACK /*|| result == CP_ONPLANE */ )
-        {
-          if( pPlane->m_nCollisionResult == CR_BOUNCE )
-          {
-            pParticle->m_vCurPos = vOldPosition;
-
-            //-----------------------------------------------------------------
-            //
-            // The new velocity vector of a particle that is bouncing off
-            // a plane is computed as follows:
-            //
-            // Vn = (N.V) * N
-            // Vt = V - Vn
-            // Vp = Vt - Kr * Vn
-            //
-            // Where:
-            // 
-            // .  = Dot product operation
-            // N  = The normal of the plane from which we bounced
-            // V  = Velocity vector prior to bounce
-            // Vn = Normal force
-            // Kr = The coefficient of restitution ( Ex. 1 = Full Bounce, 
-            //      0 = Particle Sticks )
-            // Vp = New velocity vector after bounce
-            //
-            //-----------------------------------------------------------------
-
-            float Kr = pPlane->m_fBounceFactor;
-
-            CVector Vn = pPlane->m_vNormal*DotProduct( pPlane->m_vNormal, 
-                                                       pParticle->m_vCurVel );
-            CVector Vt = pParticle->m_vCurVel - Vn;
-            CVector Vp = Vt - Vn*Kr;
-
-            pParticle->m_vCurVel = Vp;
-          }
-          else if( pPlane->m_nCollisionResult == CR_RECYCLE )
-          {
-            pParticle->m_fInitTime -= pParticle->m_fLifeCycle;
-          }
-
-          else if( pPlane->m_nCollisionResult == CR_STICK )
-          {
-            pParticle->m_vCurPos = vOldPosition;
-            pParticle->m_vCurVel = CVector(0.0f,0.0f,0.0f);
-          }
-        }
-
-        ppPlane = &pPlane->m_pNext;
-      }
+  if( m_bProfiling )
+  {
+    ProfileStage( PROFILE_INTEGRATE, m_nIntegrateTime );
+    if( m_planes.m_nPlanes > 0 )
+      ProfileStage( PROFILE_COLLIDE, m_nCollideTime );
+  }
 
-      // END Plane Checking
-      //-----------------------------------------------------------------
+  // ...then drop the ones whose time is up
+  int dwLiveCount = m_dwActiveCount;
+  {
+    PROFILE_SCOPE( PROFILE_COMPACT );
+    CompactParticles();
+  }
+  int dwExpired = dwLiveCount - m_dwActiveCount;
+  int dwEmitted = 0;
+
+  // Every emitter releases its particles in turn, starting with a
+  // different one each step
+  uint64_t nEmitStart = m_bProfiling ? ProfilerNow() : 0;
+  bool bReleased = false;
 
-      ppParticle = &pParticle->m_pNext;
+  for( int n = 0; n < m_nEmitters; ++n )
+  {
+    int dwCount = EmitParticles( &m_pEmitters[(m_nFirstEmitter + n) % m_nEmitters] );
+    if( dwCount >= 0 )
+    {
+      dwEmitted += dwCount;
+      bReleased  = true;
     }
   }
+  m_nFirstEmitter = (m_nFirstEmitter + 1) % m_nEmitters;
+
+  if( m_bProfiling && bReleased )
+    ProfileStage( PROFILE_EMIT, ProfilerNow() - nEmitStart );
+
+  if( m_bProfiling )
+  {
+    ProfileCounter( PROFILE_ACTIVE, m_dwActiveCount );
+    ProfileCounter( PROFILE_EMITTED, dwEmitted );
+    ProfileCounter( PROFILE_EXPIRED, dwExpired );
+  }
 
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: EmitParticles()
+// Desc: Releases pEmitter's particles for this step, if it is time to or it
+//       has a burst. Returns how many fit, -1 when it wasn't time.
+//-----------------------------------------------------------------------------
+int CParticleSystem::EmitParticles( ParticleEmitter *pEmitter )
+{
   //-------------------------------------------------------------------------
   // Emit new particles in accordance to the flow rate...
   // 
   // NOTE: The system operates with a finite number of particles.
   //       New particles will be created until the max amount has
-  //       been reached, after that, only old particles that have
-  //       been recycled can be reintialized and used again.
+  //       been reached, after that, only particles that have died
+  //       and been swapped out of the live range can be reused.
   //-------------------------------------------------------------------------
 
-  if( m_fCurrentTime - m_fLastUpdate > m_fReleaseInterval )
+  bool bRelease = m_fCurrentTime - pEmitter->m_fLastUpdate > pEmitter->m_fReleaseInterval;
+
+  if( !bRelease && pEmitter->m_dwBurst <= 0 )
+    return -1;
+
+  // Reset update timing, bursts come on top of the flow...
+  if( bRelease )
+    pEmitter->m_fLastUpdate = m_fCurrentTime;
+
+  int dwRelease = (bRelease ? std::max( 0, pEmitter->m_dwNumToRelease ) : 0) + pEmitter->m_dwBurst;
+  pEmitter->m_dwBurst = 0;
+
+  // The compact store can't hold particles emitted outside its extent
+  if( m_bCompact && (!InFixedRange( pEmitter->m_vPosition.x, m_fToFixed ) ||
+                     !InFixedRange( pEmitter->m_vPosition.y, m_fToFixed ) ||
+                     !InFixedRange( pEmitter->m_vPosition.z, m_fToFixed )) )
+    return 0;
+
+  // Emit new particles at specified flow rate, as many as there is room
+  // left for at the end of the live range...
+  int dwFirstNew = m_dwActiveCount;
+  int dwEndNew   = dwFirstNew + std::min( dwRelease, m_dwMaxParticles - m_dwActiveCount );
+  int dwCountNew = dwEndNew - dwFirstNew;
+
+  if( dwCountNew == 0 )
+    return 0;
+
+  // The new particles share one parameter block, the emitter's last one
+  // unless its settings have changed since
+  ParticleParams params;
+  memset( &params, 0, sizeof(params) );
+  params.m_fGravX     = pEmitter->m_vGravity.x;
+  params.m_fGravY     = pEmitter->m_vGravity.y;
+  params.m_fGravZ     = pEmitter->m_vGravity.z;
+  params.m_fWindX     = pEmitter->m_vWind.x;
+  params.m_fWindY     = pEmitter->m_vWind.y;
+  params.m_fWindZ     = pEmitter->m_vWind.z;
+  params.m_fDrag      = pEmitter->m_bAirResistence ? 1.0f : 0.0f;
+  params.m_fInvDrag   = params.m_fDrag > 0.0f ? 1.0f / params.m_fDrag : 0.0f;
+  params.m_fLifeCycle = m_bCompact ? std::min( pEmitter->m_fLifeCycle, COMPACT_MAX_AGE ) : pEmitter->m_fLifeCycle;
+  params.m_fSize      = pEmitter->m_fSize;
+
+  if( pEmitter->m_nParam < 0 ||
+      memcmp( &params, &m_pParamTable[pEmitter->m_nParam], sizeof(params) ) != 0 )
   {
-    // Reset update timing...
-    m_fLastUpdate = m_fCurrentTime;
-
-    // Emit new particles at specified flow rate...
-    for( int i = 0; i < m_dwNumToRelease; ++i )
+    // With the table full the old block has to do
+    int nParam = AcquireParams( params );
+    if( nParam >= 0 )
     {
-      // Do we have any free particles to put back to work?
-      if( m_pFreeList )
+      if( pEmitter->m_nParam >= 0 )
+        ReleaseParams( pEmitter->m_nParam );
+      pEmitter->m_nParam = nParam;
+    }
+    else if( pEmitter->m_nParam < 0 )
+      return 0;
+  }
+  m_pParamRefs[pEmitter->m_nParam] += dwCountNew;
+
+  // ...drawing all the random numbers they need in bulk first, straight
+  // into the arrays the results end up in. The colors are worked out in
+  // the previous positions of the new slots, set last. The compact store
+  // has no float arrays to work in, so it goes through m_pEmitScratch
+  // PARTICLE_EMIT_BATCH particles at a time.
+  int dwCount;
+  for( int dwBatch = dwFirstNew; dwBatch < dwEndNew; dwBatch += dwCount )
+  {
+    dwCount = m_bCompact ? std::min( PARTICLE_EMIT_BATCH, dwEndNew - dwBatch ) : dwCountNew;
+    float *pVelX = m_bCompact ? m_pEmitScratch[0] : m_pVelX + dwBatch;
+    float *pVelY = m_bCompact ? m_pEmitScratch[1] : m_pVelY + dwBatch;
+    float *pVelZ = m_bCompact ? m_pEmitScratch[2] : m_pVelZ + dwBatch;
+    float *pH    = m_bCompact ? m_pEmitScratch[3] : m_pPrevX + dwBatch;
+    float *pS    = m_bCompact ? m_pEmitScratch[4] : m_pPrevY + dwBatch;
+    float *pV    = m_bCompact ? m_pEmitScratch[5] : m_pPrevZ + dwBatch;
+
+    if( pEmitter->m_fVelocityVar != 0.0f )
+      m_random.FillUnitVectors( pVelX, pVelY, pVelZ, dwCount );
+    if( pEmitter->m_fHVar > 0 )
+      m_random.FillUniform( pH, dwCount, -1.0f, 1.0f );
+    if( pEmitter->m_fSVar > 0 )
+      m_random.FillUniform( pS, dwCount, -1.0f, 1.0f );
+    if( pEmitter->m_fVVar > 0 )
+      m_random.FillUniform( pV, dwCount, -1.0f, 1.0f );
+
+    for( int j = 0; j < dwCount; ++j )
+    {
+      // Set the attributes for our new particle...
+      CVector vCurVel = pEmitter->m_vVelocity;
+
+      if( pEmitter->m_fVelocityVar != 0.0f )
+      {
+        CVector vRandomVec( pVelX[j], pVelY[j], pVelZ[j] );
+        vCurVel += vRandomVec * pEmitter->m_fVelocityVar;
+      }
+
+      pVelX[j] = vCurVel.x;
+      pVelY[j] = vCurVel.y;
+      pVelZ[j] = vCurVel.z;
+      m_pParam[dwBatch + j] = (unsigned short)pEmitter->m_nParam;
+
+      //modifiy h by m_fHMod
+      float h = pEmitter->m_clrColor.h;
+      if (pEmitter->m_fHVar > 0)
+      {
+        h = pH[j] * pEmitter->m_fHVar;
+        h+=pEmitter->m_clrColor.h;
+
+        while (h > 360.0f)	h -= 360.0f;
+        while (h < 0)		h += 360.0f;
+
+        h = std::max(pEmitter->m_fMinH, std::min(pEmitter->m_fMaxH, h));
+      }
+
+      //modifiy s by m_fSMod
+      float s = pEmitter->m_clrColor.s;
+      if (pEmitter->m_fSVar > 0)
       {
-        // If so, hand over the first free one to be reused.
-        pParticle = m_pFreeList;
-        // Then make the next free particle in the list next to go!
-        m_pFreeList = pParticle->m_pNext;
+        s = pS[j] * pEmitter->m_fSVar;
+        s+=pEmitter->m_clrColor.s;
+
+        while (s > 1.0f) s-= 1.0f;
+        while (s < 0.0f) s+= 1.0f;
+
+        s = std::max(pEmitter->m_fMinS, std::min(pEmitter->m_fMaxS, s));
       }
-      else
+
+      //modifiy v by m_fVMod
+      float v = pEmitter->m_clrColor.v;
+      if (pEmitter->m_fVVar > 0)
       {
-        // There are no free particles to recycle...
-        // We'll have to create a new one from scratch!
-        if( m_dwActiveCount < m_dwMaxParticles )
-        {
-          if( NULL == ( pParticle = (Particle*)malloc( sizeof(Particle)) ) )
-          {
-            return false;
-          }
-          memset(pParticle ,0,sizeof(Particle) );
-        }
+        v = pV[j] * pEmitter->m_fVVar;
+        v+=pEmitter->m_clrColor.v;
+
+        while (v > 1.0f) v-= 1.0f;
+        while (v < 1.0f) v+= 1.0f;
+
+        v = std::max(pEmitter->m_fMinV, std::min(pEmitter->m_fMaxV, v));
       }
 
-      if( m_dwActiveCount < m_dwMaxParticles )
+      // Stash HSV, converted below
+      pH[j] = h;
+      pS[j] = s;
+      pV[j] = v;
+    }
+
+    // Particle colors don't change after emission, so this is the only
+    // HSV to RGB conversion a particle ever sees
+    m_colorTable.Lookup( pH, pS, pV, pH, pS, pV, dwCount );
+    PackColors( pH, pS, pV, m_pColor + dwBatch, dwCount );
+
+    if( m_bCompact )
+    {
+      short nPosX = ToFixed( pEmitter->m_vPosition.x, m_fToFixed );
+      short nPosY = ToFixed( pEmitter->m_vPosition.y, m_fToFixed );
+      short nPosZ = ToFixed( pEmitter->m_vPosition.z, m_fToFixed );
+      unsigned short nTick = GetCurrentTick();
+
+      for( int j = 0, i = dwBatch; j < dwCount; ++j, ++i )
       {
-        pParticle->m_pNext = m_pActiveList; // Make it the new head...
-        m_pActiveList = pParticle;
-
-        // Set the attributes for our new particle...
-        pParticle->m_vCurVel = m_vVelocity;
-
-        if( m_fVelocityVar != 0.0f )
-        {
-          CVector vRandomVec = getRandomVector();
-          pParticle->m_vCurVel += vRandomVec * m_fVelocityVar;
-        }
-
-        pParticle->m_fInitTime  = m_fCurrentTime;
-        pParticle->m_vCurPos    = m_vPosition;
-
-        //modifiy h by m_fHMod
-        float h = m_clrColor.h;
-        if (m_fHVar > 0)
-        {
-          h = getRandomMinMax(-1.0f, 1.0f) * m_fHVar;
-          h+=m_clrColor.h;
-
-          while (h > 360.0f)	h -= 360.0f;
-          while (h < 0)		h += 360.0f;
-
-          h = std::max(m_fMinH, std::min(m_fMaxH, h));
-        }
-
-        //modifiy s by m_fSMod
-        float s = m_clrColor.s;
-        if (m_fSVar > 0)
-        {
-          s = getRandomMinMax(-1.0f, 1.0f) * m_fSVar;
-          s+=m_clrColor.s;
-
-          while (s > 1.0f) s-= 1.0f;
-          while (s < 0.0f) s+= 1.0f;
-
-          s = std::max(m_fMinS, std::min(m_fMaxS, s));
-        }
-
-        //modifiy v by m_fVMod
-        float v = m_clrColor.v;
-        if (m_fVVar > 0)
-        {
-          v = getRandomMinMax(-1.0f, 1.0f) * m_fVVar;
-          v+=m_clrColor.v;
-
-          while (v > 1.0f) v-= 1.0f;
-          while (v < 1.0f) v+= 1.0f;
-
-          v = std::max(m_fMinV, std::min(m_fMaxV, v));
-        }
-
-        pParticle->m_clrColor	= HsvColor(h, s, v);
-
-        pParticle->m_vGravity	= m_vGravity;
-        pParticle->m_vWind		= m_vWind;
-        pParticle->m_fVelocityVar = m_fVelocityVar;
-        pParticle->m_fSize		= m_fSize;
-        pParticle->m_fLifeCycle	= m_fLifeCycle;
-        pParticle->m_bAirResistence = m_bAirResistence;
-
-        ++m_dwActiveCount;
+        m_pFixedVelX[i]  = ToFixed( pVelX[j], m_fToFixed );
+        m_pFixedVelY[i]  = ToFixed( pVelY[j], m_fToFixed );
+        m_pFixedVelZ[i]  = ToFixed( pVelZ[j], m_fToFixed );
+        m_pFixedPosX[i]  = m_pFixedPrevX[i] = nPosX;
+        m_pFixedPosY[i]  = m_pFixedPrevY[i] = nPosY;
+        m_pFixedPosZ[i]  = m_pFixedPrevZ[i] = nPosZ;
+        m_pBirthTick[i]  = nTick;
+      }
+    }
+    else
+    {
+      for( int i = dwBatch; i < dwBatch + dwCount; ++i )
+      {
+        m_pInitTime[i] = m_fCurrentTime;
+        m_pPosX[i]     = m_pPrevX[i] = pEmitter->m_vPosition.x;
+        m_pPosY[i]     = m_pPrevY[i] = pEmitter->m_vPosition.y;
+        m_pPosZ[i]     = m_pPrevZ[i] = pEmitter->m_vPosition.z;
       }
     }
   }
 
-  return true;
+  m_dwActiveCount = dwEndNew;
+  return dwCountNew;
 }
 
 //-----------------------------------------------------------------------------
-// Name: RestartParticleSystem()
-// Desc:
+// Name: SetThreadCount()
+// Desc: Starts (or stops) the worker threads Update() spreads particles over
 //-----------------------------------------------------------------------------
-void CParticleSystem::RestartParticleSystem( void )
+void CParticleSystem::SetThreadCount( int nThreads )
 {
-  Particle  *pParticle;
-  Particle **ppParticle;
+  if( nThreads < 1 )
+    nThreads = 1;
 
-  ppParticle = &m_pActiveList; // Start at the head of the active list
+  if( nThreads == m_nThreads )
+    return;
 
-  while( *ppParticle )
+  if( m_pWorkerPool != NULL )
   {
-    pParticle = *ppParticle; // Set a pointer to the head
-
-    // Put the particle back on the free list...
-    *ppParticle = pParticle->m_pNext;
-    pParticle->m_pNext = m_pFreeList;
-    m_pFreeList = pParticle;
+    delete m_pWorkerPool;
+    m_pWorkerPool = NULL;
+  }
+  m_nThreads = 1;
 
-    --m_dwActiveCount;
+  if( nThreads > 1 )
+  {
+    m_pWorkerPool = new CWorkerPool;
+    m_pWorkerPool->Start( nThreads );
+    m_nThreads = m_pWorkerPool->GetThreadCount();
   }
 }
 
 //-----------------------------------------------------------------------------
-// Name: Render()
-// Desc: Renders the particle system
-// Note: I couldn't get textures to display on the point sprites used by
-//		 the original Render method, so I have heavily rewritten it to not
-//		 user point sprites
+// Name: SimulateChunk()
+// Desc: Worker pool job, simulates one PARTICLE_CHUNK_SIZE slice of particles
 //-----------------------------------------------------------------------------
-#include <iostream>
-bool CParticleSystem::Render()
+void CParticleSystem::SimulateChunk( void *pContext, int dwChunk )
 {
-    struct CUSTOMVERTEX
-    {
-      float x, y, z; // The transformed position for the vertex.
-      float tu, tv;  // The vertex texture coordinates
-    };
+  CParticleSystem *pSystem = (CParticleSystem*)pContext;
 
-    //Store each point of the triangle together with it's colour
-    CUSTOMVERTEX cvVertices[] =
-    {
-      { -1.0f, -1.0f, 0.0f    ,0.0f, 1.0f }, // x, y, z, textures (tu, tv) 
-      { -1.0f,  1.0f, 0.0f    ,0.0f, 0.0f }, 
-      {  1.0f,  1.0f, 0.0f    ,1.0f, 0.0f },
+  int dwBegin = dwChunk * PARTICLE_CHUNK_SIZE;
+  int dwEnd   = std::min( dwBegin + PARTICLE_CHUNK_SIZE, pSystem->m_dwActiveCount );
+
+  pSystem->SimulateParticles( dwBegin, dwEnd );
+}
+
+//-----------------------------------------------------------------------------
+// Name: EvaluatePositions()
+// Desc: Evaluates the analytic particles into m_pPrev*, at the time
+//       between the last two steps that the integrator would interpolate
+//-----------------------------------------------------------------------------
+void CParticleSystem::EvaluatePositions( void )
+{
+  if( !m_bBirthState )
+    return;
+
+  PROFILE_SCOPE( PROFILE_EVALUATE );
+
+  m_fEvaluateTime = m_fCurrentTime - (1.0f - m_fInterpolation) * m_fFixedStep;
+
+  int nChunks = (m_dwActiveCount + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
 
-      { -1.0f, -1.0f, 0.0f    ,0.0f, 1.0f },
-      {  1.0f,  1.0f, 0.0f    ,1.0f, 0.0f },
-      {  1.0f, -1.0f, 0.0f    ,1.0f, 1.0f }
+  if( m_pWorkerPool != NULL && nChunks > 1 )
+    m_pWorkerPool->Run( EvaluateChunk, this, nChunks );
+  else
+    EvaluateParticles( GetParticleStreams(), 0, m_dwActiveCount, m_fEvaluateTime,
+                       m_pPrevX, m_pPrevY, m_pPrevZ );
+}
+
+//-----------------------------------------------------------------------------
+// Name: EvaluateChunk()
+// Desc: Worker pool job, evaluates one PARTICLE_CHUNK_SIZE slice of particles
+//-----------------------------------------------------------------------------
+void CParticleSystem::EvaluateChunk( void *pContext, int dwChunk )
+{
+  CParticleSystem *pSystem = (CParticleSystem*)pContext;
 
-    };
+  int dwBegin = dwChunk * PARTICLE_CHUNK_SIZE;
+  int dwEnd   = std::min( dwBegin + PARTICLE_CHUNK_SIZE, pSystem->m_dwActiveCount );
 
-    const GLfloat dif[] = {1.0, 1.0, 1.0, 1.0};
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, dif);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, dif);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, dif);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, dif);
+  EvaluateParticles( pSystem->GetParticleStreams(), dwBegin, dwEnd, pSystem->m_fEvaluateTime,
+                     pSystem->m_pPrevX, pSystem->m_pPrevY, pSystem->m_pPrevZ );
+}
 
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+//-----------------------------------------------------------------------------
+// Name: SimulateParticles()
+// Desc: Advances particles [dwBegin, dwEnd) by m_fStepTime. Particles only
+//       ever touch their own slots here, so disjoint ranges can run in
+//       parallel; removing the expired ones is left to CompactParticles().
+//-----------------------------------------------------------------------------
+void CParticleSystem::SimulateParticles( int dwBegin, int dwEnd )
+{
+  uint64_t nStart = m_bProfiling ? ProfilerNow() : 0;
+
+  // Integrate in one vectorized pass. This also keeps the pre-step
+  // positions in m_pPrev* and flags expired particles. Analytic particles
+  // only move when they are drawn, so they are just checked for expiry.
+  if( m_bBirthState )
+    ExpireParticles( GetParticleStreams(), dwBegin, dwEnd, m_fCurrentTime );
+  else if( m_bCompact )
+    IntegrateCompactParticles( GetCompactStreams(), dwBegin, dwEnd,
+                               GetCurrentTick(), m_fStepTime, m_bDrag );
+  else
+    IntegrateParticles( GetParticleStreams(), dwBegin, dwEnd,
+                        m_fCurrentTime, m_fStepTime, m_bDrag );
+
+  uint64_t nIntegrated = m_bProfiling ? ProfilerNow() : 0;
+
+  if( m_planes.m_nPlanes > 0 )
+  {
+    if( m_bCompact )
+      CollideCompactParticles( GetCompactStreams(), dwBegin, dwEnd, m_planes, GetCurrentTick() );
+    else
+      CollideParticles( GetParticleStreams(), dwBegin, dwEnd, m_planes );
+  }
+
+  // Chunks finish on different threads, so their times are summed
+  if( m_bProfiling )
+  {
+    __atomic_fetch_add( &m_nIntegrateTime, nIntegrated - nStart, __ATOMIC_RELAXED );
+    if( m_planes.m_nPlanes > 0 )
+      __atomic_fetch_add( &m_nCollideTime, ProfilerNow() - nIntegrated, __ATOMIC_RELAXED );
+  }
+}
 
+//-----------------------------------------------------------------------------
+// Name: CompactParticles()
+// Desc: Removes the particles flagged as expired by swapping the last live
+//       particle into their slot. Runs in index order, so the resulting
+//       layout does not depend on how the simulation was split up.
+//-----------------------------------------------------------------------------
+void CParticleSystem::CompactParticles( void )
+{
+  int i = 0; // Start at the first live particle
 
-    Particle    *pParticle = m_pActiveList;
-    int particles=0;
-    while (pParticle)
+  while( i < m_dwActiveCount )
+  {
+    if( m_pExpired[i] )
     {
-      ++particles;
-      CRGBA col = convertHSV2RGB(pParticle->m_clrColor);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, (const GLfloat*)col.col);
-      glMatrixMode(GL_MODELVIEW);
-      glPushMatrix();
-      glTranslatef(pParticle->m_vCurPos.x, pParticle->m_vCurPos.y, pParticle->m_vCurPos.z);
-      glScalef(m_fSize, m_fSize, m_fSize);
-      glBegin(GL_TRIANGLES);
-      for (size_t i=0;i<6;++i)
-      {
-        glTexCoord2f(cvVertices[i].tu, cvVertices[i].tv);
-        glVertex3f(cvVertices[i].x, cvVertices[i].y, cvVertices[i].z);
-      }
-      glEnd();
-      glPopMatrix();
-      pParticle = pParticle->m_pNext;
+      // Time is up, move the last live particle into this slot and
+      // check it next...
+      ReleaseParams( m_pParam[i] );
+      --m_dwActiveCount;
+      MoveParticle( i, m_dwActiveCount );
     }
+    else
+      ++i;
+  }
+}
 
-    glDisable(GL_TEXTURE_2D);
-
-    return true;
+//-----------------------------------------------------------------------------
+// Name: RestartParticleSystem()
+// Desc:
+//-----------------------------------------------------------------------------
+void CParticleSystem::RestartParticleSystem( void )
+{
+  // Every particle goes back to the free part of the arrays
+  for( int i = 0; i < m_dwActiveCount; ++i )
+    ReleaseParams( m_pParam[i] );
+  m_dwActiveCount = 0;
+  for( int n = 0; n < m_nEmitters; ++n )
+    m_pEmitters[n].m_dwBurst = 0;
 }
 
 //-----------------------------------------------------------------------------
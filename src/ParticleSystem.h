@@ -10,21 +10,40 @@
 #define CPARTICLESYSTEM_H_INCLUDED
 
 #include "types.h"
+#include "ParticleKernels.h"
+#include "Profiler.h"
+#include "Random.h"
+#include <stddef.h>
+#include "WorkerPool.h"
 #include <GL/gl.h>
 
 //-----------------------------------------------------------------------------
 // SYMBOLIC CONSTANTS
 //-----------------------------------------------------------------------------
 
-// Classify Point
-const int CP_FRONT   = 0;
-const int CP_BACK    = 1;
-const int CP_ONPLANE = 2;
+// Render Modes
+const int RM_BILLBOARDS   = 0;  // Two textured triangles per particle
+const int RM_POINTSPRITES = 1;  // One point sprite per particle, billboards if the sprites get too big
+const int RM_INSTANCED    = 2;  // One instance of a static quad per particle
 
-// Collision Results
-const int CR_BOUNCE  = 0;
-const int CR_STICK   = 1;
-const int CR_RECYCLE = 2;
+// Number of particles handed to a worker thread at a time
+const int PARTICLE_CHUNK_SIZE = 2048;
+
+// Most fixed steps one Update() runs; time beyond that is dropped
+const int PARTICLE_MAX_SUBSTEPS = 16;
+
+// Most emitters one system can have
+const int PARTICLE_MAX_EMITTERS = 32;
+
+// Most parameter blocks particles can reference at once, the range of
+// their 16 bit index
+const int PARTICLE_MAX_PARAMS = 65536;
+
+// Units from the origin the compact store reaches by default
+const float PARTICLE_COMPACT_EXTENT = 64.0f;
+
+// Particles emitted at a time into the compact store
+const int PARTICLE_EMIT_BATCH = 256;
 
 //-----------------------------------------------------------------------------
 // GLOBALS
@@ -39,38 +58,68 @@ typedef struct HsvColor
 		float h, s, v;
 } HsvColor;
 
-struct Plane
+// Where and how one emitter releases particles. The emitters of a system
+// share its particle store, collision planes, texture and draws.
+struct ParticleEmitter
 {
-    CVector m_vNormal;           // The plane's normal
-    CVector m_vPoint;            // A coplanar point within the plane
-    float       m_fBounceFactor;     // Coefficient of restitution (or how bouncy the plane is)
-    int         m_nCollisionResult;  // What will particles do when they strike the plane
+    int         m_dwNumToRelease;
+    int         m_dwBurst;               // Extra particles the next step releases
+    float       m_fReleaseInterval;
+    float       m_fLastUpdate;           // Time of the last release
+    float       m_fLifeCycle;
+    float       m_fSize;
+    HsvColor    m_clrColor;
+    CVector     m_vPosition;
+    CVector     m_vVelocity;
+    CVector     m_vGravity;
+    CVector     m_vWind;
+    bool        m_bAirResistence;
+    float       m_fVelocityVar;
 
-    Plane      *m_pNext;             // Next plane in list
-};
+    float       m_fMinH;
+    float       m_fMaxH;
+    float       m_fHVar;
 
-struct Particle
-{
-    CVector m_vCurPos;    // Current position of particle
-    CVector m_vCurVel;    // Current velocity of particle
-    float       m_fInitTime;  // Time of creation of particle
-	HsvColor	m_clrColor;	  // Color of particle
-
-	CVector m_vGravity; 
-    CVector m_vWind;    
-	float		m_fVelocityVar;
-	float		m_fSize;
-	float		m_fLifeCycle;
-	bool		m_bAirResistence;
-
-    Particle   *m_pNext;      // Next particle in list
+    float       m_fMinS;
+    float       m_fMaxS;
+    float       m_fSVar;
+
+    float       m_fMinV;
+    float       m_fMaxV;
+    float       m_fVVar;
+
+    int         m_nParam;                // Block its last particles reference, -1 for none
 };
 
 // Custom vertex and FVF declaration for point sprite vertex points
 struct PointVertex
 {
     CVector posit;
-    CRGBA color;
+    unsigned int color;  // RGBA8, red in the lowest byte
+};
+
+// Vertex of the batched billboard renderer, six per particle
+struct BillboardVertex
+{
+    float tu, tv;      // Texture coordinates
+    unsigned int color;  // Emissive color of the particle, RGBA8
+    float x, y, z;     // World space position of the corner
+};
+
+// Per particle data of the instanced renderer
+struct InstanceVertex
+{
+    float x, y, z;     // World space position of the particle
+    float size;        // Half the edge length of its quad
+    unsigned int color;  // Emissive color of the particle, RGBA8
+};
+
+// The same from the compact store, position and size in its fixed point
+struct CompactInstanceVertex
+{
+    short x, y, z;
+    short size;
+    unsigned int color;
 };
 
 //-----------------------------------------------------------------------------
@@ -98,72 +147,136 @@ public:
     CParticleSystem(void);
    ~CParticleSystem(void);
     void dtor();
-    void SetMaxParticles( int dwMaxParticles ) { m_dwMaxParticles = dwMaxParticles; }
+    void SetMaxParticles( int dwMaxParticles );
 	int GetMaxParticles( void ) { return m_dwMaxParticles; }
 
-    void SetNumToRelease( int dwNumToRelease ) { m_dwNumToRelease = dwNumToRelease; }
-	int GetNumToRelease( void ) { return m_dwNumToRelease; }
+    // Emitters release particles into the one store in turn. There is
+    // always at least one; the ones added copy emitter 0. The emitter
+    // attributes below are those of the selected emitter.
+    void SetEmitterCount( int nEmitters );
+    int GetEmitterCount( void ) { return m_nEmitters; }
+    void SelectEmitter( int nEmitter );
+
+    void SetNumToRelease( int dwNumToRelease ) { m_pEmitter->m_dwNumToRelease = dwNumToRelease; }
+	int GetNumToRelease( void ) { return m_pEmitter->m_dwNumToRelease; }
 
-    void SetReleaseInterval( float fReleaseInterval ) { m_fReleaseInterval = fReleaseInterval; }
-    float GetReleaseInterval( void ) { return m_fReleaseInterval; }
+    // Releases dwCount extra particles at the next step, release interval
+    // or not. Bursts add up until then.
+    void Burst( int dwCount ) { m_pEmitter->m_dwBurst += dwCount > 0 ? dwCount : 0; }
 
-    void SetLifeCycle( float fLifeCycle ) { m_fLifeCycle = fLifeCycle; }
-	float GetLifeCycle( void ) { return m_fLifeCycle; }
+    void SetReleaseInterval( float fReleaseInterval ) { m_pEmitter->m_fReleaseInterval = fReleaseInterval; }
+    float GetReleaseInterval( void ) { return m_pEmitter->m_fReleaseInterval; }
 
-    void SetSize( float fSize ) { m_fSize = fSize; }
-	float GetSize( void ) { return m_fSize; }
+    void SetLifeCycle( float fLifeCycle ) { m_pEmitter->m_fLifeCycle = fLifeCycle; }
+	float GetLifeCycle( void ) { return m_pEmitter->m_fLifeCycle; }
+
+    void SetSize( float fSize ) { m_pEmitter->m_fSize = fSize; }
+	float GetSize( void ) { return m_pEmitter->m_fSize; }
 	float GetMaxPointSize( void ) { return m_fMaxPointSize; }
 
-    void SetColor( HsvColor clrColor ) { m_clrColor = clrColor; }
-	HsvColor GetColor( void ) { return m_clrColor; }
+	void SetRenderMode( int nRenderMode ) { m_nRenderMode = nRenderMode; }
+	int GetRenderMode( void ) { return m_nRenderMode; }
+
+    void SetColor( HsvColor clrColor ) { m_pEmitter->m_clrColor = clrColor; }
+	HsvColor GetColor( void ) { return m_pEmitter->m_clrColor; }
+
+    // Look emitted colors up in a nHue x nSat x nVal table instead of
+    // converting them; 0 for any resolution goes back to converting
+    bool SetColorTable( int nHue, int nSat, int nVal ) { return m_colorTable.Build( nHue, nSat, nVal ); }
+
+    // Emission draws from the system's own generator; the same seed and
+    // the same sequence of updates give the same particles
+    void SetRandomSeed( uint64_t seed ) { m_random.Seed( seed ); }
+
+	void SetPosition( const CVector& vPosition ) { m_pEmitter->m_vPosition = vPosition; }
+	const CVector& GetPosition( void ) { return m_pEmitter->m_vPosition; }
+
+    void SetVelocity( const CVector& vVelocity ) { m_pEmitter->m_vVelocity = vVelocity; }
+	const CVector& GetVelocity( void ) { return m_pEmitter->m_vVelocity; }
+
+    void SetGravity( const CVector& vGravity ) { m_pEmitter->m_vGravity = vGravity; }
+	const CVector& GetGravity( void ) { return m_pEmitter->m_vGravity; }
+
+    void SetWind( const CVector& vWind ) { m_pEmitter->m_vWind = vWind; }
+	const CVector& GetWind( void ) { return m_pEmitter->m_vWind; }
 
-	void SetPosition( const CVector& vPosition ) { m_vPosition = vPosition; }
-	const CVector& GetPosition( void ) { return m_vPosition; }
+    void SetAirResistence( bool bAirResistence ) { m_pEmitter->m_bAirResistence = bAirResistence; }
+	bool GetAirResistence( void ) { return m_pEmitter->m_bAirResistence; }
 
-    void SetVelocity( const CVector& vVelocity ) { m_vVelocity = vVelocity; }
-	const CVector& GetVelocity( void ) { return m_vVelocity; }
+    void SetVelocityVar( float fVelocityVar ) { m_pEmitter->m_fVelocityVar = fVelocityVar; }
+	float GetVelocityVar( void ) { return m_pEmitter->m_fVelocityVar; }
 
-    void SetGravity( const CVector& vGravity ) { m_vGravity = vGravity; }
-	const CVector& GetGravity( void ) { return m_vGravity; }
+    // Adds a plane particles collide with and returns a handle to it, -1
+    // when there are COLLISION_MAX_PLANES already. Handles stay valid until
+    // their plane is removed, whatever happens to the others, and are
+    // handed out again after that. Particles meet the planes from the last
+    // one added to the first.
+    int SetCollisionPlane( const CVector& vPlaneNormal, const CVector& vPoint, 
+                           float fBounceFactor = 1.0f, int nCollisionResult = CR_BOUNCE );
+    void RemoveCollisionPlane( int nHandle );
+    void ClearCollisionPlanes( void );
+    int GetCollisionPlaneCount( void ) { return m_planes.m_nPlanes; }
 
-    void SetWind( const CVector& vWind ) { m_vWind = vWind; }
-	const CVector& GetWind( void ) { return m_vWind; }
+	void SetHVar( float fHVar ) { m_pEmitter->m_fHVar = fHVar; }
+	float GetHVar( void ) { return m_pEmitter->m_fHVar; }
 
-    void SetAirResistence( bool bAirResistence ) { m_bAirResistence = bAirResistence; }
-	bool GetAirResistence( void ) { return m_bAirResistence; }
+	void SetMaxH( float fMaxH ) { m_pEmitter->m_fMaxH = fMaxH; }
+	float GetMaxH( void ) { return m_pEmitter->m_fMaxH; }
 
-    void SetVelocityVar( float fVelocityVar ) { m_fVelocityVar = fVelocityVar; }
-	float GetVelocityVar( void ) { return m_fVelocityVar; }
+	void SetMinH( float fMinH ) { m_pEmitter->m_fMinH = fMinH; }
+	float GetMinH( void ) { return m_pEmitter->m_fMinH; }
 
-    void SetCollisionPlane( const CVector& vPlaneNormal, const CVector& vPoint, 
-                            float fBounceFactor = 1.0f, int nCollisionResult = CR_BOUNCE );
+	void SetSVar( float fSVar ) { m_pEmitter->m_fSVar = fSVar; }
+	float GetSVar( void ) { return m_pEmitter->m_fSVar; }
 
-	void SetHVar( float fHVar ) { m_fHVar = fHVar; }
-	float GetHVar( void ) { return m_fHVar; }
+	void SetMaxS( float fMaxS ) { m_pEmitter->m_fMaxS = fMaxS; }
+	float GetMaxS( void ) { return m_pEmitter->m_fMaxS; }
 
-	void SetMaxH( float fMaxH ) { m_fMaxH = fMaxH; }
-	float GetMaxH( void ) { return m_fMaxH; }
+	void SetMinS( float fMinS ) { m_pEmitter->m_fMinS = fMinS; }
+	float GetMinS( void ) { return m_pEmitter->m_fMinS; }
 
-	void SetMinH( float fMinH ) { m_fMinH = fMinH; }
-	float GetMinH( void ) { return m_fMinH; }
+	void SetVVar( float fVVar ) { m_pEmitter->m_fVVar = fVVar; }
+	float GetVVar( void ) { return m_pEmitter->m_fVVar; }
 
-	void SetSVar( float fSVar ) { m_fSVar = fSVar; }
-	float GetSVar( void ) { return m_fSVar; }
+	void SetMaxV( float fMaxV ) { m_pEmitter->m_fMaxV = fMaxV; }
+	float GetMaxV( void ) { return m_pEmitter->m_fMaxV; }
 
-	void SetMaxS( float fMaxS ) { m_fMaxS = fMaxS; }
-	float GetMaxS( void ) { return m_fMaxS; }
+	void SetMinV( float fMinV ) { m_pEmitter->m_fMinV = fMinV; }
+	float GetMinV( void ) { return m_pEmitter->m_fMinV; }
 
-	void SetMinS( float fMinS ) { m_fMinS = fMinS; }
-	float GetMinS( void ) { return m_fMinS; }
+	// Spreads Update() over nThreads cores; 1 runs everything inline
+	void SetThreadCount( int nThreads );
+	int GetThreadCount( void ) { return m_nThreads; }
 
-	void SetVVar( float fVVar ) { m_fVVar = fVVar; }
-	float GetVVar( void ) { return m_fVVar; }
+	int GetActiveCount( void ) { return m_dwActiveCount; }
 
-	void SetMaxV( float fMaxV ) { m_fMaxV = fMaxV; }
-	float GetMaxV( void ) { return m_fMaxV; }
+	// Keeps positions and velocities as 16 bit fixed point, up to fExtent
+	// units (per second) from 0, and birth times as 16 bit ticks. Half the
+	// memory traffic of the float store, for a step of fExtent / 32767 and
+	// life cycles of at most COMPACT_MAX_AGE. Emitters outside the extent
+	// release nothing and particles that leave it expire; velocities
+	// beyond it are clamped. Restarts the system.
+	void SetCompactStorage( bool bCompact, float fExtent = PARTICLE_COMPACT_EXTENT );
+	bool GetCompactStorage( void ) { return m_bCompact; }
 
-	void SetMinV( float fMinV ) { m_fMinV = fMinV; }
-	float GetMinV( void ) { return m_fMinV; }
+	// Keeps only what particles were emitted with and works their positions
+	// out from their age when rendering, with no integration pass at all.
+	// Exact where the integrator approximates, so trajectories differ
+	// slightly. Needs the float store and no collision planes; the system
+	// integrates as usual while either is in use.
+	void SetAnalytic( bool bAnalytic );
+	bool GetAnalytic( void ) { return m_bAnalytic; }
+
+	// Works out the positions Render() draws, for the current time. Render()
+	// calls it; only does anything while the system is analytic.
+	void EvaluatePositions( void );
+
+	// Advances the simulation in steps of fStep seconds, however long the
+	// frames are, and renders in between the last two steps. 0 goes back
+	// to one step of the frame's length per Update().
+	void SetFixedStep( float fStep );
+	float GetFixedStep( void ) { return m_fFixedStep; }
+	void SetMaxSubsteps( int nSubsteps ) { m_nMaxSubsteps = nSubsteps < 1 ? 1 : nSubsteps; }
 
 	bool Init();
     bool Update( float fElapsedTime );
@@ -175,49 +288,209 @@ public:
 
   void ctor();
 private:
+    bool ReserveParticles( int dwCapacity );
+    void FreeParticles( void );
+    void MoveParticle( int dwDst, int dwSrc );
+    int AcquireParams( const ParticleParams &params );
+    void ReleaseParams( int nParam );
+    void FreeParams( void );
+    ParticleStreams GetParticleStreams( void );
+    CompactParticleStreams GetCompactStreams( void );
+    int GetParticleArrays( void ***pppArrays, size_t *pElementSizes );
+    void BuildBillboards( int dwFirst, int dwCount, BillboardVertex *pVertices );
+    void BuildPointSprites( int dwFirst, int dwCount, PointVertex *pVertices );
+    void RenderBillboards( void );
+    bool RenderPointSprites( void );
+    void ReleaseRenderer( void );
+    bool InitInstancing( void );
+    void BuildInstances( int dwFirst, int dwCount, InstanceVertex *pVertices );
+    void BuildCompactInstances( int dwFirst, int dwCount, CompactInstanceVertex *pVertices );
+    bool RenderInstanced( void );
+    unsigned char *BeginChunk( int dwCount, size_t particleBytes );
+    void EndChunk( int dwCount, size_t particleBytes );
+    static void SimulateChunk( void *pContext, int dwChunk );
+    static void EvaluateChunk( void *pContext, int dwChunk );
+    void UpdateMotionMode( void );
+    void RebaseParticles( bool bToBirthState );
+    void SimulateParticles( int dwBegin, int dwEnd );
+    void UpdateCollisionPlanes( void );
+    void CompactParticles( void );
+    int EmitParticles( ParticleEmitter *pEmitter );
+    bool GetUniformSize( float *pSize );
+    bool Step( float fStepTime );
+
+    // Where particle n is drawn: between the last two steps in fixed step
+    // mode, its current position otherwise. Analytic particles have it
+    // worked out by EvaluatePositions().
+    CVector GetRenderPosition( int n )
+    {
+      if( m_bBirthState )
+        return CVector( m_pPrevX[n], m_pPrevY[n], m_pPrevZ[n] );
+      if( m_bCompact )
+      {
+        CVector vPos = GetParticlePosition( n );
+        if( m_fInterpolation >= 1.0f )
+          return vPos;
+        CVector vPrev = GetParticlePrev( n );
+        return CVector( vPrev.x + (vPos.x - vPrev.x) * m_fInterpolation,
+                        vPrev.y + (vPos.y - vPrev.y) * m_fInterpolation,
+                        vPrev.z + (vPos.z - vPrev.z) * m_fInterpolation );
+      }
+      if( m_fInterpolation >= 1.0f )
+        return CVector( m_pPosX[n], m_pPosY[n], m_pPosZ[n] );
+      return CVector( m_pPrevX[n] + (m_pPosX[n] - m_pPrevX[n]) * m_fInterpolation,
+                      m_pPrevY[n] + (m_pPosY[n] - m_pPrevY[n]) * m_fInterpolation,
+                      m_pPrevZ[n] + (m_pPosZ[n] - m_pPrevZ[n]) * m_fInterpolation );
+    }
+
+    // Particle n's attributes, whichever store holds them. Analytic
+    // particles are where they were last evaluated.
+    CVector GetParticlePosition( int n )
+    {
+      if( m_bBirthState )
+        return CVector( m_pPrevX[n], m_pPrevY[n], m_pPrevZ[n] );
+      if( m_bCompact )
+        return CVector( m_pFixedPosX[n] * m_fFromFixed, m_pFixedPosY[n] * m_fFromFixed, m_pFixedPosZ[n] * m_fFromFixed );
+      return CVector( m_pPosX[n], m_pPosY[n], m_pPosZ[n] );
+    }
+    CVector GetParticlePrev( int n )
+    {
+      if( m_bCompact )
+        return CVector( m_pFixedPrevX[n] * m_fFromFixed, m_pFixedPrevY[n] * m_fFromFixed, m_pFixedPrevZ[n] * m_fFromFixed );
+      return CVector( m_pPrevX[n], m_pPrevY[n], m_pPrevZ[n] );
+    }
+    CVector GetParticleVelocity( int n )
+    {
+      if( m_bCompact )
+        return CVector( m_pFixedVelX[n] * m_fFromFixed, m_pFixedVelY[n] * m_fFromFixed, m_pFixedVelZ[n] * m_fFromFixed );
+      return CVector( m_pVelX[n], m_pVelY[n], m_pVelZ[n] );
+    }
+    void SetParticleMotion( int n, const CVector& vPos, const CVector& vVel )
+    {
+      if( m_bCompact )
+      {
+        m_pFixedPosX[n] = ToFixed( vPos.x, m_fToFixed );
+        m_pFixedPosY[n] = ToFixed( vPos.y, m_fToFixed );
+        m_pFixedPosZ[n] = ToFixed( vPos.z, m_fToFixed );
+        m_pFixedVelX[n] = ToFixed( vVel.x, m_fToFixed );
+        m_pFixedVelY[n] = ToFixed( vVel.y, m_fToFixed );
+        m_pFixedVelZ[n] = ToFixed( vVel.z, m_fToFixed );
+        return;
+      }
+      m_pPosX[n] = vPos.x;
+      m_pPosY[n] = vPos.y;
+      m_pPosZ[n] = vPos.z;
+      m_pVelX[n] = vVel.x;
+      m_pVelY[n] = vVel.y;
+      m_pVelZ[n] = vVel.z;
+    }
+
+    // m_fCurrentTime in ticks of the compact store
+    unsigned short GetCurrentTick( void )
+    {
+      return (unsigned short)__builtin_llrint( (double)m_fCurrentTime * COMPACT_TICKS_PER_SECOND );
+    }
+
     GLuint m_texture;
+    GLuint m_vertexBuffer;           // 0 when the driver has no buffer objects
+    unsigned char *m_pVertexData;    // Staging memory for m_dwDiscard particles worth of vertices
+    GLuint m_quadBuffer;             // Static unit quad of the instanced renderer
+    GLuint m_instanceProgram;        // 0 when the driver can't draw instanced
+    GLint  m_instanceScale;          // Its uniform scaling the positions
+    int m_nRenderMode;
     int m_dwVBOffset;
     int m_dwFlush;
     int m_dwDiscard;
-    Particle   *m_pActiveList;
-    Particle   *m_pFreeList;
-    Plane      *m_pPlanes;
+    CollisionPlanes m_planes;
+    int         m_pPlaneIndex[COLLISION_MAX_PLANES];   // Where each handle's plane is in m_planes, -1 for none
+    int         m_pPlaneHandle[COLLISION_MAX_PLANES];  // The handle of each plane in m_planes
+
+    // Particle store. Every attribute lives in its own contiguous array,
+    // preallocated to m_dwMaxParticles entries. Live particles occupy
+    // [0, m_dwActiveCount); a dying particle is replaced by the last live
+    // one, so Update and Render only ever stream over a dense prefix.
+    // What the particles of an emitter have in common is kept once in
+    // m_pParamTable instead.
+    void       *m_pParticleData;     // Single allocation backing the arrays
+    int         m_dwCapacity;        // Number of particles the arrays can hold
+    float      *m_pPosX;             // Current position of particle
+    float      *m_pPosY;
+    float      *m_pPosZ;
+    float      *m_pPrevX;            // Position before the last step
+    float      *m_pPrevY;
+    float      *m_pPrevZ;
+    float      *m_pVelX;             // Current velocity of particle
+    float      *m_pVelY;
+    float      *m_pVelZ;
+    float      *m_pInitTime;         // Time of creation of particle
+    unsigned int *m_pColor;          // Color of particle, RGBA8 as PackColors() makes it
+    unsigned short *m_pParam;        // Its entry of m_pParamTable
+    unsigned char *m_pExpired;       // Scratch: set by the integrator for dead particles
+
+    // The compact store replaces positions, velocities and birth times
+    // when m_bCompact is set; the float arrays above are NULL then and
+    // these otherwise
+    bool        m_bCompact;
+    float       m_fCompactExtent;
+    float       m_fToFixed;          // Fixed point steps per unit
+    float       m_fFromFixed;
+    short      *m_pFixedPosX;
+    short      *m_pFixedPosY;
+    short      *m_pFixedPosZ;
+    short      *m_pFixedPrevX;
+    short      *m_pFixedPrevY;
+    short      *m_pFixedPrevZ;
+    short      *m_pFixedVelX;
+    short      *m_pFixedVelY;
+    short      *m_pFixedVelZ;
+    unsigned short *m_pBirthTick;
+
+    // With m_bBirthState set the float store holds the position, velocity
+    // and time every particle was emitted with, and m_pPrev* the positions
+    // EvaluatePositions() last worked out
+    bool        m_bAnalytic;         // Asked for with SetAnalytic()
+    bool        m_bBirthState;       // What the store holds right now
+    float       m_fEvaluateTime;     // Time EvaluatePositions() is working out
+
+    // Velocities and colors of a batch being emitted into the compact store
+    float       m_pEmitScratch[6][PARTICLE_EMIT_BATCH] __attribute__((aligned(32)));
+
+    // Parameter blocks, reference counted by the particles using them and
+    // the emitter that made them. Grows when it runs out, never shrinks.
+    ParticleParams *m_pParamTable;
+    unsigned int *m_pParamRefs;
+    unsigned short *m_pFreeParams;   // Stack of the unreferenced blocks
+    int         m_nFreeParams;
+    int         m_nParamCapacity;
+    int         m_nDragParams;       // Blocks in use with air resistence
+    bool        m_bDrag;             // Whether any particle has air resistence this step
+
+    CColorTable m_colorTable;        // Replaces the color conversion when built
+    CRandom     m_random;
 	int m_dwActiveCount;
+    CWorkerPool *m_pWorkerPool;      // NULL when updating single threaded
+    int         m_nThreads;
+    float       m_fStepTime;         // Elapsed time of the step being simulated
+    float       m_fFixedStep;        // 0 when stepping by the frame time
+    int         m_nMaxSubsteps;
+    double      m_fAccumulator;      // Frame time not yet simulated
+    float       m_fInterpolation;    // How far Render is from the previous step to the last, 0..1
+    bool        m_bProfiling;        // Whether this step times integrate and collide...
+    uint64_t    m_nIntegrateTime;    // ...summed over the worker threads, in ns
+    uint64_t    m_nCollideTime;
 	float       m_fCurrentTime;
-	float       m_fLastUpdate;
 
     float       m_fMaxPointSize;
     bool        m_bDeviceSupportsPSIZE;
 
     // Particle Attributes
     int m_dwMaxParticles;
-    int m_dwNumToRelease;
-    float       m_fReleaseInterval;
-    float       m_fLifeCycle;
-    float       m_fSize;
-    HsvColor	m_clrColor;
-    CVector m_vPosition;
-    CVector m_vVelocity;
-    CVector m_vGravity;
-    CVector m_vWind;
-    bool        m_bAirResistence;
-    float       m_fVelocityVar;
     char       *m_chTexFile;
 
-	float		m_fMinH;
-	float		m_fMaxH;
-	float		m_fHShiftRate;
-	float		m_fHVar;
-
-	float		m_fMinS;
-	float		m_fMaxS;
-	float		m_fSShiftRate;
-	float		m_fSVar;
-
-	float		m_fMinV;
-	float		m_fMaxV;
-	float		m_fVShiftRate;
-	float		m_fVVar;
+    ParticleEmitter m_pEmitters[PARTICLE_MAX_EMITTERS];
+    ParticleEmitter *m_pEmitter;     // The one the Set/Get functions work on
+    int         m_nEmitters;
+    int         m_nFirstEmitter;     // Emits first this step, so a full store is shared out fairly
 };
 
 #endif /* CPARTICLESYSTEM_H_INCLUDED */
@@ -0,0 +1,218 @@
+//-----------------------------------------------------------------------------
+//		         Name: Profiler.cpp
+//		  Description: Per stage frame timings and particle counts, kept in
+//					   lock-free histograms that can be read while the
+//					   visualisation runs
+//-----------------------------------------------------------------------------
+
+#include "Profiler.h"
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+// Log-linear buckets: values under 32 get a bucket each, every power of two
+// above that is split into 8, so a bucket is never wider than 1/8th of its
+// lower bound. 504 buckets cover all of uint64_t.
+//-----------------------------------------------------------------------------
+const int PROFILE_BUCKETS = 32 + 59 * 8;
+
+struct Histogram
+{
+  uint32_t m_nBuckets[PROFILE_BUCKETS];
+  uint64_t m_nCount;
+  uint64_t m_nSum;
+  uint64_t m_nMax;
+};
+
+volatile int g_nProfilerEnabled = 0;
+
+static Histogram m_stages[PROFILE_STAGES];
+static Histogram m_counters[PROFILE_COUNTERS];
+
+static const char *m_szStageNames[PROFILE_STAGES] =
+{
+  "AudioData", "Spectrum", "ShiftColor", "Shift", "Update",
+  "Integrate", "Collide", "Compact", "Emit", "Render", "Frame",
+  "Evaluate"
+};
+
+static const char *m_szCounterNames[PROFILE_COUNTERS] =
+{
+  "Active", "Emitted", "Expired"
+};
+
+static inline int bucketIndex( uint64_t nValue )
+{
+  if( nValue < 32 )
+    return (int)nValue;
+
+  int nExp = 63 - __builtin_clzll( nValue );
+  return 32 + (nExp - 5) * 8 + (int)((nValue >> (nExp - 3)) & 7);
+}
+
+// Middle of the bucket, as the value a percentile landing in it reports
+static inline uint64_t bucketValue( int nBucket )
+{
+  if( nBucket < 32 )
+    return nBucket;
+
+  int nExp = 5 + (nBucket - 32) / 8;
+  uint64_t nWidth = 1ULL << (nExp - 3);
+  return (8 + (nBucket - 32) % 8) * nWidth + nWidth / 2;
+}
+
+static void record( Histogram *pHistogram, uint64_t nValue )
+{
+  __atomic_fetch_add( &pHistogram->m_nBuckets[bucketIndex( nValue )], 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &pHistogram->m_nCount, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &pHistogram->m_nSum, nValue, __ATOMIC_RELAXED );
+
+  uint64_t nMax = __atomic_load_n( &pHistogram->m_nMax, __ATOMIC_RELAXED );
+  while( nValue > nMax &&
+         !__atomic_compare_exchange_n( &pHistogram->m_nMax, &nMax, nValue, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    ;
+}
+
+static void clear( Histogram *pHistogram )
+{
+  for( int n = 0; n < PROFILE_BUCKETS; ++n )
+    __atomic_store_n( &pHistogram->m_nBuckets[n], 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &pHistogram->m_nCount, 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &pHistogram->m_nSum, 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &pHistogram->m_nMax, 0, __ATOMIC_RELAXED );
+}
+
+//-----------------------------------------------------------------------------
+// Name: getStats()
+// Desc: Reads a histogram that may be written to meanwhile. The buckets are
+//       summed up front so the percentiles agree with each other, even if
+//       not quite with m_nCount.
+//-----------------------------------------------------------------------------
+static bool getStats( Histogram *pHistogram, ProfileStats *pStats )
+{
+  static const int nPercentiles[3] = { 50, 95, 99 };
+  uint64_t *pResults[3] = { &pStats->nP50, &pStats->nP95, &pStats->nP99 };
+
+  uint32_t nBuckets[PROFILE_BUCKETS];
+  uint64_t nTotal = 0;
+  for( int n = 0; n < PROFILE_BUCKETS; ++n )
+  {
+    nBuckets[n] = __atomic_load_n( &pHistogram->m_nBuckets[n], __ATOMIC_RELAXED );
+    nTotal += nBuckets[n];
+  }
+
+  uint64_t nSum    = __atomic_load_n( &pHistogram->m_nSum, __ATOMIC_RELAXED );
+  pStats->nCount   = nTotal;
+  pStats->nMax     = __atomic_load_n( &pHistogram->m_nMax, __ATOMIC_RELAXED );
+  pStats->fMean    = nTotal ? (double)nSum / nTotal : 0.0;
+  pStats->nP50     = pStats->nP95 = pStats->nP99 = 0;
+
+  if( nTotal == 0 )
+    return false;
+
+  uint64_t nSeen = 0;
+  int nNext = 0;
+  for( int n = 0; n < PROFILE_BUCKETS && nNext < 3; ++n )
+  {
+    nSeen += nBuckets[n];
+    while( nNext < 3 && nSeen * 100 >= nTotal * nPercentiles[nNext] )
+    {
+      uint64_t nValue = bucketValue( n );
+      *pResults[nNext++] = nValue < pStats->nMax ? nValue : pStats->nMax;
+    }
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name: EnableProfiler()
+// Desc:
+//-----------------------------------------------------------------------------
+void EnableProfiler( bool bEnable )
+{
+  __atomic_store_n( &g_nProfilerEnabled, bEnable ? 1 : 0, __ATOMIC_RELAXED );
+}
+
+//-----------------------------------------------------------------------------
+// Name: ResetProfile()
+// Desc: Starts every histogram over
+//-----------------------------------------------------------------------------
+void ResetProfile( void )
+{
+  for( int n = 0; n < PROFILE_STAGES; ++n )
+    clear( &m_stages[n] );
+  for( int n = 0; n < PROFILE_COUNTERS; ++n )
+    clear( &m_counters[n] );
+}
+
+void ProfileStage( int nStage, uint64_t nNanoseconds )
+{
+  if( nStage >= 0 && nStage < PROFILE_STAGES )
+    record( &m_stages[nStage], nNanoseconds );
+}
+
+void ProfileCounter( int nCounter, uint64_t nValue )
+{
+  if( nCounter >= 0 && nCounter < PROFILE_COUNTERS )
+    record( &m_counters[nCounter], nValue );
+}
+
+bool GetStageStats( int nStage, ProfileStats *pStats )
+{
+  if( nStage < 0 || nStage >= PROFILE_STAGES )
+    return false;
+  return getStats( &m_stages[nStage], pStats );
+}
+
+bool GetCounterStats( int nCounter, ProfileStats *pStats )
+{
+  if( nCounter < 0 || nCounter >= PROFILE_COUNTERS )
+    return false;
+  return getStats( &m_counters[nCounter], pStats );
+}
+
+const char *GetStageName( int nStage )
+{
+  return nStage >= 0 && nStage < PROFILE_STAGES ? m_szStageNames[nStage] : "";
+}
+
+const char *GetCounterName( int nCounter )
+{
+  return nCounter >= 0 && nCounter < PROFILE_COUNTERS ? m_szCounterNames[nCounter] : "";
+}
+
+//-----------------------------------------------------------------------------
+// Name: DumpProfile()
+// Desc:
+//-----------------------------------------------------------------------------
+void DumpProfile( void (*pfnLine)( const char *szLine, void *pContext ), void *pContext )
+{
+  char szLine[256];
+  ProfileStats stats;
+
+  for( int n = 0; n < PROFILE_STAGES; ++n )
+  {
+    if( !GetStageStats( n, &stats ) )
+      continue;
+
+    snprintf( szLine, sizeof(szLine),
+              "%-10s %8llu calls, us avg %9.2f p50 %9.2f p95 %9.2f p99 %9.2f max %9.2f",
+              m_szStageNames[n], (unsigned long long)stats.nCount, stats.fMean / 1e3,
+              stats.nP50 / 1e3, stats.nP95 / 1e3, stats.nP99 / 1e3, stats.nMax / 1e3 );
+    pfnLine( szLine, pContext );
+  }
+
+  for( int n = 0; n < PROFILE_COUNTERS; ++n )
+  {
+    if( !GetCounterStats( n, &stats ) )
+      continue;
+
+    snprintf( szLine, sizeof(szLine),
+              "%-10s %8llu frames,   avg %9.0f p50 %9llu p95 %9llu p99 %9llu max %9llu",
+              m_szCounterNames[n], (unsigned long long)stats.nCount, stats.fMean,
+              (unsigned long long)stats.nP50, (unsigned long long)stats.nP95,
+              (unsigned long long)stats.nP99, (unsigned long long)stats.nMax );
+    pfnLine( szLine, pContext );
+  }
+}
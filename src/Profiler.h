@@ -0,0 +1,120 @@
+//-----------------------------------------------------------------------------
+//		         Name: Profiler.h
+//		  Description: Per stage frame timings and particle counts, kept in
+//					   lock-free histograms that can be read while the
+//					   visualisation runs
+//-----------------------------------------------------------------------------
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+
+//-----------------------------------------------------------------------------
+// Stages, timed in nanoseconds. Integrate and collide are CPU time summed
+// over all worker threads; the rest is wall time on the calling thread.
+//-----------------------------------------------------------------------------
+const int PROFILE_AUDIODATA  = 0;    // AudioData(), all of it
+const int PROFILE_SPECTRUM   = 1;    // FFT, if ours, bars and onsets
+const int PROFILE_SHIFTCOLOR = 2;    // ShiftColor() of every emitter
+const int PROFILE_SHIFT      = 3;    // All Shift() calls of a frame, four per emitter
+const int PROFILE_UPDATE     = 4;    // CParticleSystem::Update(), all of it
+const int PROFILE_INTEGRATE  = 5;    // Integration, or only the expiry test when analytic
+const int PROFILE_COLLIDE    = 6;
+const int PROFILE_COMPACT    = 7;
+const int PROFILE_EMIT       = 8;
+const int PROFILE_RENDER     = 9;    // CParticleSystem::Render()
+const int PROFILE_FRAME      = 10;   // Render(), all of it
+const int PROFILE_EVALUATE   = 11;   // Analytic positions, part of PROFILE_RENDER
+const int PROFILE_STAGES     = 12;
+
+//-----------------------------------------------------------------------------
+// Counters, one sample per Update()
+//-----------------------------------------------------------------------------
+const int PROFILE_ACTIVE     = 0;    // Live particles after the update
+const int PROFILE_EMITTED    = 1;
+const int PROFILE_EXPIRED    = 2;
+const int PROFILE_COUNTERS   = 3;
+
+// Seconds between the add-on's log dumps while profiling is on
+const double PROFILE_DUMP_INTERVAL = 10.0;
+
+struct ProfileStats
+{
+  uint64_t nCount;      // Samples
+  double   fMean;
+  uint64_t nP50;        // Percentiles are accurate to 1/16th of the value
+  uint64_t nP95;
+  uint64_t nP99;
+  uint64_t nMax;
+};
+
+extern volatile int g_nProfilerEnabled;
+
+// Cheap enough to test around every timed block
+inline bool ProfilerEnabled( void )
+{
+  return __atomic_load_n( &g_nProfilerEnabled, __ATOMIC_RELAXED ) != 0;
+}
+
+inline uint64_t ProfilerNow( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void EnableProfiler( bool bEnable );
+void ResetProfile( void );
+
+// Safe to call from any thread
+void ProfileStage( int nStage, uint64_t nNanoseconds );
+void ProfileCounter( int nCounter, uint64_t nValue );
+
+bool GetStageStats( int nStage, ProfileStats *pStats );
+bool GetCounterStats( int nCounter, ProfileStats *pStats );
+const char *GetStageName( int nStage );
+const char *GetCounterName( int nCounter );
+
+// Formats every stage and counter with samples as one line each
+void DumpProfile( void (*pfnLine)( const char *szLine, void *pContext ), void *pContext );
+
+//-----------------------------------------------------------------------------
+// Name: CProfileScope
+// Desc: Times the enclosing block into a stage. Reads no clock while the
+//       profiler is off.
+//-----------------------------------------------------------------------------
+class CProfileScope
+{
+
+public:
+
+    CProfileScope( int nStage )
+    {
+      m_nStage = nStage;
+      m_nStart = ProfilerEnabled() ? ProfilerNow() : 0;
+    }
+
+   ~CProfileScope()
+    {
+      if( m_nStart != 0 )
+        ProfileStage( m_nStage, ProfilerNow() - m_nStart );
+    }
+
+private:
+
+    int      m_nStage;
+    uint64_t m_nStart;
+};
+
+#define PROFILE_CONCAT2( a, b ) a##b
+#define PROFILE_CONCAT( a, b )  PROFILE_CONCAT2( a, b )
+
+#if defined(FOUNTAIN_NO_PROFILER)
+#define PROFILE_SCOPE( nStage )
+#else
+#define PROFILE_SCOPE( nStage ) CProfileScope PROFILE_CONCAT( profileScope, __LINE__ )( nStage )
+#endif
+
+#endif /* PROFILER_H_INCLUDED */
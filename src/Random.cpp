@@ -0,0 +1,413 @@
+//-----------------------------------------------------------------------------
+//		         Name: Random.cpp
+//		  Description: Small, seedable xoshiro128+ random number generator
+//					   with vectorized bulk fills
+//-----------------------------------------------------------------------------
+
+#include "Random.h"
+#include "ParticleKernels.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAS_AVX2_KERNELS
+#endif
+
+// Seed of a thread's generator until SeedThreadRandom() is called
+static const uint64_t DEFAULT_SEED = 0x5eed5eed5eed5eedULL;
+
+static inline uint32_t rotl( uint32_t x, int k )
+{
+  return (x << k) | (x >> (32 - k));
+}
+
+//-----------------------------------------------------------------------------
+// Name: splitMix64()
+// Desc: Expands a seed into generator state
+//-----------------------------------------------------------------------------
+static uint64_t splitMix64( uint64_t *pState )
+{
+  uint64_t z = (*pState += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//-----------------------------------------------------------------------------
+// Name: Seed()
+// Desc:
+//-----------------------------------------------------------------------------
+void CRandom::Seed( uint64_t seed )
+{
+  uint64_t sm = seed;
+
+  for( int n = 0; n < 4; n += 2 )
+  {
+    uint64_t z = splitMix64( &sm );
+    m_state[n]     = (uint32_t)z;
+    m_state[n + 1] = (uint32_t)(z >> 32);
+  }
+
+  for( int l = 0; l < RANDOM_LANES; ++l )
+  {
+    for( int n = 0; n < 4; n += 2 )
+    {
+      uint64_t z = splitMix64( &sm );
+      m_lanes[n][l]     = (uint32_t)z;
+      m_lanes[n + 1][l] = (uint32_t)(z >> 32);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: NextUInt()
+// Desc: One step of xoshiro128+
+//-----------------------------------------------------------------------------
+uint32_t CRandom::NextUInt( void )
+{
+  uint32_t *s = m_state;
+  const uint32_t result = s[0] + s[3];
+  const uint32_t t = s[1] << 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl( s[3], 11 );
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// Name: NextFloat()
+// Desc: The low bits of xoshiro128+ are its weakest, so floats are made
+//       from the top 24
+//-----------------------------------------------------------------------------
+float CRandom::NextFloat( void )
+{
+  return (float)(NextUInt() >> 8) * (1.0f / 16777216.0f);
+}
+
+float CRandom::NextFloat( float fMin, float fMax )
+{
+  return fMin + (fMax - fMin) * NextFloat();
+}
+
+float CRandom::NextSign( float f )
+{
+  return (NextUInt() & 0x80000000u) ? f : -f;
+}
+
+//-----------------------------------------------------------------------------
+// Name: uniformScalar()
+// Desc: Advances every lane once per RANDOM_LANES outputs, in lane order.
+//       Reference for the vector paths and used for the tail.
+//-----------------------------------------------------------------------------
+static void uniformScalar( uint32_t (*s)[RANDOM_LANES], float *pDest, int i, int dwCount,
+                           float fMin, float fRange )
+{
+  for( ; i < dwCount; i += RANDOM_LANES )
+  {
+    float round[RANDOM_LANES];
+
+    for( int l = 0; l < RANDOM_LANES; ++l )
+    {
+      const uint32_t result = s[0][l] + s[3][l];
+      const uint32_t t = s[1][l] << 9;
+
+      s[2][l] ^= s[0][l];
+      s[3][l] ^= s[1][l];
+      s[1][l] ^= s[2][l];
+      s[0][l] ^= s[3][l];
+      s[2][l] ^= t;
+      s[3][l] = rotl( s[3][l], 11 );
+
+      round[l] = fMin + fRange * ((float)(result >> 8) * (1.0f / 16777216.0f));
+    }
+
+    int dwTake = dwCount - i < RANDOM_LANES ? dwCount - i : RANDOM_LANES;
+    memcpy( pDest + i, round, dwTake * sizeof(float) );
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: uniformSSE2()
+// Desc: One round of all eight lanes per iteration, as two halves
+//-----------------------------------------------------------------------------
+static int uniformSSE2( uint32_t (*s)[RANDOM_LANES], float *pDest, int i, int dwCount,
+                        float fMin, float fRange )
+{
+  const __m128 vMin   = _mm_set1_ps( fMin );
+  const __m128 vRange = _mm_set1_ps( fRange );
+  const __m128 vScale = _mm_set1_ps( 1.0f / 16777216.0f );
+
+  for( int h = 0; h < RANDOM_LANES; h += 4 )
+  {
+    __m128i s0 = _mm_load_si128( (const __m128i*)(s[0] + h) );
+    __m128i s1 = _mm_load_si128( (const __m128i*)(s[1] + h) );
+    __m128i s2 = _mm_load_si128( (const __m128i*)(s[2] + h) );
+    __m128i s3 = _mm_load_si128( (const __m128i*)(s[3] + h) );
+
+    for( int n = i; n + RANDOM_LANES <= dwCount; n += RANDOM_LANES )
+    {
+      __m128i result = _mm_add_epi32( s0, s3 );
+      __m128i t      = _mm_slli_epi32( s1, 9 );
+
+      s2 = _mm_xor_si128( s2, s0 );
+      s3 = _mm_xor_si128( s3, s1 );
+      s1 = _mm_xor_si128( s1, s2 );
+      s0 = _mm_xor_si128( s0, s3 );
+      s2 = _mm_xor_si128( s2, t );
+      s3 = _mm_or_si128( _mm_slli_epi32( s3, 11 ), _mm_srli_epi32( s3, 21 ) );
+
+      __m128 u = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( result, 8 ) ), vScale );
+      _mm_storeu_ps( pDest + n + h, _mm_add_ps( vMin, _mm_mul_ps( vRange, u ) ) );
+    }
+
+    _mm_store_si128( (__m128i*)(s[0] + h), s0 );
+    _mm_store_si128( (__m128i*)(s[1] + h), s1 );
+    _mm_store_si128( (__m128i*)(s[2] + h), s2 );
+    _mm_store_si128( (__m128i*)(s[3] + h), s3 );
+  }
+
+  return i + (dwCount - i) / RANDOM_LANES * RANDOM_LANES;
+}
+#endif
+
+#if defined(HAS_AVX2_KERNELS)
+//-----------------------------------------------------------------------------
+// Name: uniformAVX2()
+// Desc: One round of all eight lanes per iteration
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static int uniformAVX2( uint32_t (*s)[RANDOM_LANES], float *pDest, int i, int dwCount,
+                        float fMin, float fRange )
+{
+  const __m256 vMin   = _mm256_set1_ps( fMin );
+  const __m256 vRange = _mm256_set1_ps( fRange );
+  const __m256 vScale = _mm256_set1_ps( 1.0f / 16777216.0f );
+
+  __m256i s0 = _mm256_load_si256( (const __m256i*)s[0] );
+  __m256i s1 = _mm256_load_si256( (const __m256i*)s[1] );
+  __m256i s2 = _mm256_load_si256( (const __m256i*)s[2] );
+  __m256i s3 = _mm256_load_si256( (const __m256i*)s[3] );
+
+  for( ; i + RANDOM_LANES <= dwCount; i += RANDOM_LANES )
+  {
+    __m256i result = _mm256_add_epi32( s0, s3 );
+    __m256i t      = _mm256_slli_epi32( s1, 9 );
+
+    s2 = _mm256_xor_si256( s2, s0 );
+    s3 = _mm256_xor_si256( s3, s1 );
+    s1 = _mm256_xor_si256( s1, s2 );
+    s0 = _mm256_xor_si256( s0, s3 );
+    s2 = _mm256_xor_si256( s2, t );
+    s3 = _mm256_or_si256( _mm256_slli_epi32( s3, 11 ), _mm256_srli_epi32( s3, 21 ) );
+
+    __m256 u = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_srli_epi32( result, 8 ) ), vScale );
+    _mm256_storeu_ps( pDest + i, _mm256_add_ps( vMin, _mm256_mul_ps( vRange, u ) ) );
+  }
+
+  _mm256_store_si256( (__m256i*)s[0], s0 );
+  _mm256_store_si256( (__m256i*)s[1], s1 );
+  _mm256_store_si256( (__m256i*)s[2], s2 );
+  _mm256_store_si256( (__m256i*)s[3], s3 );
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: FillUniform()
+// Desc:
+//-----------------------------------------------------------------------------
+void CRandom::FillUniform( float *pDest, int dwCount, float fMin, float fMax )
+{
+  float fRange = fMax - fMin;
+  int i = 0;
+
+#if defined(HAS_AVX2_KERNELS)
+  if( CpuHasAVX2() )
+    i = uniformAVX2( m_lanes, pDest, i, dwCount, fMin, fRange );
+#endif
+#if defined(__SSE2__)
+  i = uniformSSE2( m_lanes, pDest, i, dwCount, fMin, fRange );
+#endif
+
+  uniformScalar( m_lanes, pDest, i, dwCount, fMin, fRange );
+}
+
+// sin/cos approximation after Cephes' sinf/cosf, good to a few ulp over
+// [-8192, 8192]. The scalar and the SSE2 version do the very same float
+// operations, so they agree bit for bit.
+static const float FOPI      = 1.27323954473516f;
+static const float MINUS_DP1 = -0.78515625f;
+static const float MINUS_DP2 = -2.4187564849853515625e-4f;
+static const float MINUS_DP3 = -3.77489497744594108e-8f;
+static const float SINCOF_P0 = -1.9515295891e-4f;
+static const float SINCOF_P1 =  8.3321608736e-3f;
+static const float SINCOF_P2 = -1.6666654611e-1f;
+static const float COSCOF_P0 =  2.443315711809948e-5f;
+static const float COSCOF_P1 = -1.388731625493765e-3f;
+static const float COSCOF_P2 =  4.166664568298827e-2f;
+
+static inline uint32_t floatBits( float f ) { uint32_t u; memcpy( &u, &f, 4 ); return u; }
+static inline float bitsFloat( uint32_t u ) { float f; memcpy( &f, &u, 4 ); return f; }
+
+//-----------------------------------------------------------------------------
+// Name: sinCosScalar()
+// Desc:
+//-----------------------------------------------------------------------------
+static void sinCosScalar( float x, float *pSin, float *pCos )
+{
+  uint32_t signSin = floatBits( x ) & 0x80000000u;
+  x = bitsFloat( floatBits( x ) & 0x7fffffffu );
+
+  int j = (int)(x * FOPI);
+  j = (j + 1) & ~1;
+  float y = (float)j;
+
+  uint32_t swapSin  = (uint32_t)(j & 4) << 29;
+  uint32_t signCos  = (uint32_t)(~(j - 2) & 4) << 29;
+  bool     bSinPoly = (j & 2) == 0;
+
+  x = ((x + y * MINUS_DP1) + y * MINUS_DP2) + y * MINUS_DP3;
+  signSin ^= swapSin;
+
+  float z = x * x;
+  float c = COSCOF_P0;
+  c = c * z + COSCOF_P1;
+  c = c * z + COSCOF_P2;
+  c = c * z * z - z * 0.5f + 1.0f;
+  float s = SINCOF_P0;
+  s = s * z + SINCOF_P1;
+  s = s * z + SINCOF_P2;
+  s = s * z * x + x;
+
+  float ySin2 = bSinPoly ? s : 0.0f;
+  float ySin1 = bSinPoly ? 0.0f : c;
+
+  *pSin = bitsFloat( floatBits( ySin1 + ySin2 ) ^ signSin );
+  *pCos = bitsFloat( floatBits( (c - ySin1) + (s - ySin2) ) ^ signCos );
+}
+
+//-----------------------------------------------------------------------------
+// Name: unitVectorsScalar()
+// Desc: Turns z in [-1, 1] and an angle around z into a point on the sphere.
+//       The angles come in pX and are overwritten.
+//-----------------------------------------------------------------------------
+static void unitVectorsScalar( float *pX, float *pY, const float *pZ, int i, int dwCount )
+{
+  for( ; i < dwCount; ++i )
+  {
+    float fRadius = sqrtf( 1.0f - pZ[i] * pZ[i] );
+    float fSin, fCos;
+    sinCosScalar( pX[i], &fSin, &fCos );
+    pX[i] = fCos * fRadius;
+    pY[i] = fSin * fRadius;
+  }
+}
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------------------
+// Name: unitVectorsSSE2()
+// Desc: Four vectors per iteration
+//-----------------------------------------------------------------------------
+static int unitVectorsSSE2( float *pX, float *pY, const float *pZ, int i, int dwCount )
+{
+  const __m128i one  = _mm_set1_epi32( 1 );
+  const __m128i two  = _mm_set1_epi32( 2 );
+  const __m128i four = _mm_set1_epi32( 4 );
+  const __m128  absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+
+  for( ; i + 4 <= dwCount; i += 4 )
+  {
+    __m128 z = _mm_loadu_ps( pZ + i );
+    __m128 x = _mm_loadu_ps( pX + i );
+
+    __m128 fRadius = _mm_sqrt_ps( _mm_sub_ps( _mm_set1_ps( 1.0f ), _mm_mul_ps( z, z ) ) );
+
+    __m128 signSin = _mm_andnot_ps( absMask, x );
+    x = _mm_and_ps( x, absMask );
+
+    __m128i j = _mm_cvttps_epi32( _mm_mul_ps( x, _mm_set1_ps( FOPI ) ) );
+    j = _mm_andnot_si128( one, _mm_add_epi32( j, one ) );
+    __m128 y = _mm_cvtepi32_ps( j );
+
+    __m128 swapSin  = _mm_castsi128_ps( _mm_slli_epi32( _mm_and_si128( j, four ), 29 ) );
+    __m128 signCos  = _mm_castsi128_ps( _mm_slli_epi32( _mm_andnot_si128( _mm_sub_epi32( j, two ), four ), 29 ) );
+    __m128 sinPoly  = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( j, two ), _mm_setzero_si128() ) );
+
+    x = _mm_add_ps( _mm_add_ps( _mm_add_ps( x, _mm_mul_ps( y, _mm_set1_ps( MINUS_DP1 ) ) ),
+                                _mm_mul_ps( y, _mm_set1_ps( MINUS_DP2 ) ) ),
+                    _mm_mul_ps( y, _mm_set1_ps( MINUS_DP3 ) ) );
+    signSin = _mm_xor_ps( signSin, swapSin );
+
+    __m128 zz = _mm_mul_ps( x, x );
+    __m128 c = _mm_set1_ps( COSCOF_P0 );
+    c = _mm_add_ps( _mm_mul_ps( c, zz ), _mm_set1_ps( COSCOF_P1 ) );
+    c = _mm_add_ps( _mm_mul_ps( c, zz ), _mm_set1_ps( COSCOF_P2 ) );
+    c = _mm_add_ps( _mm_sub_ps( _mm_mul_ps( _mm_mul_ps( c, zz ), zz ), _mm_mul_ps( zz, _mm_set1_ps( 0.5f ) ) ),
+                    _mm_set1_ps( 1.0f ) );
+    __m128 s = _mm_set1_ps( SINCOF_P0 );
+    s = _mm_add_ps( _mm_mul_ps( s, zz ), _mm_set1_ps( SINCOF_P1 ) );
+    s = _mm_add_ps( _mm_mul_ps( s, zz ), _mm_set1_ps( SINCOF_P2 ) );
+    s = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( s, zz ), x ), x );
+
+    __m128 ySin2 = _mm_and_ps( sinPoly, s );
+    __m128 ySin1 = _mm_andnot_ps( sinPoly, c );
+
+    __m128 fSin = _mm_xor_ps( _mm_add_ps( ySin1, ySin2 ), signSin );
+    __m128 fCos = _mm_xor_ps( _mm_add_ps( _mm_sub_ps( c, ySin1 ), _mm_sub_ps( s, ySin2 ) ), signCos );
+
+    _mm_storeu_ps( pX + i, _mm_mul_ps( fCos, fRadius ) );
+    _mm_storeu_ps( pY + i, _mm_mul_ps( fSin, fRadius ) );
+  }
+
+  return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: FillUnitVectors()
+// Desc: Uniform directions: z uniform in [-1, 1], then
+//       a uniform angle around the circle of radius sqrt(1 - z*z)
+//-----------------------------------------------------------------------------
+void CRandom::FillUnitVectors( float *pX, float *pY, float *pZ, int dwCount )
+{
+  FillUniform( pZ, dwCount, -1.0f, 1.0f );
+  FillUniform( pX, dwCount, (float)-M_PI, (float)M_PI );
+
+  int i = 0;
+#if defined(__SSE2__)
+  i = unitVectorsSSE2( pX, pY, pZ, i, dwCount );
+#endif
+  unitVectorsScalar( pX, pY, pZ, i, dwCount );
+}
+
+static __thread CRandom t_random;
+static __thread bool    t_bSeeded = false;
+
+//-----------------------------------------------------------------------------
+// Name: GetThreadRandom()
+// Desc:
+//-----------------------------------------------------------------------------
+CRandom &GetThreadRandom( void )
+{
+  if( !t_bSeeded )
+    SeedThreadRandom( DEFAULT_SEED );
+  return t_random;
+}
+
+void SeedThreadRandom( uint64_t seed )
+{
+  t_random.Seed( seed );
+  t_bSeeded = true;
+}
@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+//		         Name: Random.h
+//		  Description: Small, seedable xoshiro128+ random number generator
+//					   with vectorized bulk fills
+//-----------------------------------------------------------------------------
+
+#ifndef RANDOM_H_INCLUDED
+#define RANDOM_H_INCLUDED
+
+#include <stdint.h>
+
+// Number of independent streams the bulk fills advance side by side
+const int RANDOM_LANES = 8;
+
+//-----------------------------------------------------------------------------
+// One generator. Not synchronized: every thread or emitter owns its own.
+// The single value calls and the bulk fills draw from separate streams, and
+// the bulk fills give the same numbers with or without SIMD, so a seed
+// always reproduces the same run.
+//-----------------------------------------------------------------------------
+class CRandom
+{
+
+public:
+
+    void Seed( uint64_t seed );
+
+    uint32_t NextUInt( void );
+    float NextFloat( void );                          // [0, 1)
+    float NextFloat( float fMin, float fMax );        // [fMin, fMax)
+    float NextSign( float f );                        // f or -f
+
+    // dwCount uniform floats in [fMin, fMax)
+    void FillUniform( float *pDest, int dwCount, float fMin, float fMax );
+
+    // dwCount vectors uniformly distributed on the unit sphere
+    void FillUnitVectors( float *pX, float *pY, float *pZ, int dwCount );
+
+private:
+
+    uint32_t m_state[4];
+    uint32_t m_lanes[4][RANDOM_LANES] __attribute__((aligned(32)));
+};
+
+//-----------------------------------------------------------------------------
+// Name: GetThreadRandom()
+// Desc: The calling thread's own generator, used by getRandomMinMax() and
+//       friends. Starts from a fixed seed until SeedThreadRandom() is called.
+//-----------------------------------------------------------------------------
+CRandom &GetThreadRandom( void );
+void SeedThreadRandom( uint64_t seed );
+
+#endif /* RANDOM_H_INCLUDED */
@@ -0,0 +1,420 @@
+//-----------------------------------------------------------------------------
+//		         Name: Spectrum.cpp
+//		  Description: Groups the frequency data Kodi hands AudioData()
+//					   into bars and converts them to dB
+//-----------------------------------------------------------------------------
+
+#include "Spectrum.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Name: CSpectrumBands()
+// Desc:
+//-----------------------------------------------------------------------------
+CSpectrumBands::CSpectrumBands()
+{
+  m_iBars           = 0;
+  m_bLogScale       = false;
+  m_fMinFreq        = 0.0f;
+  m_fMaxFreq        = 0.0f;
+  m_iSampleRate     = 0;
+  m_iFreqDataLength = 0;
+  m_pPrefix         = m_pPrefixData[0];
+  m_pPrevPrefix     = m_pPrefixData[1];
+  m_fMinLevel       = 0.0f;
+  m_fMaxLevel       = 0.0f;
+
+  memset( m_pPrefixData, 0, sizeof(m_pPrefixData) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Configure()
+// Desc:
+//-----------------------------------------------------------------------------
+void CSpectrumBands::Configure( int iBars, bool bLogScale, float fMinFreq, float fMaxFreq,
+                                int iSampleRate, int iFreqDataLength )
+{
+  if( iBars > SPECTRUM_MAX_BARS )
+    iBars = SPECTRUM_MAX_BARS;
+  if( iBars < 0 )
+    iBars = 0;
+  if( iFreqDataLength > SPECTRUM_MAX_DATA )
+    iFreqDataLength = SPECTRUM_MAX_DATA;
+
+  // Bins are summed in pairs
+  iFreqDataLength &= ~1;
+
+  if( iBars == m_iBars && bLogScale == m_bLogScale && fMinFreq == m_fMinFreq &&
+      fMaxFreq == m_fMaxFreq && iSampleRate == m_iSampleRate &&
+      iFreqDataLength == m_iFreqDataLength )
+    return;
+
+  m_iBars           = iBars;
+  m_bLogScale       = bLogScale;
+  m_fMinFreq        = fMinFreq;
+  m_fMaxFreq        = fMaxFreq;
+  m_iSampleRate     = iSampleRate;
+  m_iFreqDataLength = iFreqDataLength;
+
+  // The sums of the last call were of another layout
+  memset( m_pPrefixData, 0, sizeof(m_pPrefixData) );
+
+  Build();
+}
+
+//-----------------------------------------------------------------------------
+// Name: Build()
+// Desc: Splits the bins between the bars, linearly or logarithmically in
+//       frequency (ignoring the constant term). A bar too narrow to get a
+//       bin of its own shares the previous bar's last pair.
+//-----------------------------------------------------------------------------
+void CSpectrumBands::Build( void )
+{
+  int jmin = 2;
+  int jmax;
+
+  for( int i = 0; i < m_iBars; i++ )
+  {
+    if( m_iSampleRate <= 0 )
+      jmax = jmin;
+    else if( m_bLogScale )
+      jmax = (int) (m_fMinFreq*pow(m_fMaxFreq/m_fMinFreq,(float)i/m_iBars)/m_iSampleRate*m_iFreqDataLength + 0.5f);
+    else
+      jmax = (int) ((m_fMinFreq + (m_fMaxFreq-m_fMinFreq)*i/m_iBars)/m_iSampleRate*m_iFreqDataLength + 0.5f);
+
+    // Round up to nearest multiple of 2 and check that jmin is not jmax
+    jmax <<= 1;
+    if( jmax > m_iFreqDataLength )
+      jmax = m_iFreqDataLength;
+    if( jmax == jmin )
+      jmin -= 2;
+
+    m_pBandStart[i] = jmin < 0 ? 0 : jmin;
+    m_pBandEnd[i]   = jmax;
+    m_pBandScale[i] = jmax > m_pBandStart[i] ? 1.0f / (jmax - m_pBandStart[i]) : 1.0f;
+
+    jmin = jmax;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: Analyze()
+// Desc:
+//-----------------------------------------------------------------------------
+void CSpectrumBands::Analyze( const float *pFreqData, float *pLevels, float fMinLevel, float fMaxLevel )
+{
+  m_fMinLevel = fMinLevel;
+  m_fMaxLevel = fMaxLevel;
+
+  double *pPrefix = m_pPrevPrefix;
+  m_pPrevPrefix = m_pPrefix;
+  m_pPrefix     = pPrefix;
+
+  double fSum = 0.0;
+  pPrefix[0] = 0.0;
+  for( int j = 0; j < m_iFreqDataLength; j++ )
+  {
+    fSum += pFreqData[j];
+    pPrefix[j + 1] = fSum;
+  }
+
+  for( int i = 0; i < m_iBars; i++ )
+  {
+    // Almost zero to avoid taking the log of zero
+    float fBand = (float)(pPrefix[m_pBandEnd[i]] - pPrefix[m_pBandStart[i]]);
+    m_pPower[i] = (0.000001f + fBand) * m_pBandScale[i];
+  }
+
+  PowerToDB( m_pPower, m_pPower, m_iBars );
+
+  for( int i = 0; i < m_iBars; i++ )
+  {
+    float fLevel = m_pPower[i];
+    if( fLevel > fMaxLevel )
+      fLevel = fMaxLevel;
+    if( fLevel < fMinLevel )
+      fLevel = fMinLevel;
+
+    pLevels[i] = fLevel;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: GetPrefix()
+// Desc: Sum of the data before the fractional bin fPos
+//-----------------------------------------------------------------------------
+double CSpectrumBands::GetPrefix( const double *pPrefix, float fPos )
+{
+  int j = (int)fPos;
+  if( j >= m_iFreqDataLength )
+    return pPrefix[m_iFreqDataLength];
+  return pPrefix[j] + (pPrefix[j + 1] - pPrefix[j]) * (fPos - j);
+}
+
+//-----------------------------------------------------------------------------
+// Name: GetPower()
+// Desc: Average bin of [fLowFreq, fHighFreq), in the bin layout the bars use
+//       (bin pair k is at k * sample rate / data length Hz, the constant
+//       term left out)
+//-----------------------------------------------------------------------------
+float CSpectrumBands::GetPower( const double *pPrefix, float fLowFreq, float fHighFreq )
+{
+  if( m_iSampleRate <= 0 || m_iFreqDataLength <= 2 )
+    return 0.000001f;
+
+  float fScale = 2.0f * m_iFreqDataLength / m_iSampleRate;
+  float fLow   = std::min( std::max( fLowFreq * fScale, 2.0f ), (float)m_iFreqDataLength );
+  float fHigh  = std::min( std::max( fHighFreq * fScale, 2.0f ), (float)m_iFreqDataLength );
+
+  // Narrower than a bin: the bin it falls in
+  if( fHigh - fLow < 1.0f )
+  {
+    fLow  = std::min( floorf( fLow ), (float)m_iFreqDataLength - 1.0f );
+    fHigh = fLow + 1.0f;
+  }
+
+  double fSum = GetPrefix( pPrefix, fHigh ) - GetPrefix( pPrefix, fLow );
+  return (float)((0.000001 + fSum) / (fHigh - fLow));
+}
+
+float CSpectrumBands::GetLevel( float fLowFreq, float fHighFreq )
+{
+  float fLevel = GetPower( m_pPrefix, fLowFreq, fHighFreq );
+  PowerToDB( &fLevel, &fLevel, 1 );
+  return std::max( m_fMinLevel, std::min( m_fMaxLevel, fLevel ) );
+}
+
+float CSpectrumBands::GetPrevLevel( float fLowFreq, float fHighFreq )
+{
+  float fLevel = GetPower( m_pPrevPrefix, fLowFreq, fHighFreq );
+  PowerToDB( &fLevel, &fLevel, 1 );
+  return std::max( m_fMinLevel, std::min( m_fMaxLevel, fLevel ) );
+}
+
+//-----------------------------------------------------------------------------
+// Name: CSpectrumEnvelope()
+// Desc:
+//-----------------------------------------------------------------------------
+CSpectrumEnvelope::CSpectrumEnvelope()
+{
+  m_fRise      = 1.0f;
+  m_fFall      = 1.0f;
+  m_fPeakDecay = 0.0f;
+  m_fPeakHold  = 0.0f;
+  m_iBars      = 0;
+
+  memset( m_pLevel, 0, sizeof(m_pLevel) );
+  memset( m_pPeak, 0, sizeof(m_pPeak) );
+  memset( m_pHold, 0, sizeof(m_pHold) );
+}
+
+void CSpectrumEnvelope::SetSpeeds( float fRise, float fFall, float fPeakDecay, float fPeakHold )
+{
+  m_fRise      = std::max( 0.0f, std::min( 1.0f, fRise ) );
+  m_fFall      = std::max( 0.0f, std::min( 1.0f, fFall ) );
+  m_fPeakDecay = std::max( 0.0f, fPeakDecay );
+  m_fPeakHold  = std::max( 0.0f, fPeakHold );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Process()
+// Desc: Per bar, with the speeds scaled to fDeltaTime:
+//
+//         level = bar - (bar - level) * (bar > level ? 1 - rise : 1 - fall)
+//         peak   = level >= peak ? level, held again
+//                : still held    ? peak
+//                :                 max( peak - decay, level )
+//
+//       Both paths do the same float operations in the same order. The
+//       peaks stay here, for GetPeak().
+//-----------------------------------------------------------------------------
+void CSpectrumEnvelope::Process( const float *pBars, int iBars, float fDeltaTime, float fFloor, float *pLevels )
+{
+  if( iBars > SPECTRUM_MAX_BARS )
+    iBars = SPECTRUM_MAX_BARS;
+  if( iBars <= 0 )
+    return;
+
+  // Bars of another layout have nothing to follow
+  if( iBars != m_iBars )
+  {
+    for( int i = 0; i < iBars; i++ )
+    {
+      m_pLevel[i] = pBars[i];
+      m_pPeak[i]  = pBars[i];
+      m_pHold[i]  = m_fPeakHold;
+    }
+    m_iBars = iBars;
+  }
+
+  // Part of the way left after fDeltaTime at the speeds per frame; a speed
+  // of 1 leaves exactly nothing, the level is the bar
+  float fFrames = std::max( 0.0f, fDeltaTime ) * ENVELOPE_FRAME_RATE;
+  float fRise   = powf( 1.0f - m_fRise, fFrames );
+  float fFall   = powf( 1.0f - m_fFall, fFrames );
+  float fDecay  = m_fPeakDecay * fFrames;
+  float fHold   = m_fPeakHold;
+  float fStep   = std::max( 0.0f, fDeltaTime );
+
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 vRise  = _mm_set1_ps( fRise );
+  const __m128 vFall  = _mm_set1_ps( fFall );
+  const __m128 vDecay = _mm_set1_ps( fDecay );
+  const __m128 vHold  = _mm_set1_ps( fHold );
+  const __m128 vStep  = _mm_set1_ps( fStep );
+  const __m128 vZero  = _mm_setzero_ps();
+  const __m128 vFloor = _mm_set1_ps( fFloor );
+
+  for( ; i + 4 <= iBars; i += 4 )
+  {
+    __m128 bar   = _mm_loadu_ps( pBars + i );
+    __m128 level = _mm_load_ps( m_pLevel + i );
+    __m128 peak  = _mm_load_ps( m_pPeak + i );
+    __m128 hold  = _mm_load_ps( m_pHold + i );
+
+    __m128 diff  = _mm_sub_ps( bar, level );
+    __m128 up    = _mm_cmpgt_ps( diff, vZero );
+    __m128 speed = _mm_or_ps( _mm_and_ps( up, vRise ), _mm_andnot_ps( up, vFall ) );
+    level = _mm_sub_ps( bar, _mm_mul_ps( diff, speed ) );
+
+    __m128 top   = _mm_cmpge_ps( level, peak );
+    __m128 held  = _mm_cmpgt_ps( hold, vZero );
+    __m128 fall  = _mm_max_ps( _mm_sub_ps( peak, vDecay ), level );
+    peak = _mm_or_ps( _mm_and_ps( top, level ),
+                      _mm_andnot_ps( top, _mm_or_ps( _mm_and_ps( held, peak ), _mm_andnot_ps( held, fall ) ) ) );
+    hold = _mm_or_ps( _mm_and_ps( top, vHold ), _mm_andnot_ps( top, _mm_max_ps( _mm_sub_ps( hold, vStep ), vZero ) ) );
+
+    _mm_store_ps( m_pLevel + i, level );
+    _mm_store_ps( m_pPeak + i, peak );
+    _mm_store_ps( m_pHold + i, hold );
+
+    _mm_storeu_ps( pLevels + 2 * i,     _mm_unpacklo_ps( level, vFloor ) );
+    _mm_storeu_ps( pLevels + 2 * i + 4, _mm_unpackhi_ps( level, vFloor ) );
+  }
+#endif
+
+  for( ; i < iBars; i++ )
+  {
+    float fDiff  = pBars[i] - m_pLevel[i];
+    float fLevel = pBars[i] - fDiff * (fDiff > 0.0f ? fRise : fFall);
+    float fPeak  = m_pPeak[i];
+    float fLeft  = m_pHold[i];
+
+    if( fLevel >= fPeak )
+    {
+      fPeak = fLevel;
+      fLeft = fHold;
+    }
+    else
+    {
+      if( !(fLeft > 0.0f) )
+        fPeak = std::max( fPeak - fDecay, fLevel );
+      fLeft = std::max( fLeft - fStep, 0.0f );
+    }
+
+    m_pLevel[i] = fLevel;
+    m_pPeak[i]  = fPeak;
+    m_pHold[i]  = fLeft;
+
+    pLevels[2 * i]     = fLevel;
+    pLevels[2 * i + 1] = fFloor;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// PowerToDB
+//
+// x = m * 2^e with m in [sqrt(1/2), sqrt(2)), and
+//
+//   ln(m) = 2 * atanh(s) = 2 * (s + s^3/3 + s^5/5 + ...),  s = (m - 1) / (m + 1)
+//
+// |s| < 0.1716, so five terms leave an error well below float precision.
+// Both paths do the same float operations in the same order.
+//-----------------------------------------------------------------------------
+static const float DB_PER_LN  = 4.34294481903f;     // 10 / ln(10)
+static const float LN2        = 0.69314718056f;
+static const float SQRT2      = 1.41421356237f;
+
+static void powerToDBScalar( const float *pPower, float *pDB, int i, int n )
+{
+  for( ; i < n; ++i )
+  {
+    int bits;
+    memcpy( &bits, &pPower[i], sizeof(bits) );
+
+    float e = (float)(((bits >> 23) & 0xff) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    memcpy( &m, &bits, sizeof(m) );
+
+    if( m > SQRT2 )
+    {
+      m = m * 0.5f;
+      e = e + 1.0f;
+    }
+
+    float s  = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float p  = 1.0f / 9.0f;
+    p = p * s2 + 1.0f / 7.0f;
+    p = p * s2 + 1.0f / 5.0f;
+    p = p * s2 + 1.0f / 3.0f;
+    p = p * s2 + 1.0f;
+
+    float fLn = (s + s) * p + e * LN2;
+    pDB[i] = fLn * DB_PER_LN;
+  }
+}
+
+#if defined(__SSE2__)
+static int powerToDBSSE2( const float *pPower, float *pDB, int i, int n )
+{
+  const __m128i vExpMask  = _mm_set1_epi32( 0xff );
+  const __m128i vBias     = _mm_set1_epi32( 127 );
+  const __m128i vMantMask = _mm_set1_epi32( 0x007fffff );
+  const __m128i vOne      = _mm_set1_epi32( 0x3f800000 );
+  const __m128  vHalf     = _mm_set1_ps( 0.5f );
+  const __m128  vOnef     = _mm_set1_ps( 1.0f );
+  const __m128  vSqrt2    = _mm_set1_ps( SQRT2 );
+
+  for( ; i + 4 <= n; i += 4 )
+  {
+    __m128i bits = _mm_castps_si128( _mm_loadu_ps( pPower + i ) );
+
+    __m128 e = _mm_cvtepi32_ps( _mm_sub_epi32( _mm_and_si128( _mm_srli_epi32( bits, 23 ), vExpMask ), vBias ) );
+    __m128 m = _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( bits, vMantMask ), vOne ) );
+
+    __m128 big = _mm_cmpgt_ps( m, vSqrt2 );
+    m = _mm_or_ps( _mm_and_ps( big, _mm_mul_ps( m, vHalf ) ), _mm_andnot_ps( big, m ) );
+    e = _mm_or_ps( _mm_and_ps( big, _mm_add_ps( e, vOnef ) ), _mm_andnot_ps( big, e ) );
+
+    __m128 s  = _mm_div_ps( _mm_sub_ps( m, vOnef ), _mm_add_ps( m, vOnef ) );
+    __m128 s2 = _mm_mul_ps( s, s );
+    __m128 p  = _mm_set1_ps( 1.0f / 9.0f );
+    p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 1.0f / 7.0f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 1.0f / 5.0f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 1.0f / 3.0f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, s2 ), vOnef );
+
+    __m128 ln = _mm_add_ps( _mm_mul_ps( _mm_add_ps( s, s ), p ), _mm_mul_ps( e, _mm_set1_ps( LN2 ) ) );
+    _mm_storeu_ps( pDB + i, _mm_mul_ps( ln, _mm_set1_ps( DB_PER_LN ) ) );
+  }
+  return i;
+}
+#endif
+
+void PowerToDB( const float *pPower, float *pDB, int n )
+{
+  int i = 0;
+#if defined(__SSE2__)
+  i = powerToDBSSE2( pPower, pDB, i, n );
+#endif
+  powerToDBScalar( pPower, pDB, i, n );
+}
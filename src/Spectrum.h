@@ -0,0 +1,123 @@
+//-----------------------------------------------------------------------------
+//		         Name: Spectrum.h
+//		  Description: Groups the frequency data Kodi hands AudioData()
+//					   into bars and converts them to dB
+//-----------------------------------------------------------------------------
+
+#ifndef SPECTRUM_H_INCLUDED
+#define SPECTRUM_H_INCLUDED
+
+#define SPECTRUM_MAX_BARS 720
+#define SPECTRUM_MAX_DATA 4096
+
+#define ENVELOPE_FRAME_RATE 60.0f   // CSpectrumEnvelope's speeds are per frame of this rate
+
+//-----------------------------------------------------------------------------
+// Name: CSpectrumBands
+// Desc: Keeps the frequency bin range of every bar, recomputed only when the
+//       bar layout or the format of the data changes. Analyze() also keeps
+//       running sums of the data, of this call and the one before, so the
+//       level of any frequency range costs the same as that of a bar.
+//-----------------------------------------------------------------------------
+class CSpectrumBands
+{
+
+public:
+
+    CSpectrumBands(void);
+
+    // Cheap when nothing changed since the last call
+    void Configure( int iBars, bool bLogScale, float fMinFreq, float fMaxFreq,
+                    int iSampleRate, int iFreqDataLength );
+
+    // Writes the average level of bar i in dB, clamped to
+    // [fMinLevel, fMaxLevel], to pLevels[i]
+    void Analyze( const float *pFreqData, float *pLevels, float fMinLevel, float fMaxLevel );
+
+    int GetBars( void ) { return m_iBars; }
+
+    // Level in dB of [fLowFreq, fHighFreq) Hz, clamped like the bars, as of
+    // the last Analyze() and the one before it. Partly covered bins count
+    // in proportion.
+    float GetLevel( float fLowFreq, float fHighFreq );
+    float GetPrevLevel( float fLowFreq, float fHighFreq );
+
+private:
+
+    void Build( void );
+    float GetPower( const double *pPrefix, float fLowFreq, float fHighFreq );
+    double GetPrefix( const double *pPrefix, float fPos );
+
+    int   m_iBars;
+    bool  m_bLogScale;
+    float m_fMinFreq;
+    float m_fMaxFreq;
+    int   m_iSampleRate;
+    int   m_iFreqDataLength;
+
+    int   m_pBandStart[SPECTRUM_MAX_BARS];  // First bin of each bar...
+    int   m_pBandEnd[SPECTRUM_MAX_BARS];    // ...and one past its last
+    float m_pBandScale[SPECTRUM_MAX_BARS];  // 1 / bins in the bar
+    float m_pPower[SPECTRUM_MAX_BARS];      // Scratch: average of each bar
+
+    // pPrefix[j] is the sum of the data before bin j. Doubles, since ranges
+    // are differences of sums over the whole spectrum.
+    double m_pPrefixData[2][SPECTRUM_MAX_DATA + 1];
+    double *m_pPrefix;                      // Last Analyze()...
+    double *m_pPrevPrefix;                  // ...and the one before
+    float  m_fMinLevel;
+    float  m_fMaxLevel;
+};
+
+//-----------------------------------------------------------------------------
+// Name: CSpectrumEnvelope
+// Desc: Follows the bars at a limited speed up and down and keeps the peak
+//       of each, which stays put for a while and then falls. Speeds are per
+//       frame of ENVELOPE_FRAME_RATE and scaled to the time between calls,
+//       so the envelope looks the same however often the audio comes in.
+//       Four bars at a time with SSE2.
+//-----------------------------------------------------------------------------
+class CSpectrumEnvelope
+{
+
+public:
+
+    CSpectrumEnvelope(void);
+
+    // fRise and fFall are the part of the way to a new level covered per
+    // frame, 1 jumping straight there. Peaks hold for fPeakHold seconds,
+    // then fall fPeakDecay dB per frame.
+    void SetSpeeds( float fRise, float fFall, float fPeakDecay, float fPeakHold );
+
+    // Starts over from the next Process()
+    void Reset( void ) { m_iBars = 0; }
+
+    // Follows the iBars levels of pBars, fDeltaTime seconds after the last
+    // call. Writes the level of bar i to pLevels[2 * i] and fFloor to
+    // pLevels[2 * i + 1].
+    void Process( const float *pBars, int iBars, float fDeltaTime, float fFloor, float *pLevels );
+
+    // Peak of bar i as of the last Process()
+    float GetPeak( int i ) const { return i >= 0 && i < m_iBars ? m_pPeak[i] : 0.0f; }
+
+private:
+
+    float m_fRise;
+    float m_fFall;
+    float m_fPeakDecay;
+    float m_fPeakHold;
+
+    int   m_iBars;                          // Of the last call, 0 to start over
+    float m_pLevel[SPECTRUM_MAX_BARS] __attribute__((aligned(16)));
+    float m_pPeak[SPECTRUM_MAX_BARS]  __attribute__((aligned(16)));
+    float m_pHold[SPECTRUM_MAX_BARS]  __attribute__((aligned(16)));  // Seconds left before the peak falls
+};
+
+//-----------------------------------------------------------------------------
+// Name: PowerToDB()
+// Desc: pDB[i] = 10 * log10( pPower[i] ) for positive powers, through a
+//       polynomial log good to 2e-5 dB; four at a time with SSE2
+//-----------------------------------------------------------------------------
+void PowerToDB( const float *pPower, float *pDB, int n );
+
+#endif /* SPECTRUM_H_INCLUDED */
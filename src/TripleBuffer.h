@@ -0,0 +1,71 @@
+//-----------------------------------------------------------------------------
+//		         Name: TripleBuffer.h
+//		  Description: Lock-free hand off of the latest value from one
+//					   producer thread to one consumer thread
+//-----------------------------------------------------------------------------
+
+#ifndef TRIPLEBUFFER_H_INCLUDED
+#define TRIPLEBUFFER_H_INCLUDED
+
+//-----------------------------------------------------------------------------
+// Name: CTripleBuffer
+// Desc: The producer fills its own slot and swaps it with the shared middle
+//       one; the consumer swaps its slot with the middle one when that holds
+//       something it hasn't seen. Neither side ever waits or sees a slot
+//       while the other writes it, and the consumer always gets the newest
+//       complete value; values it didn't get round to are dropped.
+//-----------------------------------------------------------------------------
+template <class T>
+class CTripleBuffer
+{
+
+public:
+
+    CTripleBuffer(void)
+    {
+      m_nBack   = 0;
+      m_nMiddle = 1;
+      m_nFront  = 2;
+    }
+
+    // Producer: the slot to fill, and handing it over once it's complete
+    T *GetWriteBuffer( void ) { return &m_buffers[m_nBack]; }
+
+    void Publish( void )
+    {
+      int nOld = __atomic_exchange_n( &m_nMiddle, m_nBack | TB_FRESH, __ATOMIC_ACQ_REL );
+      m_nBack = nOld & TB_INDEX;
+    }
+
+    // Consumer: takes the newest published value, if there is one it hasn't
+    // taken yet. GetReadBuffer() stays valid until the next Update().
+    bool Update( void )
+    {
+      if( !(__atomic_load_n( &m_nMiddle, __ATOMIC_RELAXED ) & TB_FRESH) )
+        return false;
+
+      int nOld = __atomic_exchange_n( &m_nMiddle, m_nFront, __ATOMIC_ACQ_REL );
+      m_nFront = nOld & TB_INDEX;
+      return true;
+    }
+
+    const T *GetReadBuffer( void ) { return &m_buffers[m_nFront]; }
+
+private:
+
+    enum
+    {
+      TB_INDEX = 3,   // Slot in the low bits of m_nMiddle...
+      TB_FRESH = 4    // ...and whether the consumer has taken it
+    };
+
+    T    m_buffers[3];
+
+    // Each on its own cache line, the sides don't share writes
+    int  m_nBack    __attribute__((aligned(64)));   // Producer's
+    int  m_nMiddle  __attribute__((aligned(64)));   // Shared
+    int  m_nFront   __attribute__((aligned(64)));   // Consumer's
+    char m_pad[64 - sizeof(int)];
+};
+
+#endif /* TRIPLEBUFFER_H_INCLUDED */
@@ -1,5 +1,5 @@
 #include "Util.h"
-#include <stdlib.h>
+#include "Random.h"
 
 //-----------------------------------------------------------------------------
 // Name: getRandomMinMax()
@@ -7,12 +7,10 @@
 //-----------------------------------------------------------------------------
 float getRandomMinMax( float fMin, float fMax )
 {
-    float fRandNum = (float)rand () / RAND_MAX;
-    return fMin + (fMax - fMin) * fRandNum;
+    return GetThreadRandom().NextFloat( fMin, fMax );
 }
 
 float randomizeSign(float f)
 {
-    float fRandNum = (float)rand () / RAND_MAX;
-	return fRandNum > 0.5 ? f : -f;
+	return GetThreadRandom().NextSign( f );
 }
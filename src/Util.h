@@ -1,6 +1,7 @@
 //-----------------------------------------------------------------------------
 // Name: getRandomMinMax()
-// Desc: Gets a random number between min/max boundaries
+// Desc: Gets a random number between min/max boundaries, from the calling
+//       thread's generator (see GetThreadRandom())
 //-----------------------------------------------------------------------------
 float getRandomMinMax( float fMin, float fMax );
 
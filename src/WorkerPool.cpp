@@ -0,0 +1,245 @@
+//-----------------------------------------------------------------------------
+//		         Name: WorkerPool.cpp
+//		  Description: Small persistent thread pool that runs a job over a
+//					   number of chunks, with per-thread work stealing
+//-----------------------------------------------------------------------------
+
+#include "WorkerPool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t packRange( uint32_t dwBegin, uint32_t dwEnd )
+{
+  return (uint64_t)dwBegin | ((uint64_t)dwEnd << 32);
+}
+
+//-----------------------------------------------------------------------------
+// Name: CWorkerPool()
+// Desc:
+//-----------------------------------------------------------------------------
+CWorkerPool::CWorkerPool()
+{
+  m_pWorkers    = NULL;
+  m_nThreads    = 1;
+  m_nGeneration = 0;
+  m_nBusy       = 0;
+  m_bQuit       = false;
+  m_pfnJob      = NULL;
+  m_pContext    = NULL;
+
+  pthread_mutex_init( &m_mutex, NULL );
+  pthread_cond_init( &m_wakeCond, NULL );
+  pthread_cond_init( &m_doneCond, NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Name: ~CWorkerPool()
+// Desc:
+//-----------------------------------------------------------------------------
+CWorkerPool::~CWorkerPool()
+{
+  Stop();
+
+  pthread_cond_destroy( &m_doneCond );
+  pthread_cond_destroy( &m_wakeCond );
+  pthread_mutex_destroy( &m_mutex );
+}
+
+//-----------------------------------------------------------------------------
+// Name: Start()
+// Desc:
+//-----------------------------------------------------------------------------
+bool CWorkerPool::Start( int nThreads )
+{
+  Stop();
+
+  if( nThreads < 1 )
+    nThreads = 1;
+
+  void *pWorkers = NULL;
+  if( posix_memalign( &pWorkers, 64, nThreads * sizeof(Worker) ) != 0 )
+    return false;
+  memset( pWorkers, 0, nThreads * sizeof(Worker) );
+  m_pWorkers = (Worker*)pWorkers;
+
+  m_bQuit    = false;
+  m_nThreads = 1;
+
+  for( int n = 0; n < nThreads; ++n )
+  {
+    m_pWorkers[n].m_pPool  = this;
+    m_pWorkers[n].m_nIndex = n;
+    m_pWorkers[n].m_range  = packRange( 0, 0 );
+    m_pWorkers[n].m_nGeneration = m_nGeneration;
+  }
+
+  // Worker 0 is whoever calls Run()
+  for( int n = 1; n < nThreads; ++n )
+  {
+    if( pthread_create( &m_pWorkers[n].m_thread, NULL, ThreadMain, &m_pWorkers[n] ) != 0 )
+      break;
+    ++m_nThreads;
+  }
+
+  return m_nThreads == nThreads;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Stop()
+// Desc: Joins all worker threads
+//-----------------------------------------------------------------------------
+void CWorkerPool::Stop( void )
+{
+  if( m_pWorkers == NULL )
+    return;
+
+  pthread_mutex_lock( &m_mutex );
+  m_bQuit = true;
+  pthread_cond_broadcast( &m_wakeCond );
+  pthread_mutex_unlock( &m_mutex );
+
+  for( int n = 1; n < m_nThreads; ++n )
+    pthread_join( m_pWorkers[n].m_thread, NULL );
+
+  free( m_pWorkers );
+  m_pWorkers = NULL;
+  m_nThreads = 1;
+}
+
+//-----------------------------------------------------------------------------
+// Name: Run()
+// Desc:
+//-----------------------------------------------------------------------------
+void CWorkerPool::Run( JobFunc pfnJob, void *pContext, int nChunks )
+{
+  if( nChunks <= 0 )
+    return;
+
+  if( m_pWorkers == NULL || m_nThreads == 1 )
+  {
+    for( int n = 0; n < nChunks; ++n )
+      pfnJob( pContext, n );
+    return;
+  }
+
+  pthread_mutex_lock( &m_mutex );
+
+  m_pfnJob   = pfnJob;
+  m_pContext = pContext;
+  for( int n = 0; n < m_nThreads; ++n )
+  {
+    uint32_t dwBegin = (uint32_t)((int64_t)nChunks * n / m_nThreads);
+    uint32_t dwEnd   = (uint32_t)((int64_t)nChunks * (n + 1) / m_nThreads);
+    __atomic_store_n( &m_pWorkers[n].m_range, packRange( dwBegin, dwEnd ), __ATOMIC_RELAXED );
+  }
+  m_nBusy = m_nThreads - 1;
+  ++m_nGeneration;
+  pthread_cond_broadcast( &m_wakeCond );
+
+  pthread_mutex_unlock( &m_mutex );
+
+  ProcessChunks( 0 );
+
+  pthread_mutex_lock( &m_mutex );
+  while( m_nBusy > 0 )
+    pthread_cond_wait( &m_doneCond, &m_mutex );
+  pthread_mutex_unlock( &m_mutex );
+}
+
+//-----------------------------------------------------------------------------
+// Name: ThreadMain()
+// Desc: Sleeps until a job is posted, helps with it, and goes back to sleep
+//-----------------------------------------------------------------------------
+void *CWorkerPool::ThreadMain( void *pArg )
+{
+  Worker      *pWorker = (Worker*)pArg;
+  CWorkerPool *pPool   = pWorker->m_pPool;
+
+  pthread_mutex_lock( &pPool->m_mutex );
+
+  for( ;; )
+  {
+    while( !pPool->m_bQuit && pWorker->m_nGeneration == pPool->m_nGeneration )
+      pthread_cond_wait( &pPool->m_wakeCond, &pPool->m_mutex );
+
+    if( pPool->m_bQuit )
+      break;
+
+    pWorker->m_nGeneration = pPool->m_nGeneration;
+    pthread_mutex_unlock( &pPool->m_mutex );
+
+    pPool->ProcessChunks( pWorker->m_nIndex );
+
+    pthread_mutex_lock( &pPool->m_mutex );
+    if( --pPool->m_nBusy == 0 )
+      pthread_cond_signal( &pPool->m_doneCond );
+  }
+
+  pthread_mutex_unlock( &pPool->m_mutex );
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Name: ProcessChunks()
+// Desc: Works through the worker's own chunks front to back, then steals
+//       from the back of the other workers' ranges until none are left
+//-----------------------------------------------------------------------------
+void CWorkerPool::ProcessChunks( int nWorker )
+{
+  for( ;; )
+  {
+    int dwChunk = PopFront( nWorker );
+
+    for( int n = 1; dwChunk < 0 && n < m_nThreads; ++n )
+      dwChunk = PopBack( (nWorker + n) % m_nThreads );
+
+    if( dwChunk < 0 )
+      return;
+
+    m_pfnJob( m_pContext, dwChunk );
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: PopFront()
+// Desc: Takes the next chunk of a worker's range, -1 if it is empty
+//-----------------------------------------------------------------------------
+int CWorkerPool::PopFront( int nWorker )
+{
+  volatile uint64_t *pRange = &m_pWorkers[nWorker].m_range;
+  uint64_t range = __atomic_load_n( pRange, __ATOMIC_ACQUIRE );
+
+  for( ;; )
+  {
+    uint32_t dwBegin = (uint32_t)range;
+    uint32_t dwEnd   = (uint32_t)(range >> 32);
+    if( dwBegin >= dwEnd )
+      return -1;
+
+    if( __atomic_compare_exchange_n( pRange, &range, packRange( dwBegin + 1, dwEnd ),
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+      return (int)dwBegin;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: PopBack()
+// Desc: Steals the last chunk of a worker's range, -1 if it is empty
+//-----------------------------------------------------------------------------
+int CWorkerPool::PopBack( int nWorker )
+{
+  volatile uint64_t *pRange = &m_pWorkers[nWorker].m_range;
+  uint64_t range = __atomic_load_n( pRange, __ATOMIC_ACQUIRE );
+
+  for( ;; )
+  {
+    uint32_t dwBegin = (uint32_t)range;
+    uint32_t dwEnd   = (uint32_t)(range >> 32);
+    if( dwBegin >= dwEnd )
+      return -1;
+
+    if( __atomic_compare_exchange_n( pRange, &range, packRange( dwBegin, dwEnd - 1 ),
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+      return (int)(dwEnd - 1);
+  }
+}
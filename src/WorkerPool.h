@@ -0,0 +1,65 @@
+//-----------------------------------------------------------------------------
+//		         Name: WorkerPool.h
+//		  Description: Small persistent thread pool that runs a job over a
+//					   number of chunks, with per-thread work stealing
+//-----------------------------------------------------------------------------
+
+#ifndef WORKERPOOL_H_INCLUDED
+#define WORKERPOOL_H_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+
+class CWorkerPool
+{
+
+public:
+
+    typedef void (*JobFunc)( void *pContext, int dwChunk );
+
+    CWorkerPool(void);
+   ~CWorkerPool(void);
+
+    // Starts nThreads - 1 workers; the thread calling Run() is the last one.
+    bool Start( int nThreads );
+    void Stop( void );
+    int GetThreadCount( void ) { return m_nThreads; }
+
+    // Calls pfnJob once for every chunk in [0, nChunks) and returns when all
+    // of them are done. Every thread starts on its own contiguous share of
+    // the chunks and steals from the back of the others' once it runs dry.
+    void Run( JobFunc pfnJob, void *pContext, int nChunks );
+
+private:
+
+    struct Worker
+    {
+        CWorkerPool       *m_pPool;
+        int                m_nIndex;
+        pthread_t          m_thread;
+        unsigned int       m_nGeneration;  // Last job this worker picked up
+        // Chunks left: begin in the low, end in the high 32 bits. On a cache
+        // line of its own, which the next worker doesn't share either.
+        volatile uint64_t  m_range __attribute__((aligned(64)));
+    } __attribute__((aligned(64)));
+
+    static void *ThreadMain( void *pArg );
+    void ProcessChunks( int nWorker );
+    int PopFront( int nWorker );
+    int PopBack( int nWorker );
+
+    Worker         *m_pWorkers;
+    int             m_nThreads;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_wakeCond;      // Signalled when a job is posted or on Stop()
+    pthread_cond_t  m_doneCond;      // Signalled when the last worker finishes a job
+    unsigned int    m_nGeneration;   // Bumped for every posted job
+    int             m_nBusy;         // Workers still processing the current job
+    bool            m_bQuit;
+
+    JobFunc         m_pfnJob;
+    void           *m_pContext;
+};
+
+#endif /* WORKERPOOL_H_INCLUDED */
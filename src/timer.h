@@ -8,9 +8,17 @@
 #pragma once
 
 #include "types.h"
-#include <sys/time.h>
+#include <time.h>
 
 /***************************** D E F I N E S *******************************/
+
+// Delta time filters
+const int TF_NONE			= 0;	// Raw frame to frame time
+const int TF_AVERAGE		= 1;	// Exponential moving average
+const int TF_MEDIAN			= 2;	// Median of the last few frames
+
+const int TIMER_MAX_SAMPLES	= 15;	// Most frames TF_MEDIAN looks at
+
 /****************************** M A C R O S ********************************/
 /************************** S T R U C T U R E S ****************************/
 
@@ -23,17 +31,50 @@ public:
 				CTimer();
 	void		Init(void);
 	void		Update(void);
-	f32			GetDeltaTime(void);
+	f32			GetDeltaTime(void);				// Filtered and clamped
+	f32			GetRawDeltaTime(void)			{ return m_RawDeltaTime; }
+	f64			GetTime(void)					{ return m_OldCount * 1.0e-9; }
+
+	// fAlpha is the weight TF_AVERAGE gives the newest frame, nSamples the
+	// number of frames TF_MEDIAN takes the median of
+	void		SetFilter(int nFilter, f32 fAlpha, int nSamples);
+	// Longest step handed out, however long the frame took. 0 disables.
+	void		SetMaxDeltaTime(f32 fMaxDelta)	{ m_MaxDeltaTime = fMaxDelta; }
+
+	// Makes every timer read fTime instead of the clock, for replaying
+	// captures at full speed. A negative time goes back to the clock.
+	static void	SetVirtualTime(f64 fTime)		{ VirtualTime() = fTime; }
 
 protected:
-	double m_OldCount;
+	s64				m_OldCount;			// Nanoseconds
+	f32				m_RawDeltaTime;
 	f32				m_DeltaTime;
 
-        static double WallTime ()
+	int				m_nFilter;
+	f32				m_fAlpha;
+	int				m_nSamples;
+	f32				m_Samples[TIMER_MAX_SAMPLES];	// Ring of recent deltas
+	int				m_nSampleCount;
+	int				m_nNextSample;
+	f32				m_MaxDeltaTime;
+
+	f32				Filter(f32 fDelta);
+
+        static f64 &VirtualTime ()
         {
-          timeval tmpTime;
-          gettimeofday(&tmpTime,NULL);
-          return tmpTime.tv_sec + tmpTime.tv_usec/1.0e6;
+          static f64 fVirtualTime = -1.0;
+          return fVirtualTime;
+        }
+
+        // Monotonic, so NTP adjustments never show up as frame time
+        static s64 Now ()
+        {
+          if (VirtualTime() >= 0.0)
+            return (s64)llround(VirtualTime() * 1.0e9);
+
+          timespec tmpTime;
+          clock_gettime(CLOCK_MONOTONIC, &tmpTime);
+          return (s64)tmpTime.tv_sec * 1000000000 + tmpTime.tv_nsec;
         }
 };
 
@@ -44,22 +85,93 @@ protected:
 //
 inline CTimer::CTimer()
 {
+	m_OldCount		= 0;
+	m_RawDeltaTime	= 0.0f;
 	m_DeltaTime		= 0.0f;
+	m_nFilter		= TF_NONE;
+	m_fAlpha		= 0.2f;
+	m_nSamples		= 5;
+	m_nSampleCount	= 0;
+	m_nNextSample	= 0;
+	m_MaxDeltaTime	= 0.0f;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 //
 inline void	CTimer::Init(void)
 {
-  m_OldCount = WallTime();
+  m_OldCount = Now();
+  m_RawDeltaTime = 0.0f;
+  m_DeltaTime = 0.0f;
+  m_nSampleCount = 0;
+  m_nNextSample = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 //
 inline void	CTimer::Update(void)
 {
-  m_DeltaTime = WallTime()-m_OldCount;
-  m_OldCount = WallTime();
+  s64 nNow = Now();
+  s64 nDelta = nNow - m_OldCount;
+  m_OldCount = nNow;
+
+  // Only a replay going back in time can get here with a negative delta
+  m_RawDeltaTime = nDelta > 0 ? nDelta * 1.0e-9f : 0.0f;
+
+  // Clamp before filtering, so one hiccup doesn't linger in the history
+  f32 fDelta = m_RawDeltaTime;
+  if (m_MaxDeltaTime > 0.0f && fDelta > m_MaxDeltaTime)
+    fDelta = m_MaxDeltaTime;
+
+  m_DeltaTime = Filter(fDelta);
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+inline void	CTimer::SetFilter(int nFilter, f32 fAlpha, int nSamples)
+{
+  m_nFilter = nFilter;
+  m_fAlpha = fAlpha > 0.0f && fAlpha <= 1.0f ? fAlpha : 1.0f;
+  m_nSamples = nSamples < 1 ? 1 : nSamples > TIMER_MAX_SAMPLES ? TIMER_MAX_SAMPLES : nSamples;
+  m_nSampleCount = 0;
+  m_nNextSample = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+inline f32	CTimer::Filter(f32 fDelta)
+{
+  if (m_nFilter == TF_AVERAGE)
+  {
+    // The first frame seeds the average
+    if (m_nSampleCount == 0)
+    {
+      m_nSampleCount = 1;
+      return fDelta;
+    }
+    return m_DeltaTime + m_fAlpha * (fDelta - m_DeltaTime);
+  }
+
+  if (m_nFilter == TF_MEDIAN)
+  {
+    m_Samples[m_nNextSample] = fDelta;
+    m_nNextSample = (m_nNextSample + 1) % m_nSamples;
+    if (m_nSampleCount < m_nSamples)
+      m_nSampleCount++;
+
+    // Insertion sort, there are never more than TIMER_MAX_SAMPLES
+    f32 sorted[TIMER_MAX_SAMPLES];
+    for (int i=0; i<m_nSampleCount; i++)
+    {
+      int j = i;
+      for (; j>0 && sorted[j-1] > m_Samples[i]; j--)
+        sorted[j] = sorted[j-1];
+      sorted[j] = m_Samples[i];
+    }
+    return sorted[m_nSampleCount / 2];
+  }
+
+  return fDelta;
 }
 
 ////////////////////////////////////////////////////////////////////////////
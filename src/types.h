@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <math.h>
 #include <stdlib.h>
+#include "Random.h"
 
 /***************************** D E F I N E S *******************************/
 
@@ -147,10 +148,10 @@ public:
 /***************************** I N L I N E S *******************************/
 
 inline f32	Clamp(f32 x, f32 min, f32 max)		{ return (x <= min ? min : (x >= max ? max : x)); }
-inline f32	RandFloat(void)						{ return (1.0f / RAND_MAX) * ((f32)rand());	}
+inline f32	RandFloat(void)						{ return GetThreadRandom().NextFloat();	}
 inline f32	RandSFloat(void)					{ return (RandFloat()*2.0f)-1.0f;	}
 inline f32	RandFloat(f32 min, f32 max)			{ return min + ((max-min)*RandFloat()); }
-inline int	Rand(int max)						{ return rand() % max; }
+inline int	Rand(int max)						{ return GetThreadRandom().NextUInt() % max; }
 inline f32  SquareMagnitude(const CVector2& v)	{ return v.x*v.x + v.y*v.y;	}
 
 
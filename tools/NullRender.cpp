@@ -0,0 +1,32 @@
+//-----------------------------------------------------------------------------
+//		         Name: NullRender.cpp
+//		  Description: Stands in for ParticleRender.cpp in tools that only
+//					   run the simulation, so they need neither a GL
+//					   context nor SOIL
+//-----------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool CParticleSystem::SetTexture( char *chTexFile )
+{
+  if( m_chTexFile != NULL )
+    free( m_chTexFile );
+  m_chTexFile = strdup( chTexFile );
+  return false;
+}
+
+bool CParticleSystem::Init()
+{
+  return true;
+}
+
+bool CParticleSystem::Render()
+{
+  return true;
+}
+
+void CParticleSystem::ReleaseRenderer()
+{
+}
@@ -0,0 +1,730 @@
+//-----------------------------------------------------------------------------
+//		         Name: fountain_bench.cpp
+//		  Description: Headless benchmark of CParticleSystem::Update(). Runs
+//					   the simulation without Kodi or a GL context and
+//					   reports throughput and heap allocations.
+//-----------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <new>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Allocation counting. operator new is replaced here; the C allocator is
+// wrapped at link time (-Wl,--wrap=...) where the linker supports it, which
+// catches every malloc the particle system makes.
+//-----------------------------------------------------------------------------
+static volatile long g_nAllocs = 0;
+static volatile long g_nAllocBytes = 0;
+
+static inline void countAlloc( size_t size )
+{
+  __atomic_fetch_add( &g_nAllocs, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &g_nAllocBytes, (long)size, __ATOMIC_RELAXED );
+}
+
+#if defined(FOUNTAIN_BENCH_WRAP_MALLOC)
+extern "C"
+{
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t count, size_t size );
+void *__real_realloc( void *p, size_t size );
+int   __real_posix_memalign( void **pp, size_t alignment, size_t size );
+
+void *__wrap_malloc( size_t size )
+{
+  countAlloc( size );
+  return __real_malloc( size );
+}
+
+void *__wrap_calloc( size_t count, size_t size )
+{
+  countAlloc( count * size );
+  return __real_calloc( count, size );
+}
+
+void *__wrap_realloc( void *p, size_t size )
+{
+  countAlloc( size );
+  return __real_realloc( p, size );
+}
+
+int __wrap_posix_memalign( void **pp, size_t alignment, size_t size )
+{
+  countAlloc( size );
+  return __real_posix_memalign( pp, alignment, size );
+}
+}
+#endif
+
+void *operator new( size_t size )
+{
+  countAlloc( size );
+  void *p = malloc( size ? size : 1 );
+  if( p == NULL )
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[]( size_t size )
+{
+  return operator new( size );
+}
+
+void operator delete( void *p ) throw()
+{
+  free( p );
+}
+
+void operator delete[]( void *p ) throw()
+{
+  free( p );
+}
+
+void operator delete( void *p, size_t ) throw()
+{
+  free( p );
+}
+
+void operator delete[]( void *p, size_t ) throw()
+{
+  free( p );
+}
+
+//-----------------------------------------------------------------------------
+// Options
+//-----------------------------------------------------------------------------
+struct BenchOptions
+{
+  int      nParticles;     // Particle budget (SetMaxParticles)
+  int      nRelease;       // Particles released per step, 0 keeps the budget full
+  int      nEmitters;      // Emitters sharing the budget and the release
+  float    fInterval;      // Release interval in seconds
+  int      nPlanes;        // Collision planes
+  int      nResult;        // What the planes do to particles, CR_*
+  float    fStep;          // Timestep in seconds
+  float    fSimRate;       // Fixed simulation steps per second, 0 steps by fStep
+  int      nFrames;        // Measured steps
+  int      nWarmup;        // Steps run before measuring, 0 runs one life cycle
+  int      nThreads;
+  float    fLifeCycle;
+  bool     bAirResistence;
+  bool     bCompact;       // Fixed point store
+  bool     bAnalytic;      // Positions evaluated once per step instead of integrated
+  float    fVelocityVar;
+  unsigned nSeed;
+  bool     bProfile;       // Per stage timings of the measured steps
+  bool     bVerify;        // Compare the kernel paths instead of benchmarking
+  int      nTableHue;      // Color table resolution, 0 converts colors
+  int      nTableSat;
+  int      nTableVal;
+};
+
+static void usage( const char *szName )
+{
+  printf( "usage: %s [options]\n"
+          "  --particles N     particle budget (default 100000)\n"
+          "  --release N       particles released per step, 0 keeps the budget full (default 0)\n"
+          "  --interval S      release interval in seconds (default 0)\n"
+          "  --emitters N      emitters on a ring, sharing budget and release (default 1)\n"
+          "  --planes N        collision planes, up to 64 (default 0)\n"
+          "  --result R        bounce, stick, recycle or mixed (default bounce)\n"
+          "  --dt S            timestep in seconds (default 0.016667)\n"
+          "  --simrate HZ      simulate in fixed steps at HZ, dt becomes the frame time (default 0)\n"
+          "  --frames N        measured steps (default 1000)\n"
+          "  --warmup N        steps before measuring, 0 for one life cycle (default 0)\n"
+          "  --threads N       simulation threads (default 1)\n"
+          "  --lifecycle S     particle life in seconds (default 3)\n"
+          "  --no-air          disable air resistence\n"
+          "  --compact         16 bit fixed point particle store\n"
+          "  --analytic        evaluate positions from particle age, as rendering would\n"
+          "  --velvar F        velocity variation (default 1.5)\n"
+          "  --seed N          random seed (default 1)\n"
+          "  --colortable HxSxV look colors up in a table, reporting its error (default off)\n"
+          "  --profile         print per stage timings\n"
+          "  --verify          check that the scalar, SSE2 and AVX2 kernels give identical results\n",
+          szName );
+}
+
+static bool parseOptions( int argc, char **argv, BenchOptions *pOptions )
+{
+  for( int i = 1; i < argc; ++i )
+  {
+    const char *szArg = argv[i];
+    const char *szVal = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if( strcmp( szArg, "--no-air" ) == 0 )
+    {
+      pOptions->bAirResistence = false;
+      continue;
+    }
+    if( strcmp( szArg, "--compact" ) == 0 )
+    {
+      pOptions->bCompact = true;
+      continue;
+    }
+    if( strcmp( szArg, "--analytic" ) == 0 )
+    {
+      pOptions->bAnalytic = true;
+      continue;
+    }
+    if( strcmp( szArg, "--profile" ) == 0 )
+    {
+      pOptions->bProfile = true;
+      continue;
+    }
+    if( strcmp( szArg, "--verify" ) == 0 )
+    {
+      pOptions->bVerify = true;
+      continue;
+    }
+    if( strcmp( szArg, "--help" ) == 0 || szVal == NULL )
+      return false;
+
+    if( strcmp( szArg, "--particles" ) == 0 )      pOptions->nParticles = atoi( szVal );
+    else if( strcmp( szArg, "--release" ) == 0 )   pOptions->nRelease = atoi( szVal );
+    else if( strcmp( szArg, "--interval" ) == 0 )  pOptions->fInterval = (float)atof( szVal );
+    else if( strcmp( szArg, "--emitters" ) == 0 )  pOptions->nEmitters = atoi( szVal );
+    else if( strcmp( szArg, "--planes" ) == 0 )    pOptions->nPlanes = atoi( szVal );
+    else if( strcmp( szArg, "--dt" ) == 0 )        pOptions->fStep = (float)atof( szVal );
+    else if( strcmp( szArg, "--simrate" ) == 0 )   pOptions->fSimRate = (float)atof( szVal );
+    else if( strcmp( szArg, "--frames" ) == 0 )    pOptions->nFrames = atoi( szVal );
+    else if( strcmp( szArg, "--warmup" ) == 0 )    pOptions->nWarmup = atoi( szVal );
+    else if( strcmp( szArg, "--threads" ) == 0 )   pOptions->nThreads = atoi( szVal );
+    else if( strcmp( szArg, "--lifecycle" ) == 0 ) pOptions->fLifeCycle = (float)atof( szVal );
+    else if( strcmp( szArg, "--velvar" ) == 0 )    pOptions->fVelocityVar = (float)atof( szVal );
+    else if( strcmp( szArg, "--seed" ) == 0 )      pOptions->nSeed = (unsigned)strtoul( szVal, NULL, 0 );
+    else if( strcmp( szArg, "--colortable" ) == 0 )
+    {
+      if( sscanf( szVal, "%dx%dx%d", &pOptions->nTableHue, &pOptions->nTableSat, &pOptions->nTableVal ) != 3 ||
+          pOptions->nTableHue < 1 || pOptions->nTableSat < 2 || pOptions->nTableVal < 2 )
+        return false;
+    }
+    else if( strcmp( szArg, "--result" ) == 0 )
+    {
+      if( strcmp( szVal, "bounce" ) == 0 )       pOptions->nResult = CR_BOUNCE;
+      else if( strcmp( szVal, "stick" ) == 0 )   pOptions->nResult = CR_STICK;
+      else if( strcmp( szVal, "recycle" ) == 0 ) pOptions->nResult = CR_RECYCLE;
+      else if( strcmp( szVal, "mixed" ) == 0 )   pOptions->nResult = CR_MIXED;
+      else return false;
+    }
+    else
+      return false;
+
+    ++i;
+  }
+
+  return pOptions->nParticles > 0 && pOptions->fStep > 0.0f && pOptions->nFrames > 0 &&
+         pOptions->nEmitters > 0 && pOptions->nEmitters <= PARTICLE_MAX_EMITTERS &&
+         pOptions->nPlanes >= 0 && pOptions->nPlanes <= COLLISION_MAX_PLANES;
+}
+
+static void printLine( const char *szLine, void * )
+{
+  printf( "  %s\n", szLine );
+}
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------------------------------------------------------
+// Name: colorTableError()
+// Desc: Largest difference of any component between table lookups and
+//       ConvertHSVToRGB() over nCount random colors, as floats and in the
+//       256 levels PackColors() keeps
+//-----------------------------------------------------------------------------
+static void colorTableError( int nHue, int nSat, int nVal, int nCount, unsigned nSeed,
+                             float *pMaxError, int *pMaxLevels )
+{
+  CColorTable table;
+  table.Build( nHue, nSat, nVal );
+
+  CRandom random;
+  random.Seed( nSeed );
+
+  float *pBuffer = (float*)malloc( nCount * 9 * sizeof(float) );
+  float *pH = pBuffer, *pS = pH + nCount, *pV = pS + nCount;
+  float *pR = pV + nCount, *pG = pR + nCount, *pB = pG + nCount;
+  float *pTableR = pB + nCount, *pTableG = pTableR + nCount, *pTableB = pTableG + nCount;
+
+  random.FillUniform( pH, nCount, 0.0f, 360.0f );
+  random.FillUniform( pS, nCount, 0.0f, 1.0f );
+  random.FillUniform( pV, nCount, 0.0f, 1.0f );
+  ConvertHSVToRGB( pH, pS, pV, pR, pG, pB, nCount );
+  table.Lookup( pH, pS, pV, pTableR, pTableG, pTableB, nCount );
+
+  unsigned int *pColor = (unsigned int*)pH;     // Done with the HSV
+  unsigned int *pTableColor = (unsigned int*)pS;
+  PackColors( pR, pG, pB, pColor, nCount );
+  PackColors( pTableR, pTableG, pTableB, pTableColor, nCount );
+
+  *pMaxError  = 0.0f;
+  *pMaxLevels = 0;
+  for( int i = 0; i < nCount; ++i )
+  {
+    *pMaxError = std::max( *pMaxError, fabsf( pTableR[i] - pR[i] ) );
+    *pMaxError = std::max( *pMaxError, fabsf( pTableG[i] - pG[i] ) );
+    *pMaxError = std::max( *pMaxError, fabsf( pTableB[i] - pB[i] ) );
+    for( int nShift = 0; nShift < 24; nShift += 8 )
+      *pMaxLevels = std::max( *pMaxLevels, abs( (int)((pTableColor[i] >> nShift) & 0xff) -
+                                                (int)((pColor[i] >> nShift) & 0xff) ) );
+  }
+
+  free( pBuffer );
+}
+
+//-----------------------------------------------------------------------------
+// Kernel verification. Every kernel runs on the same particles once per
+// path, and everything they can write has to come out bit for bit the same.
+//-----------------------------------------------------------------------------
+const int VERIFY_COUNT = 4099;      // Not a multiple of any vector width...
+const int VERIFY_BEGIN = 3;         // ...nor is the start, so tails and unaligned loads run
+
+// All the arrays of both stores, so one memcmp() covers whatever a kernel writes
+struct VerifyState
+{
+  float          pPosX[VERIFY_COUNT], pPosY[VERIFY_COUNT], pPosZ[VERIFY_COUNT];
+  float          pPrevX[VERIFY_COUNT], pPrevY[VERIFY_COUNT], pPrevZ[VERIFY_COUNT];
+  float          pVelX[VERIFY_COUNT], pVelY[VERIFY_COUNT], pVelZ[VERIFY_COUNT];
+  float          pInitTime[VERIFY_COUNT];
+  float          pOutX[VERIFY_COUNT], pOutY[VERIFY_COUNT], pOutZ[VERIFY_COUNT];
+  float          pH[VERIFY_COUNT], pS[VERIFY_COUNT], pV[VERIFY_COUNT];
+  float          pR[VERIFY_COUNT], pG[VERIFY_COUNT], pB[VERIFY_COUNT];
+  short          pFixedPosX[VERIFY_COUNT], pFixedPosY[VERIFY_COUNT], pFixedPosZ[VERIFY_COUNT];
+  short          pFixedPrevX[VERIFY_COUNT], pFixedPrevY[VERIFY_COUNT], pFixedPrevZ[VERIFY_COUNT];
+  short          pFixedVelX[VERIFY_COUNT], pFixedVelY[VERIFY_COUNT], pFixedVelZ[VERIFY_COUNT];
+  unsigned short pBirthTick[VERIFY_COUNT];
+  unsigned short pParam[VERIFY_COUNT];
+  unsigned char  pExpired[VERIFY_COUNT];
+};
+
+const float          VERIFY_TIME     = 10.0f;
+const unsigned short VERIFY_TICK     = 40000;
+const float          VERIFY_STEP     = 1.0f / 60.0f;
+const float          VERIFY_TO_FIXED = 64.0f;   // Range of +-512, which some particles leave
+
+//-----------------------------------------------------------------------------
+// Name: fillVerifyState()
+// Desc: Random particles around the planes of addVerifyPlanes(), some of
+//       them expired, not born yet or about to leave the compact range
+//-----------------------------------------------------------------------------
+static void fillVerifyState( VerifyState *p, unsigned nSeed )
+{
+  CRandom random;
+  random.Seed( nSeed );
+
+  memset( p, 0, sizeof(*p) );
+  for( int i = 0; i < VERIFY_COUNT; ++i )
+  {
+    p->pPosX[i]  = random.NextFloat( -20.0f, 20.0f );
+    p->pPosY[i]  = random.NextFloat( -20.0f, 20.0f );
+    p->pPosZ[i]  = random.NextFloat( -20.0f, 20.0f );
+    p->pPrevX[i] = p->pPosX[i] - random.NextFloat( -0.5f, 0.5f );
+    p->pPrevY[i] = p->pPosY[i] - random.NextFloat( -0.5f, 0.5f );
+    p->pPrevZ[i] = p->pPosZ[i] - random.NextFloat( -0.5f, 0.5f );
+    p->pVelX[i]  = random.NextFloat( -10.0f, 10.0f );
+    p->pVelY[i]  = random.NextFloat( -10.0f, 10.0f );
+    p->pVelZ[i]  = random.NextFloat( -10.0f, 10.0f );
+    p->pInitTime[i] = VERIFY_TIME - random.NextFloat( -0.5f, 4.0f );
+
+    // Sextant boundaries, 0 and 360 included, as well
+    float h = random.NextFloat( 0.0f, 360.0f );
+    p->pH[i] = i % 16 == 0 ? 60.0f * (i / 16 % 7) : h;
+    p->pS[i] = random.NextFloat();
+    p->pV[i] = random.NextFloat();
+
+    float fEdge = i % 32 == 0 ? 32767.0f / VERIFY_TO_FIXED - random.NextFloat( 0.0f, 4.0f ) : 20.0f;
+    p->pFixedPosX[i]  = ToFixed( p->pPosX[i] * fEdge / 20.0f, VERIFY_TO_FIXED );
+    p->pFixedPosY[i]  = ToFixed( p->pPosY[i], VERIFY_TO_FIXED );
+    p->pFixedPosZ[i]  = ToFixed( p->pPosZ[i], VERIFY_TO_FIXED );
+    p->pFixedPrevX[i] = ToFixed( p->pPrevX[i], VERIFY_TO_FIXED );
+    p->pFixedPrevY[i] = ToFixed( p->pPrevY[i], VERIFY_TO_FIXED );
+    p->pFixedPrevZ[i] = ToFixed( p->pPrevZ[i], VERIFY_TO_FIXED );
+    p->pFixedVelX[i]  = ToFixed( p->pVelX[i] * 20.0f, VERIFY_TO_FIXED );
+    p->pFixedVelY[i]  = ToFixed( p->pVelY[i] * 20.0f, VERIFY_TO_FIXED );
+    p->pFixedVelZ[i]  = ToFixed( p->pVelZ[i] * 20.0f, VERIFY_TO_FIXED );
+    p->pBirthTick[i]  = (unsigned short)(VERIFY_TICK - random.NextUInt() % (4 * COMPACT_TICKS_PER_SECOND));
+
+    p->pParam[i]   = (unsigned short)(random.NextUInt() % 4);
+    p->pExpired[i] = random.NextUInt() % 8 == 0 ? 1 : 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: addVerifyPlanes()
+// Desc: A floor, or a box of five planes around the particles, all with
+//       nResult or taking turns with the results for CR_MIXED
+//-----------------------------------------------------------------------------
+static void addVerifyPlanes( CollisionPlanes *pPlanes, bool bSingle, int nResult )
+{
+  static const float pNormals[5][3] = { { 0, 0, 1 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0.6f, 0.8f }, { 0, -0.8f, 0.6f } };
+
+  pPlanes->m_nPlanes = bSingle ? 1 : 5;
+  pPlanes->m_nResult = nResult;
+  for( int n = 0; n < pPlanes->m_nPlanes; ++n )
+  {
+    pPlanes->m_pNormalX[n] = pNormals[n][0];
+    pPlanes->m_pNormalY[n] = pNormals[n][1];
+    pPlanes->m_pNormalZ[n] = pNormals[n][2];
+    pPlanes->m_pPointX[n]  = -12.0f * pNormals[n][0];
+    pPlanes->m_pPointY[n]  = -12.0f * pNormals[n][1];
+    pPlanes->m_pPointZ[n]  = -12.0f * pNormals[n][2];
+    pPlanes->m_pBounceFactor[n]    = 0.25f + 0.25f * n;
+    pPlanes->m_pCollisionResult[n] = nResult == CR_MIXED ? n % CR_MIXED : nResult;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Name: runVerifyCase()
+// Desc: Runs case nCase on p, returning its name; NULL once past the last
+//-----------------------------------------------------------------------------
+static const char *runVerifyCase( int nCase, VerifyState *p )
+{
+  static const char *szResults[CR_MIXED + 1] = { "bounce", "stick", "recycle", "mixed" };
+  static char szName[64];
+
+  // With and without air resistence, with different life cycles
+  ParticleParams pParams[4];
+  memset( pParams, 0, sizeof(pParams) );
+  for( int n = 0; n < 4; ++n )
+  {
+    pParams[n].m_fGravZ      = -15.0f + n;
+    pParams[n].m_fWindX      = n & 1 ? 1.0f : 0.0f;
+    pParams[n].m_fWindY      = -2.0f;
+    pParams[n].m_fDrag       = n & 1 ? 1.0f : 0.0f;
+    pParams[n].m_fInvDrag    = n & 1 ? 1.0f : 0.0f;
+    pParams[n].m_fLifeCycle  = 1.0f + n * 0.75f;
+    pParams[n].m_fSize       = 0.1f;
+  }
+
+  // The kernels only leave air resistence out when no particle has any
+  ParticleParams pNoDrag[4];
+  for( int n = 0; n < 4; ++n )
+  {
+    pNoDrag[n] = pParams[n];
+    pNoDrag[n].m_fDrag    = 0.0f;
+    pNoDrag[n].m_fInvDrag = 0.0f;
+  }
+
+  ParticleStreams streams;
+  streams.m_pPosX = p->pPosX;     streams.m_pPosY = p->pPosY;     streams.m_pPosZ = p->pPosZ;
+  streams.m_pPrevX = p->pPrevX;   streams.m_pPrevY = p->pPrevY;   streams.m_pPrevZ = p->pPrevZ;
+  streams.m_pVelX = p->pVelX;     streams.m_pVelY = p->pVelY;     streams.m_pVelZ = p->pVelZ;
+  streams.m_pInitTime   = p->pInitTime;
+  streams.m_pParam      = p->pParam;
+  streams.m_pParamTable = pParams;
+  streams.m_pExpired    = p->pExpired;
+
+  CompactParticleStreams compact;
+  compact.m_pPosX = p->pFixedPosX;    compact.m_pPosY = p->pFixedPosY;    compact.m_pPosZ = p->pFixedPosZ;
+  compact.m_pPrevX = p->pFixedPrevX;  compact.m_pPrevY = p->pFixedPrevY;  compact.m_pPrevZ = p->pFixedPrevZ;
+  compact.m_pVelX = p->pFixedVelX;    compact.m_pVelY = p->pFixedVelY;    compact.m_pVelZ = p->pFixedVelZ;
+  compact.m_pBirthTick  = p->pBirthTick;
+  compact.m_pParam      = p->pParam;
+  compact.m_pParamTable = pParams;
+  compact.m_pExpired    = p->pExpired;
+  compact.m_fToFixed    = VERIFY_TO_FIXED;
+  compact.m_fFromFixed  = 1.0f / VERIFY_TO_FIXED;
+
+  switch( nCase )
+  {
+    case 0:
+      IntegrateParticles( streams, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TIME, VERIFY_STEP, true );
+      return "integrate";
+    case 1:
+      streams.m_pParamTable = pNoDrag;
+      IntegrateParticles( streams, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TIME, VERIFY_STEP, false );
+      return "integrate, no drag";
+    case 2:
+      IntegrateCompactParticles( compact, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TICK, VERIFY_STEP, true );
+      return "compact integrate";
+    case 3:
+      compact.m_pParamTable = pNoDrag;
+      IntegrateCompactParticles( compact, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TICK, VERIFY_STEP, false );
+      return "compact integrate, no drag";
+    case 4:
+      ExpireParticles( streams, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TIME );
+      return "expire";
+    case 5:
+      EvaluateParticles( streams, VERIFY_BEGIN, VERIFY_COUNT, VERIFY_TIME, p->pOutX, p->pOutY, p->pOutZ );
+      return "evaluate";
+    case 6:
+      ConvertHSVToRGB( p->pH + VERIFY_BEGIN, p->pS + VERIFY_BEGIN, p->pV + VERIFY_BEGIN,
+                       p->pR + VERIFY_BEGIN, p->pG + VERIFY_BEGIN, p->pB + VERIFY_BEGIN,
+                       VERIFY_COUNT - VERIFY_BEGIN );
+      return "hsv to rgb";
+  }
+
+  // Collisions: both stores, one plane and several, every result
+  nCase -= 7;
+  if( nCase >= 2 * 2 * (CR_MIXED + 1) )
+    return NULL;
+
+  bool bCompact = nCase & 1;
+  bool bSingle  = (nCase >> 1) & 1;
+  int  nResult  = nCase >> 2;
+
+  CollisionPlanes planes;
+  memset( &planes, 0, sizeof(planes) );
+  addVerifyPlanes( &planes, bSingle, nResult );
+
+  if( bCompact )
+    CollideCompactParticles( compact, VERIFY_BEGIN, VERIFY_COUNT, planes, VERIFY_TICK );
+  else
+    CollideParticles( streams, VERIFY_BEGIN, VERIFY_COUNT, planes );
+
+  snprintf( szName, sizeof(szName), "%scollide, %s, %s", bCompact ? "compact " : "",
+            bSingle ? "1 plane" : "5 planes", szResults[nResult] );
+  return szName;
+}
+
+//-----------------------------------------------------------------------------
+// Name: verifyKernels()
+// Desc: Runs every case on the scalar path and compares the SSE2 and AVX2
+//       paths to it, those the CPU has. Returns whether all of them match.
+//-----------------------------------------------------------------------------
+static bool verifyKernels( unsigned nSeed )
+{
+  static const char *szPaths[] = { "scalar", "sse2", "avx2" };
+
+  VerifyState *pInput     = (VerifyState*)malloc( sizeof(VerifyState) );
+  VerifyState *pReference = (VerifyState*)malloc( sizeof(VerifyState) );
+  VerifyState *pState     = (VerifyState*)malloc( sizeof(VerifyState) );
+
+  SetKernelPath( KERNEL_PATH_AVX2 );
+  int nBestPath = GetKernelPath();
+  printf( "paths:             %s", szPaths[0] );
+  for( int nPath = KERNEL_PATH_SSE2; nPath <= nBestPath; ++nPath )
+    printf( ", %s", szPaths[nPath] );
+  printf( "\n" );
+
+  bool bAllMatch = true;
+  for( int nCase = 0; ; ++nCase )
+  {
+    fillVerifyState( pInput, nSeed );
+
+    memcpy( pReference, pInput, sizeof(VerifyState) );
+    SetKernelPath( KERNEL_PATH_SCALAR );
+    const char *szCase = runVerifyCase( nCase, pReference );
+    if( szCase == NULL )
+      break;
+
+    printf( "%-36s", szCase );
+    bool bMatch = true;
+    for( int nPath = KERNEL_PATH_SSE2; nPath <= nBestPath; ++nPath )
+    {
+      memcpy( pState, pInput, sizeof(VerifyState) );
+      SetKernelPath( nPath );
+      runVerifyCase( nCase, pState );
+      if( memcmp( pState, pReference, sizeof(VerifyState) ) != 0 )
+      {
+        printf( " %s differs", szPaths[nPath] );
+        bMatch = false;
+      }
+    }
+    printf( bMatch ? " identical\n" : "\n" );
+    bAllMatch = bAllMatch && bMatch;
+  }
+
+  SetKernelPath( KERNEL_PATH_AVX2 );
+  free( pInput );
+  free( pReference );
+  free( pState );
+
+  printf( "verify:            %s\n", bAllMatch ? "all paths identical" : "FAILED" );
+  return bAllMatch;
+}
+
+//-----------------------------------------------------------------------------
+// Name: addPlanes()
+// Desc: Spreads nPlanes planes facing the emitter over a sphere of radius
+//       10 around it, so all of them see particles. CR_MIXED takes turns
+//       with the results.
+//-----------------------------------------------------------------------------
+static void addPlanes( CParticleSystem *pSystem, int nPlanes, int nResult )
+{
+  const float fGoldenAngle = (float)(M_PI * (3.0 - sqrt( 5.0 )));
+
+  for( int n = 0; n < nPlanes; ++n )
+  {
+    float z = nPlanes > 1 ? 1.0f - 2.0f * (n + 0.5f) / nPlanes : -1.0f;
+    float r = sqrtf( 1.0f - z * z );
+    CVector vDir( cosf( n * fGoldenAngle ) * r, sinf( n * fGoldenAngle ) * r, z );
+
+    pSystem->SetCollisionPlane( CVector( -vDir.x, -vDir.y, -vDir.z ), vDir * 10.0f, 0.5f,
+                                nResult == CR_MIXED ? n % CR_MIXED : nResult );
+  }
+}
+
+int main( int argc, char **argv )
+{
+  BenchOptions options;
+  options.nParticles     = 100000;
+  options.nRelease       = 0;
+  options.nEmitters      = 1;
+  options.fInterval      = 0.0f;
+  options.nPlanes        = 0;
+  options.nResult        = CR_BOUNCE;
+  options.fStep          = 1.0f / 60.0f;
+  options.fSimRate       = 0.0f;
+  options.nFrames        = 1000;
+  options.nWarmup        = 0;
+  options.nThreads       = 1;
+  options.fLifeCycle     = 3.0f;
+  options.bAirResistence = true;
+  options.bCompact       = false;
+  options.bAnalytic      = false;
+  options.fVelocityVar   = 1.5f;
+  options.nSeed          = 1;
+  options.bProfile       = false;
+  options.bVerify        = false;
+  options.nTableHue      = 0;
+  options.nTableSat      = 0;
+  options.nTableVal      = 0;
+
+  if( !parseOptions( argc, argv, &options ) )
+  {
+    usage( argv[0] );
+    return 1;
+  }
+
+  if( options.bVerify )
+    return verifyKernels( options.nSeed ) ? 0 : 1;
+
+  // Enough particles per release to replace the ones that die
+  if( options.nRelease <= 0 )
+  {
+    float fSimStep  = options.fSimRate > 0.0f ? 1.0f / options.fSimRate : options.fStep;
+    float fReleases = options.fLifeCycle / std::max( fSimStep, options.fInterval );
+    options.nRelease = (int)ceilf( options.nParticles / std::max( fReleases, 1.0f ) ) + 1;
+  }
+  if( options.nWarmup <= 0 )
+    options.nWarmup = (int)ceilf( options.fLifeCycle / options.fStep ) + 1;
+
+  long nSetupAllocs = g_nAllocs;
+
+  // Same emitter as the add-on's default settings
+  CParticleSystem *pSystem = new CParticleSystem;
+  pSystem->ctor();
+  pSystem->SetRandomSeed( options.nSeed );
+  pSystem->SetMaxParticles( options.nParticles );
+  pSystem->SetNumToRelease( options.nRelease );
+  pSystem->SetReleaseInterval( options.fInterval );
+  pSystem->SetLifeCycle( options.fLifeCycle );
+  pSystem->SetSize( 0.1f );
+  pSystem->SetColor( HsvColor( 0.0f, 1.0f, 0.6f ) );
+  pSystem->SetPosition( CVector( 0.0f, 0.0f, 0.0f ) );
+  pSystem->SetVelocity( CVector( -4.0f, 4.0f, 0.0f ) );
+  pSystem->SetGravity( CVector( 0.0f, 0.0f, -15.0f ) );
+  pSystem->SetWind( CVector( 1.0f, -2.0f, 0.0f ) );
+  pSystem->SetAirResistence( options.bAirResistence );
+  pSystem->SetVelocityVar( options.fVelocityVar );
+  pSystem->SetHVar( 45.0f );
+  pSystem->SetMinH( 0.0f );
+  pSystem->SetMaxH( 360.0f );
+  pSystem->SetThreadCount( options.nThreads );
+  pSystem->SetCompactStorage( options.bCompact );
+  pSystem->SetAnalytic( options.bAnalytic );
+  pSystem->SetColorTable( options.nTableHue, options.nTableSat, options.nTableVal );
+  if( options.fSimRate > 0.0f )
+    pSystem->SetFixedStep( 1.0f / options.fSimRate );
+
+  // The others copy it, spread around a ring like the add-on's, and the
+  // release is split between them
+  pSystem->SetEmitterCount( options.nEmitters );
+  for( int n = 0; n < options.nEmitters; ++n )
+  {
+    float fAngle = 2.0f * (float)M_PI * n / options.nEmitters;
+    float c = cosf( fAngle ), s = sinf( fAngle );
+
+    pSystem->SelectEmitter( n );
+    pSystem->SetNumToRelease( (options.nRelease + options.nEmitters - 1) / options.nEmitters );
+    if( options.nEmitters > 1 )
+    {
+      pSystem->SetPosition( CVector( 6.0f * c, 6.0f * s, 0.0f ) );
+      pSystem->SetVelocity( CVector( -4.0f * c - 4.0f * s, -4.0f * s + 4.0f * c, 0.0f ) );
+    }
+  }
+  pSystem->SelectEmitter( 0 );
+  addPlanes( pSystem, options.nPlanes, options.nResult );
+
+  for( int n = 0; n < options.nWarmup; ++n )
+    pSystem->Update( options.fStep );
+
+  nSetupAllocs = g_nAllocs - nSetupAllocs;
+  long nRunAllocs     = g_nAllocs;
+  long nRunAllocBytes = g_nAllocBytes;
+
+  ResetProfile();
+  EnableProfiler( options.bProfile );
+
+  double fUpdates   = 0.0;
+  double fWorstStep = 0.0;
+  double fStart     = now();
+
+  for( int n = 0; n < options.nFrames; ++n )
+  {
+    fUpdates += pSystem->GetActiveCount();
+
+    double fStepStart = now();
+    pSystem->Update( options.fStep );
+    pSystem->EvaluatePositions();     // What Render() would do first
+    fWorstStep = std::max( fWorstStep, now() - fStepStart );
+  }
+
+  double fSeconds = now() - fStart;
+  EnableProfiler( false );
+  nRunAllocs     = g_nAllocs - nRunAllocs;
+  nRunAllocBytes = g_nAllocBytes - nRunAllocBytes;
+
+  printf( "particles:         %d budget, %.0f average, %d released per step\n",
+          options.nParticles, fUpdates / options.nFrames, options.nRelease );
+  printf( "emitters:          %d\n", pSystem->GetEmitterCount() );
+  printf( "planes:            %d\n", options.nPlanes );
+  printf( "threads:           %d\n", pSystem->GetThreadCount() );
+  printf( "store:             %s\n", pSystem->GetCompactStorage() ? "compact" : "float" );
+  printf( "motion:            %s\n", pSystem->GetAnalytic() && !pSystem->GetCompactStorage() &&
+                                      options.nPlanes == 0 ? "analytic" : "integrated" );
+  if( options.nTableHue > 0 )
+  {
+    float fMaxError;
+    int   nMaxLevels;
+    colorTableError( options.nTableHue, options.nTableSat, options.nTableVal, 1 << 20, options.nSeed,
+                     &fMaxError, &nMaxLevels );
+    printf( "colors:            %dx%dx%d table, max error %.4f (%d of 255 levels)\n",
+            options.nTableHue, options.nTableSat, options.nTableVal, fMaxError, nMaxLevels );
+  }
+  else
+    printf( "colors:            converted\n" );
+  printf( "steps:             %d of %g s after %d warmup\n", options.nFrames, options.fStep, options.nWarmup );
+  printf( "time:              %.3f s, %.3f ms per step, %.3f ms worst\n",
+          fSeconds, fSeconds * 1e3 / options.nFrames, fWorstStep * 1e3 );
+  printf( "particles/sec:     %.0f\n", fUpdates / fSeconds );
+  printf( "ns/particle:       %.3f\n", fUpdates > 0.0 ? fSeconds * 1e9 / fUpdates : 0.0 );
+#if defined(FOUNTAIN_BENCH_WRAP_MALLOC)
+  printf( "allocations:       %ld during setup, %ld (%ld bytes) while measuring\n",
+          nSetupAllocs, nRunAllocs, nRunAllocBytes );
+#else
+  printf( "allocations:       %ld during setup, %ld (%ld bytes) while measuring (operator new only)\n",
+          nSetupAllocs, nRunAllocs, nRunAllocBytes );
+#endif
+  if( options.bProfile )
+  {
+    printf( "profile:\n" );
+    DumpProfile( printLine, NULL );
+  }
+
+  pSystem->dtor();
+  delete pSystem;
+
+  return 0;
+}
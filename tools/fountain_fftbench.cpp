@@ -0,0 +1,234 @@
+//-----------------------------------------------------------------------------
+//		         Name: fountain_fftbench.cpp
+//		  Description: Headless benchmark of the spectrum stage of
+//					   AudioData(): bars, their envelope and onsets from
+//					   Kodi's frequency data against our own FFT of the PCM
+//					   data at every size
+//-----------------------------------------------------------------------------
+
+#include "FFT.h"
+#include "Onset.h"
+#include "Spectrum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Options
+//-----------------------------------------------------------------------------
+struct BenchOptions
+{
+  int   nCalls;          // Measured AudioData() calls per path
+  int   nAudioLength;    // Interleaved PCM samples per call
+  int   nChannels;
+  int   nFreqLength;     // Frequency data Kodi hands over per call
+  int   nSampleRate;
+  int   nBars;
+  bool  bLogScale;
+};
+
+static void usage( const char *szName )
+{
+  printf( "usage: %s [options]\n"
+          "  --calls N         measured calls per path (default 20000)\n"
+          "  --audio N         interleaved PCM samples per call (default 512)\n"
+          "  --channels N      PCM channels (default 2)\n"
+          "  --freq N          frequency data per call on Kodi's path (default 512)\n"
+          "  --rate HZ         sample rate (default 44100)\n"
+          "  --bars N          spectrum bars (default 96)\n"
+          "  --logscale        logarithmic frequency scale\n",
+          szName );
+}
+
+static bool parseOptions( int argc, char **argv, BenchOptions *pOptions )
+{
+  for( int i = 1; i < argc; ++i )
+  {
+    const char *szArg = argv[i];
+    const char *szVal = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if( strcmp( szArg, "--logscale" ) == 0 )
+    {
+      pOptions->bLogScale = true;
+      continue;
+    }
+    if( strcmp( szArg, "--help" ) == 0 || szVal == NULL )
+      return false;
+
+    if( strcmp( szArg, "--calls" ) == 0 )         pOptions->nCalls = atoi( szVal );
+    else if( strcmp( szArg, "--audio" ) == 0 )    pOptions->nAudioLength = atoi( szVal );
+    else if( strcmp( szArg, "--channels" ) == 0 ) pOptions->nChannels = atoi( szVal );
+    else if( strcmp( szArg, "--freq" ) == 0 )     pOptions->nFreqLength = atoi( szVal );
+    else if( strcmp( szArg, "--rate" ) == 0 )     pOptions->nSampleRate = atoi( szVal );
+    else if( strcmp( szArg, "--bars" ) == 0 )     pOptions->nBars = atoi( szVal );
+    else
+      return false;
+
+    ++i;
+  }
+
+  return pOptions->nCalls > 0 && pOptions->nAudioLength > 0 && pOptions->nChannels > 0 &&
+         pOptions->nFreqLength > 0 && pOptions->nFreqLength <= SPECTRUM_MAX_DATA &&
+         pOptions->nSampleRate > 0 && pOptions->nBars > 0 && pOptions->nBars <= SPECTRUM_MAX_BARS;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compareDoubles( const void *pA, const void *pB )
+{
+  double a = *(const double*)pA, b = *(const double*)pB;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static void printTimings( const char *szName, double *pTimes, int nCalls, double fBase )
+{
+  double fSum = 0.0;
+  for( int n = 0; n < nCalls; ++n )
+    fSum += pTimes[n];
+  qsort( pTimes, nCalls, sizeof(double), compareDoubles );
+
+  double fMean = fSum / nCalls;
+  printf( "%-10s us/call avg %8.2f p50 %8.2f p99 %8.2f", szName, fMean * 1e6,
+          pTimes[nCalls / 2] * 1e6, pTimes[(int)(nCalls * 0.99)] * 1e6 );
+  if( fBase > 0.0 )
+    printf( "  %6.2fx Kodi's", fMean / fBase );
+  printf( "\n" );
+}
+
+//-----------------------------------------------------------------------------
+// A few tones over noise, so the levels aren't all the same, and a kick
+// drum at 120 BPM for the onsets to find
+//-----------------------------------------------------------------------------
+static void makeAudio( float *pAudio, int nLength, int nChannels, int nSampleRate, int nCall )
+{
+  static const float fTones[3] = { 55.0f, 440.0f, 3520.0f };
+
+  int nFrames = nLength / nChannels;
+  for( int i = 0; i < nFrames; ++i )
+  {
+    double t = (double)(nCall * nFrames + i) / nSampleRate;
+    float fSample = 0.05f * (rand() / (float)RAND_MAX - 0.5f);
+    for( int n = 0; n < 3; ++n )
+      fSample += 0.25f * (float)sin( 2.0 * M_PI * fTones[n] * t );
+
+    double fBeat = fmod( t, 0.5 );
+    fSample += (float)exp( -fBeat * 50.0 ) * (0.5f * (float)sin( 2.0 * M_PI * 60.0 * t ) +
+                                              0.5f * (rand() / (float)RAND_MAX - 0.5f));
+    for( int c = 0; c < nChannels; ++c )
+      pAudio[i * nChannels + c] = fSample;
+  }
+}
+
+static CRealFFT       m_fft;
+static CSampleHistory m_history;
+static CSpectrumBands m_spectrum;
+static CSpectrumEnvelope m_envelope;
+static COnsetDetector m_onset;
+
+int main( int argc, char **argv )
+{
+  BenchOptions options;
+  options.nCalls       = 20000;
+  options.nAudioLength = 512;
+  options.nChannels    = 2;
+  options.nFreqLength  = 512;
+  options.nSampleRate  = 44100;
+  options.nBars        = 96;
+  options.bLogScale    = false;
+
+  if( !parseOptions( argc, argv, &options ) )
+  {
+    usage( argv[0] );
+    return 1;
+  }
+
+  // Two seconds of audio, played over and over
+  const int nBlocks = std::max( 1, 2 * options.nSampleRate * options.nChannels / options.nAudioLength );
+  float  *pAudio  = (float*)malloc( sizeof(float) * options.nAudioLength * nBlocks );
+  float  *pFreq   = (float*)malloc( sizeof(float) * options.nFreqLength * nBlocks );
+  float  *pPower  = (float*)malloc( sizeof(float) * FFT_MAX_SIZE / 2 );
+  float  *pLevels = (float*)malloc( sizeof(float) * SPECTRUM_MAX_BARS );
+  float  *pSmooth = (float*)malloc( sizeof(float) * SPECTRUM_MAX_BARS * 2 );
+  double *pTimes  = (double*)malloc( sizeof(double) * options.nCalls );
+
+  srand( 1 );
+  for( int n = 0; n < nBlocks; ++n )
+  {
+    makeAudio( pAudio + n * options.nAudioLength, options.nAudioLength, options.nChannels,
+               options.nSampleRate, n );
+    for( int j = 0; j < options.nFreqLength; ++j )
+      pFreq[n * options.nFreqLength + j] = (float)rand();
+  }
+
+  printf( "calls:             %d per path, %d PCM samples of %d channels each\n",
+          options.nCalls, options.nAudioLength, options.nChannels );
+  printf( "bars:              %d, %s scale\n", options.nBars, options.bLogScale ? "log" : "linear" );
+
+  float fCallTime = (float)(options.nAudioLength / options.nChannels) / options.nSampleRate;
+  int   nOnsets   = 0;
+
+  // Kodi's path: its FFT ran before AudioData(), we only make the bars
+  m_spectrum.Configure( options.nBars, options.bLogScale, 200.0f, 24000.0f, options.nSampleRate, options.nFreqLength );
+  for( int n = 0; n < options.nCalls; ++n )
+  {
+    const float *pData = pFreq + (n % nBlocks) * options.nFreqLength;
+    double fStart = now();
+    m_spectrum.Analyze( pData, pLevels, 0.0f, 96.0f );
+    m_envelope.Process( pLevels, options.nBars, fCallTime, 0.0f, pSmooth );
+    nOnsets += m_onset.Process( pLevels, options.nBars, fCallTime );
+    pTimes[n] = now() - fStart;
+  }
+
+  double fBase = 0.0;
+  for( int n = 0; n < options.nCalls; ++n )
+    fBase += pTimes[n];
+  fBase /= options.nCalls;
+
+  char szName[32];
+  snprintf( szName, sizeof(szName), "Kodi %d", options.nFreqLength );
+  printTimings( szName, pTimes, options.nCalls, 0.0 );
+
+  // Ours: mix down, FFT the latest window, make the bars
+  for( int nSize = FFT_MIN_SIZE; nSize <= FFT_MAX_SIZE; nSize *= 2 )
+  {
+    m_fft.SetSize( nSize );
+    m_history.Clear();
+    m_onset.Reset();
+    m_envelope.Reset();
+    nOnsets = 0;
+    m_spectrum.Configure( options.nBars, options.bLogScale, 200.0f, 24000.0f, options.nSampleRate, nSize / 2 );
+
+    for( int n = 0; n < options.nCalls; ++n )
+    {
+      const float *pData = pAudio + (n % nBlocks) * options.nAudioLength;
+      double fStart = now();
+      m_history.Add( pData, options.nAudioLength, options.nChannels );
+      m_fft.PowerSpectrum( m_history.GetLatest( nSize ), pPower );
+      m_spectrum.Analyze( pPower, pLevels, 0.0f, 96.0f );
+      m_envelope.Process( pLevels, options.nBars, fCallTime, 0.0f, pSmooth );
+      nOnsets += m_onset.Process( pLevels, options.nBars, fCallTime );
+      pTimes[n] = now() - fStart;
+    }
+
+    snprintf( szName, sizeof(szName), "FFT %d", nSize );
+    printTimings( szName, pTimes, options.nCalls, fBase );
+    printf( "           %d onsets, %.1f BPM\n", nOnsets, m_onset.GetTempo() );
+  }
+
+  free( pAudio );
+  free( pFreq );
+  free( pPower );
+  free( pLevels );
+  free( pSmooth );
+  free( pTimes );
+
+  return 0;
+}
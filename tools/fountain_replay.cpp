@@ -0,0 +1,341 @@
+//-----------------------------------------------------------------------------
+//		         Name: fountain_replay.cpp
+//		  Description: Feeds a capture written with FOUNTAIN_CAPTURE back
+//					   through the visualisation at full speed, against an
+//					   offscreen EGL context, and reports the cost of every
+//					   frame
+//-----------------------------------------------------------------------------
+
+#include "Capture.h"
+#include "Fountain.h"
+#include "Profiler.h"
+#include "timer.h"
+#include <xbmc/xbmc_vis_dll.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" void Start(int iChannels, int iSamplesPerSec, int iBitsPerSample, const char* szSongName);
+extern "C" void AudioData(const float* pAudioData, int iAudioDataLength, float *pFreqData, int iFreqDataLength);
+extern "C" void Render();
+extern "C" ADDON_STATUS ADDON_SetSetting(const char *strSetting, const void* value);
+extern "C" void ADDON_Stop();
+
+//-----------------------------------------------------------------------------
+// Name: createContext()
+// Desc: Desktop GL through whatever EGL the system has, drawing into a
+//       framebuffer object so no window or pbuffer is needed (Mesa's
+//       surfaceless platform will do)
+//-----------------------------------------------------------------------------
+static bool createContext( int iWidth, int iHeight )
+{
+  EGLDisplay display = EGL_NO_DISPLAY;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+  if( getPlatformDisplay != NULL )
+    display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+  if( display == EGL_NO_DISPLAY || !eglInitialize( display, NULL, NULL ) )
+  {
+    display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+    if( display == EGL_NO_DISPLAY || !eglInitialize( display, NULL, NULL ) )
+      return false;
+  }
+
+  const EGLint configAttribs[] =
+  {
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config = NULL;
+  EGLint nConfigs = 0;
+  eglChooseConfig( display, configAttribs, &config, 1, &nConfigs );
+
+  if( !eglBindAPI( EGL_OPENGL_API ) )
+    return false;
+
+  EGLContext context = eglCreateContext( display, nConfigs > 0 ? config : NULL, EGL_NO_CONTEXT, NULL );
+  if( context == EGL_NO_CONTEXT ||
+      eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) != EGL_TRUE )
+    return false;
+
+  GLuint colorBuffer, depthBuffer, frameBuffer;
+  glGenRenderbuffers( 1, &colorBuffer );
+  glBindRenderbuffer( GL_RENDERBUFFER, colorBuffer );
+  glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, iWidth, iHeight );
+  glGenRenderbuffers( 1, &depthBuffer );
+  glBindRenderbuffer( GL_RENDERBUFFER, depthBuffer );
+  glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, iWidth, iHeight );
+
+  glGenFramebuffers( 1, &frameBuffer );
+  glBindFramebuffer( GL_FRAMEBUFFER, frameBuffer );
+  glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer );
+  glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer );
+
+  return glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------------------------------------------------------
+// Name: hashFrame()
+// Desc: FNV-1a over the color buffer, to tell whether two replays drew the
+//       very same frames
+//-----------------------------------------------------------------------------
+static uint64_t hashFrame( int iWidth, int iHeight, unsigned char *pPixels )
+{
+  glReadPixels( 0, 0, iWidth, iHeight, GL_RGBA, GL_UNSIGNED_BYTE, pPixels );
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for( int n = 0; n < iWidth * iHeight * 4; ++n )
+  {
+    hash ^= pPixels[n];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Per call timings
+//-----------------------------------------------------------------------------
+struct Timings
+{
+  double *m_pTimes;
+  int     m_nCount;
+  int     m_nCapacity;
+};
+
+static void addTiming( Timings *pTimings, double fTime )
+{
+  if( pTimings->m_nCount == pTimings->m_nCapacity )
+  {
+    pTimings->m_nCapacity = pTimings->m_nCapacity ? pTimings->m_nCapacity * 2 : 4096;
+    pTimings->m_pTimes = (double*)realloc( pTimings->m_pTimes, pTimings->m_nCapacity * sizeof(double) );
+  }
+  pTimings->m_pTimes[pTimings->m_nCount++] = fTime;
+}
+
+static int compareTimes( const void *pA, const void *pB )
+{
+  double a = *(const double*)pA, b = *(const double*)pB;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static void printTimings( const char *szName, Timings *pTimings )
+{
+  if( pTimings->m_nCount == 0 )
+  {
+    printf( "%-8s no calls\n", szName );
+    return;
+  }
+
+  double fTotal = 0.0;
+  for( int n = 0; n < pTimings->m_nCount; ++n )
+    fTotal += pTimings->m_pTimes[n];
+
+  double *pSorted = (double*)malloc( pTimings->m_nCount * sizeof(double) );
+  memcpy( pSorted, pTimings->m_pTimes, pTimings->m_nCount * sizeof(double) );
+  qsort( pSorted, pTimings->m_nCount, sizeof(double), compareTimes );
+
+  int nLast = pTimings->m_nCount - 1;
+  printf( "%-8s %d calls, ms avg %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+          szName, pTimings->m_nCount, fTotal * 1e3 / pTimings->m_nCount,
+          pSorted[nLast * 50 / 100] * 1e3, pSorted[nLast * 95 / 100] * 1e3,
+          pSorted[nLast * 99 / 100] * 1e3, pSorted[nLast] * 1e3 );
+
+  free( pSorted );
+}
+
+static void printLine( const char *szLine, void * )
+{
+  printf( "  %s\n", szLine );
+}
+
+static void usage( const char *szName )
+{
+  printf( "usage: %s [options] capture\n"
+          "  --addon DIR       add-on directory holding resources/ (default visualization.fountain)\n"
+          "  --size WxH        framebuffer size (default 1280x720)\n"
+          "  --csv FILE        write frame, clock and render time of every frame\n"
+          "  --verify          hash every frame (adds a readback per frame)\n"
+          "  --profile         print per stage timings\n",
+          szName );
+}
+
+int main( int argc, char **argv )
+{
+  const char *szAddon   = "visualization.fountain";
+  const char *szCapture = NULL;
+  const char *szCSV     = NULL;
+  int  iWidth  = 1280;
+  int  iHeight = 720;
+  bool bVerify = false;
+  bool bProfile = false;
+
+  for( int i = 1; i < argc; ++i )
+  {
+    if( strcmp( argv[i], "--addon" ) == 0 && i + 1 < argc )
+      szAddon = argv[++i];
+    else if( strcmp( argv[i], "--size" ) == 0 && i + 1 < argc )
+    {
+      if( sscanf( argv[++i], "%dx%d", &iWidth, &iHeight ) != 2 || iWidth < 1 || iHeight < 1 )
+      {
+        usage( argv[0] );
+        return 1;
+      }
+    }
+    else if( strcmp( argv[i], "--csv" ) == 0 && i + 1 < argc )
+      szCSV = argv[++i];
+    else if( strcmp( argv[i], "--verify" ) == 0 )
+      bVerify = true;
+    else if( strcmp( argv[i], "--profile" ) == 0 )
+      bProfile = true;
+    else if( argv[i][0] != '-' && szCapture == NULL )
+      szCapture = argv[i];
+    else
+    {
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  if( szCapture == NULL )
+  {
+    usage( argv[0] );
+    return 1;
+  }
+
+  CCaptureReader reader;
+  if( !reader.Open( szCapture ) )
+  {
+    fprintf( stderr, "%s is not a capture\n", szCapture );
+    return 1;
+  }
+
+  if( !createContext( iWidth, iHeight ) )
+  {
+    fprintf( stderr, "can't create an offscreen GL context\n" );
+    return 1;
+  }
+  glViewport( 0, 0, iWidth, iHeight );
+
+  FILE *pCSV = NULL;
+  if( szCSV != NULL )
+  {
+    pCSV = fopen( szCSV, "w" );
+    if( pCSV == NULL )
+    {
+      fprintf( stderr, "can't write %s\n", szCSV );
+      return 1;
+    }
+    fprintf( pCSV, bVerify ? "frame,clock,render_ms,hash\n" : "frame,clock,render_ms\n" );
+  }
+
+  unsigned char *pPixels = (unsigned char*)malloc( iWidth * iHeight * 4 );
+  Timings renderTimings = { NULL, 0, 0 };
+  Timings audioTimings  = { NULL, 0, 0 };
+  uint64_t frameHash = 0;
+  uint64_t runHash   = 0xcbf29ce484222325ULL;
+
+  // The clock only moves when the capture says so
+  CTimer::SetVirtualTime( 0.0 );
+  CreateFountain( szAddon );
+
+  ResetProfile();
+  EnableProfiler( bProfile );
+
+  CaptureRecord record;
+  double fStart = now();
+
+  while( reader.Next( &record ) )
+  {
+    switch( record.m_nType )
+    {
+      case CAPTURE_SEED:
+        SeedFountain( record.m_seed );
+        break;
+
+      case CAPTURE_SETTING:
+        ADDON_SetSetting( record.m_szName, &record.m_iValue );
+        break;
+
+      case CAPTURE_START:
+        CTimer::SetVirtualTime( record.m_fClock );
+        Start( record.m_iChannels, record.m_iSamplesPerSec, record.m_iBitsPerSample, record.m_szName );
+        break;
+
+      case CAPTURE_AUDIO:
+      {
+        double fCallStart = now();
+        AudioData( record.m_pAudioData, record.m_iAudioDataLength, record.m_pFreqData, record.m_iFreqDataLength );
+        addTiming( &audioTimings, now() - fCallStart );
+        break;
+      }
+
+      case CAPTURE_RENDER:
+      {
+        CTimer::SetVirtualTime( record.m_fClock );
+
+        double fCallStart = now();
+        Render();
+        glFinish();
+        double fTime = now() - fCallStart;
+        addTiming( &renderTimings, fTime );
+
+        if( bVerify )
+        {
+          frameHash = hashFrame( iWidth, iHeight, pPixels );
+          runHash = (runHash ^ frameHash) * 0x100000001b3ULL;
+        }
+
+        if( pCSV != NULL )
+        {
+          fprintf( pCSV, "%d,%.6f,%.4f", renderTimings.m_nCount - 1, record.m_fClock, fTime * 1e3 );
+          if( bVerify )
+            fprintf( pCSV, ",%016llx", (unsigned long long)frameHash );
+          fprintf( pCSV, "\n" );
+        }
+        break;
+      }
+    }
+  }
+
+  double fSeconds = now() - fStart;
+  EnableProfiler( false );
+
+  if( !bVerify )
+    frameHash = hashFrame( iWidth, iHeight, pPixels );
+
+  printf( "replayed %s in %.3f s\n", szCapture, fSeconds );
+  printTimings( "Render", &renderTimings );
+  printTimings( "AudioData", &audioTimings );
+  printf( "last frame hash %016llx\n", (unsigned long long)frameHash );
+  if( bVerify )
+    printf( "all frames hash %016llx\n", (unsigned long long)runHash );
+  if( bProfile )
+  {
+    printf( "profile:\n" );
+    DumpProfile( printLine, NULL );
+  }
+
+  ADDON_Stop();
+  CTimer::SetVirtualTime( -1.0 );
+
+  if( pCSV != NULL )
+    fclose( pCSV );
+  free( pPixels );
+  free( renderTimings.m_pTimes );
+  free( audioTimings.m_pTimes );
+
+  return 0;
+}